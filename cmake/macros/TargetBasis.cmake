@@ -1,2 +1,10 @@
 macro(target_basis)
-endmacro()
\ No newline at end of file
+    find_package(basisu CONFIG REQUIRED)
+    # The transcoder is in the basisu library, along with the encoder
+    if (TARGET basisu::basisu_lib)
+        target_link_libraries(${TARGET_NAME} PRIVATE basisu::basisu_lib)
+    else()
+        target_link_libraries(${TARGET_NAME} PRIVATE basisu::basisu_encoder)
+    endif()
+    target_compile_definitions(${TARGET_NAME} PRIVATE KHRPP_HAVE_BASISU)
+endmacro()
@@ -0,0 +1,15 @@
+macro(TARGET_DEFLATE)
+    # Prefer libdeflate for its whole buffer inflate, falling back to zlib
+    find_package(libdeflate CONFIG QUIET)
+    if (TARGET libdeflate::libdeflate_shared)
+        target_link_libraries(${TARGET_NAME} PRIVATE libdeflate::libdeflate_shared)
+        target_compile_definitions(${TARGET_NAME} PRIVATE KHRPP_HAVE_LIBDEFLATE)
+    elseif (TARGET libdeflate::libdeflate_static)
+        target_link_libraries(${TARGET_NAME} PRIVATE libdeflate::libdeflate_static)
+        target_compile_definitions(${TARGET_NAME} PRIVATE KHRPP_HAVE_LIBDEFLATE)
+    else()
+        find_package(ZLIB REQUIRED)
+        target_link_libraries(${TARGET_NAME} PRIVATE ZLIB::ZLIB)
+        target_compile_definitions(${TARGET_NAME} PRIVATE KHRPP_HAVE_ZLIB)
+    endif()
+endmacro()
@@ -0,0 +1,9 @@
+macro(TARGET_ZSTD)
+    find_package(zstd CONFIG REQUIRED)
+    if (TARGET zstd::libzstd_shared)
+        target_link_libraries(${TARGET_NAME} PRIVATE zstd::libzstd_shared)
+    else()
+        target_link_libraries(${TARGET_NAME} PRIVATE zstd::libzstd_static)
+    endif()
+    target_compile_definitions(${TARGET_NAME} PRIVATE KHRPP_HAVE_ZSTD)
+endmacro()
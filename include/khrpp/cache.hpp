@@ -0,0 +1,231 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_cache_hpp
+#define khrpp_cache_hpp
+
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "storage.hpp"
+
+namespace khrpp { namespace utils {
+
+// Identifies the contents of a file independently of the path used to reach it.  A file that is modified in place
+// gets a new identity, so stale mappings are never handed out.
+struct FileIdentity {
+    uint64_t device{ 0 };
+    uint64_t inode{ 0 };
+    uint64_t size{ 0 };
+    int64_t modifiedSeconds{ 0 };
+    int64_t modifiedNanoseconds{ 0 };
+
+    bool operator==(const FileIdentity& other) const {
+        return device == other.device && inode == other.inode && size == other.size && modifiedSeconds == other.modifiedSeconds &&
+               modifiedNanoseconds == other.modifiedNanoseconds;
+    }
+
+    struct Hash {
+        size_t operator()(const FileIdentity& identity) const {
+            uint64_t result = 0xcbf29ce484222325ULL;
+            for (uint64_t value : { identity.device, identity.inode, identity.size, (uint64_t)identity.modifiedSeconds,
+                                    (uint64_t)identity.modifiedNanoseconds }) {
+                result = (result ^ value) * 0x100000001b3ULL;
+            }
+            return (size_t)result;
+        }
+    };
+
+    // Returns false if the file can't be identified (it doesn't exist, or it's an Android asset)
+    static bool get(const std::string& filename, FileIdentity& result) {
+#if defined(__ANDROID__)
+        return false;
+#else
+        const auto handle = FileStorage::openHandle(filename);
+        if (handle == FileStorage::invalidHandle()) {
+            return false;
+        }
+        const bool success = get(handle, result);
+        FileStorage::closeHandle(handle);
+        return success;
+#endif
+    }
+
+#if !defined(__ANDROID__)
+    // Identifies an open file, so that the identity is guaranteed to describe what's then read or mapped through the
+    // same handle even if the path is replaced in the meantime
+    static bool get(FileStorage::Handle handle, FileIdentity& result) {
+#if defined(_WIN32)
+        BY_HANDLE_FILE_INFORMATION info;
+        if (0 == GetFileInformationByHandle(handle, &info)) {
+            return false;
+        }
+        result.device = info.dwVolumeSerialNumber;
+        result.inode = ((uint64_t)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+        result.size = ((uint64_t)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+        result.modifiedSeconds = ((int64_t)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+        result.modifiedNanoseconds = 0;
+        return true;
+#else
+        struct stat sb;
+        if (-1 == fstat(handle, &sb)) {
+            return false;
+        }
+        result.device = (uint64_t)sb.st_dev;
+        result.inode = (uint64_t)sb.st_ino;
+        result.size = (uint64_t)sb.st_size;
+#if defined(__APPLE__)
+        result.modifiedSeconds = sb.st_mtimespec.tv_sec;
+        result.modifiedNanoseconds = sb.st_mtimespec.tv_nsec;
+#else
+        result.modifiedSeconds = sb.st_mtim.tv_sec;
+        result.modifiedNanoseconds = sb.st_mtim.tv_nsec;
+#endif
+        return true;
+#endif
+    }
+#endif
+};
+
+// Hands out shared file mappings, so that a file is only mapped once no matter how many times or through how many
+// different paths it's requested.  The total size of the mappings held by the cache is kept under a budget by
+// dropping the least recently requested ones.  An evicted mapping the cache holds the only reference to is advised as
+// DONT_NEED before it's released, so its pages leave the page cache along with the mapping.  Evicted mappings still in
+// use elsewhere are released without any advice, since it would make their readers fault the pages back in.
+class StorageCache {
+public:
+    struct Stats {
+        uint64_t hits{ 0 };
+        uint64_t misses{ 0 };
+        uint64_t evictions{ 0 };
+        size_t mappedBytes{ 0 };
+        size_t entryCount{ 0 };
+    };
+
+    explicit StorageCache(size_t budget)
+        : _budget{ budget } {}
+
+    StorageCache(const StorageCache&) = delete;
+    StorageCache& operator=(const StorageCache&) = delete;
+
+    Storage::ConstPointer readFile(const std::string& filename, AccessHint hint = AccessHint::NORMAL) {
+#if defined(__ANDROID__)
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            ++_stats.misses;
+        }
+        return Storage::readFile(filename, hint);
+#else
+        // The file is identified and mapped through the same handle, so a file replaced at the same path in between
+        // can't be cached under the identity of the one it replaced
+        const auto handle = FileStorage::openHandle(filename);
+        if (handle == FileStorage::invalidHandle()) {
+            throw std::runtime_error("Failed to open file");
+        }
+        FileIdentity identity;
+        if (!FileIdentity::get(handle, identity)) {
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                ++_stats.misses;
+            }
+            return std::make_shared<const FileStorage>(handle, hint);
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto itr = _index.find(identity);
+            if (itr != _index.end()) {
+                ++_stats.hits;
+                _entries.splice(_entries.begin(), _entries, itr->second);
+                FileStorage::closeHandle(handle);
+                return itr->second->storage;
+            }
+            ++_stats.misses;
+        }
+
+        // Map outside the lock so that misses on different files don't serialize
+        Storage::ConstPointer storage = std::make_shared<const FileStorage>(handle, hint);
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto itr = _index.find(identity);
+        if (itr != _index.end()) {
+            // Lost a race with another thread mapping the same file, prefer the mapping that's already shared
+            _entries.splice(_entries.begin(), _entries, itr->second);
+            return itr->second->storage;
+        }
+        _entries.push_front(Entry{ identity, storage });
+        _index.emplace(identity, _entries.begin());
+        _stats.mappedBytes += storage->size();
+        _stats.entryCount = _index.size();
+        evict();
+        return storage;
+#endif
+    }
+
+    size_t getBudget() const {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _budget;
+    }
+
+    void setBudget(size_t budget) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _budget = budget;
+        evict();
+    }
+
+    Stats getStats() const {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        while (!_entries.empty()) {
+            evictLeastRecent();
+        }
+    }
+
+private:
+    struct Entry {
+        FileIdentity identity;
+        Storage::ConstPointer storage;
+    };
+
+    // Must be called with the mutex held
+    void evict() {
+        // Never evict the most recent entry, even if it's bigger than the whole budget on its own
+        while (_stats.mappedBytes > _budget && _entries.size() > 1) {
+            evictLeastRecent();
+        }
+    }
+
+    // Must be called with the mutex held
+    void evictLeastRecent() {
+        auto& entry = _entries.back();
+        if (1 == entry.storage.use_count()) {
+            entry.storage->advise(AccessHint::DONT_NEED);
+        }
+        _stats.mappedBytes -= entry.storage->size();
+        ++_stats.evictions;
+        _index.erase(entry.identity);
+        _entries.pop_back();
+        _stats.entryCount = _index.size();
+    }
+
+    mutable std::mutex _mutex;
+    size_t _budget;
+    Stats _stats;
+    // Most recently requested first
+    std::list<Entry> _entries;
+    std::unordered_map<FileIdentity, std::list<Entry>::iterator, FileIdentity::Hash> _index;
+};
+
+}}  // namespace khrpp::utils
+
+#endif
@@ -0,0 +1,694 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_hash_hpp
+#define khrpp_hash_hpp
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "storage.hpp"
+#include "threads.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define KHRPP_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define KHRPP_CRC32C_ARM 1
+#include <arm_acle.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define KHRPP_XXH3_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define KHRPP_XXH3_AVX2 1
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#define KHRPP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KHRPP_TARGET_AVX2
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define KHRPP_XXH3_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Content hashing.  CRC-32C (Castagnoli) checksums for integrity checks use the hardware CRC instructions where they're
+// available (SSE 4.2 on x86-64, detected at runtime, and the ARMv8 CRC extension when it's enabled at compile time),
+// with a slicing-by-8 table implementation everywhere else.  Keys for deduplication and caching, where 32 bits would
+// collide within a few tens of thousands of assets, use the 64 bit XXH3 instead, with AVX2 (detected at runtime) or
+// SSE2 kernels on x86-64 and NEON on ARM64.  All of the implementations of each produce identical results.
+namespace khrpp { namespace utils {
+
+namespace crc32c_detail {
+
+static const uint32_t POLYNOMIAL{ 0x82F63B78 };
+
+using Tables = std::array<std::array<uint32_t, 256>, 8>;
+
+inline const Tables& TABLES() {
+    static const Tables TABLES_VALUE = [] {
+        Tables result{};
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc & 1) ? (crc >> 1) ^ POLYNOMIAL : crc >> 1;
+            }
+            result[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; ++i) {
+            for (size_t table = 1; table < 8; ++table) {
+                result[table][i] = (result[table - 1][i] >> 8) ^ result[0][result[table - 1][i] & 0xFF];
+            }
+        }
+        return result;
+    }();
+    return TABLES_VALUE;
+}
+
+// Multiplies two polynomials modulo the CRC polynomial, in the bit reflected representation
+inline uint32_t multiplyModP(uint32_t a, uint32_t b) {
+    uint32_t mask = 1u << 31;
+    uint32_t result = 0;
+    while (true) {
+        if (a & mask) {
+            result ^= b;
+            if (0 == (a & (mask - 1))) {
+                break;
+            }
+        }
+        mask >>= 1;
+        b = (b & 1) ? (b >> 1) ^ POLYNOMIAL : b >> 1;
+    }
+    return result;
+}
+
+// x^(8 * byteCount) modulo the CRC polynomial, i.e. the factor that advances a raw CRC state past byteCount zeros
+inline uint32_t shiftFactor(size_t byteCount) {
+    static const std::array<uint32_t, 64> POWERS = [] {
+        // POWERS[i] = x^(2^i)
+        std::array<uint32_t, 64> result{};
+        result[0] = 1u << 30;
+        for (size_t i = 1; i < result.size(); ++i) {
+            result[i] = multiplyModP(result[i - 1], result[i - 1]);
+        }
+        return result;
+    }();
+    uint32_t result = 1u << 31;
+    // Start at x^8, since the length is in bytes
+    for (size_t power = 3; byteCount; byteCount >>= 1, ++power) {
+        if (byteCount & 1) {
+            result = multiplyModP(POWERS[power % POWERS.size()], result);
+        }
+    }
+    return result;
+}
+
+// All of the kernels operate on the raw (not inverted) CRC state
+inline uint32_t updateTables(uint32_t crc, const uint8_t* data, size_t size) {
+    const auto& tables = TABLES();
+    while (size && (reinterpret_cast<uintptr_t>(data) & 7)) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+        --size;
+    }
+    while (size >= 8) {
+        uint32_t low, high;
+        memcpy(&low, data, 4);
+        memcpy(&high, data + 4, 4);
+        low ^= crc;
+        crc = tables[7][low & 0xFF] ^ tables[6][(low >> 8) & 0xFF] ^ tables[5][(low >> 16) & 0xFF] ^ tables[4][low >> 24] ^
+              tables[3][high & 0xFF] ^ tables[2][(high >> 8) & 0xFF] ^ tables[1][(high >> 16) & 0xFF] ^ tables[0][high >> 24];
+        data += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = (crc >> 8) ^ tables[0][(crc ^ *data++) & 0xFF];
+    }
+    return crc;
+}
+
+// The CRC instructions have a latency of several cycles but a throughput of one per cycle, so the hardware kernels run
+// three independent streams over adjacent blocks and merge them afterwards
+static const size_t INTERLEAVE_BLOCK_SIZE{ 8192 };
+
+#if defined(KHRPP_CRC32C_SSE42)
+inline bool hasHardwareSupport() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    static const bool SUPPORTED = [] {
+        int info[4];
+        __cpuid(info, 1);
+        return 0 != (info[2] & (1 << 20));
+    }();
+#else
+    static const bool SUPPORTED = __builtin_cpu_supports("sse4.2");
+#endif
+    return SUPPORTED;
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("sse4.2")))
+#endif
+inline uint32_t updateHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    static const uint32_t SHIFT_1 = shiftFactor(INTERLEAVE_BLOCK_SIZE);
+    static const uint32_t SHIFT_2 = shiftFactor(2 * INTERLEAVE_BLOCK_SIZE);
+    while (size && (reinterpret_cast<uintptr_t>(data) & 7)) {
+        crc = _mm_crc32_u8(crc, *data++);
+        --size;
+    }
+    while (size >= 3 * INTERLEAVE_BLOCK_SIZE) {
+        uint64_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < INTERLEAVE_BLOCK_SIZE; i += 8) {
+            uint64_t value0, value1, value2;
+            memcpy(&value0, data + i, 8);
+            memcpy(&value1, data + INTERLEAVE_BLOCK_SIZE + i, 8);
+            memcpy(&value2, data + 2 * INTERLEAVE_BLOCK_SIZE + i, 8);
+            crc0 = _mm_crc32_u64(crc0, value0);
+            crc1 = _mm_crc32_u64(crc1, value1);
+            crc2 = _mm_crc32_u64(crc2, value2);
+        }
+        crc = multiplyModP(SHIFT_2, (uint32_t)crc0) ^ multiplyModP(SHIFT_1, (uint32_t)crc1) ^ (uint32_t)crc2;
+        data += 3 * INTERLEAVE_BLOCK_SIZE;
+        size -= 3 * INTERLEAVE_BLOCK_SIZE;
+    }
+    uint64_t crc64 = crc;
+    while (size >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc64 = _mm_crc32_u64(crc64, value);
+        data += 8;
+        size -= 8;
+    }
+    crc = (uint32_t)crc64;
+    while (size--) {
+        crc = _mm_crc32_u8(crc, *data++);
+    }
+    return crc;
+}
+#elif defined(KHRPP_CRC32C_ARM)
+inline bool hasHardwareSupport() {
+    return true;
+}
+
+inline uint32_t updateHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    static const uint32_t SHIFT_1 = shiftFactor(INTERLEAVE_BLOCK_SIZE);
+    static const uint32_t SHIFT_2 = shiftFactor(2 * INTERLEAVE_BLOCK_SIZE);
+    while (size && (reinterpret_cast<uintptr_t>(data) & 7)) {
+        crc = __crc32cb(crc, *data++);
+        --size;
+    }
+    while (size >= 3 * INTERLEAVE_BLOCK_SIZE) {
+        uint32_t crc0 = crc, crc1 = 0, crc2 = 0;
+        for (size_t i = 0; i < INTERLEAVE_BLOCK_SIZE; i += 8) {
+            uint64_t value0, value1, value2;
+            memcpy(&value0, data + i, 8);
+            memcpy(&value1, data + INTERLEAVE_BLOCK_SIZE + i, 8);
+            memcpy(&value2, data + 2 * INTERLEAVE_BLOCK_SIZE + i, 8);
+            crc0 = __crc32cd(crc0, value0);
+            crc1 = __crc32cd(crc1, value1);
+            crc2 = __crc32cd(crc2, value2);
+        }
+        crc = multiplyModP(SHIFT_2, crc0) ^ multiplyModP(SHIFT_1, crc1) ^ crc2;
+        data += 3 * INTERLEAVE_BLOCK_SIZE;
+        size -= 3 * INTERLEAVE_BLOCK_SIZE;
+    }
+    while (size >= 8) {
+        uint64_t value;
+        memcpy(&value, data, 8);
+        crc = __crc32cd(crc, value);
+        data += 8;
+        size -= 8;
+    }
+    while (size--) {
+        crc = __crc32cb(crc, *data++);
+    }
+    return crc;
+}
+#else
+inline bool hasHardwareSupport() {
+    return false;
+}
+
+inline uint32_t updateHardware(uint32_t crc, const uint8_t* data, size_t size) {
+    return updateTables(crc, data, size);
+}
+#endif
+
+}  // namespace crc32c_detail
+
+// Continues the CRC-32C `crc` of some preceding data over `size` more bytes.  Start from 0.
+inline uint32_t crc32c(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    crc = ~crc;
+    crc = crc32c_detail::hasHardwareSupport() ? crc32c_detail::updateHardware(crc, data, size) : crc32c_detail::updateTables(crc, data, size);
+    return ~crc;
+}
+
+// Portable implementation, for comparison with the hardware accelerated one
+inline uint32_t crc32cTables(const uint8_t* data, size_t size, uint32_t crc = 0) {
+    return ~crc32c_detail::updateTables(~crc, data, size);
+}
+
+// Given the CRCs of two adjacent buffers, returns the CRC of their concatenation
+inline uint32_t crc32cCombine(uint32_t crcFirst, uint32_t crcSecond, size_t secondSize) {
+    return crc32c_detail::multiplyModP(crc32c_detail::shiftFactor(secondSize), crcFirst) ^ crcSecond;
+}
+
+// Computes the CRC-32C of a buffer, splitting buffers of more than a few megabytes into chunks that are hashed on the
+// given pool and then combined.  The calling thread works through chunks as well, so it's safe to call from a task
+// already running on the same pool.
+inline uint32_t crc32cParallel(const uint8_t* data, size_t size, ThreadPool& pool = ThreadPool::shared()) {
+    static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    const size_t chunkCount = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    if (chunkCount < 2 || pool.size() < 2) {
+        return crc32c(data, size);
+    }
+
+    std::vector<uint32_t> crcs(chunkCount);
+    parallelFor(pool, chunkCount, [&](size_t chunk) {
+        const size_t offset = chunk * CHUNK_SIZE;
+        crcs[chunk] = crc32c(data + offset, std::min(CHUNK_SIZE, size - offset));
+    });
+
+    uint32_t result = crcs[0];
+    for (size_t chunk = 1; chunk < chunkCount; ++chunk) {
+        result = crc32cCombine(result, crcs[chunk], std::min(CHUNK_SIZE, size - chunk * CHUNK_SIZE));
+    }
+    return result;
+}
+
+namespace xxh3_detail {
+
+static const uint64_t PRIME32_1{ 0x9E3779B1 };
+static const uint64_t PRIME32_2{ 0x85EBCA77 };
+static const uint64_t PRIME32_3{ 0xC2B2AE3D };
+static const uint64_t PRIME64_1{ 0x9E3779B185EBCA87ULL };
+static const uint64_t PRIME64_2{ 0xC2B2AE3D27D4EB4FULL };
+static const uint64_t PRIME64_3{ 0x165667B19E3779F9ULL };
+static const uint64_t PRIME64_4{ 0x85EBCA77C2B2AE63ULL };
+static const uint64_t PRIME64_5{ 0x27D4EB2F165667C5ULL };
+static const uint64_t PRIME_MX1{ 0x165667919E3779F9ULL };
+static const uint64_t PRIME_MX2{ 0x9FB21C651E98DF25ULL };
+
+static const size_t SECRET_SIZE{ 192 };
+static const size_t STRIPE_SIZE{ 64 };
+static const size_t STRIPES_PER_BLOCK{ (SECRET_SIZE - STRIPE_SIZE) / 8 };
+static const size_t STRIPE_BLOCK_SIZE{ STRIPE_SIZE * STRIPES_PER_BLOCK };
+
+// The default secret from the XXH3 specification
+alignas(16) static const uint8_t SECRET[SECRET_SIZE]{
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+    0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+    0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+    0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+    0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+    0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+    0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+    0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+    0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// Little endian reads, as everywhere else in the library
+inline uint32_t read32(const uint8_t* data) {
+    uint32_t result;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+inline uint64_t read64(const uint8_t* data) {
+    uint64_t result;
+    memcpy(&result, data, sizeof(result));
+    return result;
+}
+
+inline uint64_t rotateLeft(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+inline uint32_t swap32(uint32_t value) {
+    return ((value << 24) & 0xFF000000) | ((value << 8) & 0x00FF0000) | ((value >> 8) & 0x0000FF00) | ((value >> 24) & 0x000000FF);
+}
+
+inline uint64_t swap64(uint64_t value) {
+    return ((uint64_t)swap32((uint32_t)value) << 32) | swap32((uint32_t)(value >> 32));
+}
+
+// The low and high halves of the 128 bit product, xored together
+inline uint64_t multiplyFold(uint64_t a, uint64_t b) {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = (unsigned __int128)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#elif defined(_MSC_VER) && defined(_M_X64)
+    uint64_t high;
+    const uint64_t low = _umul128(a, b, &high);
+    return low ^ high;
+#else
+    const uint64_t loLo = (a & 0xFFFFFFFF) * (b & 0xFFFFFFFF);
+    const uint64_t hiLo = (a >> 32) * (b & 0xFFFFFFFF);
+    const uint64_t loHi = (a & 0xFFFFFFFF) * (b >> 32);
+    const uint64_t hiHi = (a >> 32) * (b >> 32);
+    const uint64_t cross = (loLo >> 32) + (hiLo & 0xFFFFFFFF) + loHi;
+    const uint64_t high = (hiLo >> 32) + (cross >> 32) + hiHi;
+    const uint64_t low = (cross << 32) | (loLo & 0xFFFFFFFF);
+    return low ^ high;
+#endif
+}
+
+inline uint64_t avalanche64(uint64_t hash) {
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+inline uint64_t avalanche(uint64_t hash) {
+    hash ^= hash >> 37;
+    hash *= PRIME_MX1;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+inline uint64_t mix16(const uint8_t* data, const uint8_t* secret) {
+    return multiplyFold(read64(data) ^ read64(secret), read64(data + 8) ^ read64(secret + 8));
+}
+
+inline uint64_t hashShort(const uint8_t* data, size_t size) {
+    if (size > 8) {
+        const uint64_t low = read64(data) ^ read64(SECRET + 24) ^ read64(SECRET + 32);
+        const uint64_t high = read64(data + size - 8) ^ read64(SECRET + 40) ^ read64(SECRET + 48);
+        return avalanche(size + swap64(low) + high + multiplyFold(low, high));
+    }
+    if (size >= 4) {
+        const uint64_t input = read32(data + size - 4) + ((uint64_t)read32(data) << 32);
+        uint64_t hash = input ^ (read64(SECRET + 8) ^ read64(SECRET + 16));
+        hash ^= rotateLeft(hash, 49) ^ rotateLeft(hash, 24);
+        hash *= PRIME_MX2;
+        hash ^= (hash >> 35) + size;
+        hash *= PRIME_MX2;
+        return hash ^ (hash >> 28);
+    }
+    if (size) {
+        const uint32_t combined = ((uint32_t)data[0] << 16) | ((uint32_t)data[size >> 1] << 24) | data[size - 1] | ((uint32_t)size << 8);
+        return avalanche64(combined ^ (uint64_t)(read32(SECRET) ^ read32(SECRET + 4)));
+    }
+    return avalanche64(read64(SECRET + 56) ^ read64(SECRET + 64));
+}
+
+// 17 to 240 bytes
+inline uint64_t hashMedium(const uint8_t* data, size_t size) {
+    uint64_t hash = size * PRIME64_1;
+    if (size <= 128) {
+        for (size_t i = 0; i < 4 && size > 32 * i; ++i) {
+            hash += mix16(data + 16 * i, SECRET + 32 * i);
+            hash += mix16(data + size - 16 * (i + 1), SECRET + 32 * i + 16);
+        }
+        return avalanche(hash);
+    }
+    for (size_t i = 0; i < 8; ++i) {
+        hash += mix16(data + 16 * i, SECRET + 16 * i);
+    }
+    hash = avalanche(hash);
+    for (size_t i = 8; i < size / 16; ++i) {
+        hash += mix16(data + 16 * i, SECRET + 16 * (i - 8) + 3);
+    }
+    hash += mix16(data + size - 16, SECRET + 136 - 17);
+    return avalanche(hash);
+}
+
+// The long input kernels process 64 byte stripes into eight 64 bit lanes.  Each keeps its lanes in a member, so they
+// can stay in registers for the whole input.
+class ScalarKernel {
+public:
+    explicit ScalarKernel(const uint64_t* lanes) { memcpy(_lanes, lanes, sizeof(_lanes)); }
+
+    void accumulate(const uint8_t* data, const uint8_t* secret) {
+        for (size_t i = 0; i < 8; ++i) {
+            const uint64_t value = read64(data + 8 * i);
+            const uint64_t keyed = value ^ read64(secret + 8 * i);
+            _lanes[i ^ 1] += value;
+            _lanes[i] += (keyed & 0xFFFFFFFF) * (keyed >> 32);
+        }
+    }
+
+    void scramble(const uint8_t* secret) {
+        for (size_t i = 0; i < 8; ++i) {
+            uint64_t lane = _lanes[i];
+            lane ^= lane >> 47;
+            lane ^= read64(secret + 8 * i);
+            _lanes[i] = lane * PRIME32_1;
+        }
+    }
+
+    void store(uint64_t* lanes) const { memcpy(lanes, _lanes, sizeof(_lanes)); }
+
+private:
+    uint64_t _lanes[8];
+};
+
+#if defined(KHRPP_XXH3_SSE2)
+class Sse2Kernel {
+public:
+    explicit Sse2Kernel(const uint64_t* lanes) {
+        for (size_t i = 0; i < 4; ++i) {
+            _lanes[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(lanes) + i);
+        }
+    }
+
+    void accumulate(const uint8_t* data, const uint8_t* secret) {
+        for (size_t i = 0; i < 4; ++i) {
+            const __m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data) + i);
+            const __m128i keyed = _mm_xor_si128(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i));
+            const __m128i product = _mm_mul_epu32(keyed, _mm_shuffle_epi32(keyed, _MM_SHUFFLE(0, 3, 0, 1)));
+            const __m128i swapped = _mm_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            _lanes[i] = _mm_add_epi64(product, _mm_add_epi64(_lanes[i], swapped));
+        }
+    }
+
+    void scramble(const uint8_t* secret) {
+        const __m128i prime = _mm_set1_epi32((int)PRIME32_1);
+        for (size_t i = 0; i < 4; ++i) {
+            __m128i lane = _mm_xor_si128(_lanes[i], _mm_srli_epi64(_lanes[i], 47));
+            lane = _mm_xor_si128(lane, _mm_loadu_si128(reinterpret_cast<const __m128i*>(secret) + i));
+            const __m128i low = _mm_mul_epu32(lane, prime);
+            const __m128i high = _mm_mul_epu32(_mm_shuffle_epi32(lane, _MM_SHUFFLE(0, 3, 0, 1)), prime);
+            _lanes[i] = _mm_add_epi64(low, _mm_slli_epi64(high, 32));
+        }
+    }
+
+    void store(uint64_t* lanes) const {
+        for (size_t i = 0; i < 4; ++i) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes) + i, _lanes[i]);
+        }
+    }
+
+private:
+    __m128i _lanes[4];
+};
+#endif
+
+#if defined(KHRPP_XXH3_AVX2)
+inline bool hasAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    static const bool SUPPORTED = [] {
+        int info[4];
+        __cpuid(info, 1);
+        // AVX, and the OS saving the YMM registers
+        if (0 == (info[2] & (1 << 27)) || 0 == (info[2] & (1 << 28)) || 6 != (_xgetbv(0) & 6)) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return 0 != (info[1] & (1 << 5));
+    }();
+#else
+    static const bool SUPPORTED = __builtin_cpu_supports("avx2");
+#endif
+    return SUPPORTED;
+}
+
+class Avx2Kernel {
+public:
+    KHRPP_TARGET_AVX2 explicit Avx2Kernel(const uint64_t* lanes) {
+        for (size_t i = 0; i < 2; ++i) {
+            _lanes[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lanes) + i);
+        }
+    }
+
+    KHRPP_TARGET_AVX2 void accumulate(const uint8_t* data, const uint8_t* secret) {
+        for (size_t i = 0; i < 2; ++i) {
+            const __m256i value = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data) + i);
+            const __m256i keyed = _mm256_xor_si256(value, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+            const __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+            const __m256i swapped = _mm256_shuffle_epi32(value, _MM_SHUFFLE(1, 0, 3, 2));
+            _lanes[i] = _mm256_add_epi64(product, _mm256_add_epi64(_lanes[i], swapped));
+        }
+    }
+
+    KHRPP_TARGET_AVX2 void scramble(const uint8_t* secret) {
+        const __m256i prime = _mm256_set1_epi32((int)PRIME32_1);
+        for (size_t i = 0; i < 2; ++i) {
+            __m256i lane = _mm256_xor_si256(_lanes[i], _mm256_srli_epi64(_lanes[i], 47));
+            lane = _mm256_xor_si256(lane, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(secret) + i));
+            const __m256i low = _mm256_mul_epu32(lane, prime);
+            const __m256i high = _mm256_mul_epu32(_mm256_srli_epi64(lane, 32), prime);
+            _lanes[i] = _mm256_add_epi64(low, _mm256_slli_epi64(high, 32));
+        }
+    }
+
+    KHRPP_TARGET_AVX2 void store(uint64_t* lanes) const {
+        for (size_t i = 0; i < 2; ++i) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes) + i, _lanes[i]);
+        }
+    }
+
+private:
+    __m256i _lanes[2];
+};
+#endif
+
+#if defined(KHRPP_XXH3_NEON)
+class NeonKernel {
+public:
+    explicit NeonKernel(const uint64_t* lanes) {
+        for (size_t i = 0; i < 4; ++i) {
+            _lanes[i] = vld1q_u64(lanes + 2 * i);
+        }
+    }
+
+    void accumulate(const uint8_t* data, const uint8_t* secret) {
+        for (size_t i = 0; i < 4; ++i) {
+            const uint64x2_t value = vreinterpretq_u64_u8(vld1q_u8(data + 16 * i));
+            const uint64x2_t keyed = veorq_u64(value, vreinterpretq_u64_u8(vld1q_u8(secret + 16 * i)));
+            const uint64x2_t product = vmull_u32(vmovn_u64(keyed), vshrn_n_u64(keyed, 32));
+            const uint64x2_t swapped = vextq_u64(value, value, 1);
+            _lanes[i] = vaddq_u64(product, vaddq_u64(_lanes[i], swapped));
+        }
+    }
+
+    void scramble(const uint8_t* secret) {
+        const uint32x2_t prime = vdup_n_u32((uint32_t)PRIME32_1);
+        for (size_t i = 0; i < 4; ++i) {
+            uint64x2_t lane = veorq_u64(_lanes[i], vshrq_n_u64(_lanes[i], 47));
+            lane = veorq_u64(lane, vreinterpretq_u64_u8(vld1q_u8(secret + 16 * i)));
+            const uint64x2_t high = vshlq_n_u64(vmull_u32(vshrn_n_u64(lane, 32), prime), 32);
+            _lanes[i] = vmlal_u32(high, vmovn_u64(lane), prime);
+        }
+    }
+
+    void store(uint64_t* lanes) const {
+        for (size_t i = 0; i < 4; ++i) {
+            vst1q_u64(lanes + 2 * i, _lanes[i]);
+        }
+    }
+
+private:
+    uint64x2_t _lanes[4];
+};
+#endif
+
+// More than 240 bytes
+template <typename Kernel>
+inline uint64_t hashLong(const uint8_t* data, size_t size) {
+    uint64_t lanes[8]{ PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3, PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+    Kernel kernel{ lanes };
+    const size_t blockCount = (size - 1) / STRIPE_BLOCK_SIZE;
+    for (size_t block = 0; block < blockCount; ++block) {
+        for (size_t stripe = 0; stripe < STRIPES_PER_BLOCK; ++stripe) {
+            kernel.accumulate(data + block * STRIPE_BLOCK_SIZE + stripe * STRIPE_SIZE, SECRET + stripe * 8);
+        }
+        kernel.scramble(SECRET + SECRET_SIZE - STRIPE_SIZE);
+    }
+    const size_t stripeCount = ((size - 1) - blockCount * STRIPE_BLOCK_SIZE) / STRIPE_SIZE;
+    for (size_t stripe = 0; stripe < stripeCount; ++stripe) {
+        kernel.accumulate(data + blockCount * STRIPE_BLOCK_SIZE + stripe * STRIPE_SIZE, SECRET + stripe * 8);
+    }
+    kernel.accumulate(data + size - STRIPE_SIZE, SECRET + SECRET_SIZE - STRIPE_SIZE - 7);
+    kernel.store(lanes);
+
+    uint64_t hash = size * PRIME64_1;
+    for (size_t i = 0; i < 4; ++i) {
+        hash += multiplyFold(lanes[2 * i] ^ read64(SECRET + 11 + 16 * i), lanes[2 * i + 1] ^ read64(SECRET + 11 + 16 * i + 8));
+    }
+    return avalanche(hash);
+}
+
+#if defined(KHRPP_XXH3_AVX2)
+// Only this function is compiled for AVX2, so the kernel has to be inlined into it in full
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2"), flatten))
+#endif
+inline uint64_t hashLongAvx2(const uint8_t* data, size_t size) {
+    return hashLong<Avx2Kernel>(data, size);
+}
+#endif
+
+}  // namespace xxh3_detail
+
+// The 64 bit XXH3 hash, with the default secret and seed, of `size` bytes.  Inputs of more than 240 bytes use AVX2 on
+// x86-64 when the CPU has it (detected at runtime) and SSE2 otherwise, and NEON on ARM64.
+inline uint64_t xxh3(const uint8_t* data, size_t size) {
+    if (size <= 16) {
+        return xxh3_detail::hashShort(data, size);
+    }
+    if (size <= 240) {
+        return xxh3_detail::hashMedium(data, size);
+    }
+#if defined(KHRPP_XXH3_AVX2)
+    if (xxh3_detail::hasAvx2()) {
+        return xxh3_detail::hashLongAvx2(data, size);
+    }
+#endif
+#if defined(KHRPP_XXH3_NEON)
+    return xxh3_detail::hashLong<xxh3_detail::NeonKernel>(data, size);
+#elif defined(KHRPP_XXH3_SSE2)
+    return xxh3_detail::hashLong<xxh3_detail::Sse2Kernel>(data, size);
+#else
+    return xxh3_detail::hashLong<xxh3_detail::ScalarKernel>(data, size);
+#endif
+}
+
+// Portable implementation, for comparison with the vectorized one
+inline uint64_t xxh3Scalar(const uint8_t* data, size_t size) {
+    if (size <= 240) {
+        return xxh3(data, size);
+    }
+    return xxh3_detail::hashLong<xxh3_detail::ScalarKernel>(data, size);
+}
+
+// Content hash of a storage or part of one, suitable for deduplication and cache keys.  Use crc32c or crc32cParallel
+// for integrity checks.
+inline uint64_t hash(const StorageSpan& span) {
+    return xxh3(span.data(), span.size());
+}
+
+// A tree hash for spans too large to hash at the speed of one core: the XXH3 hash of the array of XXH3 hashes of each
+// 4 MiB chunk, in order, with the chunks hashed on the given pool.  The result doesn't depend on the pool, but it's a
+// different function from hash(), even for spans of a single chunk, so the two can't be mixed in one set of keys.
+inline uint64_t hashParallel(const StorageSpan& span, ThreadPool& pool = ThreadPool::shared()) {
+    static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    const size_t chunkCount = (span.size() + CHUNK_SIZE - 1) / CHUNK_SIZE;
+    std::vector<uint64_t> hashes(chunkCount);
+    parallelFor(pool, chunkCount, [&](size_t chunk) {
+        const size_t offset = chunk * CHUNK_SIZE;
+        hashes[chunk] = xxh3(span.data() + offset, std::min(CHUNK_SIZE, span.size() - offset));
+    });
+    return xxh3(reinterpret_cast<const uint8_t*>(hashes.data()), hashes.size() * sizeof(uint64_t));
+}
+
+}}  // namespace khrpp::utils
+
+#endif
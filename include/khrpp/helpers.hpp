@@ -10,9 +10,11 @@
 #define khrpp_helpers_hpp
 
 #include <algorithm>
+#include <array>
 #include <cstdint>
 #include <list>
 #include <string>
+#include <type_traits>
 #include <unordered_map>
 #include <vector>
 
@@ -38,6 +40,7 @@ struct AlignedStreamBuffer {
         , _start(_data) {}
 
     inline size_t offset() const { return _data - _start; }
+    inline const uint8_t* data() const { return _data; }
     inline bool empty() const { return _size == 0; }
     inline size_t size() const { return _size; }
 
@@ -111,22 +114,24 @@ private:
 
 using KeyValueMap = std::unordered_map<std::string, Bytes>;
 
-inline void parseKtxKeyValueData(AlignedStreamBuffer kvBuffer, KeyValueMap& result, bool zeroCheck = true) {
+// Validates KTX key/value data, calling `callback(key, keyLength, value, valueSize)` for each entry in place
+template <typename F>
+inline void forEachKtxKeyValue(AlignedStreamBuffer kvBuffer, F&& callback, bool zeroCheck = true) {
     while (!kvBuffer.empty() && kvBuffer.size() > 4) {
-        std::vector<uint8_t> bytes;
         uint32_t kvSize;
         if (!kvBuffer.read(kvSize)) {
             throw std::runtime_error("Unable to parse KVD size");
         }
-        if (!kvBuffer.readVector(kvSize, bytes)) {
+        const uint8_t* bytes = kvBuffer.data();
+        if (!kvBuffer.skip(kvSize)) {
             throw std::runtime_error("Unable to read KVD data");
         }
 
-        auto nullPos = std::find(bytes.begin(), bytes.end(), 0);
-        if (nullPos == bytes.end()) {
+        auto nullPos = std::find(bytes, bytes + kvSize, 0);
+        if (nullPos == bytes + kvSize) {
             throw std::runtime_error("Unable to find key termination null in KVD data");
         }
-        result.emplace(std::string{ (const char*)bytes.data() }, Bytes{ nullPos + 1, bytes.end() });
+        callback((const char*)bytes, (size_t)(nullPos - bytes), nullPos + 1, (size_t)(bytes + kvSize - (nullPos + 1)));
         if (kvBuffer.size() != 0) {
             if (!kvBuffer.align(4)) {
                 throw std::runtime_error("Unable to align to key-value interval, or alignment padding is non-Zero");
@@ -139,6 +144,81 @@ inline void parseKtxKeyValueData(AlignedStreamBuffer kvBuffer, KeyValueMap& resu
     }
 }
 
+inline void parseKtxKeyValueData(AlignedStreamBuffer kvBuffer, KeyValueMap& result, bool zeroCheck = true) {
+    forEachKtxKeyValue(
+        kvBuffer,
+        [&](const char* key, size_t keyLength, const uint8_t* value, size_t valueSize) {
+            result.emplace(std::string{ key, keyLength }, Bytes{ value, value + valueSize });
+        },
+        zeroCheck);
+}
+
+// A set of enum values fixed at compile time, for validating enums read from files.  The values are kept sorted, with
+// a bitmap over the 256 values starting at the smallest, which covers the dense runs most enums have, and a binary
+// search for the rest.  Lookups need no static initialization or hashing and work in constant expressions.
+template <typename T, size_t N>
+class EnumSet {
+public:
+    using Value = std::underlying_type_t<T>;
+    static const size_t BITMAP_SIZE{ 256 };
+
+    constexpr explicit EnumSet(const T (&values)[N])
+        : _values{}
+        , _bitmap{} {
+        for (size_t i = 0; i < N; ++i) {
+            // Insertion sort, as std::sort isn't constexpr before C++20
+            const Value value = static_cast<Value>(values[i]);
+            size_t j = i;
+            for (; j > 0 && _values[j - 1] > value; --j) {
+                _values[j] = _values[j - 1];
+            }
+            _values[j] = value;
+        }
+        for (; _bitmapEnd < N && _values[_bitmapEnd] - _values[0] < BITMAP_SIZE; ++_bitmapEnd) {
+            const size_t bit = (size_t)(_values[_bitmapEnd] - _values[0]);
+            _bitmap[bit / 64] |= (uint64_t)1 << (bit % 64);
+        }
+    }
+
+    constexpr bool contains(T value) const {
+        const Value raw = static_cast<Value>(value);
+        if (0 == N || raw < _values[0]) {
+            return false;
+        }
+        if (raw - _values[0] < BITMAP_SIZE) {
+            const size_t bit = (size_t)(raw - _values[0]);
+            return 0 != (_bitmap[bit / 64] & ((uint64_t)1 << (bit % 64)));
+        }
+        size_t low = _bitmapEnd;
+        size_t high = N;
+        while (low < high) {
+            const size_t middle = low + (high - low) / 2;
+            if (_values[middle] < raw) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        return low < N && _values[low] == raw;
+    }
+    // As std::unordered_set::count
+    constexpr size_t count(T value) const { return contains(value) ? 1 : 0; }
+    constexpr size_t size() const { return N; }
+    // In ascending order of value
+    constexpr T operator[](size_t index) const { return static_cast<T>(_values[index]); }
+
+private:
+    std::array<Value, N> _values;
+    std::array<uint64_t, BITMAP_SIZE / 64> _bitmap;
+    // The index of the first value beyond the bitmap
+    size_t _bitmapEnd{ 0 };
+};
+
+template <typename T, size_t N>
+constexpr EnumSet<T, N> makeEnumSet(const T (&values)[N]) {
+    return EnumSet<T, N>{ values };
+}
+
 // Currently only used by testing code
 inline std::list<std::string> splitString(const std::string& source, const char delimiter = ' ') {
     std::list<std::string> result;
@@ -0,0 +1,189 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_dfd_hpp
+#define khrpp_ktx_dfd_hpp
+
+#include "../helpers.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace khrpp { namespace ktx2 {
+
+// The basic descriptor block of a Khronos Data Format Descriptor, which describes the layout of the texel blocks of a
+// KTX2 file independently of its vkFormat.  Values the specification doesn't define yet are kept as they are.
+struct DataFormat {
+    enum class ColorModel : uint8_t
+    {
+        UNSPECIFIED = 0,
+        RGBSDA = 1,
+        YUVSDA = 2,
+        YIQSDA = 3,
+        LABSDA = 4,
+        CMYKA = 5,
+        XYZW = 6,
+        HSVA_ANG = 7,
+        HSLA_ANG = 8,
+        HSVA_HEX = 9,
+        HSLA_HEX = 10,
+        YCGCOA = 11,
+        YCCBCCRC = 12,
+        ICTCP = 13,
+        CIEXYZ = 14,
+        CIEXYY = 15,
+        BC1A = 128,
+        BC2 = 129,
+        BC3 = 130,
+        BC4 = 131,
+        BC5 = 132,
+        BC6H = 133,
+        BC7 = 134,
+        ETC1 = 160,
+        ETC2 = 161,
+        ASTC = 162,
+        ETC1S = 163,
+        PVRTC = 164,
+        PVRTC2 = 165,
+        UASTC = 166,
+    };
+
+    enum class TransferFunction : uint8_t
+    {
+        UNSPECIFIED = 0,
+        LINEAR = 1,
+        SRGB = 2,
+    };
+
+    static const uint8_t FLAG_ALPHA_PREMULTIPLIED{ 1 };
+
+    struct Sample {
+        // Qualifiers in the high bits of the channel type
+        static const uint8_t QUALIFIER_LINEAR{ 0x10 };
+        static const uint8_t QUALIFIER_EXPONENT{ 0x20 };
+        static const uint8_t QUALIFIER_SIGNED{ 0x40 };
+        static const uint8_t QUALIFIER_FLOAT{ 0x80 };
+
+        uint16_t bitOffset{ 0 };
+        // The actual length in bits, i.e. one more than is stored
+        uint16_t bitLength{ 0 };
+        uint8_t channelType{ 0 };
+        std::array<uint8_t, 4> samplePosition{};
+        uint32_t sampleLower{ 0 };
+        uint32_t sampleUpper{ 0 };
+
+        // The meaning of the channel id depends on the color model, e.g. 0 is red for RGBSDA, 15 is alpha for most
+        uint8_t getChannelId() const { return channelType & 0xF; }
+        bool isLinear() const { return 0 != (channelType & QUALIFIER_LINEAR); }
+        bool isExponent() const { return 0 != (channelType & QUALIFIER_EXPONENT); }
+        bool isSigned() const { return 0 != (channelType & QUALIFIER_SIGNED); }
+        bool isFloat() const { return 0 != (channelType & QUALIFIER_FLOAT); }
+    };
+
+    uint16_t versionNumber{ 0 };
+    ColorModel colorModel{ ColorModel::UNSPECIFIED };
+    uint8_t colorPrimaries{ 0 };
+    TransferFunction transferFunction{ TransferFunction::UNSPECIFIED };
+    uint8_t flags{ 0 };
+    // The actual dimensions in texels, i.e. one more than is stored.  Unused dimensions are 1.
+    std::array<uint16_t, 4> texelBlockDimension{ { 1, 1, 1, 1 } };
+    // Bytes per texel block in each plane.  All zero for supercompressed formats, whose blocks have no fixed size.
+    std::array<uint8_t, 8> bytesPlane{};
+    std::vector<Sample> samples;
+
+    // Parses the basic descriptor block from a DFD, not including its leading dfdTotalSize, as in Descriptor::dfd.
+    // Returns false, leaving the defaults, if there's no well formed basic descriptor block.  The DFD isn't otherwise
+    // validated, so a file whose DFD can't be parsed is still usable through its level index.
+    bool parse(const uint8_t* data, size_t size);
+
+    bool isSrgb() const { return transferFunction == TransferFunction::SRGB; }
+    bool isAlphaPremultiplied() const { return 0 != (flags & FLAG_ALPHA_PREMULTIPLIED); }
+
+    uint32_t getBlockWidth() const { return texelBlockDimension[0]; }
+    uint32_t getBlockHeight() const { return texelBlockDimension[1]; }
+    uint32_t getBlockDepth() const { return texelBlockDimension[2]; }
+    // The total size of a texel block across all planes, or 0 if blocks have no fixed size
+    uint32_t getBytesPerBlock() const {
+        uint32_t result = 0;
+        for (const auto bytes : bytesPlane) {
+            result += bytes;
+        }
+        return result;
+    }
+    // The size of an image of the given dimensions in texels, rounded up to whole blocks, or 0 if blocks have no fixed
+    // size
+    size_t getImageSize(uint32_t width, uint32_t height = 1, uint32_t depth = 1) const {
+        const size_t blocksX = (std::max<uint32_t>(1, width) + getBlockWidth() - 1) / getBlockWidth();
+        const size_t blocksY = (std::max<uint32_t>(1, height) + getBlockHeight() - 1) / getBlockHeight();
+        const size_t blocksZ = (std::max<uint32_t>(1, depth) + getBlockDepth() - 1) / getBlockDepth();
+        return blocksX * blocksY * blocksZ * getBytesPerBlock();
+    }
+};
+
+}}  // namespace khrpp::ktx2
+
+// Implementation
+
+namespace khrpp { namespace ktx2 {
+
+inline bool DataFormat::parse(const uint8_t* data, size_t size) {
+    static const uint32_t KHRONOS_VENDOR_ID = 0;
+    static const uint32_t BASIC_DESCRIPTOR_TYPE = 0;
+    static const size_t BASIC_BLOCK_HEADER_SIZE = 24;
+    static const size_t SAMPLE_SIZE = 16;
+
+    *this = DataFormat{};
+    AlignedStreamBuffer buffer{ size, data };
+    while (!buffer.empty()) {
+        const uint8_t* block = buffer.data();
+        uint32_t words[2];
+        if (!buffer.read(words)) {
+            break;
+        }
+        const uint32_t vendorId = words[0] & 0x1FFFF;
+        const uint32_t descriptorType = words[0] >> 17;
+        const size_t blockSize = words[1] >> 16;
+        if (blockSize < sizeof(words) || !buffer.skip(blockSize - sizeof(words))) {
+            break;
+        }
+        if (vendorId != KHRONOS_VENDOR_ID || descriptorType != BASIC_DESCRIPTOR_TYPE) {
+            continue;
+        }
+        if (blockSize < BASIC_BLOCK_HEADER_SIZE || 0 != (blockSize - BASIC_BLOCK_HEADER_SIZE) % SAMPLE_SIZE) {
+            break;
+        }
+        versionNumber = (uint16_t)(words[1] & 0xFFFF);
+        colorModel = static_cast<ColorModel>(block[8]);
+        colorPrimaries = block[9];
+        transferFunction = static_cast<TransferFunction>(block[10]);
+        flags = block[11];
+        for (size_t i = 0; i < texelBlockDimension.size(); ++i) {
+            texelBlockDimension[i] = (uint16_t)(block[12 + i] + 1);
+        }
+        memcpy(bytesPlane.data(), block + 16, bytesPlane.size());
+        const size_t sampleCount = (blockSize - BASIC_BLOCK_HEADER_SIZE) / SAMPLE_SIZE;
+        samples.resize(sampleCount);
+        for (size_t i = 0; i < sampleCount; ++i) {
+            const uint8_t* source = block + BASIC_BLOCK_HEADER_SIZE + i * SAMPLE_SIZE;
+            auto& sample = samples[i];
+            memcpy(&sample.bitOffset, source, sizeof(sample.bitOffset));
+            sample.bitLength = (uint16_t)source[2] + 1;
+            sample.channelType = source[3];
+            memcpy(sample.samplePosition.data(), source + 4, sample.samplePosition.size());
+            memcpy(&sample.sampleLower, source + 8, sizeof(sample.sampleLower));
+            memcpy(&sample.sampleUpper, source + 12, sizeof(sample.sampleUpper));
+        }
+        return true;
+    }
+    return false;
+}
+
+}}  // namespace khrpp::ktx2
+
+#endif
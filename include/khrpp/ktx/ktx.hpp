@@ -17,11 +17,11 @@
 #include <string>
 #include <memory>
 #include <algorithm>
-#include <unordered_set>
 #include <unordered_map>
 
 #include "../constants.hpp"
 #include "../helpers.hpp"
+#include "../storage.hpp"
 
 namespace khrpp { namespace ktx {
 
@@ -101,8 +101,48 @@ inline bool checkAlignment(T value) {
 // actual image / face data available.
 struct Descriptor {
     using ImageOffset = size_t;
-    using FaceOffsets = std::vector<ImageOffset>;
-    using ArrayOffsets = std::vector<FaceOffsets>;
+    // The offset of every face of every array element of every mip, in file order, shared by every copy of a descriptor
+    using ImageOffsets = std::shared_ptr<const std::vector<ImageOffset>>;
+
+    // The offsets of the faces of a single array element of a single mip
+    class FaceOffsets {
+    public:
+        FaceOffsets(const ImageOffset* offsets, uint32_t faceCount)
+            : _offsets{ offsets }
+            , _faceCount{ faceCount } {}
+        size_t size() const { return _faceCount; }
+        bool empty() const { return 0 == _faceCount; }
+        const ImageOffset& operator[](size_t face) const { return _offsets[face]; }
+        const ImageOffset* begin() const { return _offsets; }
+        const ImageOffset* end() const { return _offsets + _faceCount; }
+
+    private:
+        const ImageOffset* _offsets;
+        uint32_t _faceCount;
+    };
+
+    // The offsets of every face of every array element of a single mip, indexed as arrayOffsets[arrayElement][face].  A
+    // view of the descriptor's flat table, so it doesn't allocate.
+    class ArrayOffsets {
+    public:
+        ArrayOffsets() = default;
+        ArrayOffsets(const ImageOffsets& table, size_t first, uint32_t arrayElementCount, uint32_t faceCount)
+            : _table{ table }
+            , _first{ first }
+            , _arrayElementCount{ arrayElementCount }
+            , _faceCount{ faceCount } {}
+        size_t size() const { return _arrayElementCount; }
+        bool empty() const { return 0 == _arrayElementCount; }
+        FaceOffsets operator[](size_t arrayElement) const {
+            return FaceOffsets{ _table->data() + _first + arrayElement * _faceCount, _faceCount };
+        }
+
+    private:
+        ImageOffsets _table;
+        size_t _first{ 0 };
+        uint32_t _arrayElementCount{ 0 };
+        uint32_t _faceCount{ 0 };
+    };
 
     // Size as specified by the KTX specification
     static const size_t KTX_HEADER_SIZE{ 64 };
@@ -140,20 +180,37 @@ struct Descriptor {
 
         bool isArray() const { return numberOfArrayElements > 0; }
         bool isCompressed() const { return glFormat == GLFormat::COMPRESSED; }
+        // Only non-array cube maps give the size of a single face as the imageSize, and pad each face to 4 bytes.
+        // Everywhere else the imageSize covers every array element and face of the mip.
+        bool hasFaceImageSize() const { return !isArray() && numberOfFaces == NUM_CUBEMAPFACES; }
         void validate() const;
     };
 
 	Header header;
     KeyValueMap kvd;
     struct MipDescriptor {
+        // As stored in the file, see Header::hasFaceImageSize
         uint32_t imageSize{ 0 };
+        // The size of a single face of a single array element
+        size_t faceSize{ 0 };
         ArrayOffsets arrayOffsets;
     };
     std::vector<MipDescriptor> mipDescriptors;
+    ImageOffsets imageOffsets;
+
+    // Stride math over imageOffsets, without any range checks
+    ImageOffset getImageOffset(uint32_t mip, uint32_t arrayElement = 0, uint32_t face = 0) const {
+        const size_t arrayElementCount = std::max<uint32_t>(1, header.numberOfArrayElements);
+        return (*imageOffsets)[((size_t)mip * arrayElementCount + arrayElement) * header.numberOfFaces + face];
+    }
 
     // Mip descriptors?
     void parse(const uint8_t* const data, size_t size);
 
+    // Returns the data of a single face of a single array element of a mip, given the whole of the file that was
+    // parsed.  Doesn't allocate, so it's suitable for walking every image of large arrays.
+    utils::StorageSpan getImage(const utils::StorageSpan& file, uint32_t mip, uint32_t arrayElement = 0, uint32_t face = 0) const;
+
     static bool validate(const uint8_t* const data, size_t size) noexcept {
         try {
             Descriptor().parse(data, size);
@@ -366,233 +423,248 @@ namespace khrpp { namespace ktx {
 //    return keyValuesSize;
 //}
 //
-inline const std::unordered_set<GLType>& VALID_GL_TYPES() {
-    static const std::unordered_set<GLType> VALID_GL_TYPES{
-        GLType::UNSIGNED_BYTE,
-        GLType::BYTE,
-        GLType::UNSIGNED_SHORT,
-        GLType::SHORT,
-        GLType::UNSIGNED_INT,
-        GLType::INT,
-        GLType::HALF_FLOAT,
-        GLType::FLOAT,
-        GLType::UNSIGNED_BYTE_3_3_2,
-        GLType::UNSIGNED_BYTE_2_3_3_REV,
-        GLType::UNSIGNED_SHORT_5_6_5,
-        GLType::UNSIGNED_SHORT_5_6_5_REV,
-        GLType::UNSIGNED_SHORT_4_4_4_4,
-        GLType::UNSIGNED_SHORT_4_4_4_4_REV,
-        GLType::UNSIGNED_SHORT_5_5_5_1,
-        GLType::UNSIGNED_SHORT_1_5_5_5_REV,
-        GLType::UNSIGNED_INT_8_8_8_8,
-        GLType::UNSIGNED_INT_8_8_8_8_REV,
-        GLType::UNSIGNED_INT_10_10_10_2,
-        GLType::UNSIGNED_INT_2_10_10_10_REV,
-        GLType::UNSIGNED_INT_24_8,
-        GLType::UNSIGNED_INT_10F_11F_11F_REV,
-        GLType::UNSIGNED_INT_5_9_9_9_REV,
-        GLType::FLOAT_32_UNSIGNED_INT_24_8_REV,
-    };
-    return VALID_GL_TYPES;
+namespace detail {
+inline constexpr auto VALID_GL_TYPES = makeEnumSet<GLType>({
+    GLType::UNSIGNED_BYTE,
+    GLType::BYTE,
+    GLType::UNSIGNED_SHORT,
+    GLType::SHORT,
+    GLType::UNSIGNED_INT,
+    GLType::INT,
+    GLType::HALF_FLOAT,
+    GLType::FLOAT,
+    GLType::UNSIGNED_BYTE_3_3_2,
+    GLType::UNSIGNED_BYTE_2_3_3_REV,
+    GLType::UNSIGNED_SHORT_5_6_5,
+    GLType::UNSIGNED_SHORT_5_6_5_REV,
+    GLType::UNSIGNED_SHORT_4_4_4_4,
+    GLType::UNSIGNED_SHORT_4_4_4_4_REV,
+    GLType::UNSIGNED_SHORT_5_5_5_1,
+    GLType::UNSIGNED_SHORT_1_5_5_5_REV,
+    GLType::UNSIGNED_INT_8_8_8_8,
+    GLType::UNSIGNED_INT_8_8_8_8_REV,
+    GLType::UNSIGNED_INT_10_10_10_2,
+    GLType::UNSIGNED_INT_2_10_10_10_REV,
+    GLType::UNSIGNED_INT_24_8,
+    GLType::UNSIGNED_INT_10F_11F_11F_REV,
+    GLType::UNSIGNED_INT_5_9_9_9_REV,
+    GLType::FLOAT_32_UNSIGNED_INT_24_8_REV,
+});
+}  // namespace detail
+
+constexpr const auto& VALID_GL_TYPES() {
+    return detail::VALID_GL_TYPES;
 }
 
-inline const std::unordered_set<GLFormat>& VALID_GL_FORMATS() {
-    static const std::unordered_set<GLFormat> VALID_GL_FORMATS{
-        GLFormat::STENCIL_INDEX, GLFormat::DEPTH_COMPONENT,
-        GLFormat::DEPTH_STENCIL, GLFormat::LUMINANCE,
-        GLFormat::RED,           GLFormat::GREEN,
-        GLFormat::BLUE,          GLFormat::RG,
-        GLFormat::RGB,           GLFormat::RGBA,
-        GLFormat::BGR,           GLFormat::BGRA,
-        GLFormat::RG_INTEGER,    GLFormat::RED_INTEGER,
-        GLFormat::GREEN_INTEGER, GLFormat::BLUE_INTEGER,
-        GLFormat::RGB_INTEGER,   GLFormat::RGBA_INTEGER,
-        GLFormat::BGR_INTEGER,   GLFormat::BGRA_INTEGER,
-    };
-    return VALID_GL_FORMATS;
+namespace detail {
+inline constexpr auto VALID_GL_FORMATS = makeEnumSet<GLFormat>({
+    GLFormat::STENCIL_INDEX, GLFormat::DEPTH_COMPONENT,
+    GLFormat::DEPTH_STENCIL, GLFormat::LUMINANCE,
+    GLFormat::RED,           GLFormat::GREEN,
+    GLFormat::BLUE,          GLFormat::RG,
+    GLFormat::RGB,           GLFormat::RGBA,
+    GLFormat::BGR,           GLFormat::BGRA,
+    GLFormat::RG_INTEGER,    GLFormat::RED_INTEGER,
+    GLFormat::GREEN_INTEGER, GLFormat::BLUE_INTEGER,
+    GLFormat::RGB_INTEGER,   GLFormat::RGBA_INTEGER,
+    GLFormat::BGR_INTEGER,   GLFormat::BGRA_INTEGER,
+});
+}  // namespace detail
+
+constexpr const auto& VALID_GL_FORMATS() {
+    return detail::VALID_GL_FORMATS;
 }
 
-inline const std::unordered_set<GLInternalFormat>& VALID_GL_INTERNAL_FORMATS() {
-    static const std::unordered_set<GLInternalFormat> VALID_GL_INTERNAL_FORMATS{
-        GLInternalFormat::LUMINANCE8,
-        GLInternalFormat::R8,
-        GLInternalFormat::R8_SNORM,
-        GLInternalFormat::R16,
-        GLInternalFormat::R16_SNORM,
-        GLInternalFormat::RG8,
-        GLInternalFormat::RG8_SNORM,
-        GLInternalFormat::RG16,
-        GLInternalFormat::RG16_SNORM,
-        GLInternalFormat::R3_G3_B2,
-        GLInternalFormat::RGB4,
-        GLInternalFormat::RGB5,
-        GLInternalFormat::RGB565,
-        GLInternalFormat::RGB8,
-        GLInternalFormat::RGB8_SNORM,
-        GLInternalFormat::RGB10,
-        GLInternalFormat::RGB12,
-        GLInternalFormat::RGB16,
-        GLInternalFormat::RGB16_SNORM,
-        GLInternalFormat::RGBA2,
-        GLInternalFormat::RGBA4,
-        GLInternalFormat::RGB5_A1,
-        GLInternalFormat::RGBA8,
-        GLInternalFormat::RGBA8_SNORM,
-        GLInternalFormat::RGB10_A2,
-        GLInternalFormat::RGB10_A2UI,
-        GLInternalFormat::RGBA12,
-        GLInternalFormat::RGBA16,
-        GLInternalFormat::RGBA16_SNORM,
-        GLInternalFormat::SRGB8,
-        GLInternalFormat::SRGB8_ALPHA8,
-        GLInternalFormat::R16F,
-        GLInternalFormat::RG16F,
-        GLInternalFormat::RGB16F,
-        GLInternalFormat::RGBA16F,
-        GLInternalFormat::R32F,
-        GLInternalFormat::RG32F,
-        GLInternalFormat::RGBA32F,
-        GLInternalFormat::R11F_G11F_B10F,
-        GLInternalFormat::RGB9_E5,
-        GLInternalFormat::R8I,
-        GLInternalFormat::R8UI,
-        GLInternalFormat::R16I,
-        GLInternalFormat::R16UI,
-        GLInternalFormat::R32I,
-        GLInternalFormat::R32UI,
-        GLInternalFormat::RG8I,
-        GLInternalFormat::RG8UI,
-        GLInternalFormat::RG16I,
-        GLInternalFormat::RG16UI,
-        GLInternalFormat::RG32I,
-        GLInternalFormat::RG32UI,
-        GLInternalFormat::RGB8I,
-        GLInternalFormat::RGB8UI,
-        GLInternalFormat::RGB16I,
-        GLInternalFormat::RGB16UI,
-        GLInternalFormat::RGB32I,
-        GLInternalFormat::RGB32UI,
-        GLInternalFormat::RGBA8I,
-        GLInternalFormat::RGBA8UI,
-        GLInternalFormat::RGBA16I,
-        GLInternalFormat::RGBA16UI,
-        GLInternalFormat::RGBA32I,
-        GLInternalFormat::RGBA32UI,
-        GLInternalFormat::DEPTH_COMPONENT16,
-        GLInternalFormat::DEPTH_COMPONENT24,
-        GLInternalFormat::DEPTH_COMPONENT32,
-        GLInternalFormat::DEPTH_COMPONENT32F,
-        GLInternalFormat::DEPTH24_STENCIL8,
-        GLInternalFormat::DEPTH32F_STENCIL8,
-        GLInternalFormat::STENCIL_INDEX1,
-        GLInternalFormat::STENCIL_INDEX4,
-        GLInternalFormat::STENCIL_INDEX8,
-        GLInternalFormat::STENCIL_INDEX16,
-    };
-    return VALID_GL_INTERNAL_FORMATS;
+namespace detail {
+inline constexpr auto VALID_GL_INTERNAL_FORMATS = makeEnumSet<GLInternalFormat>({
+    GLInternalFormat::LUMINANCE8,
+    GLInternalFormat::R8,
+    GLInternalFormat::R8_SNORM,
+    GLInternalFormat::R16,
+    GLInternalFormat::R16_SNORM,
+    GLInternalFormat::RG8,
+    GLInternalFormat::RG8_SNORM,
+    GLInternalFormat::RG16,
+    GLInternalFormat::RG16_SNORM,
+    GLInternalFormat::R3_G3_B2,
+    GLInternalFormat::RGB4,
+    GLInternalFormat::RGB5,
+    GLInternalFormat::RGB565,
+    GLInternalFormat::RGB8,
+    GLInternalFormat::RGB8_SNORM,
+    GLInternalFormat::RGB10,
+    GLInternalFormat::RGB12,
+    GLInternalFormat::RGB16,
+    GLInternalFormat::RGB16_SNORM,
+    GLInternalFormat::RGBA2,
+    GLInternalFormat::RGBA4,
+    GLInternalFormat::RGB5_A1,
+    GLInternalFormat::RGBA8,
+    GLInternalFormat::RGBA8_SNORM,
+    GLInternalFormat::RGB10_A2,
+    GLInternalFormat::RGB10_A2UI,
+    GLInternalFormat::RGBA12,
+    GLInternalFormat::RGBA16,
+    GLInternalFormat::RGBA16_SNORM,
+    GLInternalFormat::SRGB8,
+    GLInternalFormat::SRGB8_ALPHA8,
+    GLInternalFormat::R16F,
+    GLInternalFormat::RG16F,
+    GLInternalFormat::RGB16F,
+    GLInternalFormat::RGBA16F,
+    GLInternalFormat::R32F,
+    GLInternalFormat::RG32F,
+    GLInternalFormat::RGBA32F,
+    GLInternalFormat::R11F_G11F_B10F,
+    GLInternalFormat::RGB9_E5,
+    GLInternalFormat::R8I,
+    GLInternalFormat::R8UI,
+    GLInternalFormat::R16I,
+    GLInternalFormat::R16UI,
+    GLInternalFormat::R32I,
+    GLInternalFormat::R32UI,
+    GLInternalFormat::RG8I,
+    GLInternalFormat::RG8UI,
+    GLInternalFormat::RG16I,
+    GLInternalFormat::RG16UI,
+    GLInternalFormat::RG32I,
+    GLInternalFormat::RG32UI,
+    GLInternalFormat::RGB8I,
+    GLInternalFormat::RGB8UI,
+    GLInternalFormat::RGB16I,
+    GLInternalFormat::RGB16UI,
+    GLInternalFormat::RGB32I,
+    GLInternalFormat::RGB32UI,
+    GLInternalFormat::RGBA8I,
+    GLInternalFormat::RGBA8UI,
+    GLInternalFormat::RGBA16I,
+    GLInternalFormat::RGBA16UI,
+    GLInternalFormat::RGBA32I,
+    GLInternalFormat::RGBA32UI,
+    GLInternalFormat::DEPTH_COMPONENT16,
+    GLInternalFormat::DEPTH_COMPONENT24,
+    GLInternalFormat::DEPTH_COMPONENT32,
+    GLInternalFormat::DEPTH_COMPONENT32F,
+    GLInternalFormat::DEPTH24_STENCIL8,
+    GLInternalFormat::DEPTH32F_STENCIL8,
+    GLInternalFormat::STENCIL_INDEX1,
+    GLInternalFormat::STENCIL_INDEX4,
+    GLInternalFormat::STENCIL_INDEX8,
+    GLInternalFormat::STENCIL_INDEX16,
+});
+}  // namespace detail
+
+constexpr const auto& VALID_GL_INTERNAL_FORMATS() {
+    return detail::VALID_GL_INTERNAL_FORMATS;
 }
 
-inline const std::unordered_set<GLInternalFormat>& VALID_GL_INTERNAL_COMPRESSED_FORMATS() {
-    static const std::unordered_set<GLInternalFormat> VALID_GL_INTERNAL_COMPRESSED_FORMATS{
-        GLInternalFormat::COMPRESSED_RED,
-        GLInternalFormat::COMPRESSED_RG,
-        GLInternalFormat::COMPRESSED_RGB,
-        GLInternalFormat::COMPRESSED_RGBA,
-        GLInternalFormat::COMPRESSED_SRGB,
-        GLInternalFormat::COMPRESSED_SRGB_ALPHA,
-        GLInternalFormat::COMPRESSED_ETC1_RGB8_OES,
-        GLInternalFormat::COMPRESSED_RGB_S3TC_DXT1_EXT,
-        GLInternalFormat::COMPRESSED_RGBA_S3TC_DXT3_EXT,
-        GLInternalFormat::COMPRESSED_SRGB_S3TC_DXT1_EXT,
-        GLInternalFormat::COMPRESSED_RGBA_S3TC_DXT1_EXT,
-        GLInternalFormat::COMPRESSED_RGBA_S3TC_DXT5_EXT,
-        GLInternalFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
-        GLInternalFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT,
-        GLInternalFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,
-        GLInternalFormat::COMPRESSED_RED_RGTC1,
-        GLInternalFormat::COMPRESSED_SIGNED_RED_RGTC1,
-        GLInternalFormat::COMPRESSED_RG_RGTC2,
-        GLInternalFormat::COMPRESSED_SIGNED_RG_RGTC2,
-        GLInternalFormat::COMPRESSED_RGBA_BPTC_UNORM,
-        GLInternalFormat::COMPRESSED_SRGB_ALPHA_BPTC_UNORM,
-        GLInternalFormat::COMPRESSED_RGB_BPTC_SIGNED_FLOAT,
-        GLInternalFormat::COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,
-        GLInternalFormat::COMPRESSED_RGB8_ETC2,
-        GLInternalFormat::COMPRESSED_SRGB8_ETC2,
-        GLInternalFormat::COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2,
-        GLInternalFormat::COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,
-        GLInternalFormat::COMPRESSED_RGBA8_ETC2_EAC,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,
-        GLInternalFormat::COMPRESSED_R11_EAC,
-        GLInternalFormat::COMPRESSED_SIGNED_R11_EAC,
-        GLInternalFormat::COMPRESSED_RG11_EAC,
-        GLInternalFormat::COMPRESSED_SIGNED_RG11_EAC,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_4x4,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_5x4,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_5x5,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_6x5,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_6x6,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_8x5,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_8x6,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_8x8,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_10x5,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_10x6,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_10x8,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_10x10,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_12x10,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_12x12,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_3x3x3_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_4x3x3_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_4x4x3_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_4x4x4_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_5x4x4_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_5x5x4_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_5x5x5_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_6x5x5_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_6x6x5_OES,
-        GLInternalFormat::COMPRESSED_RGBA_ASTC_6x6x6_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x4,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x4,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x5,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x5,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x6,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_8x5,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_8x6,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_8x8,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x5,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x6,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x8,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x10,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_12x10,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_12x12,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_3x3x3_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x3x3_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x4x3_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x4x4_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x4x4_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x5x4_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x5x5_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x5x5_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x6x5_OES,
-        GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x6x6_OES,
-    };
-    return VALID_GL_INTERNAL_COMPRESSED_FORMATS;
+namespace detail {
+inline constexpr auto VALID_GL_INTERNAL_COMPRESSED_FORMATS = makeEnumSet<GLInternalFormat>({
+    GLInternalFormat::COMPRESSED_RED,
+    GLInternalFormat::COMPRESSED_RG,
+    GLInternalFormat::COMPRESSED_RGB,
+    GLInternalFormat::COMPRESSED_RGBA,
+    GLInternalFormat::COMPRESSED_SRGB,
+    GLInternalFormat::COMPRESSED_SRGB_ALPHA,
+    GLInternalFormat::COMPRESSED_ETC1_RGB8_OES,
+    GLInternalFormat::COMPRESSED_RGB_S3TC_DXT1_EXT,
+    GLInternalFormat::COMPRESSED_RGBA_S3TC_DXT3_EXT,
+    GLInternalFormat::COMPRESSED_SRGB_S3TC_DXT1_EXT,
+    GLInternalFormat::COMPRESSED_RGBA_S3TC_DXT1_EXT,
+    GLInternalFormat::COMPRESSED_RGBA_S3TC_DXT5_EXT,
+    GLInternalFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
+    GLInternalFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT,
+    GLInternalFormat::COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,
+    GLInternalFormat::COMPRESSED_RED_RGTC1,
+    GLInternalFormat::COMPRESSED_SIGNED_RED_RGTC1,
+    GLInternalFormat::COMPRESSED_RG_RGTC2,
+    GLInternalFormat::COMPRESSED_SIGNED_RG_RGTC2,
+    GLInternalFormat::COMPRESSED_RGBA_BPTC_UNORM,
+    GLInternalFormat::COMPRESSED_SRGB_ALPHA_BPTC_UNORM,
+    GLInternalFormat::COMPRESSED_RGB_BPTC_SIGNED_FLOAT,
+    GLInternalFormat::COMPRESSED_RGB_BPTC_UNSIGNED_FLOAT,
+    GLInternalFormat::COMPRESSED_RGB8_ETC2,
+    GLInternalFormat::COMPRESSED_SRGB8_ETC2,
+    GLInternalFormat::COMPRESSED_RGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+    GLInternalFormat::COMPRESSED_SRGB8_PUNCHTHROUGH_ALPHA1_ETC2,
+    GLInternalFormat::COMPRESSED_RGBA8_ETC2_EAC,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ETC2_EAC,
+    GLInternalFormat::COMPRESSED_R11_EAC,
+    GLInternalFormat::COMPRESSED_SIGNED_R11_EAC,
+    GLInternalFormat::COMPRESSED_RG11_EAC,
+    GLInternalFormat::COMPRESSED_SIGNED_RG11_EAC,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_4x4,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_5x4,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_5x5,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_6x5,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_6x6,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_8x5,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_8x6,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_8x8,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_10x5,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_10x6,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_10x8,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_10x10,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_12x10,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_12x12,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_3x3x3_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_4x3x3_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_4x4x3_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_4x4x4_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_5x4x4_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_5x5x4_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_5x5x5_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_6x5x5_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_6x6x5_OES,
+    GLInternalFormat::COMPRESSED_RGBA_ASTC_6x6x6_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x4,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x4,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x5,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x5,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x6,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_8x5,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_8x6,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_8x8,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x5,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x6,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x8,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_10x10,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_12x10,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_12x12,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_3x3x3_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x3x3_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x4x3_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_4x4x4_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x4x4_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x5x4_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_5x5x5_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x5x5_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x6x5_OES,
+    GLInternalFormat::COMPRESSED_SRGB8_ALPHA8_ASTC_6x6x6_OES,
+});
+}  // namespace detail
+
+constexpr const auto& VALID_GL_INTERNAL_COMPRESSED_FORMATS() {
+    return detail::VALID_GL_INTERNAL_COMPRESSED_FORMATS;
 }
 
-inline const std::unordered_set<GLBaseInternalFormat>& VALID_GL_BASE_INTERNAL_FORMATS() {
-    static const std::unordered_set<GLBaseInternalFormat> VALID_GL_BASE_INTERNAL_FORMATS{
-        GLBaseInternalFormat::DEPTH_COMPONENT,
-        GLBaseInternalFormat::DEPTH_STENCIL,
-        GLBaseInternalFormat::LUMINANCE,
-        GLBaseInternalFormat::RED,
-        GLBaseInternalFormat::RG,
-        GLBaseInternalFormat::RGB,
-        GLBaseInternalFormat::RGBA,
-        GLBaseInternalFormat::SRGB,
-        GLBaseInternalFormat::SRGB_ALPHA,
-        GLBaseInternalFormat::STENCIL_INDEX,
-    };
-    return VALID_GL_BASE_INTERNAL_FORMATS;
+namespace detail {
+inline constexpr auto VALID_GL_BASE_INTERNAL_FORMATS = makeEnumSet<GLBaseInternalFormat>({
+    GLBaseInternalFormat::DEPTH_COMPONENT,
+    GLBaseInternalFormat::DEPTH_STENCIL,
+    GLBaseInternalFormat::LUMINANCE,
+    GLBaseInternalFormat::RED,
+    GLBaseInternalFormat::RG,
+    GLBaseInternalFormat::RGB,
+    GLBaseInternalFormat::RGBA,
+    GLBaseInternalFormat::SRGB,
+    GLBaseInternalFormat::SRGB_ALPHA,
+    GLBaseInternalFormat::STENCIL_INDEX,
+});
+}  // namespace detail
+
+constexpr const auto& VALID_GL_BASE_INTERNAL_FORMATS() {
+    return detail::VALID_GL_BASE_INTERNAL_FORMATS;
 }
 
 inline void Descriptor::parse(const uint8_t* const data, size_t size) {
@@ -620,30 +692,53 @@ inline void Descriptor::parse(const uint8_t* const data, size_t size) {
 
     // images read
     {
-        uint32_t faceCount = header.numberOfFaces;
-        uint32_t arrayElementCount = header.numberOfArrayElements == 0 ? 1 : header.numberOfArrayElements;
-
+        const uint32_t faceCount = header.numberOfFaces;
+        const uint32_t arrayElementCount = std::max<uint32_t>(1, header.numberOfArrayElements);
+        const size_t imageCount = (size_t)arrayElementCount * faceCount;
+        const bool hasFaceImageSize = header.hasFaceImageSize();
+
+        // A single allocation for the offsets of every image, rather than one per array element per mip
+        auto offsets = std::make_shared<std::vector<ImageOffset>>();
+        offsets->resize(imageCount * header.numberOfMipmapLevels);
+        imageOffsets = offsets;
         mipDescriptors.clear();
         mipDescriptors.resize(header.numberOfMipmapLevels);
         for (uint32_t mip = 0; mip < header.numberOfMipmapLevels; ++mip) {
             MipDescriptor& mipDescriptor = mipDescriptors[mip];
             buffer.read(mipDescriptor.imageSize);
-
-            // Read in array elements
-            ArrayOffsets& arrayOffsets = mipDescriptor.arrayOffsets;
-            arrayOffsets.resize(arrayElementCount);
-            for (uint32_t arrayElement = 0; arrayElement < arrayElementCount; ++arrayElement) {
-                FaceOffsets& faceOffsets = arrayOffsets[arrayElement];
-                faceOffsets.resize(faceCount);
-                for (uint32_t face = 0; face < faceCount; ++face) {
-                    faceOffsets[face] = buffer.offset();
-                    buffer.skip(mipDescriptor.imageSize);
-                }
+            const size_t first = mip * imageCount;
+            mipDescriptor.arrayOffsets = ArrayOffsets{ imageOffsets, first, arrayElementCount, faceCount };
+
+            // Non-array cube map faces are each padded, everything else is a single block of data padded at the end
+            ImageOffset offset = buffer.offset();
+            size_t imageStride;
+            if (hasFaceImageSize) {
+                mipDescriptor.faceSize = mipDescriptor.imageSize;
+                imageStride = evalPaddedSize(mipDescriptor.faceSize);
+                buffer.skip(imageStride * imageCount);
+            } else {
+                mipDescriptor.faceSize = mipDescriptor.imageSize / imageCount;
+                imageStride = mipDescriptor.faceSize;
+                buffer.skip(evalPaddedSize(mipDescriptor.imageSize));
+            }
+            for (size_t image = 0; image < imageCount; ++image) {
+                (*offsets)[first + image] = offset;
+                offset += imageStride;
             }
         }
     }
 }
 
+inline utils::StorageSpan Descriptor::getImage(const utils::StorageSpan& file, uint32_t mip, uint32_t arrayElement, uint32_t face) const {
+    if (mip >= mipDescriptors.size()) {
+        throw std::runtime_error(FORMAT("Invalid mip {}", mip));
+    }
+    if (arrayElement >= std::max<uint32_t>(1, header.numberOfArrayElements) || face >= header.numberOfFaces) {
+        throw std::runtime_error(FORMAT("Invalid array element {} or face {} for mip {}", arrayElement, face, mip));
+    }
+    return file.subspan(getImageOffset(mip, arrayElement, face), mipDescriptors[mip].faceSize);
+}
+
 inline void Descriptor::Header::validate() const {
     if (0 != memcmp(identifier, IDENTIFIER().data(), IDENTIFIER_LENGTH)) {
         throw std::runtime_error("Invalid KTX file identifier");
@@ -656,7 +751,7 @@ inline void Descriptor::Header::validate() const {
     //
     // GL enum validity
     //
-    if (VALID_GL_BASE_INTERNAL_FORMATS().count(glBaseInternalFormat) != 1) {
+    if (!VALID_GL_BASE_INTERNAL_FORMATS().contains(glBaseInternalFormat)) {
         throw std::runtime_error(FORMAT("Invalid glBaseInternalFormat {}", (uint32_t)glBaseInternalFormat));
     }
 
@@ -669,19 +764,19 @@ inline void Descriptor::Header::validate() const {
             throw std::runtime_error(FORMAT("Invalid glTypeSize {} for compressed KTX", (uint32_t)glTypeSize));
         }
 
-        if (VALID_GL_INTERNAL_COMPRESSED_FORMATS().count(glInternalFormat) != 1) {
+        if (!VALID_GL_INTERNAL_COMPRESSED_FORMATS().contains(glInternalFormat)) {
             throw std::runtime_error(FORMAT("Invalid glInternalFormat {} for compressed KTX", (uint32_t)glInternalFormat));
         }
     } else {
-        if (VALID_GL_TYPES().count(glType) != 1) {
+        if (!VALID_GL_TYPES().contains(glType)) {
             throw std::runtime_error(FORMAT("Invalid glType {} for uncompressed KTX", (uint32_t)glType));
         }
 
-        if (VALID_GL_FORMATS().count(glFormat) != 1) {
+        if (!VALID_GL_FORMATS().contains(glFormat)) {
             throw std::runtime_error(FORMAT("Invalid glFormat {} for uncompressed KTX", (uint32_t)glFormat));
         }
 
-        if (VALID_GL_INTERNAL_FORMATS().count(glInternalFormat) != 1) {
+        if (!VALID_GL_INTERNAL_FORMATS().contains(glInternalFormat)) {
             throw std::runtime_error(FORMAT("Invalid glInternalFormat {} for uncompressed KTX", (uint32_t)glInternalFormat));
         }
     }
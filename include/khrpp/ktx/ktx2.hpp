@@ -8,15 +8,24 @@
 #ifndef khrpp_ktx2_hpp
 #define khrpp_ktx2_hpp
 
-#include "constants.hpp"
-#include "helpers.hpp"
+#include "../constants.hpp"
+#include "../hash.hpp"
+#include "../helpers.hpp"
+#include "../storage.hpp"
+#include "../streaming.hpp"
+#include "dfd.hpp"
 
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <iterator>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
 namespace khrpp { namespace ktx2 {
@@ -39,6 +48,11 @@ struct Descriptor {
         return IDENTIFIER_VALUE;
     };
 
+    struct LevelDescriptor {
+        uint64_t byteOffset{ 0 };
+        uint64_t byteLength{ 0 };
+        uint64_t uncompressedByteLength{ 0 };
+    };
     struct Header {
 		Byte identifier[IDENTIFIER_LENGTH]{};
         vk::Format format{ vk::Format::UNDEFINED };
@@ -60,18 +74,42 @@ struct Descriptor {
         // Supercompression global data
         uint64_t sgdByteOffset{ 0 };
         uint64_t sgdByteLength{ 0 };
+
+        // The number of leading bytes of the file occupied by the header, level index, DFD, KVD and SGD, i.e.
+        // everything parseIndex needs to see
+        size_t getIndexSize() const {
+            size_t result = sizeof(Header) + std::max<uint32_t>(1, levelCount) * sizeof(LevelDescriptor);
+            if (dfdByteLength) {
+                result = std::max<size_t>(result, (size_t)dfdByteOffset + dfdByteLength);
+            }
+            if (kvdByteLength) {
+                result = std::max<size_t>(result, (size_t)kvdByteOffset + kvdByteLength);
+            }
+            if (sgdByteLength) {
+                result = std::max<size_t>(result, (size_t)(sgdByteOffset + sgdByteLength));
+            }
+            return result;
+        }
+
+        // Supercompressed level data is packed without padding
+        size_t getLevelAlignment() const { return supercompressionScheme == SupercompressionScheme::NONE ? 8 : 1; }
+
+        // The size of a single face of a single layer of a mip level, including all of its z slices, and of a single z
+        // slice, as described by `format`.  0 if the format's blocks have no fixed size, as for supercompressed files.
+        size_t getImageSize(const DataFormat& format, uint32_t level) const {
+            return format.getImageSize(pixelWidth >> level, pixelHeight >> level, pixelDepth >> level);
+        }
+        size_t getSliceSize(const DataFormat& format, uint32_t level) const {
+            return format.getImageSize(pixelWidth >> level, pixelHeight >> level);
+        }
     } header;
 
-    struct LevelDescriptor {
-        uint64_t byteOffset{ 0 };
-        uint64_t byteLength{ 0 };
-        uint64_t uncompressedByteLength{ 0 };
-    };
     std::vector<LevelDescriptor> levels;
 
-    // DFD 1.3 (1.2 for now)
-    // FIXME create a dfd wrapper and build a vector of those
+    // DFD 1.3, without its leading dfdTotalSize
     Bytes dfd;
+    // The basic descriptor block of the DFD, if it has one
+    DataFormat dataFormat;
 
     // Key/value pairs
     std::unordered_map<String, Bytes> kvd;
@@ -109,6 +147,27 @@ struct Descriptor {
     // Mip descriptors?
     void parse(const uint8_t* const data, size_t size);
 
+    // Parses and validates everything preceding the level data.  Only the first `size` bytes of the file, at least
+    // Header::getIndexSize() of them, need to be available at `data`.  Level ranges are validated against `fileSize`,
+    // but the level data and its alignment padding are never touched.
+    void parseIndex(const uint8_t* const data, size_t size, size_t fileSize);
+    // The total size of the file starting at `data`, as described by its level index, or 0 if fewer than the first
+    // Header::getIndexSize() bytes are available yet.  For sources like pipes and decompressors where the size isn't
+    // known up front, this is the `fileSize` to pass to parseIndex.
+    static size_t getFileSize(const uint8_t* const data, size_t size);
+
+    // Return the data of a whole mip level, or of a single face of a single layer of a mip level, given the whole of
+    // the file that was parsed.  Neither allocates, so they're suitable for walking every image of large arrays.
+    // Individual images can only be addressed in files without supercompression.
+    utils::StorageSpan getLevel(const utils::StorageSpan& file, uint32_t level) const;
+    utils::StorageSpan getImage(const utils::StorageSpan& file, uint32_t level, uint32_t layer = 0, uint32_t face = 0) const;
+    // Sizes computed from the DFD rather than from the level index, see Header::getImageSize
+    size_t getImageSize(uint32_t level) const { return header.getImageSize(dataFormat, level); }
+    size_t getSliceSize(uint32_t level) const { return header.getSliceSize(dataFormat, level); }
+    // The 64 bit content hash (utils::hash) of each mip level's data as stored (i.e. still supercompressed, if it is),
+    // hashed in place with the levels spread over the given pool
+    std::vector<uint64_t> getLevelDigests(const utils::StorageSpan& file, utils::ThreadPool& pool = utils::ThreadPool::shared()) const;
+
     static bool validate(const uint8_t* const data, size_t size) noexcept {
         try {
             Descriptor().parse(data, size);
@@ -117,226 +176,421 @@ struct Descriptor {
         }
         return true;
     }
+
+private:
+    friend class Parser;
+    friend struct DescriptorView;
+    friend class LazyDescriptor;
+
+    // The stages of parseIndex, each continuing from where the previous one left `buffer`
+    void parseHeader(AlignedStreamBuffer& buffer) { readHeader(buffer, header); }
+    void parseLevelIndex(AlignedStreamBuffer& buffer) { readLevelIndex(buffer, header, levels); }
+    void parseDfd(AlignedStreamBuffer& buffer);
+    void parseKvd(AlignedStreamBuffer& buffer);
+    void parseSgd(AlignedStreamBuffer& buffer);
+    void validateLevels(size_t offset, size_t fileSize) const { validateLevels(header, levels, offset, fileSize); }
+
+    // The validation shared with DescriptorView.  The DFD, KVD and SGD readers return the (unparsed) contents of
+    // their sections, which are empty when the section is absent.
+    static void readHeader(AlignedStreamBuffer& buffer, Header& header);
+    static void readLevelIndex(AlignedStreamBuffer& buffer, const Header& header, std::vector<LevelDescriptor>& levels);
+    static AlignedStreamBuffer readDfd(AlignedStreamBuffer& buffer, const Header& header);
+    static AlignedStreamBuffer readKvd(AlignedStreamBuffer& buffer, const Header& header);
+    static AlignedStreamBuffer readSgd(AlignedStreamBuffer& buffer, const Header& header);
+    static void validateLevels(const Header& header, const std::vector<LevelDescriptor>& levels, size_t offset, size_t fileSize);
+    static void validateLevelPadding(const Header& header, const std::vector<LevelDescriptor>& levels, const uint8_t* const data, size_t size);
+    static utils::StorageSpan getLevel(const std::vector<LevelDescriptor>& levels, const utils::StorageSpan& file, uint32_t level);
+    static utils::StorageSpan getImage(const Header& header,
+                                       const std::vector<LevelDescriptor>& levels,
+                                       const utils::StorageSpan& file,
+                                       uint32_t level,
+                                       uint32_t layer,
+                                       uint32_t face);
+};
+
+// A descriptor that references the storage it was parsed from instead of copying the DFD, the key/value data and the
+// Basis global data out of it, so parsing allocates nothing but the level index.  Validation is identical to
+// Descriptor's, and the view keeps the storage alive.
+struct DescriptorView {
+    using Header = Descriptor::Header;
+    using LevelDescriptor = Descriptor::LevelDescriptor;
+
+    // The key/value pairs, parsed on the fly from the validated data as they're iterated over
+    class KeyValueView {
+    public:
+        struct Entry {
+            std::string_view key;
+            utils::StorageSpan value;
+        };
+
+        class Iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const Entry*;
+            using reference = const Entry&;
+
+            Iterator() = default;
+            const Entry& operator*() const { return _entry; }
+            const Entry* operator->() const { return &_entry; }
+            Iterator& operator++() {
+                _offset = _next;
+                load();
+                return *this;
+            }
+            bool operator==(const Iterator& other) const { return _offset == other._offset && _data.data() == other._data.data(); }
+            bool operator!=(const Iterator& other) const { return !(*this == other); }
+
+        private:
+            friend class KeyValueView;
+            Iterator(const utils::StorageSpan& data, size_t offset)
+                : _data{ data }
+                , _offset{ offset } {
+                load();
+            }
+            void load();
+
+            utils::StorageSpan _data;
+            size_t _offset{ 0 };
+            size_t _next{ 0 };
+            Entry _entry;
+        };
+
+        KeyValueView() = default;
+        KeyValueView(const utils::StorageSpan& data, size_t count)
+            : _data{ data }
+            , _count{ count } {}
+
+        Iterator begin() const { return Iterator{ _data, 0 }; }
+        Iterator end() const { return Iterator{ _data, _data.size() }; }
+        size_t size() const { return _count; }
+        bool empty() const { return 0 == _count; }
+        std::optional<utils::StorageSpan> find(std::string_view key) const;
+        const utils::StorageSpan& data() const { return _data; }
+
+    private:
+        utils::StorageSpan _data;
+        size_t _count{ 0 };
+    };
+
+    struct BasisView {
+        using BasisHeader = Descriptor::BasisDescriptor::BasisHeader;
+        using BasisImageDescriptor = Descriptor::BasisDescriptor::BasisImageDescriptor;
+
+        BasisHeader header;
+        // Packed BasisImageDescriptors, which needn't be suitably aligned, so use getImage()
+        utils::StorageSpan images;
+        utils::StorageSpan endpointsData;
+        utils::StorageSpan selectorsData;
+        utils::StorageSpan tableData;
+
+        size_t getImageCount() const { return images.size() / sizeof(BasisImageDescriptor); }
+        BasisImageDescriptor getImage(size_t index) const;
+        void parse(const Header& ktxHeader, const utils::StorageSpan& data);
+    };
+
+    Header header;
+    std::vector<LevelDescriptor> levels;
+    // The DFD, not including its leading total size, as in Descriptor
+    utils::StorageSpan dfd;
+    KeyValueView kvd;
+    std::optional<BasisView> basisData;
+
+    // Parsed on demand, so that parsing the view doesn't allocate
+    DataFormat getDataFormat() const {
+        DataFormat result;
+        result.parse(dfd.data(), dfd.size());
+        return result;
+    }
+
+    void parse(const utils::Storage::ConstPointer& storage);
+    // As Descriptor::parseIndex, where `storage` may hold only the first part of the file, such as a
+    // WindowedFileStorage
+    void parseIndex(const utils::Storage::ConstPointer& storage, size_t fileSize);
+
+    utils::StorageSpan getLevel(uint32_t level) const { return Descriptor::getLevel(levels, *_storage, level); }
+    utils::StorageSpan getImage(uint32_t level, uint32_t layer = 0, uint32_t face = 0) const {
+        return Descriptor::getImage(header, levels, *_storage, level, layer, face);
+    }
+    const utils::Storage::ConstPointer& storage() const { return _storage; }
+
+private:
+    friend class LazyDescriptor;
+
+    // Parses the DFD, KVD and SGD following the level index, leaving `buffer` at the end of the SGD
+    void parseSections(const utils::StorageSpan& file, AlignedStreamBuffer& buffer);
+
+    utils::Storage::ConstPointer _storage;
+};
+
+// A descriptor for call sites that mostly need the dimensions, format and level ranges.  Construction validates only
+// the header and the level index, and the DFD, the key/value data and the SGD are parsed (as spans into the storage,
+// like DescriptorView) the first time any of them is accessed.  validateFully() performs every check that
+// Descriptor::parse does, for ingesting untrusted files.  Lazy parsing is thread safe.
+class LazyDescriptor {
+public:
+    using Header = Descriptor::Header;
+    using LevelDescriptor = Descriptor::LevelDescriptor;
+
+    LazyDescriptor() = default;
+    explicit LazyDescriptor(const utils::Storage::ConstPointer& storage) { parse(storage); }
+
+    void parse(const utils::Storage::ConstPointer& storage);
+
+    const Header& header() const { return _header; }
+    const std::vector<LevelDescriptor>& levels() const { return _levels; }
+    // Each of these parses the DFD, KVD and SGD on first use, and throws if they're invalid
+    const utils::StorageSpan& dfd() const { return sections().dfd; }
+    const DescriptorView::KeyValueView& kvd() const { return sections().kvd; }
+    const std::optional<DescriptorView::BasisView>& basisData() const { return sections().basisData; }
+    DataFormat getDataFormat() const { return sections().getDataFormat(); }
+
+    void validateFully() const;
+
+    utils::StorageSpan getLevel(uint32_t level) const { return Descriptor::getLevel(_levels, *_storage, level); }
+    utils::StorageSpan getImage(uint32_t level, uint32_t layer = 0, uint32_t face = 0) const {
+        return Descriptor::getImage(_header, _levels, *_storage, level, layer, face);
+    }
+    const utils::Storage::ConstPointer& storage() const { return _storage; }
+
+private:
+    struct Sections {
+        std::once_flag once;
+        // Only the header and the DFD, KVD and SGD fields are used
+        DescriptorView view;
+        // Where the SGD ends, for validateFully
+        size_t end{ 0 };
+    };
+    const DescriptorView& sections() const;
+
+    Header _header;
+    std::vector<LevelDescriptor> _levels;
+    utils::Storage::ConstPointer _storage;
+    std::unique_ptr<Sections> _sections;
 };
 
 }}  // namespace khrpp::ktx2
 
 namespace khrpp { namespace ktx2 {
 
-inline const std::unordered_set<vk::Format>& VALID_VK_FORMATS() {
-    static const std::unordered_set<vk::Format> VALID_VK_FORMATS{
-        vk::Format::UNDEFINED,
-        vk::Format::R4G4_UNORM_PACK8,
-        vk::Format::R4G4B4A4_UNORM_PACK16,
-        vk::Format::B4G4R4A4_UNORM_PACK16,
-        vk::Format::R5G6B5_UNORM_PACK16,
-        vk::Format::B5G6R5_UNORM_PACK16,
-        vk::Format::R5G5B5A1_UNORM_PACK16,
-        vk::Format::B5G5R5A1_UNORM_PACK16,
-        vk::Format::A1R5G5B5_UNORM_PACK16,
-        vk::Format::R8_UNORM,
-        vk::Format::R8_SNORM,
-        vk::Format::R8_UINT,
-        vk::Format::R8_SINT,
-        vk::Format::R8_SRGB,
-        vk::Format::R8G8_UNORM,
-        vk::Format::R8G8_SNORM,
-        vk::Format::R8G8_UINT,
-        vk::Format::R8G8_SINT,
-        vk::Format::R8G8_SRGB,
-        vk::Format::R8G8B8_UNORM,
-        vk::Format::R8G8B8_SNORM,
-        vk::Format::R8G8B8_UINT,
-        vk::Format::R8G8B8_SINT,
-        vk::Format::R8G8B8_SRGB,
-        vk::Format::B8G8R8_UNORM,
-        vk::Format::B8G8R8_SNORM,
-        vk::Format::B8G8R8_UINT,
-        vk::Format::B8G8R8_SINT,
-        vk::Format::B8G8R8_SRGB,
-        vk::Format::R8G8B8A8_UNORM,
-        vk::Format::R8G8B8A8_SNORM,
-        vk::Format::R8G8B8A8_UINT,
-        vk::Format::R8G8B8A8_SINT,
-        vk::Format::R8G8B8A8_SRGB,
-        vk::Format::B8G8R8A8_UNORM,
-        vk::Format::B8G8R8A8_SNORM,
-        vk::Format::B8G8R8A8_UINT,
-        vk::Format::B8G8R8A8_SINT,
-        vk::Format::B8G8R8A8_SRGB,
-        vk::Format::A2R10G10B10_UNORM_PACK32,
-        vk::Format::A2R10G10B10_SNORM_PACK32,
-        vk::Format::A2R10G10B10_UINT_PACK32,
-        vk::Format::A2R10G10B10_SINT_PACK32,
-        vk::Format::A2B10G10R10_UNORM_PACK32,
-        vk::Format::A2B10G10R10_SNORM_PACK32,
-        vk::Format::A2B10G10R10_UINT_PACK32,
-        vk::Format::A2B10G10R10_SINT_PACK32,
-        vk::Format::R16_UNORM,
-        vk::Format::R16_SNORM,
-        vk::Format::R16_UINT,
-        vk::Format::R16_SINT,
-        vk::Format::R16_SFLOAT,
-        vk::Format::R16G16_UNORM,
-        vk::Format::R16G16_SNORM,
-        vk::Format::R16G16_UINT,
-        vk::Format::R16G16_SINT,
-        vk::Format::R16G16_SFLOAT,
-        vk::Format::R16G16B16_UNORM,
-        vk::Format::R16G16B16_SNORM,
-        vk::Format::R16G16B16_UINT,
-        vk::Format::R16G16B16_SINT,
-        vk::Format::R16G16B16_SFLOAT,
-        vk::Format::R16G16B16A16_UNORM,
-        vk::Format::R16G16B16A16_SNORM,
-        vk::Format::R16G16B16A16_UINT,
-        vk::Format::R16G16B16A16_SINT,
-        vk::Format::R16G16B16A16_SFLOAT,
-        vk::Format::R32_UINT,
-        vk::Format::R32_SINT,
-        vk::Format::R32_SFLOAT,
-        vk::Format::R32G32_UINT,
-        vk::Format::R32G32_SINT,
-        vk::Format::R32G32_SFLOAT,
-        vk::Format::R32G32B32_UINT,
-        vk::Format::R32G32B32_SINT,
-        vk::Format::R32G32B32_SFLOAT,
-        vk::Format::R32G32B32A32_UINT,
-        vk::Format::R32G32B32A32_SINT,
-        vk::Format::R32G32B32A32_SFLOAT,
-        vk::Format::R64_UINT,
-        vk::Format::R64_SINT,
-        vk::Format::R64_SFLOAT,
-        vk::Format::R64G64_UINT,
-        vk::Format::R64G64_SINT,
-        vk::Format::R64G64_SFLOAT,
-        vk::Format::R64G64B64_UINT,
-        vk::Format::R64G64B64_SINT,
-        vk::Format::R64G64B64_SFLOAT,
-        vk::Format::R64G64B64A64_UINT,
-        vk::Format::R64G64B64A64_SINT,
-        vk::Format::R64G64B64A64_SFLOAT,
-        vk::Format::B10G11R11_UFLOAT_PACK32,
-        vk::Format::E5B9G9R9_UFLOAT_PACK32,
-        vk::Format::D16_UNORM,
-        vk::Format::X8_D24_UNORM_PACK32,
-        vk::Format::D32_SFLOAT,
-        vk::Format::S8_UINT,
-        vk::Format::D16_UNORM_S8_UINT,
-        vk::Format::D24_UNORM_S8_UINT,
-        vk::Format::D32_SFLOAT_S8_UINT,
-        vk::Format::BC1_RGB_UNORM_BLOCK,
-        vk::Format::BC1_RGB_SRGB_BLOCK,
-        vk::Format::BC1_RGBA_UNORM_BLOCK,
-        vk::Format::BC1_RGBA_SRGB_BLOCK,
-        vk::Format::BC2_UNORM_BLOCK,
-        vk::Format::BC2_SRGB_BLOCK,
-        vk::Format::BC3_UNORM_BLOCK,
-        vk::Format::BC3_SRGB_BLOCK,
-        vk::Format::BC4_UNORM_BLOCK,
-        vk::Format::BC4_SNORM_BLOCK,
-        vk::Format::BC5_UNORM_BLOCK,
-        vk::Format::BC5_SNORM_BLOCK,
-        vk::Format::BC6H_UFLOAT_BLOCK,
-        vk::Format::BC6H_SFLOAT_BLOCK,
-        vk::Format::BC7_UNORM_BLOCK,
-        vk::Format::BC7_SRGB_BLOCK,
-        vk::Format::ETC2_R8G8B8_UNORM_BLOCK,
-        vk::Format::ETC2_R8G8B8_SRGB_BLOCK,
-        vk::Format::ETC2_R8G8B8A1_UNORM_BLOCK,
-        vk::Format::ETC2_R8G8B8A1_SRGB_BLOCK,
-        vk::Format::ETC2_R8G8B8A8_UNORM_BLOCK,
-        vk::Format::ETC2_R8G8B8A8_SRGB_BLOCK,
-        vk::Format::EAC_R11_UNORM_BLOCK,
-        vk::Format::EAC_R11_SNORM_BLOCK,
-        vk::Format::EAC_R11G11_UNORM_BLOCK,
-        vk::Format::EAC_R11G11_SNORM_BLOCK,
-        vk::Format::ASTC_4x4_UNORM_BLOCK,
-        vk::Format::ASTC_4x4_SRGB_BLOCK,
-        vk::Format::ASTC_5x4_UNORM_BLOCK,
-        vk::Format::ASTC_5x4_SRGB_BLOCK,
-        vk::Format::ASTC_5x5_UNORM_BLOCK,
-        vk::Format::ASTC_5x5_SRGB_BLOCK,
-        vk::Format::ASTC_6x5_UNORM_BLOCK,
-        vk::Format::ASTC_6x5_SRGB_BLOCK,
-        vk::Format::ASTC_6x6_UNORM_BLOCK,
-        vk::Format::ASTC_6x6_SRGB_BLOCK,
-        vk::Format::ASTC_8x5_UNORM_BLOCK,
-        vk::Format::ASTC_8x5_SRGB_BLOCK,
-        vk::Format::ASTC_8x6_UNORM_BLOCK,
-        vk::Format::ASTC_8x6_SRGB_BLOCK,
-        vk::Format::ASTC_8x8_UNORM_BLOCK,
-        vk::Format::ASTC_8x8_SRGB_BLOCK,
-        vk::Format::ASTC_10x5_UNORM_BLOCK,
-        vk::Format::ASTC_10x5_SRGB_BLOCK,
-        vk::Format::ASTC_10x6_UNORM_BLOCK,
-        vk::Format::ASTC_10x6_SRGB_BLOCK,
-        vk::Format::ASTC_10x8_UNORM_BLOCK,
-        vk::Format::ASTC_10x8_SRGB_BLOCK,
-        vk::Format::ASTC_10x10_UNORM_BLOCK,
-        vk::Format::ASTC_10x10_SRGB_BLOCK,
-        vk::Format::ASTC_12x10_UNORM_BLOCK,
-        vk::Format::ASTC_12x10_SRGB_BLOCK,
-        vk::Format::ASTC_12x12_UNORM_BLOCK,
-        vk::Format::ASTC_12x12_SRGB_BLOCK,
-        vk::Format::G8B8G8R8_422_UNORM,
-        vk::Format::B8G8R8G8_422_UNORM,
-        vk::Format::G8_B8_R8_3PLANE_420_UNORM,
-        vk::Format::G8_B8R8_2PLANE_420_UNORM,
-        vk::Format::G8_B8_R8_3PLANE_422_UNORM,
-        vk::Format::G8_B8R8_2PLANE_422_UNORM,
-        vk::Format::G8_B8_R8_3PLANE_444_UNORM,
-        vk::Format::R10X6_UNORM_PACK16,
-        vk::Format::R10X6G10X6_UNORM_2PACK16,
-        vk::Format::R10X6G10X6B10X6A10X6_UNORM_4PACK16,
-        vk::Format::G10X6B10X6G10X6R10X6_422_UNORM_4PACK16,
-        vk::Format::B10X6G10X6R10X6G10X6_422_UNORM_4PACK16,
-        vk::Format::G10X6_B10X6_R10X6_3PLANE_420_UNORM_3PACK16,
-        vk::Format::G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16,
-        vk::Format::G10X6_B10X6_R10X6_3PLANE_422_UNORM_3PACK16,
-        vk::Format::G10X6_B10X6R10X6_2PLANE_422_UNORM_3PACK16,
-        vk::Format::G10X6_B10X6_R10X6_3PLANE_444_UNORM_3PACK16,
-        vk::Format::R12X4_UNORM_PACK16,
-        vk::Format::R12X4G12X4_UNORM_2PACK16,
-        vk::Format::R12X4G12X4B12X4A12X4_UNORM_4PACK16,
-        vk::Format::G12X4B12X4G12X4R12X4_422_UNORM_4PACK16,
-        vk::Format::B12X4G12X4R12X4G12X4_422_UNORM_4PACK16,
-        vk::Format::G12X4_B12X4_R12X4_3PLANE_420_UNORM_3PACK16,
-        vk::Format::G12X4_B12X4R12X4_2PLANE_420_UNORM_3PACK16,
-        vk::Format::G12X4_B12X4_R12X4_3PLANE_422_UNORM_3PACK16,
-        vk::Format::G12X4_B12X4R12X4_2PLANE_422_UNORM_3PACK16,
-        vk::Format::G12X4_B12X4_R12X4_3PLANE_444_UNORM_3PACK16,
-        vk::Format::G16B16G16R16_422_UNORM,
-        vk::Format::B16G16R16G16_422_UNORM,
-        vk::Format::G16_B16_R16_3PLANE_420_UNORM,
-        vk::Format::G16_B16R16_2PLANE_420_UNORM,
-        vk::Format::G16_B16_R16_3PLANE_422_UNORM,
-        vk::Format::G16_B16R16_2PLANE_422_UNORM,
-        vk::Format::G16_B16_R16_3PLANE_444_UNORM,
-        vk::Format::PVRTC1_2BPP_UNORM_BLOCK_IMG,
-        vk::Format::PVRTC1_4BPP_UNORM_BLOCK_IMG,
-        vk::Format::PVRTC2_2BPP_UNORM_BLOCK_IMG,
-        vk::Format::PVRTC2_4BPP_UNORM_BLOCK_IMG,
-        vk::Format::PVRTC1_2BPP_SRGB_BLOCK_IMG,
-        vk::Format::PVRTC1_4BPP_SRGB_BLOCK_IMG,
-        vk::Format::PVRTC2_2BPP_SRGB_BLOCK_IMG,
-        vk::Format::PVRTC2_4BPP_SRGB_BLOCK_IMG,
-        vk::Format::ASTC_4x4_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_5x4_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_5x5_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_6x5_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_6x6_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_8x5_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_8x6_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_8x8_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_10x5_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_10x6_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_10x8_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_10x10_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_12x10_SFLOAT_BLOCK_EXT,
-        vk::Format::ASTC_12x12_SFLOAT_BLOCK_EXT,
-    };
-    return VALID_VK_FORMATS;
+namespace detail {
+inline constexpr auto VALID_VK_FORMATS = makeEnumSet<vk::Format>({
+    vk::Format::UNDEFINED,
+    vk::Format::R4G4_UNORM_PACK8,
+    vk::Format::R4G4B4A4_UNORM_PACK16,
+    vk::Format::B4G4R4A4_UNORM_PACK16,
+    vk::Format::R5G6B5_UNORM_PACK16,
+    vk::Format::B5G6R5_UNORM_PACK16,
+    vk::Format::R5G5B5A1_UNORM_PACK16,
+    vk::Format::B5G5R5A1_UNORM_PACK16,
+    vk::Format::A1R5G5B5_UNORM_PACK16,
+    vk::Format::R8_UNORM,
+    vk::Format::R8_SNORM,
+    vk::Format::R8_UINT,
+    vk::Format::R8_SINT,
+    vk::Format::R8_SRGB,
+    vk::Format::R8G8_UNORM,
+    vk::Format::R8G8_SNORM,
+    vk::Format::R8G8_UINT,
+    vk::Format::R8G8_SINT,
+    vk::Format::R8G8_SRGB,
+    vk::Format::R8G8B8_UNORM,
+    vk::Format::R8G8B8_SNORM,
+    vk::Format::R8G8B8_UINT,
+    vk::Format::R8G8B8_SINT,
+    vk::Format::R8G8B8_SRGB,
+    vk::Format::B8G8R8_UNORM,
+    vk::Format::B8G8R8_SNORM,
+    vk::Format::B8G8R8_UINT,
+    vk::Format::B8G8R8_SINT,
+    vk::Format::B8G8R8_SRGB,
+    vk::Format::R8G8B8A8_UNORM,
+    vk::Format::R8G8B8A8_SNORM,
+    vk::Format::R8G8B8A8_UINT,
+    vk::Format::R8G8B8A8_SINT,
+    vk::Format::R8G8B8A8_SRGB,
+    vk::Format::B8G8R8A8_UNORM,
+    vk::Format::B8G8R8A8_SNORM,
+    vk::Format::B8G8R8A8_UINT,
+    vk::Format::B8G8R8A8_SINT,
+    vk::Format::B8G8R8A8_SRGB,
+    vk::Format::A2R10G10B10_UNORM_PACK32,
+    vk::Format::A2R10G10B10_SNORM_PACK32,
+    vk::Format::A2R10G10B10_UINT_PACK32,
+    vk::Format::A2R10G10B10_SINT_PACK32,
+    vk::Format::A2B10G10R10_UNORM_PACK32,
+    vk::Format::A2B10G10R10_SNORM_PACK32,
+    vk::Format::A2B10G10R10_UINT_PACK32,
+    vk::Format::A2B10G10R10_SINT_PACK32,
+    vk::Format::R16_UNORM,
+    vk::Format::R16_SNORM,
+    vk::Format::R16_UINT,
+    vk::Format::R16_SINT,
+    vk::Format::R16_SFLOAT,
+    vk::Format::R16G16_UNORM,
+    vk::Format::R16G16_SNORM,
+    vk::Format::R16G16_UINT,
+    vk::Format::R16G16_SINT,
+    vk::Format::R16G16_SFLOAT,
+    vk::Format::R16G16B16_UNORM,
+    vk::Format::R16G16B16_SNORM,
+    vk::Format::R16G16B16_UINT,
+    vk::Format::R16G16B16_SINT,
+    vk::Format::R16G16B16_SFLOAT,
+    vk::Format::R16G16B16A16_UNORM,
+    vk::Format::R16G16B16A16_SNORM,
+    vk::Format::R16G16B16A16_UINT,
+    vk::Format::R16G16B16A16_SINT,
+    vk::Format::R16G16B16A16_SFLOAT,
+    vk::Format::R32_UINT,
+    vk::Format::R32_SINT,
+    vk::Format::R32_SFLOAT,
+    vk::Format::R32G32_UINT,
+    vk::Format::R32G32_SINT,
+    vk::Format::R32G32_SFLOAT,
+    vk::Format::R32G32B32_UINT,
+    vk::Format::R32G32B32_SINT,
+    vk::Format::R32G32B32_SFLOAT,
+    vk::Format::R32G32B32A32_UINT,
+    vk::Format::R32G32B32A32_SINT,
+    vk::Format::R32G32B32A32_SFLOAT,
+    vk::Format::R64_UINT,
+    vk::Format::R64_SINT,
+    vk::Format::R64_SFLOAT,
+    vk::Format::R64G64_UINT,
+    vk::Format::R64G64_SINT,
+    vk::Format::R64G64_SFLOAT,
+    vk::Format::R64G64B64_UINT,
+    vk::Format::R64G64B64_SINT,
+    vk::Format::R64G64B64_SFLOAT,
+    vk::Format::R64G64B64A64_UINT,
+    vk::Format::R64G64B64A64_SINT,
+    vk::Format::R64G64B64A64_SFLOAT,
+    vk::Format::B10G11R11_UFLOAT_PACK32,
+    vk::Format::E5B9G9R9_UFLOAT_PACK32,
+    vk::Format::D16_UNORM,
+    vk::Format::X8_D24_UNORM_PACK32,
+    vk::Format::D32_SFLOAT,
+    vk::Format::S8_UINT,
+    vk::Format::D16_UNORM_S8_UINT,
+    vk::Format::D24_UNORM_S8_UINT,
+    vk::Format::D32_SFLOAT_S8_UINT,
+    vk::Format::BC1_RGB_UNORM_BLOCK,
+    vk::Format::BC1_RGB_SRGB_BLOCK,
+    vk::Format::BC1_RGBA_UNORM_BLOCK,
+    vk::Format::BC1_RGBA_SRGB_BLOCK,
+    vk::Format::BC2_UNORM_BLOCK,
+    vk::Format::BC2_SRGB_BLOCK,
+    vk::Format::BC3_UNORM_BLOCK,
+    vk::Format::BC3_SRGB_BLOCK,
+    vk::Format::BC4_UNORM_BLOCK,
+    vk::Format::BC4_SNORM_BLOCK,
+    vk::Format::BC5_UNORM_BLOCK,
+    vk::Format::BC5_SNORM_BLOCK,
+    vk::Format::BC6H_UFLOAT_BLOCK,
+    vk::Format::BC6H_SFLOAT_BLOCK,
+    vk::Format::BC7_UNORM_BLOCK,
+    vk::Format::BC7_SRGB_BLOCK,
+    vk::Format::ETC2_R8G8B8_UNORM_BLOCK,
+    vk::Format::ETC2_R8G8B8_SRGB_BLOCK,
+    vk::Format::ETC2_R8G8B8A1_UNORM_BLOCK,
+    vk::Format::ETC2_R8G8B8A1_SRGB_BLOCK,
+    vk::Format::ETC2_R8G8B8A8_UNORM_BLOCK,
+    vk::Format::ETC2_R8G8B8A8_SRGB_BLOCK,
+    vk::Format::EAC_R11_UNORM_BLOCK,
+    vk::Format::EAC_R11_SNORM_BLOCK,
+    vk::Format::EAC_R11G11_UNORM_BLOCK,
+    vk::Format::EAC_R11G11_SNORM_BLOCK,
+    vk::Format::ASTC_4x4_UNORM_BLOCK,
+    vk::Format::ASTC_4x4_SRGB_BLOCK,
+    vk::Format::ASTC_5x4_UNORM_BLOCK,
+    vk::Format::ASTC_5x4_SRGB_BLOCK,
+    vk::Format::ASTC_5x5_UNORM_BLOCK,
+    vk::Format::ASTC_5x5_SRGB_BLOCK,
+    vk::Format::ASTC_6x5_UNORM_BLOCK,
+    vk::Format::ASTC_6x5_SRGB_BLOCK,
+    vk::Format::ASTC_6x6_UNORM_BLOCK,
+    vk::Format::ASTC_6x6_SRGB_BLOCK,
+    vk::Format::ASTC_8x5_UNORM_BLOCK,
+    vk::Format::ASTC_8x5_SRGB_BLOCK,
+    vk::Format::ASTC_8x6_UNORM_BLOCK,
+    vk::Format::ASTC_8x6_SRGB_BLOCK,
+    vk::Format::ASTC_8x8_UNORM_BLOCK,
+    vk::Format::ASTC_8x8_SRGB_BLOCK,
+    vk::Format::ASTC_10x5_UNORM_BLOCK,
+    vk::Format::ASTC_10x5_SRGB_BLOCK,
+    vk::Format::ASTC_10x6_UNORM_BLOCK,
+    vk::Format::ASTC_10x6_SRGB_BLOCK,
+    vk::Format::ASTC_10x8_UNORM_BLOCK,
+    vk::Format::ASTC_10x8_SRGB_BLOCK,
+    vk::Format::ASTC_10x10_UNORM_BLOCK,
+    vk::Format::ASTC_10x10_SRGB_BLOCK,
+    vk::Format::ASTC_12x10_UNORM_BLOCK,
+    vk::Format::ASTC_12x10_SRGB_BLOCK,
+    vk::Format::ASTC_12x12_UNORM_BLOCK,
+    vk::Format::ASTC_12x12_SRGB_BLOCK,
+    vk::Format::G8B8G8R8_422_UNORM,
+    vk::Format::B8G8R8G8_422_UNORM,
+    vk::Format::G8_B8_R8_3PLANE_420_UNORM,
+    vk::Format::G8_B8R8_2PLANE_420_UNORM,
+    vk::Format::G8_B8_R8_3PLANE_422_UNORM,
+    vk::Format::G8_B8R8_2PLANE_422_UNORM,
+    vk::Format::G8_B8_R8_3PLANE_444_UNORM,
+    vk::Format::R10X6_UNORM_PACK16,
+    vk::Format::R10X6G10X6_UNORM_2PACK16,
+    vk::Format::R10X6G10X6B10X6A10X6_UNORM_4PACK16,
+    vk::Format::G10X6B10X6G10X6R10X6_422_UNORM_4PACK16,
+    vk::Format::B10X6G10X6R10X6G10X6_422_UNORM_4PACK16,
+    vk::Format::G10X6_B10X6_R10X6_3PLANE_420_UNORM_3PACK16,
+    vk::Format::G10X6_B10X6R10X6_2PLANE_420_UNORM_3PACK16,
+    vk::Format::G10X6_B10X6_R10X6_3PLANE_422_UNORM_3PACK16,
+    vk::Format::G10X6_B10X6R10X6_2PLANE_422_UNORM_3PACK16,
+    vk::Format::G10X6_B10X6_R10X6_3PLANE_444_UNORM_3PACK16,
+    vk::Format::R12X4_UNORM_PACK16,
+    vk::Format::R12X4G12X4_UNORM_2PACK16,
+    vk::Format::R12X4G12X4B12X4A12X4_UNORM_4PACK16,
+    vk::Format::G12X4B12X4G12X4R12X4_422_UNORM_4PACK16,
+    vk::Format::B12X4G12X4R12X4G12X4_422_UNORM_4PACK16,
+    vk::Format::G12X4_B12X4_R12X4_3PLANE_420_UNORM_3PACK16,
+    vk::Format::G12X4_B12X4R12X4_2PLANE_420_UNORM_3PACK16,
+    vk::Format::G12X4_B12X4_R12X4_3PLANE_422_UNORM_3PACK16,
+    vk::Format::G12X4_B12X4R12X4_2PLANE_422_UNORM_3PACK16,
+    vk::Format::G12X4_B12X4_R12X4_3PLANE_444_UNORM_3PACK16,
+    vk::Format::G16B16G16R16_422_UNORM,
+    vk::Format::B16G16R16G16_422_UNORM,
+    vk::Format::G16_B16_R16_3PLANE_420_UNORM,
+    vk::Format::G16_B16R16_2PLANE_420_UNORM,
+    vk::Format::G16_B16_R16_3PLANE_422_UNORM,
+    vk::Format::G16_B16R16_2PLANE_422_UNORM,
+    vk::Format::G16_B16_R16_3PLANE_444_UNORM,
+    vk::Format::PVRTC1_2BPP_UNORM_BLOCK_IMG,
+    vk::Format::PVRTC1_4BPP_UNORM_BLOCK_IMG,
+    vk::Format::PVRTC2_2BPP_UNORM_BLOCK_IMG,
+    vk::Format::PVRTC2_4BPP_UNORM_BLOCK_IMG,
+    vk::Format::PVRTC1_2BPP_SRGB_BLOCK_IMG,
+    vk::Format::PVRTC1_4BPP_SRGB_BLOCK_IMG,
+    vk::Format::PVRTC2_2BPP_SRGB_BLOCK_IMG,
+    vk::Format::PVRTC2_4BPP_SRGB_BLOCK_IMG,
+    vk::Format::ASTC_4x4_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_5x4_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_5x5_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_6x5_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_6x6_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_8x5_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_8x6_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_8x8_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_10x5_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_10x6_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_10x8_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_10x10_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_12x10_SFLOAT_BLOCK_EXT,
+    vk::Format::ASTC_12x12_SFLOAT_BLOCK_EXT,
+});
+}  // namespace detail
+
+constexpr const auto& VALID_VK_FORMATS() {
+    return detail::VALID_VK_FORMATS;
 }
 
 inline void Descriptor::BasisDescriptor::parse(const Header& ktxHeader, const uint8_t* const data, size_t size) {
@@ -379,106 +633,614 @@ inline void Descriptor::BasisDescriptor::parse(const Header& ktxHeader, const ui
     }
 }
 
-inline void Descriptor::parse(const uint8_t* const data, size_t size) {
+inline void Descriptor::parseIndex(const uint8_t* const data, size_t size, size_t fileSize) {
+    if (size > fileSize) {
+        throw std::runtime_error("Invalid KTX2 file size");
+    }
     AlignedStreamBuffer buffer{ size, data };
+    parseHeader(buffer);
+    parseLevelIndex(buffer);
+    parseDfd(buffer);
+    parseKvd(buffer);
+    parseSgd(buffer);
+    validateLevels(buffer.offset(), fileSize);
+}
 
+inline void Descriptor::readHeader(AlignedStreamBuffer& buffer, Header& header) {
     if (!buffer.read(header)) {
         throw std::runtime_error("Unable to parse KTX2 header");
     }
 
-    if (0 == VALID_VK_FORMATS().count(header.format)) {
+    if (!VALID_VK_FORMATS().contains(header.format)) {
         throw std::runtime_error(FORMAT("Invalid vulkan format {}", static_cast<uint32_t>(header.format)));
     }
 
     if (0 != memcmp(IDENTIFIER().data(), header.identifier, IDENTIFIER_LENGTH)) {
         throw std::runtime_error("Invalid KTX identifier bytes");
     }
+}
 
-    // Mip level index
-    {
-        uint32_t mipLevelCount = std::max<uint32_t>(1, header.levelCount);
-        for (uint32_t mipLevel = 0; mipLevel < mipLevelCount; ++mipLevel) {
-            LevelDescriptor level;
-            if (!buffer.read(level)) {
-                throw std::runtime_error(FORMAT("Unable to read KTX2 mip level descriptor {}", mipLevel));
-            }
-            // FIXME Validate the values?  ensure the offset is always dropping?
-            levels.push_back(level);
+inline void Descriptor::readLevelIndex(AlignedStreamBuffer& buffer, const Header& header, std::vector<LevelDescriptor>& levels) {
+    uint32_t mipLevelCount = std::max<uint32_t>(1, header.levelCount);
+    // Checked before reserving, so a corrupt level count can't ask for more memory than the buffer could describe
+    if ((size_t)mipLevelCount * sizeof(LevelDescriptor) > buffer.size()) {
+        throw std::runtime_error(FORMAT("Unable to read {} KTX2 mip level descriptors", mipLevelCount));
+    }
+    levels.reserve(levels.size() + mipLevelCount);
+    for (uint32_t mipLevel = 0; mipLevel < mipLevelCount; ++mipLevel) {
+        LevelDescriptor level;
+        if (!buffer.read(level)) {
+            throw std::runtime_error(FORMAT("Unable to read KTX2 mip level descriptor {}", mipLevel));
         }
+        // FIXME Validate the values?  ensure the offset is always dropping?
+        levels.push_back(level);
+    }
+}
+
+inline AlignedStreamBuffer Descriptor::readDfd(AlignedStreamBuffer& buffer, const Header& header) {
+    if (!header.dfdByteLength) {
+        return buffer.front(0);
+    }
+    if (buffer.offset() != header.dfdByteOffset) {
+        throw std::runtime_error("Invalid DFD byte offset");
+    }
+    uint32_t dfdSize;
+    if (!buffer.read(dfdSize)) {
+        throw std::runtime_error("Unable to read KTX2 dfd descriptor size");
+    }
+
+    if (dfdSize != header.dfdByteLength) {
+        throw std::runtime_error("DFD descriptor size mismatch.  Header size must match DFD size");
+    }
+
+    auto result = buffer.front(header.dfdByteLength - sizeof(dfdSize));
+    if (!buffer.skip(header.dfdByteLength - sizeof(dfdSize))) {
+        throw std::runtime_error("Unable to read KTX2 dfd");
+    }
+    return result;
+}
+
+inline AlignedStreamBuffer Descriptor::readKvd(AlignedStreamBuffer& buffer, const Header& header) {
+    if (!header.kvdByteLength) {
+        return buffer.front(0);
+    }
+    if (buffer.offset() != header.kvdByteOffset) {
+        throw std::runtime_error("Invalid key/value data byte offset");
+    }
+    auto result = buffer.front(header.kvdByteLength);
+    if (!buffer.skip(header.kvdByteLength)) {
+        throw std::runtime_error("Unable to read key/value data");
+    }
+    return result;
+}
+
+inline AlignedStreamBuffer Descriptor::readSgd(AlignedStreamBuffer& buffer, const Header& header) {
+    if (!header.sgdByteLength) {
+        return buffer.front(0);
+    }
+    if (!buffer.align(8)) {
+        throw std::runtime_error("Unable to align to kvd/sgd, or alignment padding is non-Zero");
+    }
+    if (buffer.offset() != header.sgdByteOffset) {
+        throw std::runtime_error("Invalid supercompression data byte offset");
+    }
+
+    auto result = buffer.front(header.sgdByteLength);
+    if (!buffer.skip(header.sgdByteLength)) {
+        throw std::runtime_error("Unable to read supercompression data");
+    }
+    return result;
+}
+
+inline void Descriptor::parseDfd(AlignedStreamBuffer& buffer) {
+    auto dfdBuffer = readDfd(buffer, header);
+    dfd.assign(dfdBuffer.data(), dfdBuffer.data() + dfdBuffer.size());
+    dataFormat.parse(dfd.data(), dfd.size());
+}
+
+inline void Descriptor::parseKvd(AlignedStreamBuffer& buffer) {
+    parseKtxKeyValueData(readKvd(buffer, header), kvd);
+}
+
+inline void Descriptor::parseSgd(AlignedStreamBuffer& buffer) {
+    auto sgdBuffer = readSgd(buffer, header);
+    if (header.sgdByteLength && header.supercompressionScheme == SupercompressionScheme::BASIS) {
+        basisData = std::optional<BasisDescriptor>{};
+        basisData->parse(header, sgdBuffer.data(), sgdBuffer.size());
     }
+}
 
-    // DFD block
-    if (header.dfdByteLength) {
-        if (buffer.offset() != header.dfdByteOffset) {
-            throw std::runtime_error("Invalid DFD byte offset");
+// validate per-mip levels against the file size, without touching the data
+inline void Descriptor::validateLevels(const Header& header, const std::vector<LevelDescriptor>& levels, size_t offset, size_t fileSize) {
+    if (offset > fileSize) {
+        throw std::runtime_error("Unable to align on sgd/image data interval, or alignment padding is non-Zero");
+    }
+    const size_t alignment = header.getLevelAlignment();
+    for (auto itr = levels.rbegin(); itr != levels.rend(); ++itr) {
+        [[maybe_unused]] const size_t mipLevel = header.levelCount - (itr - levels.rbegin());
+        const auto& level = *itr;
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        if (offset != level.byteOffset) {
+            throw std::runtime_error(
+                FORMAT("Invalid image level byte offset {} or btye length {} for mip {}", level.byteOffset, level.byteLength, mipLevel));
         }
-        uint32_t dfdSize;
-        if (!buffer.read(dfdSize)) {
-            throw std::runtime_error("Unable to read KTX2 dfd descriptor size");
+        if (offset > fileSize || level.byteLength > fileSize - offset) {
+            throw std::runtime_error(FORMAT("Unable to read image btye length {} for mip {}", level.byteLength, mipLevel));
         }
+        offset += level.byteLength;
+    }
+    if (offset != fileSize) {
+        throw std::runtime_error("Unable to align on mip data interval, or alignment padding is non-Zero");
+    }
+}
 
-        if (dfdSize != header.dfdByteLength) {
-            throw std::runtime_error("DFD descriptor size mismatch.  Header size must match DFD size");
+inline size_t Descriptor::getFileSize(const uint8_t* const data, size_t size) {
+    Header fileHeader;
+    if (size < sizeof(Header)) {
+        return 0;
+    }
+    memcpy(&fileHeader, data, sizeof(Header));
+    if (size < fileHeader.getIndexSize()) {
+        return 0;
+    }
+    size_t result = fileHeader.getIndexSize();
+    const uint32_t levelCount = std::max<uint32_t>(1, fileHeader.levelCount);
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        LevelDescriptor level;
+        memcpy(&level, data + sizeof(Header) + i * sizeof(LevelDescriptor), sizeof(LevelDescriptor));
+        if (level.byteLength > SIZE_MAX - level.byteOffset) {
+            throw std::runtime_error(FORMAT("Invalid image level byte offset {} or btye length {} for mip {}", level.byteOffset, level.byteLength, i));
         }
+        result = std::max<size_t>(result, (size_t)(level.byteOffset + level.byteLength));
+    }
+    return result;
+}
 
-        buffer.readVector(header.dfdByteLength - sizeof(dfdSize), dfd);
+inline utils::StorageSpan Descriptor::getLevel(const std::vector<LevelDescriptor>& levels, const utils::StorageSpan& file, uint32_t level) {
+    if (level >= levels.size()) {
+        throw std::runtime_error(FORMAT("Invalid mip level {}", level));
     }
+    return file.subspan(levels[level].byteOffset, levels[level].byteLength);
+}
+
+inline utils::StorageSpan Descriptor::getImage(const Header& header,
+                                               const std::vector<LevelDescriptor>& levels,
+                                               const utils::StorageSpan& file,
+                                               uint32_t level,
+                                               uint32_t layer,
+                                               uint32_t face) {
+    if (header.supercompressionScheme != SupercompressionScheme::NONE) {
+        throw std::runtime_error("Individual images of supercompressed levels can't be addressed");
+    }
+    const uint32_t layerCount = std::max<uint32_t>(1, header.arrayElementCount);
+    const uint32_t faceCount = std::max<uint32_t>(1, header.faceCount);
+    if (layer >= layerCount || face >= faceCount) {
+        throw std::runtime_error(FORMAT("Invalid layer {} or face {}", layer, face));
+    }
+    auto levelSpan = getLevel(levels, file, level);
+    const size_t imageSize = levelSpan.size() / ((size_t)layerCount * faceCount);
+    return levelSpan.subspan(((size_t)layer * faceCount + face) * imageSize, imageSize);
+}
 
-    // Key/value data
-    if (header.kvdByteLength) {
-        if (buffer.offset() != header.kvdByteOffset) {
-            throw std::runtime_error("Invalid key/value data byte offset");
+inline utils::StorageSpan Descriptor::getLevel(const utils::StorageSpan& file, uint32_t level) const {
+    return getLevel(levels, file, level);
+}
+
+inline utils::StorageSpan Descriptor::getImage(const utils::StorageSpan& file, uint32_t level, uint32_t layer, uint32_t face) const {
+    return getImage(header, levels, file, level, layer, face);
+}
+
+inline std::vector<uint64_t> Descriptor::getLevelDigests(const utils::StorageSpan& file, utils::ThreadPool& pool) const {
+    std::vector<uint64_t> result(levels.size());
+    // Level 0 is the largest, so it's claimed first
+    utils::parallelFor(pool, levels.size(), [&](size_t level) { result[level] = utils::hash(getLevel(file, (uint32_t)level)); });
+    return result;
+}
+
+// With the whole file available, also check that all of the alignment padding is zero
+inline void Descriptor::validateLevelPadding(const Header& header,
+                                             const std::vector<LevelDescriptor>& levels,
+                                             const uint8_t* const data,
+                                             size_t size) {
+    AlignedStreamBuffer buffer{ size, data };
+    if (!buffer.skip(header.getIndexSize()) || !buffer.align(header.getLevelAlignment())) {
+        throw std::runtime_error("Unable to align on sgd/image data interval, or alignment padding is non-Zero");
+    }
+    for (auto itr = levels.rbegin(); itr != levels.rend(); ++itr) {
+        const auto& level = *itr;
+        if (!buffer.skip(level.byteLength)) {
+            throw std::runtime_error("Unable to read image data");
         }
-        auto kvBuffer = buffer.front(header.kvdByteLength);
-        if (!buffer.skip(header.kvdByteLength)) {
-            throw std::runtime_error("Unable to read key/value data");
+        if (!buffer.empty() && !buffer.align(header.getLevelAlignment())) {
+            throw std::runtime_error("Unable to align on mip data interval, or alignment padding is non-Zero");
         }
-        parseKtxKeyValueData(kvBuffer, kvd);
     }
+}
 
-    if (!buffer.align(8)) {
-        throw std::runtime_error("Unable to align to kvd/sgd, or alignment padding is non-Zero");
+inline void Descriptor::parse(const uint8_t* const data, size_t size) {
+    parseIndex(data, size, size);
+    validateLevelPadding(header, levels, data, size);
+}
+
+inline void DescriptorView::KeyValueView::Iterator::load() {
+    // The data has already been validated, so only the end needs checking
+    if (_offset >= _data.size()) {
+        _offset = _next = _data.size();
+        return;
     }
+    uint32_t kvSize;
+    memcpy(&kvSize, _data.data() + _offset, sizeof(kvSize));
+    const char* key = reinterpret_cast<const char*>(_data.data() + _offset + sizeof(kvSize));
+    const size_t keyLength = strnlen(key, kvSize);
+    _entry.key = std::string_view{ key, keyLength };
+    _entry.value = _data.subspan(_offset + sizeof(kvSize) + keyLength + 1, kvSize - keyLength - 1);
+    _next = std::min(_data.size(), (_offset + sizeof(kvSize) + kvSize + 3) & ~(size_t)3);
+}
 
-    if (header.sgdByteLength) {
-        if (buffer.offset() != header.sgdByteOffset) {
-            throw std::runtime_error("Invalid supercompression data byte offset");
+inline std::optional<utils::StorageSpan> DescriptorView::KeyValueView::find(std::string_view key) const {
+    for (const auto& entry : *this) {
+        if (entry.key == key) {
+            return entry.value;
         }
+    }
+    return {};
+}
 
-        if (!buffer.skip(header.sgdByteLength)) {
-            throw std::runtime_error("Unable to read supercompression data");
-        }
+inline DescriptorView::BasisView::BasisImageDescriptor DescriptorView::BasisView::getImage(size_t index) const {
+    if (index >= getImageCount()) {
+        throw std::runtime_error(FORMAT("Invalid basis image {}", index));
+    }
+    BasisImageDescriptor result;
+    memcpy(&result, images.data() + index * sizeof(BasisImageDescriptor), sizeof(BasisImageDescriptor));
+    return result;
+}
 
-        if (header.supercompressionScheme == SupercompressionScheme::BASIS) {
-            basisData = std::optional<BasisDescriptor>{};
-            basisData->parse(header, data + header.sgdByteOffset, header.sgdByteLength);
+inline void DescriptorView::BasisView::parse(const Header& ktxHeader, const utils::StorageSpan& data) {
+    AlignedStreamBuffer buffer{ data.size(), data.data() };
+    if (!buffer.read(header)) {
+        throw std::runtime_error("Unable to parse KTX2 basis supercompression header");
+    }
+
+    auto levelCount = std::max<uint32_t>(1, ktxHeader.levelCount);
+    auto layerCount = std::max<uint32_t>(1, ktxHeader.arrayElementCount);
+    auto faceCount = std::max<uint32_t>(1, ktxHeader.faceCount);
+    auto pixelDepth = std::max<uint32_t>(1, ktxHeader.pixelDepth);
+    const size_t imagesByteLength = (size_t)levelCount * layerCount * faceCount * pixelDepth * sizeof(BasisImageDescriptor);
+    // Each section follows the previous one, and the extended data is skipped
+    struct Section {
+        size_t length;
+        utils::StorageSpan* target;
+        const char* name;
+    };
+    const Section sections[]{ { imagesByteLength, &images, "image descriptors" },
+                              { header.endpointsByteLength, &endpointsData, "endpointsData" },
+                              { header.selectorsByteLength, &selectorsData, "selectorsData" },
+                              { header.tablesByteLength, &tableData, "tableData" },
+                              { header.extendedByteLength, nullptr, "extendedData" } };
+    for (const auto& section : sections) {
+        const size_t offset = buffer.offset();
+        if (!buffer.skip(section.length)) {
+            throw std::runtime_error(FORMAT("Unable to parse KTX2 basis {}", section.name));
+        }
+        if (section.target) {
+            *section.target = data.subspan(offset, section.length);
         }
     }
 
-    if (!buffer.align(8)) {
-        throw std::runtime_error("Unable to align on sgd/image data interval, or alignment padding is non-Zero");
+    if (buffer.size() != 0) {
+        throw std::runtime_error("Unexpected leftover KTX2 basis data");
     }
+}
+
+inline void DescriptorView::parseIndex(const utils::Storage::ConstPointer& storage, size_t fileSize) {
+    const utils::StorageSpan file{ *storage };
+    if (file.size() > fileSize) {
+        throw std::runtime_error("Invalid KTX2 file size");
+    }
+    AlignedStreamBuffer buffer{ file.size(), file.data() };
+    Descriptor::readHeader(buffer, header);
+    levels.clear();
+    Descriptor::readLevelIndex(buffer, header, levels);
+
+    parseSections(file, buffer);
+    Descriptor::validateLevels(header, levels, buffer.offset(), fileSize);
+    _storage = storage;
+}
+
+inline void DescriptorView::parse(const utils::Storage::ConstPointer& storage) {
+    parseIndex(storage, storage->size());
+    Descriptor::validateLevelPadding(header, levels, storage->data(), storage->size());
+}
 
-    // validate per-mip levels
+inline void DescriptorView::parseSections(const utils::StorageSpan& file, AlignedStreamBuffer& buffer) {
+    auto dfdBuffer = Descriptor::readDfd(buffer, header);
+    dfd = file.subspan(dfdBuffer.data() - file.data(), dfdBuffer.size());
+
+    auto kvdBuffer = Descriptor::readKvd(buffer, header);
+    size_t kvdCount = 0;
+    forEachKtxKeyValue(kvdBuffer, [&](const char*, size_t, const uint8_t*, size_t) { ++kvdCount; });
+    kvd = KeyValueView{ file.subspan(kvdBuffer.data() - file.data(), kvdBuffer.size()), kvdCount };
+
+    auto sgdBuffer = Descriptor::readSgd(buffer, header);
+    basisData.reset();
+    if (header.sgdByteLength && header.supercompressionScheme == SupercompressionScheme::BASIS) {
+        basisData = BasisView{};
+        basisData->parse(header, file.subspan(sgdBuffer.data() - file.data(), sgdBuffer.size()));
+    }
+}
+
+inline void LazyDescriptor::parse(const utils::Storage::ConstPointer& storage) {
+    const utils::StorageSpan file{ *storage };
+    AlignedStreamBuffer buffer{ file.size(), file.data() };
+    Descriptor::readHeader(buffer, _header);
+    _levels.clear();
+    Descriptor::readLevelIndex(buffer, _header, _levels);
+    // Without parsing them, assume the sections end where the header says they do
+    const size_t indexSize = _header.getIndexSize();
+    if (indexSize > file.size()) {
+        throw std::runtime_error("Unable to read KTX2 DFD, KVD or SGD");
+    }
+    Descriptor::validateLevels(_header, _levels, indexSize, file.size());
+    _storage = storage;
+    _sections = std::make_unique<Sections>();
+}
+
+inline const DescriptorView& LazyDescriptor::sections() const {
+    if (!_sections) {
+        throw std::runtime_error("KTX2 descriptor hasn't been parsed");
+    }
+    std::call_once(_sections->once, [this] {
+        const utils::StorageSpan file{ *_storage };
+        AlignedStreamBuffer buffer{ file.size(), file.data() };
+        buffer.skip(sizeof(Header) + _levels.size() * sizeof(LevelDescriptor));
+        auto& view = _sections->view;
+        view.header = _header;
+        view.parseSections(file, buffer);
+        _sections->end = buffer.offset();
+    });
+    return _sections->view;
+}
+
+inline void LazyDescriptor::validateFully() const {
+    sections();
+    Descriptor::validateLevels(_header, _levels, _sections->end, _storage->size());
+    Descriptor::validateLevelPadding(_header, _levels, _storage->data(), _storage->size());
+}
+
+// Parses a KTX2 file incrementally as its bytes arrive, in chunks of any size, so that parsing can overlap the network
+// or decompression that produces them.  Each section is fully validated, exactly as Descriptor::parse would, and
+// reported to the listener as soon as all of its bytes are available: the header, the level index, the DFD, the KVD,
+// the SGD (each reported even when empty), then every mip level in file order (smallest first), and finally COMPLETE.
+//
+// The parser either owns the storage the chunks are appended to with feed(), or follows a StreamingStorage filled by
+// someone else, in which case update() parses whatever has arrived.  Any error is thrown from the call that finds it,
+// after which the parser refuses any more data.
+class Parser {
+public:
+    enum class Section
     {
-        for (auto itr = levels.rbegin(); itr != levels.rend(); ++itr) {
-            size_t mipLevel = header.levelCount - (itr - levels.rbegin());
-            const auto& level = *itr;
-            auto offset = buffer.offset();
-            if (offset != level.byteOffset) {
-                throw std::runtime_error(
-                    FORMAT("Invalid image level byte offset {} or btye length {} for mip {}", level.byteOffset, level.byteLength, mipLevel));
+        HEADER,
+        LEVEL_INDEX,
+        DFD,
+        KVD,
+        SGD,
+        LEVEL,
+        COMPLETE,
+    };
+
+    struct Event {
+        Section section;
+        // Only meaningful for LEVEL events
+        uint32_t level;
+        // The bytes of the section, or of the level data for LEVEL events
+        utils::StorageSpan data;
+    };
+    using Listener = std::function<void(const Event& event)>;
+
+    // The bytes that must arrive before the next section is complete
+    struct Need {
+        size_t offset{ 0 };
+        size_t size{ 0 };
+    };
+
+    explicit Parser(Listener listener, size_t capacity = utils::StreamingStorage::DEFAULT_CAPACITY);
+    Parser(const std::shared_ptr<const utils::StreamingStorage>& source, Listener listener);
+
+    // Appends the next chunk of the file to the owned storage and parses as much as possible
+    void feed(const uint8_t* const data, size_t size);
+    // Parses whatever has arrived in the storage since the last call
+    void update();
+    // Called at the end of the input.  Throws if the file is incomplete.
+    void finish();
+
+    Need need() const;
+    // The offset up to which the file has been parsed, which is the end of the section being reported during a
+    // listener call
+    size_t getParsedSize() const { return _offset; }
+    bool isComplete() const { return Section::COMPLETE == _next; }
+    // Valid up to the last section reported
+    const Descriptor& descriptor() const { return _descriptor; }
+    const std::shared_ptr<const utils::StreamingStorage>& storage() const { return _source; }
+
+private:
+    // The offset at which the next section ends
+    size_t sectionEnd() const;
+    void parseSection(const uint8_t* const data, size_t available);
+
+    Listener _listener;
+    std::shared_ptr<utils::StreamingStorage> _owned;
+    std::shared_ptr<const utils::StreamingStorage> _source;
+    Descriptor _descriptor;
+    Section _next{ Section::HEADER };
+    // The offset up to which the file has been parsed
+    size_t _offset{ 0 };
+    // Known once the level index has been parsed
+    size_t _fileSize{ 0 };
+    // Levels are stored smallest first, so count down
+    uint32_t _nextLevel{ 0 };
+    bool _failed{ false };
+};
+
+inline Parser::Parser(Listener listener, size_t capacity)
+    : _listener{ std::move(listener) }
+    , _owned{ std::make_shared<utils::StreamingStorage>(capacity) }
+    , _source{ _owned } {}
+
+inline Parser::Parser(const std::shared_ptr<const utils::StreamingStorage>& source, Listener listener)
+    : _listener{ std::move(listener) }
+    , _source{ source } {}
+
+inline void Parser::feed(const uint8_t* const data, size_t size) {
+    if (!_owned) {
+        throw std::runtime_error("KTX2 parser doesn't own its storage, use update()");
+    }
+    if (_failed) {
+        throw std::runtime_error("KTX2 parser has already failed");
+    }
+    _owned->append(data, size);
+    update();
+}
+
+inline void Parser::update() {
+    if (_failed) {
+        throw std::runtime_error("KTX2 parser has already failed");
+    }
+    const uint8_t* const data = _source->data();
+    const size_t available = _source->size();
+    try {
+        if (_fileSize && available > _fileSize) {
+            throw std::runtime_error("Unexpected data after the KTX2 level data");
+        }
+        while (!isComplete() && sectionEnd() <= available) {
+            parseSection(data, available);
+        }
+    } catch (...) {
+        _failed = true;
+        throw;
+    }
+}
+
+inline void Parser::finish() {
+    if (_owned) {
+        _owned->finish();
+    }
+    update();
+    if (!isComplete()) {
+        _failed = true;
+        throw std::runtime_error(FORMAT("Truncated KTX2 file, {} more bytes needed at offset {}", need().size, need().offset));
+    }
+}
+
+inline Parser::Need Parser::need() const {
+    if (isComplete()) {
+        return {};
+    }
+    const size_t available = _source->size();
+    const size_t end = sectionEnd();
+    return Need{ available, end > available ? end - available : 0 };
+}
+
+inline size_t Parser::sectionEnd() const {
+    const auto& header = _descriptor.header;
+    switch (_next) {
+        case Section::HEADER:
+            return sizeof(Descriptor::Header);
+        case Section::LEVEL_INDEX:
+            return sizeof(Descriptor::Header) + std::max<uint32_t>(1, header.levelCount) * sizeof(Descriptor::LevelDescriptor);
+        case Section::DFD:
+            return header.dfdByteLength ? std::max<size_t>(_offset, (size_t)header.dfdByteOffset + header.dfdByteLength) : _offset;
+        case Section::KVD:
+            return header.kvdByteLength ? std::max<size_t>(_offset, (size_t)header.kvdByteOffset + header.kvdByteLength) : _offset;
+        case Section::SGD:
+            if (!header.sgdByteLength) {
+                return _offset;
             }
-            if (!buffer.skip(level.byteLength)) {
-                throw std::runtime_error(FORMAT("Unable to read image btye length {} for mip {}", level.byteLength, mipLevel));
+            if (header.sgdByteOffset > _fileSize || header.sgdByteLength > _fileSize - header.sgdByteOffset) {
+                throw std::runtime_error("Invalid supercompression data byte offset");
             }
-            if (!buffer.empty() && !buffer.align(8)) {
+            return std::max<size_t>(_offset, (size_t)(header.sgdByteOffset + header.sgdByteLength));
+        case Section::LEVEL: {
+            const auto& level = _descriptor.levels[_nextLevel - 1];
+            return (size_t)(level.byteOffset + level.byteLength);
+        }
+        default:
+            return _offset;
+    }
+}
+
+inline void Parser::parseSection(const uint8_t* const data, size_t available) {
+    AlignedStreamBuffer buffer{ available, data };
+    buffer.skip(_offset);
+    const Section section = _next;
+    size_t start = _offset;
+    uint32_t level = 0;
+    switch (section) {
+        case Section::HEADER:
+            _descriptor.parseHeader(buffer);
+            _next = Section::LEVEL_INDEX;
+            break;
+
+        case Section::LEVEL_INDEX:
+            _descriptor.parseLevelIndex(buffer);
+            _fileSize = buffer.offset();
+            for (const auto& levelDescriptor : _descriptor.levels) {
+                if (levelDescriptor.byteLength > SIZE_MAX - levelDescriptor.byteOffset) {
+                    throw std::runtime_error(FORMAT("Invalid image level byte offset {} or btye length {}", levelDescriptor.byteOffset,
+                                                    levelDescriptor.byteLength));
+                }
+                _fileSize = std::max<size_t>(_fileSize, (size_t)(levelDescriptor.byteOffset + levelDescriptor.byteLength));
+            }
+            if (available > _fileSize) {
+                throw std::runtime_error("Unexpected data after the KTX2 level data");
+            }
+            _nextLevel = (uint32_t)_descriptor.levels.size();
+            _next = Section::DFD;
+            break;
+
+        case Section::DFD:
+            _descriptor.parseDfd(buffer);
+            _next = Section::KVD;
+            break;
+
+        case Section::KVD:
+            _descriptor.parseKvd(buffer);
+            _next = Section::SGD;
+            break;
+
+        case Section::SGD:
+            _descriptor.parseSgd(buffer);
+            if (_descriptor.header.sgdByteLength) {
+                start = _descriptor.header.sgdByteOffset;
+            }
+            _descriptor.validateLevels(buffer.offset(), _fileSize);
+            _next = Section::LEVEL;
+            break;
+
+        case Section::LEVEL: {
+            level = --_nextLevel;
+            const auto& levelDescriptor = _descriptor.levels[level];
+            if (!buffer.align(_descriptor.header.getLevelAlignment())) {
                 throw std::runtime_error("Unable to align on mip data interval, or alignment padding is non-Zero");
             }
+            start = buffer.offset();
+            buffer.skip(levelDescriptor.byteLength);
+            if (0 == _nextLevel) {
+                _next = Section::COMPLETE;
+            }
+            break;
         }
+
+        default:
+            return;
     }
-    if (!buffer.empty()) {
-        throw std::runtime_error("Unable to align on mip data interval, or alignment padding is non-Zero");
+    _offset = buffer.offset();
+
+    if (_listener) {
+        const utils::StorageSpan file{ *_source };
+        _listener(Event{ section, level, file.subspan(start, _offset - start) });
+        if (isComplete()) {
+            _listener(Event{ Section::COMPLETE, 0, file });
+        }
     }
 }
 
@@ -0,0 +1,158 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_progressive_hpp
+#define khrpp_ktx_progressive_hpp
+
+#include "ktx2.hpp"
+#include "subresource.hpp"
+#include "../streaming.hpp"
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace khrpp { namespace ktx2 {
+
+// Reports each mip level of a KTX2 file, and the images it holds, as soon as its bytes have arrived.  KTX2 stores the
+// levels smallest first, so a renderer can show a low resolution version of a large texture after only its first few
+// kilobytes, and refine it as the larger levels arrive.
+//
+// Like Parser, which it's built on, the loader either owns the storage chunks are appended to with feed(), or follows a
+// StreamingStorage filled by someone else, in which case update() reports whatever has arrived and run() blocks until
+// the whole file has.  Levels are reported from the thread that calls feed(), update() or run().
+class ProgressiveLoader {
+public:
+    // A single z slice of a single face of a single layer
+    struct Image {
+        uint32_t layer;
+        uint32_t face;
+        uint32_t slice;
+        utils::StorageSpan data;
+    };
+
+    struct Level {
+        uint32_t level;
+        uint32_t width;
+        uint32_t height;
+        uint32_t depth;
+        // The level data as stored, still supercompressed if the file is
+        utils::StorageSpan data;
+        // In file order, i.e. every slice of every face of every layer.  Empty for supercompressed levels, whose images
+        // can't be addressed until the level is decompressed.
+        std::vector<Image> images;
+    };
+    using Listener = std::function<void(const Level& level)>;
+
+    explicit ProgressiveLoader(Listener listener, size_t capacity = utils::StreamingStorage::DEFAULT_CAPACITY);
+    ProgressiveLoader(const std::shared_ptr<const utils::StreamingStorage>& source, Listener listener);
+
+    // The parser reports back to this instance
+    ProgressiveLoader(const ProgressiveLoader& other) = delete;
+    ProgressiveLoader& operator=(const ProgressiveLoader& other) = delete;
+
+    // Appends the next chunk of the file to the owned storage and reports any levels it completes
+    void feed(const uint8_t* const data, size_t size) { _parser.feed(data, size); }
+    // Reports any levels completed by data that arrived in the storage since the last call
+    void update() { _parser.update(); }
+    // Blocks on the followed storage, reporting levels as they arrive, until the file is complete.  Throws if the
+    // producer fails or finishes before the whole file has arrived.
+    void run();
+    // Called at the end of the input.  Throws if the file is incomplete.
+    void finish() { _parser.finish(); }
+
+    bool isComplete() const { return _parser.isComplete(); }
+    // The offset up to which the file has been parsed, which is the end of the level being reported during a listener
+    // call
+    size_t getParsedSize() const { return _parser.getParsedSize(); }
+    // The number of levels reported so far, which are the smallest ones
+    uint32_t getLoadedLevelCount() const { return _loadedLevelCount; }
+    // Valid once the first level has been reported
+    const Descriptor& descriptor() const { return _parser.descriptor(); }
+    // Built when the first level is reported, and left empty for supercompressed files
+    const SubresourceIndex& subresources() const { return _subresources; }
+    const std::shared_ptr<const utils::StreamingStorage>& storage() const { return _parser.storage(); }
+
+private:
+    Parser::Listener createParserListener();
+    void onLevel(uint32_t level, const utils::StorageSpan& data);
+
+    Listener _listener;
+    uint32_t _loadedLevelCount{ 0 };
+    SubresourceIndex _subresources;
+    Parser _parser;
+};
+
+}}  // namespace khrpp::ktx2
+
+// Implementation
+
+namespace khrpp { namespace ktx2 {
+
+inline ProgressiveLoader::ProgressiveLoader(Listener listener, size_t capacity)
+    : _listener{ std::move(listener) }
+    , _parser{ createParserListener(), capacity } {}
+
+inline ProgressiveLoader::ProgressiveLoader(const std::shared_ptr<const utils::StreamingStorage>& source, Listener listener)
+    : _listener{ std::move(listener) }
+    , _parser{ source, createParserListener() } {}
+
+inline Parser::Listener ProgressiveLoader::createParserListener() {
+    return [this](const Parser::Event& event) {
+        if (Parser::Section::LEVEL == event.section) {
+            onLevel(event.level, event.data);
+        }
+    };
+}
+
+inline void ProgressiveLoader::run() {
+    const auto& source = _parser.storage();
+    while (!_parser.isComplete()) {
+        const auto need = _parser.need();
+        source->waitFor(need.offset + need.size);
+        // Anything appended before the producer finished is visible to the update below
+        if (source->isComplete()) {
+            _parser.finish();
+            return;
+        }
+        _parser.update();
+    }
+}
+
+inline void ProgressiveLoader::onLevel(uint32_t level, const utils::StorageSpan& data) {
+    const auto& descriptor = _parser.descriptor();
+    const auto& header = descriptor.header;
+    Level result{ level,
+                  std::max<uint32_t>(1, header.pixelWidth >> level),
+                  std::max<uint32_t>(1, header.pixelHeight >> level),
+                  std::max<uint32_t>(1, header.pixelDepth >> level),
+                  data,
+                  {} };
+    if (header.supercompressionScheme == SupercompressionScheme::NONE) {
+        // Every level is in the index, so only build it once
+        if (0 == _subresources.getLevelCount()) {
+            _subresources = SubresourceIndex::create(descriptor);
+        }
+        const uint32_t sliceCount = _subresources.getSliceCount(level);
+        const utils::StorageSpan file{ *_parser.storage() };
+        result.images.reserve((size_t)_subresources.getLayerCount() * _subresources.getFaceCount() * sliceCount);
+        for (uint32_t layer = 0; layer < _subresources.getLayerCount(); ++layer) {
+            for (uint32_t face = 0; face < _subresources.getFaceCount(); ++face) {
+                for (uint32_t slice = 0; slice < sliceCount; ++slice) {
+                    result.images.push_back(Image{ layer, face, slice, _subresources.getSlice(file, level, layer, face, slice) });
+                }
+            }
+        }
+    }
+    ++_loadedLevelCount;
+    if (_listener) {
+        _listener(result);
+    }
+}
+
+}}  // namespace khrpp::ktx2
+
+#endif
@@ -0,0 +1,197 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_ranges_hpp
+#define khrpp_ktx_ranges_hpp
+
+#include "ktx.hpp"
+#include "ktx2.hpp"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace khrpp {
+
+// The byte ranges of a KTX or KTX2 file holding a subset of its mip levels, so that a loader short on memory can skip
+// the largest levels without mapping or faulting in the whole file.  Only the descriptor is needed to plan the reads:
+// for KTX2 that's just the index (see Descriptor::parseIndex), for KTX, whose image sizes are spread through the level
+// data, a descriptor parsed from a mapping only faults in a page per mip.
+//
+// The levels are read into a single buffer.  Levels adjacent in the file, which the selected levels almost always are,
+// are merged into a single read, so the buffer holds the level data exactly as laid out in the file, and getLevel()
+// finds each level in it.
+class LevelRanges {
+public:
+    static const uint32_t ALL_LEVELS{ ~(uint32_t)0 };
+    // Ranges closer together than this are read as one, since the extra bytes cost less than another request
+    static const size_t MERGE_DISTANCE{ 4096 };
+
+    LevelRanges() = default;
+    // Levels baseLevel up to, but not including, baseLevel + levelCount
+    static LevelRanges create(const ktx2::Descriptor& descriptor, uint32_t baseLevel, uint32_t levelCount = ALL_LEVELS);
+    static LevelRanges create(const ktx::Descriptor& descriptor, uint32_t baseLevel, uint32_t levelCount = ALL_LEVELS);
+    // Skips as few of the largest levels as it takes for the rest to fit in `budget` bytes of level data as stored, so
+    // compressed sizes for supercompressed files, but always keeps at least the smallest level
+    static LevelRanges createForBudget(const ktx2::Descriptor& descriptor, size_t budget);
+    static LevelRanges createForBudget(const ktx::Descriptor& descriptor, size_t budget);
+
+    uint32_t getBaseLevel() const { return _baseLevel; }
+    uint32_t getLevelCount() const { return (uint32_t)_levels.size(); }
+    // The reads to issue, in file order
+    const std::vector<utils::Storage::FileRange>& ranges() const { return _ranges; }
+    // The size of the buffer the reads fill, which is also the number of bytes read
+    size_t size() const { return _size; }
+
+    // Reads the ranges of `filename` into `target`, which must hold at least size() bytes
+    void read(const std::string& filename, uint8_t* target) const { utils::Storage::readFileRanges(filename, _ranges, target); }
+    utils::Storage::ConstPointer read(const std::string& filename) const;
+    // The data of one of the selected levels in a buffer filled by read(), exactly as it's stored in the file
+    utils::StorageSpan getLevel(const utils::StorageSpan& buffer, uint32_t level) const;
+    // Where a position in the file ends up in the buffer filled by read(), for resolving offsets from other indices of
+    // the file, such as SubresourceIndex.  Throws if it wasn't read.
+    size_t getTargetOffset(uint64_t fileOffset) const;
+
+private:
+    struct Level {
+        uint64_t offset;
+        size_t size;
+    };
+
+    template <typename GetLevel>
+    static LevelRanges create(uint32_t totalLevelCount, uint32_t baseLevel, uint32_t levelCount, GetLevel&& getLevel);
+    template <typename GetLevel>
+    static LevelRanges createForBudget(uint32_t totalLevelCount, size_t budget, GetLevel&& getLevel);
+
+    uint32_t _baseLevel{ 0 };
+    std::vector<Level> _levels;
+    std::vector<utils::Storage::FileRange> _ranges;
+    size_t _size{ 0 };
+};
+
+}  // namespace khrpp
+
+// Implementation
+
+namespace khrpp {
+
+namespace detail {
+
+inline std::pair<uint64_t, size_t> getKtx2LevelRange(const ktx2::Descriptor& descriptor, uint32_t level) {
+    return { descriptor.levels[level].byteOffset, (size_t)descriptor.levels[level].byteLength };
+}
+
+// From the first face of the first array element through the end of the last face of the last array element, which
+// takes in any cube face padding but not the imageSize or the mip padding
+inline std::pair<uint64_t, size_t> getKtxLevelRange(const ktx::Descriptor& descriptor, uint32_t mip) {
+    const uint32_t arrayElementCount = std::max<uint32_t>(1, descriptor.header.numberOfArrayElements);
+    const size_t first = descriptor.getImageOffset(mip);
+    const size_t last = descriptor.getImageOffset(mip, arrayElementCount - 1, descriptor.header.numberOfFaces - 1);
+    return { first, last - first + descriptor.mipDescriptors[mip].faceSize };
+}
+
+}  // namespace detail
+
+inline LevelRanges LevelRanges::create(const ktx2::Descriptor& descriptor, uint32_t baseLevel, uint32_t levelCount) {
+    return create((uint32_t)descriptor.levels.size(), baseLevel, levelCount,
+                  [&](uint32_t level) { return detail::getKtx2LevelRange(descriptor, level); });
+}
+
+inline LevelRanges LevelRanges::create(const ktx::Descriptor& descriptor, uint32_t baseLevel, uint32_t levelCount) {
+    return create((uint32_t)descriptor.mipDescriptors.size(), baseLevel, levelCount,
+                  [&](uint32_t mip) { return detail::getKtxLevelRange(descriptor, mip); });
+}
+
+inline LevelRanges LevelRanges::createForBudget(const ktx2::Descriptor& descriptor, size_t budget) {
+    return createForBudget((uint32_t)descriptor.levels.size(), budget,
+                           [&](uint32_t level) { return detail::getKtx2LevelRange(descriptor, level); });
+}
+
+inline LevelRanges LevelRanges::createForBudget(const ktx::Descriptor& descriptor, size_t budget) {
+    return createForBudget((uint32_t)descriptor.mipDescriptors.size(), budget,
+                           [&](uint32_t mip) { return detail::getKtxLevelRange(descriptor, mip); });
+}
+
+template <typename GetLevel>
+inline LevelRanges LevelRanges::create(uint32_t totalLevelCount, uint32_t baseLevel, uint32_t levelCount, GetLevel&& getLevel) {
+    if (baseLevel >= totalLevelCount) {
+        throw std::runtime_error(FORMAT("Invalid base level {} of {}", baseLevel, totalLevelCount));
+    }
+    levelCount = std::min(levelCount, totalLevelCount - baseLevel);
+
+    LevelRanges result;
+    result._baseLevel = baseLevel;
+    result._levels.reserve(levelCount);
+    for (uint32_t level = baseLevel; level < baseLevel + levelCount; ++level) {
+        const auto range = getLevel(level);
+        result._levels.push_back(Level{ range.first, range.second });
+    }
+
+    // Merge in file order, which is smallest first for KTX2 and largest first for KTX
+    std::vector<Level> sorted = result._levels;
+    std::sort(sorted.begin(), sorted.end(), [](const Level& a, const Level& b) { return a.offset < b.offset; });
+    for (const auto& level : sorted) {
+        if (!result._ranges.empty()) {
+            auto& last = result._ranges.back();
+            const uint64_t lastEnd = last.offset + last.size;
+            if (level.offset <= lastEnd + MERGE_DISTANCE) {
+                const uint64_t end = std::max<uint64_t>(lastEnd, level.offset + level.size);
+                result._size += (size_t)(end - lastEnd);
+                last.size = (size_t)(end - last.offset);
+                continue;
+            }
+        }
+        result._ranges.push_back(utils::Storage::FileRange{ level.offset, level.size, result._size });
+        result._size += level.size;
+    }
+    return result;
+}
+
+template <typename GetLevel>
+inline LevelRanges LevelRanges::createForBudget(uint32_t totalLevelCount, size_t budget, GetLevel&& getLevel) {
+    if (0 == totalLevelCount) {
+        throw std::runtime_error("No levels to read");
+    }
+    // Add levels from the smallest up while they fit
+    uint32_t baseLevel = totalLevelCount - 1;
+    size_t total = getLevel(baseLevel).second;
+    while (baseLevel > 0) {
+        const size_t size = getLevel(baseLevel - 1).second;
+        if (size > budget || total > budget - size) {
+            break;
+        }
+        total += size;
+        --baseLevel;
+    }
+    return create(totalLevelCount, baseLevel, ALL_LEVELS, std::forward<GetLevel>(getLevel));
+}
+
+inline size_t LevelRanges::getTargetOffset(uint64_t fileOffset) const {
+    for (const auto& range : _ranges) {
+        if (fileOffset >= range.offset && fileOffset - range.offset <= range.size) {
+            return range.targetOffset + (size_t)(fileOffset - range.offset);
+        }
+    }
+    throw std::runtime_error(FORMAT("File offset {} wasn't read", fileOffset));
+}
+
+inline utils::Storage::ConstPointer LevelRanges::read(const std::string& filename) const {
+    auto result = std::make_shared<utils::MemoryStorage>(_size, nullptr, utils::AllocationPolicy::UNINITIALIZED);
+    read(filename, result->mutableData());
+    return result;
+}
+
+inline utils::StorageSpan LevelRanges::getLevel(const utils::StorageSpan& buffer, uint32_t level) const {
+    if (level < _baseLevel || level - _baseLevel >= _levels.size()) {
+        throw std::runtime_error(FORMAT("Mip level {} wasn't read", level));
+    }
+    const auto& entry = _levels[level - _baseLevel];
+    return buffer.subspan(getTargetOffset(entry.offset), entry.size);
+}
+
+}  // namespace khrpp
+
+#endif
@@ -0,0 +1,171 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_subresource_hpp
+#define khrpp_ktx_subresource_hpp
+
+#include "ktx.hpp"
+#include "ktx2.hpp"
+
+#include <vector>
+
+namespace khrpp {
+
+// Where every z slice of every face of every layer of every mip level of a KTX or KTX2 file lives, for random access to
+// single slices of large 3D and array textures.  Within a level the images are stored layer by layer and face by face,
+// each holding its z slices back to back, so a single record of strides per level addresses any subresource in
+// constant time.  Only files whose level data isn't supercompressed can be indexed.
+//
+// A slice is a single row of blocks in z for block compressed 3D formats, i.e. there are depth / blockDepth of them.
+class SubresourceIndex {
+public:
+    // A byte range of the file
+    struct Range {
+        size_t offset{ 0 };
+        size_t size{ 0 };
+    };
+
+    struct Level {
+        // Of the first slice of the first face of the first layer
+        size_t offset{ 0 };
+        size_t sliceSize{ 0 };
+        // The distance between consecutive images (faces, then layers), which is more than sliceCount * sliceSize
+        // when KTX cube faces are padded
+        size_t imageStride{ 0 };
+        uint32_t sliceCount{ 1 };
+    };
+
+    SubresourceIndex() = default;
+    // Throws if the descriptor's level sizes can't be evenly divided into its images and slices
+    static SubresourceIndex create(const ktx::Descriptor& descriptor);
+    // Throws if the level data is supercompressed, or can't be evenly divided into its images and slices
+    static SubresourceIndex create(const ktx2::Descriptor& descriptor);
+
+    uint32_t getLevelCount() const { return (uint32_t)_levels.size(); }
+    uint32_t getLayerCount() const { return _layerCount; }
+    uint32_t getFaceCount() const { return _faceCount; }
+    uint32_t getSliceCount(uint32_t level) const { return getLevel(level).sliceCount; }
+    const Level& getLevel(uint32_t level) const;
+    const std::vector<Level>& levels() const { return _levels; }
+
+    // A single z slice.  Throws if any of the indices is out of range.
+    Range getSlice(uint32_t level, uint32_t layer = 0, uint32_t face = 0, uint32_t slice = 0) const;
+    // Every z slice of a single face of a single layer, which are always contiguous
+    Range getImage(uint32_t level, uint32_t layer = 0, uint32_t face = 0) const;
+    // Spans of `file`, which must be the whole of the file that was indexed
+    utils::StorageSpan getSlice(const utils::StorageSpan& file, uint32_t level, uint32_t layer = 0, uint32_t face = 0, uint32_t slice = 0) const {
+        const auto range = getSlice(level, layer, face, slice);
+        return file.subspan(range.offset, range.size);
+    }
+    utils::StorageSpan getImage(const utils::StorageSpan& file, uint32_t level, uint32_t layer = 0, uint32_t face = 0) const {
+        const auto range = getImage(level, layer, face);
+        return file.subspan(range.offset, range.size);
+    }
+
+private:
+    SubresourceIndex(uint32_t layerCount, uint32_t faceCount, uint32_t levelCount)
+        : _layerCount{ layerCount }
+        , _faceCount{ faceCount } {
+        _levels.reserve(levelCount);
+    }
+    // Appends a level whose images of `imageSize` bytes are each split into `sliceCount` slices
+    void addLevel(size_t offset, size_t imageSize, size_t imageStride, uint32_t sliceCount);
+
+    uint32_t _layerCount{ 1 };
+    uint32_t _faceCount{ 1 };
+    std::vector<Level> _levels;
+};
+
+}  // namespace khrpp
+
+// Implementation
+
+namespace khrpp {
+
+inline SubresourceIndex SubresourceIndex::create(const ktx::Descriptor& descriptor) {
+    const auto& header = descriptor.header;
+    SubresourceIndex result{ std::max<uint32_t>(1, header.numberOfArrayElements), std::max<uint32_t>(1, header.numberOfFaces),
+                             (uint32_t)descriptor.mipDescriptors.size() };
+    const size_t imageCount = (size_t)result._layerCount * result._faceCount;
+    const bool perFace = header.hasFaceImageSize();
+    size_t offset = ktx::Descriptor::KTX_HEADER_SIZE + header.bytesOfKeyValueData;
+    for (uint32_t mip = 0; mip < descriptor.mipDescriptors.size(); ++mip) {
+        const size_t imageSize = descriptor.mipDescriptors[mip].imageSize;
+        offset += ktx::Descriptor::IMAGE_SIZE_WIDTH;
+        const uint32_t depth = std::max<uint32_t>(1, header.pixelDepth >> mip);
+        if (perFace) {
+            result.addLevel(offset, imageSize, ktx::evalPaddedSize(imageSize), depth);
+            offset += ktx::evalPaddedSize(imageSize) * imageCount;
+        } else {
+            if (0 != imageSize % imageCount) {
+                throw std::runtime_error(FORMAT("Mip {} size {} can't be divided into {} images", mip, imageSize, imageCount));
+            }
+            result.addLevel(offset, imageSize / imageCount, imageSize / imageCount, depth);
+            offset += ktx::evalPaddedSize(imageSize);
+        }
+    }
+    return result;
+}
+
+inline SubresourceIndex SubresourceIndex::create(const ktx2::Descriptor& descriptor) {
+    const auto& header = descriptor.header;
+    if (header.supercompressionScheme != ktx2::SupercompressionScheme::NONE) {
+        throw std::runtime_error("Subresources of supercompressed levels can't be addressed");
+    }
+    SubresourceIndex result{ std::max<uint32_t>(1, header.arrayElementCount), std::max<uint32_t>(1, header.faceCount),
+                             (uint32_t)descriptor.levels.size() };
+    const size_t imageCount = (size_t)result._layerCount * result._faceCount;
+    const uint32_t blockDepth = std::max<uint32_t>(1, descriptor.dataFormat.getBlockDepth());
+    for (uint32_t level = 0; level < descriptor.levels.size(); ++level) {
+        const auto& levelDescriptor = descriptor.levels[level];
+        if (0 != levelDescriptor.byteLength % imageCount) {
+            throw std::runtime_error(FORMAT("Level {} length {} can't be divided into {} images", level, levelDescriptor.byteLength, imageCount));
+        }
+        const size_t imageSize = (size_t)(levelDescriptor.byteLength / imageCount);
+        const uint32_t depth = std::max<uint32_t>(1, header.pixelDepth >> level);
+        result.addLevel((size_t)levelDescriptor.byteOffset, imageSize, imageSize, (depth + blockDepth - 1) / blockDepth);
+    }
+    return result;
+}
+
+inline void SubresourceIndex::addLevel(size_t offset, size_t imageSize, size_t imageStride, uint32_t sliceCount) {
+    if (0 != imageSize % sliceCount) {
+        throw std::runtime_error(FORMAT("Level {} image size {} can't be divided into {} slices", _levels.size(), imageSize, sliceCount));
+    }
+    Level level;
+    level.offset = offset;
+    level.sliceSize = imageSize / sliceCount;
+    level.imageStride = imageStride;
+    level.sliceCount = sliceCount;
+    _levels.push_back(level);
+}
+
+inline const SubresourceIndex::Level& SubresourceIndex::getLevel(uint32_t level) const {
+    if (level >= _levels.size()) {
+        throw std::runtime_error(FORMAT("Invalid mip level {}", level));
+    }
+    return _levels[level];
+}
+
+inline SubresourceIndex::Range SubresourceIndex::getImage(uint32_t level, uint32_t layer, uint32_t face) const {
+    const auto& entry = getLevel(level);
+    if (layer >= _layerCount || face >= _faceCount) {
+        throw std::runtime_error(FORMAT("Invalid layer {} or face {}", layer, face));
+    }
+    return Range{ entry.offset + ((size_t)layer * _faceCount + face) * entry.imageStride, entry.sliceSize * entry.sliceCount };
+}
+
+inline SubresourceIndex::Range SubresourceIndex::getSlice(uint32_t level, uint32_t layer, uint32_t face, uint32_t slice) const {
+    const auto& entry = getLevel(level);
+    if (layer >= _layerCount || face >= _faceCount || slice >= entry.sliceCount) {
+        throw std::runtime_error(FORMAT("Invalid layer {}, face {} or slice {}", layer, face, slice));
+    }
+    return Range{ entry.offset + ((size_t)layer * _faceCount + face) * entry.imageStride + (size_t)slice * entry.sliceSize, entry.sliceSize };
+}
+
+}  // namespace khrpp
+
+#endif
@@ -0,0 +1,241 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_supercompression_hpp
+#define khrpp_ktx_supercompression_hpp
+
+#include "ktx2.hpp"
+#include "../threads.hpp"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+// Decoders for the KTX2 supercompression schemes are only available when the build provides the libraries they need,
+// see the TARGET_ZSTD and TARGET_DEFLATE cmake macros
+#if defined(KHRPP_HAVE_ZSTD)
+#include <zstd.h>
+#endif
+
+// ZLIB levels are inflated with libdeflate where it's available, which decodes whole buffers at once and is much faster
+// than zlib's streaming inflate
+#if defined(KHRPP_HAVE_LIBDEFLATE)
+#include <libdeflate.h>
+#elif defined(KHRPP_HAVE_ZLIB)
+#include <climits>
+#include <zlib.h>
+#endif
+
+namespace khrpp { namespace ktx2 {
+
+// A caller provided buffer to decompress a level into, such as part of a mapped staging buffer
+struct LevelTarget {
+    uint32_t level{ 0 };
+    uint8_t* data{ nullptr };
+    size_t size{ 0 };
+};
+
+// Whether the levels of files using `scheme` can be decompressed by this build
+inline bool canDecompress(SupercompressionScheme scheme) {
+    switch (scheme) {
+        case SupercompressionScheme::NONE:
+            return true;
+#if defined(KHRPP_HAVE_ZSTD)
+        case SupercompressionScheme::ZSTD:
+            return true;
+#endif
+#if defined(KHRPP_HAVE_LIBDEFLATE) || defined(KHRPP_HAVE_ZLIB)
+        case SupercompressionScheme::ZLIB:
+            return true;
+#endif
+        default:
+            return false;
+    }
+}
+
+// Decompresses a single level into `target`, which must have room for at least its uncompressedByteLength.  Throws if
+// the level data doesn't decompress to exactly that many bytes.  Levels without supercompression are copied.
+void decompressLevel(const Descriptor::Header& header, const Descriptor::LevelDescriptor& level, const utils::StorageSpan& data, const LevelTarget& target);
+
+// Decompresses the `targets` levels of a parsed file, running them concurrently on `pool`.  The largest levels are
+// started first, and the calling thread takes part, so this is safe to call from a task running on the same pool.
+// If any level fails the first error is rethrown once every level has finished.
+void decompressLevels(const Descriptor::Header& header,
+                      const std::vector<Descriptor::LevelDescriptor>& levels,
+                      const utils::StorageSpan& file,
+                      const std::vector<LevelTarget>& targets,
+                      utils::ThreadPool& pool = utils::ThreadPool::shared());
+
+inline void decompressLevels(const Descriptor& descriptor,
+                             const utils::StorageSpan& file,
+                             const std::vector<LevelTarget>& targets,
+                             utils::ThreadPool& pool = utils::ThreadPool::shared()) {
+    decompressLevels(descriptor.header, descriptor.levels, file, targets, pool);
+}
+
+inline void decompressLevels(const DescriptorView& descriptor,
+                             const std::vector<LevelTarget>& targets,
+                             utils::ThreadPool& pool = utils::ThreadPool::shared()) {
+    decompressLevels(descriptor.header, descriptor.levels, *descriptor.storage(), targets, pool);
+}
+
+inline void decompressLevels(const LazyDescriptor& descriptor,
+                             const std::vector<LevelTarget>& targets,
+                             utils::ThreadPool& pool = utils::ThreadPool::shared()) {
+    decompressLevels(descriptor.header(), descriptor.levels(), *descriptor.storage(), targets, pool);
+}
+
+}}  // namespace khrpp::ktx2
+
+// Implementation
+
+namespace khrpp { namespace ktx2 {
+
+namespace detail {
+
+#if defined(KHRPP_HAVE_ZSTD)
+// Decompression contexts are expensive to create, so each thread keeps one
+inline ZSTD_DCtx* getZstdContext() {
+    struct Deleter {
+        void operator()(ZSTD_DCtx* context) const { ZSTD_freeDCtx(context); }
+    };
+    static thread_local std::unique_ptr<ZSTD_DCtx, Deleter> CONTEXT{ ZSTD_createDCtx() };
+    if (!CONTEXT) {
+        throw std::runtime_error("Unable to create a ZSTD decompression context");
+    }
+    return CONTEXT.get();
+}
+
+inline size_t decompressZstd(const utils::StorageSpan& data, uint8_t* target, size_t targetSize) {
+    const size_t result = ZSTD_decompressDCtx(getZstdContext(), target, targetSize, data.data(), data.size());
+    if (ZSTD_isError(result)) {
+        throw std::runtime_error(FORMAT("Unable to decompress ZSTD level data: {}", ZSTD_getErrorName(result)));
+    }
+    return result;
+}
+#endif
+
+#if defined(KHRPP_HAVE_LIBDEFLATE)
+inline size_t inflateZlib(const utils::StorageSpan& data, uint8_t* target, size_t targetSize) {
+    struct Deleter {
+        void operator()(libdeflate_decompressor* decompressor) const { libdeflate_free_decompressor(decompressor); }
+    };
+    static thread_local std::unique_ptr<libdeflate_decompressor, Deleter> DECOMPRESSOR{ libdeflate_alloc_decompressor() };
+    if (!DECOMPRESSOR) {
+        throw std::runtime_error("Unable to create a deflate decompressor");
+    }
+    size_t result = 0;
+    if (LIBDEFLATE_SUCCESS != libdeflate_zlib_decompress(DECOMPRESSOR.get(), data.data(), data.size(), target, targetSize, &result)) {
+        throw std::runtime_error("Unable to inflate ZLIB level data");
+    }
+    return result;
+}
+#elif defined(KHRPP_HAVE_ZLIB)
+// Inflates straight into the target.  zlib counts in uInt, so buffers over 4 GiB are fed to it in pieces.
+inline size_t inflateZlib(const utils::StorageSpan& data, uint8_t* target, size_t targetSize) {
+    static const size_t MAX_CHUNK = UINT_MAX;
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    if (Z_OK != inflateInit(&stream)) {
+        throw std::runtime_error("Unable to initialize zlib");
+    }
+    size_t inputOffset = 0;
+    size_t outputOffset = 0;
+    int result = Z_OK;
+    while (Z_OK == result) {
+        if (0 == stream.avail_in) {
+            const size_t chunk = std::min(MAX_CHUNK, data.size() - inputOffset);
+            stream.next_in = const_cast<Bytef*>(data.data() + inputOffset);
+            stream.avail_in = (uInt)chunk;
+            inputOffset += chunk;
+        }
+        if (0 == stream.avail_out) {
+            const size_t chunk = std::min(MAX_CHUNK, targetSize - outputOffset);
+            stream.next_out = target + outputOffset;
+            stream.avail_out = (uInt)chunk;
+            outputOffset += chunk;
+        }
+        result = inflate(&stream, Z_NO_FLUSH);
+    }
+    const size_t produced = outputOffset - stream.avail_out;
+    inflateEnd(&stream);
+    if (Z_STREAM_END != result) {
+        throw std::runtime_error(FORMAT("Unable to inflate ZLIB level data: {}", result));
+    }
+    return produced;
+}
+#endif
+
+}  // namespace detail
+
+inline void decompressLevel(const Descriptor::Header& header, const Descriptor::LevelDescriptor& level, const utils::StorageSpan& data, const LevelTarget& target) {
+    if (level.uncompressedByteLength > target.size) {
+        throw std::runtime_error(FORMAT("Level {} needs {} bytes but the target only has {}", target.level, level.uncompressedByteLength, target.size));
+    }
+    size_t decompressedSize = 0;
+    switch (header.supercompressionScheme) {
+        case SupercompressionScheme::NONE:
+            decompressedSize = data.size();
+            if (decompressedSize <= target.size) {
+                memcpy(target.data, data.data(), decompressedSize);
+            }
+            break;
+#if defined(KHRPP_HAVE_ZSTD)
+        case SupercompressionScheme::ZSTD:
+            decompressedSize = detail::decompressZstd(data, target.data, target.size);
+            break;
+#endif
+#if defined(KHRPP_HAVE_LIBDEFLATE) || defined(KHRPP_HAVE_ZLIB)
+        case SupercompressionScheme::ZLIB:
+            decompressedSize = detail::inflateZlib(data, target.data, target.size);
+            break;
+#endif
+        default:
+            throw std::runtime_error(FORMAT("Unsupported supercompression scheme {}", static_cast<uint32_t>(header.supercompressionScheme)));
+    }
+    if (decompressedSize != level.uncompressedByteLength) {
+        throw std::runtime_error(
+            FORMAT("Level {} decompressed to {} bytes instead of {}", target.level, decompressedSize, level.uncompressedByteLength));
+    }
+}
+
+inline void decompressLevels(const Descriptor::Header& header,
+                             const std::vector<Descriptor::LevelDescriptor>& levels,
+                             const utils::StorageSpan& file,
+                             const std::vector<LevelTarget>& targets,
+                             utils::ThreadPool& pool) {
+    // Validate everything up front, so that nothing is written if any of the targets is wrong
+    for (const auto& target : targets) {
+        if (target.level >= levels.size()) {
+            throw std::runtime_error(FORMAT("Invalid mip level {}", target.level));
+        }
+        if (levels[target.level].uncompressedByteLength > target.size) {
+            throw std::runtime_error(
+                FORMAT("Level {} needs {} bytes but the target only has {}", target.level, levels[target.level].uncompressedByteLength, target.size));
+        }
+    }
+    if (!canDecompress(header.supercompressionScheme)) {
+        throw std::runtime_error(FORMAT("Unsupported supercompression scheme {}", static_cast<uint32_t>(header.supercompressionScheme)));
+    }
+
+    // The largest levels dominate, so start them first
+    std::vector<const LevelTarget*> order;
+    for (const auto& target : targets) {
+        order.push_back(&target);
+    }
+    std::stable_sort(order.begin(), order.end(), [&](const LevelTarget* a, const LevelTarget* b) {
+        return levels[a->level].uncompressedByteLength > levels[b->level].uncompressedByteLength;
+    });
+    utils::parallelFor(pool, order.size(), [&](size_t index) {
+        const auto& target = *order[index];
+        const auto& level = levels[target.level];
+        decompressLevel(header, level, file.subspan(level.byteOffset, level.byteLength), target);
+    });
+}
+
+}}  // namespace khrpp::ktx2
+
+#endif
@@ -0,0 +1,379 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_transcode_hpp
+#define khrpp_ktx_transcode_hpp
+
+#include "ktx2.hpp"
+#include "supercompression.hpp"
+#include "../threads.hpp"
+
+#include <vector>
+
+// Transcoding needs the Basis Universal transcoder, see the target_basis cmake macro.  The layout helpers are always
+// available.
+#if defined(KHRPP_HAVE_BASISU)
+#include <mutex>
+#if __has_include(<basisu/transcoder/basisu_transcoder.h>)
+#include <basisu/transcoder/basisu_transcoder.h>
+#else
+#include <basisu_transcoder.h>
+#endif
+#endif
+
+namespace khrpp { namespace ktx2 {
+
+// The GPU formats Basis Universal textures can be transcoded to
+enum class TranscodeFormat : uint32_t
+{
+    BC1_RGB,
+    BC3_RGBA,
+    BC7_RGBA,
+    ETC2_RGBA,
+    ASTC_4x4_RGBA,
+    RGBA32,
+};
+
+// The Basis Universal codec of a KTX2 file's level data, if any
+enum class BasisCodec : uint32_t
+{
+    NONE,
+    // BasisLZ supercompression, whose endpoint and selector codebooks are in the supercompression global data
+    ETC1S,
+    // UASTC blocks, optionally ZSTD or ZLIB supercompressed
+    UASTC,
+};
+
+BasisCodec getBasisCodec(const Descriptor& descriptor);
+
+// Whether this build can transcode `descriptor`'s images
+bool canTranscode(const Descriptor& descriptor);
+
+// The Vulkan format of transcoded data, as sRGB if the source's transfer function is
+vk::Format getVkFormat(TranscodeFormat format, bool srgb);
+
+// Where each image of a transcoded texture lives in the output.  Levels are stored largest first, each holding its
+// layers, and the faces of each layer, tightly packed in that order, so a level is a single buffer to image copy region
+// covering layerCount * faceCount array layers.  Level offsets are aligned to LEVEL_ALIGNMENT, which satisfies the
+// offset requirements of every supported format, so the whole buffer can be uploaded with one copy command.
+struct TranscodeLayout {
+    static constexpr size_t LEVEL_ALIGNMENT{ 16 };
+
+    struct Level {
+        uint32_t width{ 0 };
+        uint32_t height{ 0 };
+        size_t offset{ 0 };
+        size_t imageSize{ 0 };
+        size_t size{ 0 };
+    };
+
+    TranscodeFormat format{ TranscodeFormat::RGBA32 };
+    vk::Format vkFormat{ vk::Format::UNDEFINED };
+    uint32_t layerCount{ 1 };
+    uint32_t faceCount{ 1 };
+    std::vector<Level> levels;
+    size_t size{ 0 };
+
+    static TranscodeLayout create(const Descriptor& descriptor, TranscodeFormat format);
+
+    uint32_t getImageCount() const { return layerCount * faceCount; }
+    // The offset of a single face of a single layer of a level
+    size_t getImageOffset(uint32_t level, uint32_t layer = 0, uint32_t face = 0) const {
+        return levels[level].offset + (layer * faceCount + face) * levels[level].imageSize;
+    }
+};
+
+#if defined(KHRPP_HAVE_BASISU)
+// Transcodes every image of a BasisLZ or UASTC file into `target`, which must have room for layout.size bytes, laid out
+// as described by `layout`.  Images are transcoded concurrently on `pool`, largest level first, with the calling thread
+// taking part.  Supercompressed UASTC levels are decompressed first, also concurrently.  Throws if any image fails.
+void transcode(const Descriptor& descriptor,
+               const utils::StorageSpan& file,
+               const TranscodeLayout& layout,
+               uint8_t* target,
+               size_t targetSize,
+               utils::ThreadPool& pool = utils::ThreadPool::shared());
+
+inline Bytes transcode(const Descriptor& descriptor,
+                       const utils::StorageSpan& file,
+                       TranscodeFormat format,
+                       utils::ThreadPool& pool = utils::ThreadPool::shared()) {
+    const auto layout = TranscodeLayout::create(descriptor, format);
+    Bytes result(layout.size);
+    transcode(descriptor, file, layout, result.data(), result.size(), pool);
+    return result;
+}
+#endif
+
+}}  // namespace khrpp::ktx2
+
+// Implementation
+
+namespace khrpp { namespace ktx2 {
+
+namespace detail {
+
+// UASTC files with alpha, identified by the channel id of their only sample
+static const uint8_t UASTC_CHANNEL_RGBA = 3;
+static const uint8_t UASTC_CHANNEL_RRRG = 5;
+
+inline uint32_t getBlockDimension(TranscodeFormat format) {
+    return format == TranscodeFormat::RGBA32 ? 1 : 4;
+}
+
+inline size_t getBytesPerBlock(TranscodeFormat format) {
+    switch (format) {
+        case TranscodeFormat::BC1_RGB:
+            return 8;
+        case TranscodeFormat::RGBA32:
+            return 4;
+        default:
+            return 16;
+    }
+}
+
+}  // namespace detail
+
+inline BasisCodec getBasisCodec(const Descriptor& descriptor) {
+    if (descriptor.header.supercompressionScheme == SupercompressionScheme::BASIS) {
+        return BasisCodec::ETC1S;
+    }
+    if (descriptor.header.format == vk::Format::UNDEFINED && descriptor.dataFormat.colorModel == DataFormat::ColorModel::UASTC) {
+        return BasisCodec::UASTC;
+    }
+    return BasisCodec::NONE;
+}
+
+inline bool canTranscode(const Descriptor& descriptor) {
+#if defined(KHRPP_HAVE_BASISU)
+    // Basis Universal has no 3D textures
+    if (descriptor.header.pixelDepth > 1) {
+        return false;
+    }
+    switch (getBasisCodec(descriptor)) {
+        case BasisCodec::ETC1S:
+            return descriptor.basisData.has_value();
+        case BasisCodec::UASTC:
+            return canDecompress(descriptor.header.supercompressionScheme);
+        default:
+            return false;
+    }
+#else
+    return false;
+#endif
+}
+
+inline vk::Format getVkFormat(TranscodeFormat format, bool srgb) {
+    switch (format) {
+        case TranscodeFormat::BC1_RGB:
+            return srgb ? vk::Format::BC1_RGB_SRGB_BLOCK : vk::Format::BC1_RGB_UNORM_BLOCK;
+        case TranscodeFormat::BC3_RGBA:
+            return srgb ? vk::Format::BC3_SRGB_BLOCK : vk::Format::BC3_UNORM_BLOCK;
+        case TranscodeFormat::BC7_RGBA:
+            return srgb ? vk::Format::BC7_SRGB_BLOCK : vk::Format::BC7_UNORM_BLOCK;
+        case TranscodeFormat::ETC2_RGBA:
+            return srgb ? vk::Format::ETC2_R8G8B8A8_SRGB_BLOCK : vk::Format::ETC2_R8G8B8A8_UNORM_BLOCK;
+        case TranscodeFormat::ASTC_4x4_RGBA:
+            return srgb ? vk::Format::ASTC_4x4_SRGB_BLOCK : vk::Format::ASTC_4x4_UNORM_BLOCK;
+        case TranscodeFormat::RGBA32:
+            return srgb ? vk::Format::R8G8B8A8_SRGB : vk::Format::R8G8B8A8_UNORM;
+    }
+    throw std::runtime_error(FORMAT("Invalid transcode format {}", static_cast<uint32_t>(format)));
+}
+
+inline TranscodeLayout TranscodeLayout::create(const Descriptor& descriptor, TranscodeFormat format) {
+    const auto& header = descriptor.header;
+    TranscodeLayout result;
+    result.format = format;
+    result.vkFormat = getVkFormat(format, descriptor.dataFormat.isSrgb());
+    result.layerCount = std::max<uint32_t>(1, header.arrayElementCount);
+    result.faceCount = std::max<uint32_t>(1, header.faceCount);
+
+    const uint32_t blockDimension = detail::getBlockDimension(format);
+    const size_t bytesPerBlock = detail::getBytesPerBlock(format);
+    const uint32_t levelCount = std::max<uint32_t>(1, header.levelCount);
+    size_t offset = 0;
+    for (uint32_t level = 0; level < levelCount; ++level) {
+        Level entry;
+        entry.width = std::max<uint32_t>(1, header.pixelWidth >> level);
+        entry.height = std::max<uint32_t>(1, header.pixelHeight >> level);
+        const size_t blocksX = (entry.width + blockDimension - 1) / blockDimension;
+        const size_t blocksY = (entry.height + blockDimension - 1) / blockDimension;
+        entry.imageSize = blocksX * blocksY * bytesPerBlock;
+        entry.size = entry.imageSize * result.getImageCount();
+        entry.offset = offset;
+        offset = (offset + entry.size + LEVEL_ALIGNMENT - 1) & ~(LEVEL_ALIGNMENT - 1);
+        result.levels.push_back(entry);
+    }
+    result.size = result.levels.back().offset + result.levels.back().size;
+    return result;
+}
+
+#if defined(KHRPP_HAVE_BASISU)
+
+namespace detail {
+
+inline basist::transcoder_texture_format getBasisFormat(TranscodeFormat format) {
+    switch (format) {
+        case TranscodeFormat::BC1_RGB:
+            return basist::transcoder_texture_format::cTFBC1_RGB;
+        case TranscodeFormat::BC3_RGBA:
+            return basist::transcoder_texture_format::cTFBC3_RGBA;
+        case TranscodeFormat::BC7_RGBA:
+            return basist::transcoder_texture_format::cTFBC7_RGBA;
+        case TranscodeFormat::ETC2_RGBA:
+            return basist::transcoder_texture_format::cTFETC2_RGBA;
+        case TranscodeFormat::ASTC_4x4_RGBA:
+            return basist::transcoder_texture_format::cTFASTC_4x4_RGBA;
+        case TranscodeFormat::RGBA32:
+            return basist::transcoder_texture_format::cTFRGBA32;
+    }
+    throw std::runtime_error(FORMAT("Invalid transcode format {}", static_cast<uint32_t>(format)));
+}
+
+// The transcoder's lookup tables are built once per process
+inline void initBasisTranscoder() {
+    static std::once_flag ONCE;
+    std::call_once(ONCE, [] { basist::basisu_transcoder_init(); });
+}
+
+// One image of one level, and where it goes
+struct TranscodeTask {
+    uint32_t level;
+    uint32_t image;
+    uint8_t* target;
+};
+
+}  // namespace detail
+
+inline void transcode(const Descriptor& descriptor,
+                      const utils::StorageSpan& file,
+                      const TranscodeLayout& layout,
+                      uint8_t* target,
+                      size_t targetSize,
+                      utils::ThreadPool& pool) {
+    const auto& header = descriptor.header;
+    const BasisCodec codec = getBasisCodec(descriptor);
+    if (BasisCodec::NONE == codec) {
+        throw std::runtime_error("Only BasisLZ and UASTC textures can be transcoded");
+    }
+    if (!canTranscode(descriptor)) {
+        throw std::runtime_error("Unable to transcode this texture with the current build");
+    }
+    if (layout.levels.size() != descriptor.levels.size() || layout.getImageCount() != std::max<uint32_t>(1, header.arrayElementCount) * std::max<uint32_t>(1, header.faceCount)) {
+        throw std::runtime_error("Transcode layout doesn't match the texture");
+    }
+    if (targetSize < layout.size) {
+        throw std::runtime_error(FORMAT("Transcoding needs {} bytes but the target only has {}", layout.size, targetSize));
+    }
+    detail::initBasisTranscoder();
+
+    const auto basisFormat = detail::getBasisFormat(layout.format);
+    const uint32_t imageCount = layout.getImageCount();
+    // Levels are already stored largest first, so this order has the most expensive images claimed first
+    std::vector<detail::TranscodeTask> tasks;
+    tasks.reserve(layout.levels.size() * imageCount);
+    for (uint32_t level = 0; level < layout.levels.size(); ++level) {
+        for (uint32_t image = 0; image < imageCount; ++image) {
+            tasks.push_back({ level, image, target + layout.levels[level].offset + image * layout.levels[level].imageSize });
+        }
+    }
+    // RGBA32 output is sized in pixels rather than blocks
+    const auto getOutputSize = [&](const TranscodeLayout::Level& level) -> uint32_t {
+        return (uint32_t)(level.imageSize / detail::getBytesPerBlock(layout.format));
+    };
+
+    if (BasisCodec::ETC1S == codec) {
+        const auto& basis = *descriptor.basisData;
+        if (basis.images.size() != tasks.size()) {
+            throw std::runtime_error("Basis image descriptors don't match the texture");
+        }
+        // The codebooks are decoded once and shared by every image
+        basist::basisu_lowlevel_etc1s_transcoder transcoder;
+        if (!transcoder.decode_palettes(basis.header.endpointCount, basis.endpointsData.data(), (uint32_t)basis.endpointsData.size(),
+                                        basis.header.selectorCount, basis.selectorsData.data(), (uint32_t)basis.selectorsData.size())) {
+            throw std::runtime_error("Unable to decode the Basis endpoint and selector codebooks");
+        }
+        if (!transcoder.decode_tables(basis.tableData.data(), (uint32_t)basis.tableData.size())) {
+            throw std::runtime_error("Unable to decode the Basis Huffman tables");
+        }
+        const bool hasAlpha = std::any_of(basis.images.begin(), basis.images.end(), [](const auto& image) { return image.alphaSliceByteLength != 0; });
+        utils::parallelFor(pool, tasks.size(), [&](size_t index) {
+            const auto& task = tasks[index];
+            const auto& level = layout.levels[task.level];
+            const auto& image = basis.images[task.level * imageCount + task.image];
+            const auto levelData = descriptor.getLevel(file, task.level);
+            // Each concurrent transcode needs its own state
+            basist::basisu_transcoder_state state;
+            if (!transcoder.transcode_image(basisFormat, task.target, getOutputSize(level), levelData.data(), (uint32_t)levelData.size(),
+                                            (level.width + 3) / 4, (level.height + 3) / 4, level.width, level.height, task.level,
+                                            image.sliceByteOffset, image.sliceByteLength, image.alphaSliceByteOffset,
+                                            image.alphaSliceByteLength, 0, hasAlpha, false, 0, &state)) {
+                throw std::runtime_error(FORMAT("Unable to transcode level {} image {}", task.level, task.image));
+            }
+        });
+        return;
+    }
+
+    // UASTC levels are an array of 16 byte blocks per image, once any supercompression is removed
+    struct LevelData {
+        const uint8_t* data;
+        size_t size;
+    };
+    std::vector<LevelData> levelData;
+    Bytes decompressed;
+    if (SupercompressionScheme::NONE == header.supercompressionScheme) {
+        for (uint32_t level = 0; level < descriptor.levels.size(); ++level) {
+            const auto span = descriptor.getLevel(file, level);
+            levelData.push_back({ span.data(), span.size() });
+        }
+    } else {
+        std::vector<LevelTarget> levelTargets;
+        size_t size = 0;
+        for (const auto& level : descriptor.levels) {
+            size += level.uncompressedByteLength;
+        }
+        decompressed.resize(size);
+        size = 0;
+        for (uint32_t level = 0; level < descriptor.levels.size(); ++level) {
+            const size_t levelSize = descriptor.levels[level].uncompressedByteLength;
+            levelTargets.push_back({ level, decompressed.data() + size, levelSize });
+            levelData.push_back({ decompressed.data() + size, levelSize });
+            size += levelSize;
+        }
+        decompressLevels(descriptor, file, levelTargets, pool);
+    }
+    for (uint32_t level = 0; level < levelData.size(); ++level) {
+        const auto& entry = layout.levels[level];
+        const size_t expected = (size_t)((entry.width + 3) / 4) * ((entry.height + 3) / 4) * 16 * imageCount;
+        if (levelData[level].size != expected) {
+            throw std::runtime_error(FORMAT("UASTC level {} has {} bytes instead of {}", level, levelData[level].size, expected));
+        }
+    }
+
+    const auto& samples = descriptor.dataFormat.samples;
+    const uint8_t channel = samples.empty() ? 0 : samples[0].getChannelId();
+    const bool hasAlpha = channel == detail::UASTC_CHANNEL_RGBA || channel == detail::UASTC_CHANNEL_RRRG;
+    basist::basisu_lowlevel_uastc_transcoder transcoder;
+    utils::parallelFor(pool, tasks.size(), [&](size_t index) {
+        const auto& task = tasks[index];
+        const auto& level = layout.levels[task.level];
+        const uint32_t blocksX = (level.width + 3) / 4;
+        const uint32_t blocksY = (level.height + 3) / 4;
+        const uint32_t imageSize = blocksX * blocksY * 16;
+        const auto& data = levelData[task.level];
+        if (!transcoder.transcode_image(basisFormat, task.target, getOutputSize(level), data.data, (uint32_t)data.size, blocksX, blocksY,
+                                        level.width, level.height, task.level, task.image * imageSize, imageSize, 0, hasAlpha)) {
+            throw std::runtime_error(FORMAT("Unable to transcode level {} image {}", task.level, task.image));
+        }
+    });
+}
+
+#endif
+
+}}  // namespace khrpp::ktx2
+
+#endif
@@ -0,0 +1,421 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_ktx_writer_hpp
+#define khrpp_ktx_writer_hpp
+
+#include "ktx2.hpp"
+#include "supercompression.hpp"
+#include "../threads.hpp"
+
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace khrpp { namespace ktx2 {
+
+// Builds KTX2 files from in-memory levels.  The header supplies the format, dimensions and counts, and the writer fills
+// in every offset and length, laying the file out exactly as Descriptor::parse expects: the DFD and KVD immediately
+// after the level index, the SGD 8 byte aligned, and the levels smallest first with zeroed alignment padding.
+//
+// Levels are stored as given, already in the header's supercompression scheme.  Alternatively files without
+// supercompression can have every level ZSTD compressed as they're written, concurrently on a ThreadPool.
+class Writer {
+public:
+    explicit Writer(const Descriptor::Header& header);
+
+    // Takes everything needed to write `descriptor`'s file back out, e.g. for re-encoding with ZSTD.  The levels are
+    // referenced rather than copied, keeping the file's storage alive.
+    static Writer fromDescriptor(const Descriptor& descriptor, const utils::StorageSpan& file);
+
+    const Descriptor::Header& getHeader() const { return _header; }
+
+    // The DFD, without the leading dfdTotalSize, as in Descriptor::dfd
+    void setDfd(const Bytes& dfd);
+    // Entries are written sorted by key, as the specification requires.  String values should include their
+    // terminating null.
+    void setKeyValue(const std::string& key, const Bytes& value);
+    void setSupercompressionGlobalData(const Bytes& sgd);
+    // `data` must be in the header's supercompression scheme.  uncompressedByteLength defaults to the size of the data
+    // for files without supercompression, and to 0 otherwise.
+    void setLevel(uint32_t level, const utils::Storage::ConstPointer& data, uint64_t uncompressedByteLength = 0);
+    void setLevel(uint32_t level, const Bytes& data) { setLevel(level, utils::Storage::create(data.size(), const_cast<uint8_t*>(data.data()))); }
+
+#if defined(KHRPP_HAVE_ZSTD)
+    // ZSTD compress every level when the file is laid out.  Only for headers without supercompression.
+    void setZstdCompression(int compressionLevel = 3);
+#endif
+
+    // Lays out the file, compressing the levels concurrently on `pool` if requested, and returns its size.  The write
+    // functions call this if anything has changed since it was last called.
+    size_t prepare(utils::ThreadPool& pool = utils::ThreadPool::shared());
+
+    // Writes the file to `target`, which must have room for at least prepare() bytes
+    void write(uint8_t* target, size_t size, utils::ThreadPool& pool = utils::ThreadPool::shared());
+    Bytes write(utils::ThreadPool& pool = utils::ThreadPool::shared());
+    void write(std::ostream& output, utils::ThreadPool& pool = utils::ThreadPool::shared());
+    // Allocates the file up front and writes it through a memory mapping, flushing it before returning
+    void writeFile(const std::string& filename, utils::ThreadPool& pool = utils::ThreadPool::shared());
+
+private:
+    struct Level {
+        utils::Storage::ConstPointer data;
+        uint64_t uncompressedByteLength{ 0 };
+        // Set by prepare() when compressing
+        Bytes compressed;
+        const uint8_t* getData() const { return compressed.empty() ? data->data() : compressed.data(); }
+    };
+
+    // Calls `output(offset, data, size)` for every piece of the file in order, where `offset` is the file offset the
+    // piece starts at.  Gaps between pieces are alignment padding, and must be zeroed.
+    template <typename F>
+    void forEachPiece(F&& output) const;
+
+    Descriptor::Header _header;
+    Bytes _dfd;
+    std::map<std::string, Bytes> _kvd;
+    Bytes _sgd;
+    std::vector<Level> _levels;
+    SupercompressionScheme _compression{ SupercompressionScheme::NONE };
+    int _compressionLevel{ 0 };
+
+    // The layout computed by prepare()
+    bool _prepared{ false };
+    Descriptor::Header _outputHeader;
+    std::vector<Descriptor::LevelDescriptor> _outputLevels;
+    Bytes _outputDfd;
+    Bytes _outputKvd;
+    size_t _size{ 0 };
+};
+
+}}  // namespace khrpp::ktx2
+
+// Implementation
+
+namespace khrpp { namespace ktx2 {
+
+namespace detail {
+
+// Supercompressed levels have no fixed block size, so the KTX2 spec requires bytesPlane of the basic descriptor block
+// to be zero.  `dfd` doesn't include its leading dfdTotalSize, as in Descriptor::dfd.
+inline void clearBytesPlane(Bytes& dfd) {
+    static const uint32_t KHRONOS_VENDOR_ID = 0;
+    static const uint32_t BASIC_DESCRIPTOR_TYPE = 0;
+    static const size_t BASIC_BLOCK_HEADER_SIZE = 24;
+    static const size_t BYTES_PLANE_OFFSET = 16;
+
+    size_t offset = 0;
+    while (offset + 2 * sizeof(uint32_t) <= dfd.size()) {
+        uint32_t words[2];
+        memcpy(words, dfd.data() + offset, sizeof(words));
+        const size_t blockSize = words[1] >> 16;
+        if (blockSize < sizeof(words) || offset + blockSize > dfd.size()) {
+            return;
+        }
+        if ((words[0] & 0x1FFFF) == KHRONOS_VENDOR_ID && (words[0] >> 17) == BASIC_DESCRIPTOR_TYPE && blockSize >= BASIC_BLOCK_HEADER_SIZE) {
+            memset(dfd.data() + offset + BYTES_PLANE_OFFSET, 0, BASIC_BLOCK_HEADER_SIZE - BYTES_PLANE_OFFSET);
+            return;
+        }
+        offset += blockSize;
+    }
+}
+
+}  // namespace detail
+
+#if defined(KHRPP_HAVE_ZSTD)
+namespace detail {
+
+// As with decompression, each thread keeps a context
+inline ZSTD_CCtx* getZstdCompressionContext() {
+    struct Deleter {
+        void operator()(ZSTD_CCtx* context) const { ZSTD_freeCCtx(context); }
+    };
+    static thread_local std::unique_ptr<ZSTD_CCtx, Deleter> CONTEXT{ ZSTD_createCCtx() };
+    if (!CONTEXT) {
+        throw std::runtime_error("Unable to create a ZSTD compression context");
+    }
+    return CONTEXT.get();
+}
+
+inline Bytes compressZstd(const uint8_t* data, size_t size, int compressionLevel) {
+    Bytes result(ZSTD_compressBound(size));
+    const size_t compressedSize = ZSTD_compressCCtx(getZstdCompressionContext(), result.data(), result.size(), data, size, compressionLevel);
+    if (ZSTD_isError(compressedSize)) {
+        throw std::runtime_error(FORMAT("Unable to compress ZSTD level data: {}", ZSTD_getErrorName(compressedSize)));
+    }
+    result.resize(compressedSize);
+    return result;
+}
+
+}  // namespace detail
+#endif
+
+inline Writer::Writer(const Descriptor::Header& header)
+    : _header{ header } {
+    memcpy(_header.identifier, Descriptor::IDENTIFIER().data(), Descriptor::IDENTIFIER_LENGTH);
+    _levels.resize(std::max<uint32_t>(1, header.levelCount));
+}
+
+inline Writer Writer::fromDescriptor(const Descriptor& descriptor, const utils::StorageSpan& file) {
+    Writer result{ descriptor.header };
+    result.setDfd(descriptor.dfd);
+    for (const auto& entry : descriptor.kvd) {
+        result.setKeyValue(entry.first, entry.second);
+    }
+    // Only BasisLZ global data is kept by the descriptor, so rebuild it, without any extended data
+    if (descriptor.basisData) {
+        const auto& basis = *descriptor.basisData;
+        auto basisHeader = basis.header;
+        basisHeader.extendedByteLength = 0;
+        const size_t imagesSize = basis.images.size() * sizeof(Descriptor::BasisDescriptor::BasisImageDescriptor);
+        Bytes sgd(sizeof(basisHeader) + imagesSize);
+        memcpy(sgd.data(), &basisHeader, sizeof(basisHeader));
+        memcpy(sgd.data() + sizeof(basisHeader), basis.images.data(), imagesSize);
+        sgd.insert(sgd.end(), basis.endpointsData.begin(), basis.endpointsData.end());
+        sgd.insert(sgd.end(), basis.selectorsData.begin(), basis.selectorsData.end());
+        sgd.insert(sgd.end(), basis.tableData.begin(), basis.tableData.end());
+        result.setSupercompressionGlobalData(sgd);
+    }
+    for (uint32_t level = 0; level < descriptor.levels.size(); ++level) {
+        result.setLevel(level, descriptor.getLevel(file, level).retain(), descriptor.levels[level].uncompressedByteLength);
+    }
+    return result;
+}
+
+inline void Writer::setDfd(const Bytes& dfd) {
+    _dfd = dfd;
+    _prepared = false;
+}
+
+inline void Writer::setKeyValue(const std::string& key, const Bytes& value) {
+    if (key.empty() || key.find('\0') != std::string::npos) {
+        throw std::runtime_error(FORMAT("Invalid KTX2 key '{}'", key));
+    }
+    _kvd[key] = value;
+    _prepared = false;
+}
+
+inline void Writer::setSupercompressionGlobalData(const Bytes& sgd) {
+    _sgd = sgd;
+    _prepared = false;
+}
+
+inline void Writer::setLevel(uint32_t level, const utils::Storage::ConstPointer& data, uint64_t uncompressedByteLength) {
+    if (level >= _levels.size()) {
+        throw std::runtime_error(FORMAT("Invalid mip level {}", level));
+    }
+    if (0 == uncompressedByteLength && SupercompressionScheme::NONE == _header.supercompressionScheme) {
+        uncompressedByteLength = data->size();
+    }
+    _levels[level] = Level{ data, uncompressedByteLength, {} };
+    _prepared = false;
+}
+
+#if defined(KHRPP_HAVE_ZSTD)
+inline void Writer::setZstdCompression(int compressionLevel) {
+    if (SupercompressionScheme::NONE != _header.supercompressionScheme) {
+        throw std::runtime_error("Only levels without supercompression can be compressed");
+    }
+    _compression = SupercompressionScheme::ZSTD;
+    _compressionLevel = compressionLevel;
+    _prepared = false;
+}
+#endif
+
+inline size_t Writer::prepare(utils::ThreadPool& pool) {
+    if (_prepared) {
+        return _size;
+    }
+    for (uint32_t level = 0; level < _levels.size(); ++level) {
+        if (!_levels[level].data) {
+            throw std::runtime_error(FORMAT("No data for mip level {}", level));
+        }
+    }
+
+#if defined(KHRPP_HAVE_ZSTD)
+    if (SupercompressionScheme::ZSTD == _compression) {
+        // The largest levels dominate, so start them first
+        utils::parallelFor(pool, _levels.size(), [&](size_t index) {
+            auto& level = _levels[index];
+            level.compressed = detail::compressZstd(level.data->data(), level.data->size(), _compressionLevel);
+        });
+    }
+#endif
+
+    _outputKvd.clear();
+    for (const auto& entry : _kvd) {
+        const uint32_t kvSize = (uint32_t)(entry.first.size() + 1 + entry.second.size());
+        const size_t start = _outputKvd.size();
+        _outputKvd.resize(start + sizeof(kvSize) + kvSize);
+        memcpy(_outputKvd.data() + start, &kvSize, sizeof(kvSize));
+        memcpy(_outputKvd.data() + start + sizeof(kvSize), entry.first.c_str(), entry.first.size() + 1);
+        if (!entry.second.empty()) {
+            memcpy(_outputKvd.data() + start + sizeof(kvSize) + entry.first.size() + 1, entry.second.data(), entry.second.size());
+        }
+        _outputKvd.resize((_outputKvd.size() + 3) & ~(size_t)3);
+    }
+
+    _outputHeader = _header;
+    if (SupercompressionScheme::NONE != _compression) {
+        _outputHeader.supercompressionScheme = _compression;
+    }
+    _outputDfd = _dfd;
+    if (SupercompressionScheme::NONE != _outputHeader.supercompressionScheme) {
+        detail::clearBytesPlane(_outputDfd);
+    }
+    size_t offset = sizeof(Descriptor::Header) + _levels.size() * sizeof(Descriptor::LevelDescriptor);
+    _outputHeader.dfdByteOffset = _outputDfd.empty() ? 0 : (uint32_t)offset;
+    _outputHeader.dfdByteLength = _outputDfd.empty() ? 0 : (uint32_t)(sizeof(uint32_t) + _outputDfd.size());
+    offset += _outputHeader.dfdByteLength;
+    _outputHeader.kvdByteOffset = _outputKvd.empty() ? 0 : (uint32_t)offset;
+    _outputHeader.kvdByteLength = (uint32_t)_outputKvd.size();
+    offset += _outputHeader.kvdByteLength;
+    if (!_sgd.empty()) {
+        offset = (offset + 7) & ~(size_t)7;
+    }
+    _outputHeader.sgdByteOffset = _sgd.empty() ? 0 : offset;
+    _outputHeader.sgdByteLength = _sgd.size();
+    offset += _sgd.size();
+
+    // Levels are stored smallest first
+    const size_t alignment = _outputHeader.getLevelAlignment();
+    _outputLevels.resize(_levels.size());
+    for (size_t index = _levels.size(); index-- > 0;) {
+        const auto& level = _levels[index];
+        auto& output = _outputLevels[index];
+        offset = (offset + alignment - 1) & ~(alignment - 1);
+        output.byteOffset = offset;
+        output.byteLength = level.compressed.empty() ? level.data->size() : level.compressed.size();
+        output.uncompressedByteLength = level.compressed.empty() ? level.uncompressedByteLength : level.data->size();
+        offset += output.byteLength;
+    }
+    _size = offset;
+    _prepared = true;
+    return _size;
+}
+
+template <typename F>
+inline void Writer::forEachPiece(F&& output) const {
+    output(0, reinterpret_cast<const uint8_t*>(&_outputHeader), sizeof(_outputHeader));
+    output(sizeof(_outputHeader), reinterpret_cast<const uint8_t*>(_outputLevels.data()), _outputLevels.size() * sizeof(Descriptor::LevelDescriptor));
+    if (_outputHeader.dfdByteLength) {
+        output(_outputHeader.dfdByteOffset, reinterpret_cast<const uint8_t*>(&_outputHeader.dfdByteLength), sizeof(uint32_t));
+        output(_outputHeader.dfdByteOffset + sizeof(uint32_t), _outputDfd.data(), _outputDfd.size());
+    }
+    if (_outputHeader.kvdByteLength) {
+        output(_outputHeader.kvdByteOffset, _outputKvd.data(), _outputKvd.size());
+    }
+    if (_outputHeader.sgdByteLength) {
+        output(_outputHeader.sgdByteOffset, _sgd.data(), _sgd.size());
+    }
+    for (size_t index = _levels.size(); index-- > 0;) {
+        output(_outputLevels[index].byteOffset, _levels[index].getData(), _outputLevels[index].byteLength);
+    }
+}
+
+inline void Writer::write(uint8_t* target, size_t size, utils::ThreadPool& pool) {
+    if (size < prepare(pool)) {
+        throw std::runtime_error(FORMAT("Writing needs {} bytes but the target only has {}", _size, size));
+    }
+    size_t written = 0;
+    forEachPiece([&](size_t offset, const uint8_t* data, size_t pieceSize) {
+        memset(target + written, 0, offset - written);
+        memcpy(target + offset, data, pieceSize);
+        written = offset + pieceSize;
+    });
+}
+
+inline Bytes Writer::write(utils::ThreadPool& pool) {
+    Bytes result(prepare(pool));
+    write(result.data(), result.size(), pool);
+    return result;
+}
+
+inline void Writer::write(std::ostream& output, utils::ThreadPool& pool) {
+    prepare(pool);
+    static const std::array<char, 8> PADDING{};
+    size_t written = 0;
+    forEachPiece([&](size_t offset, const uint8_t* data, size_t pieceSize) {
+        output.write(PADDING.data(), offset - written);
+        output.write(reinterpret_cast<const char*>(data), pieceSize);
+        written = offset + pieceSize;
+    });
+    if (!output) {
+        throw std::runtime_error("Unable to write KTX2 file");
+    }
+}
+
+inline void Writer::writeFile(const std::string& filename, utils::ThreadPool& pool) {
+    const size_t size = prepare(pool);
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error(FORMAT("Unable to open {} for writing", filename));
+    }
+    HANDLE mapFile = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+    uint8_t* mapped = mapFile ? static_cast<uint8_t*>(MapViewOfFile(mapFile, FILE_MAP_WRITE, 0, 0, size)) : nullptr;
+    if (!mapped) {
+        if (mapFile) {
+            CloseHandle(mapFile);
+        }
+        CloseHandle(file);
+        throw std::runtime_error(FORMAT("Unable to map {} for writing", filename));
+    }
+    try {
+        write(mapped, size, pool);
+    } catch (...) {
+        UnmapViewOfFile(mapped);
+        CloseHandle(mapFile);
+        CloseHandle(file);
+        throw;
+    }
+    const bool flushed = FlushViewOfFile(mapped, 0);
+    UnmapViewOfFile(mapped);
+    CloseHandle(mapFile);
+    CloseHandle(file);
+#else
+    const int fd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (-1 == fd) {
+        throw std::runtime_error(FORMAT("Unable to open {} for writing", filename));
+    }
+    // Reserve the blocks up front.  A sparse file would only find out the disk is full when a store through the mapping
+    // faults, as SIGBUS rather than an error.
+    if (0 != posix_fallocate(fd, 0, (off_t)size)) {
+        close(fd);
+        throw std::runtime_error(FORMAT("Unable to allocate {} bytes for {}", size, filename));
+    }
+    void* mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mapped == MAP_FAILED) {
+        close(fd);
+        throw std::runtime_error(FORMAT("Unable to map {} for writing", filename));
+    }
+    try {
+        write(static_cast<uint8_t*>(mapped), size, pool);
+    } catch (...) {
+        munmap(mapped, size);
+        close(fd);
+        throw;
+    }
+    // munmap doesn't report write back errors, so flush explicitly
+    const bool flushed = 0 == msync(mapped, size, MS_SYNC);
+    munmap(mapped, size);
+    close(fd);
+#endif
+    if (!flushed) {
+        throw std::runtime_error(FORMAT("Unable to write {}", filename));
+    }
+}
+
+}}  // namespace khrpp::ktx2
+
+#endif
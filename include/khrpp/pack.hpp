@@ -0,0 +1,325 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_pack_hpp
+#define khrpp_pack_hpp
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "helpers.hpp"
+#include "storage.hpp"
+#include "ktx/ktx.hpp"
+#include "ktx/ktx2.hpp"
+
+namespace khrpp { namespace pack {
+
+/*
+    A texture pack is a single file holding many KTX and KTX2 files, so that a whole set of textures can be served from
+    one mapping.  All values are little endian.
+
+    Header                                          48 bytes
+    Entry entries[entryCount]                       64 bytes each, at tocOffset, sorted by (nameHash, name)
+    char names[namesLength]                         at namesOffset, not null terminated
+    for each entry
+        Byte padding[]                              to the next multiple of PAYLOAD_ALIGNMENT
+        Byte payload[byteLength]                    an unmodified KTX or KTX2 file
+    end
+
+    Payloads are page aligned, so a view of one is suitable for passing straight to the descriptor parse functions,
+    and the TOC is read in place, so looking an entry up never allocates.
+*/
+
+using Byte = uint8_t;
+
+static const size_t IDENTIFIER_LENGTH{ 12 };
+using Identifier = std::array<uint8_t, IDENTIFIER_LENGTH>;
+
+inline const Identifier& IDENTIFIER() {
+    static const Identifier IDENTIFIER_VALUE{ { 0xAB, 0x4B, 0x50, 0x41, 0x43, 0x4B, 0x31, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A } };
+    return IDENTIFIER_VALUE;
+}
+
+static const uint32_t VERSION{ 1 };
+static const size_t PAYLOAD_ALIGNMENT{ 4096 };
+
+enum class Container : uint32_t
+{
+    KTX = 1,
+    KTX2 = 2,
+};
+
+// 64 bit FNV-1a of the entry name
+inline constexpr uint64_t hashName(std::string_view name) {
+    uint64_t result = 0xcbf29ce484222325ULL;
+    for (char c : name) {
+        result = (result ^ (uint8_t)c) * 0x100000001b3ULL;
+    }
+    return result;
+}
+
+struct Header {
+    Byte identifier[IDENTIFIER_LENGTH]{};
+    uint32_t version{ VERSION };
+    uint32_t entryCount{ 0 };
+    uint32_t reserved{ 0 };
+    uint64_t tocOffset{ 0 };
+    uint64_t namesOffset{ 0 };
+    uint64_t namesLength{ 0 };
+};
+static_assert(sizeof(Header) == 48, "Unexpected pack header size");
+
+// Enough of the payload's header to pick out textures without parsing them
+struct Summary {
+    Container container{ Container::KTX2 };
+    // A vk::Format for KTX2 payloads, a gl internal format for KTX payloads
+    uint32_t format{ 0 };
+    uint32_t pixelWidth{ 0 };
+    uint32_t pixelHeight{ 0 };
+    uint32_t pixelDepth{ 0 };
+    uint32_t layerCount{ 0 };
+    uint32_t faceCount{ 0 };
+    uint32_t levelCount{ 0 };
+};
+
+struct Entry {
+    uint64_t nameHash{ 0 };
+    uint64_t byteOffset{ 0 };
+    uint64_t byteLength{ 0 };
+    // Relative to Header::namesOffset
+    uint32_t nameOffset{ 0 };
+    uint32_t nameLength{ 0 };
+    Summary summary;
+};
+static_assert(sizeof(Entry) == 64, "Unexpected pack entry size");
+
+// Serves the entries of a pack from a single storage, typically a file mapping.  The storage is validated once on
+// construction, after which lookups are a binary search of the TOC in place.
+class Reader {
+public:
+    explicit Reader(const utils::Storage::ConstPointer& storage);
+
+    size_t size() const { return _header.entryCount; }
+    const Entry* begin() const { return _entries; }
+    const Entry* end() const { return _entries + _header.entryCount; }
+
+    // Returns nullptr if there's no entry with the given name
+    const Entry* find(std::string_view name) const;
+    std::string_view getName(const Entry& entry) const { return std::string_view{ _names + entry.nameOffset, entry.nameLength }; }
+
+    // Non-owning, valid for as long as the reader's storage is
+    utils::StorageSpan getSpan(const Entry& entry) const { return utils::StorageSpan{ *_storage }.subspan(entry.byteOffset, entry.byteLength); }
+    utils::Storage::ConstPointer createView(const Entry& entry) const { return _storage->createView(entry.byteLength, entry.byteOffset); }
+
+    const utils::Storage::ConstPointer& getStorage() const { return _storage; }
+
+private:
+    const utils::Storage::ConstPointer _storage;
+    Header _header;
+    const Entry* _entries{ nullptr };
+    const char* _names{ nullptr };
+};
+
+// Builds a pack from a set of KTX and KTX2 files.  Every payload is parsed as it's added, so a pack never contains
+// anything the descriptors would reject.
+class Writer {
+public:
+    void add(const std::string& name, const utils::Storage::ConstPointer& storage);
+    void addFile(const std::string& name, const std::string& filename) { add(name, utils::Storage::readFile(filename)); }
+    size_t size() const { return _entries.size(); }
+    void write(const std::string& filename) const;
+
+    static Summary summarize(const uint8_t* data, size_t size);
+
+private:
+    struct PendingEntry {
+        std::string name;
+        uint64_t nameHash;
+        Summary summary;
+        utils::Storage::ConstPointer storage;
+    };
+    std::vector<PendingEntry> _entries;
+};
+
+}}  // namespace khrpp::pack
+
+//
+// Implementation
+//
+
+namespace khrpp { namespace pack {
+
+inline bool operator<(const Entry& entry, uint64_t nameHash) {
+    return entry.nameHash < nameHash;
+}
+
+inline Reader::Reader(const utils::Storage::ConstPointer& storage)
+    : _storage{ storage } {
+    const uint8_t* data = _storage->data();
+    const size_t size = _storage->size();
+    AlignedStreamBuffer buffer{ size, data };
+    if (!buffer.read(_header)) {
+        throw std::runtime_error("Unable to read pack header");
+    }
+    if (0 != memcmp(IDENTIFIER().data(), _header.identifier, IDENTIFIER_LENGTH)) {
+        throw std::runtime_error("Invalid pack identifier bytes");
+    }
+    if (_header.version != VERSION) {
+        throw std::runtime_error(FORMAT("Unsupported pack version {}", _header.version));
+    }
+    if (_header.tocOffset > size || (size - _header.tocOffset) / sizeof(Entry) < _header.entryCount) {
+        throw std::runtime_error("Invalid pack table of contents range");
+    }
+    if (_header.namesOffset > size || _header.namesLength > size - _header.namesOffset) {
+        throw std::runtime_error("Invalid pack name table range");
+    }
+    // The TOC is used in place, which requires it to be suitably aligned in memory
+    if (0 != (reinterpret_cast<uintptr_t>(data + _header.tocOffset) % alignof(Entry))) {
+        throw std::runtime_error("Pack table of contents is misaligned");
+    }
+    _entries = reinterpret_cast<const Entry*>(data + _header.tocOffset);
+    _names = reinterpret_cast<const char*>(data + _header.namesOffset);
+
+    for (uint32_t i = 0; i < _header.entryCount; ++i) {
+        const auto& entry = _entries[i];
+        if (entry.nameOffset > _header.namesLength || entry.nameLength > _header.namesLength - entry.nameOffset) {
+            throw std::runtime_error(FORMAT("Invalid name range for pack entry {}", i));
+        }
+        if (entry.nameHash != hashName(getName(entry))) {
+            throw std::runtime_error(FORMAT("Invalid name hash for pack entry {}", i));
+        }
+        if (entry.byteOffset > size || entry.byteLength > size - entry.byteOffset) {
+            throw std::runtime_error(FORMAT("Invalid payload range for pack entry {}", i));
+        }
+        if (i > 0) {
+            const auto& previous = _entries[i - 1];
+            if (previous.nameHash > entry.nameHash || (previous.nameHash == entry.nameHash && getName(previous) >= getName(entry))) {
+                throw std::runtime_error(FORMAT("Pack entry {} is out of order", i));
+            }
+        }
+    }
+}
+
+inline const Entry* Reader::find(std::string_view name) const {
+    const uint64_t nameHash = hashName(name);
+    for (auto itr = std::lower_bound(begin(), end(), nameHash); itr != end() && itr->nameHash == nameHash; ++itr) {
+        if (getName(*itr) == name) {
+            return itr;
+        }
+    }
+    return nullptr;
+}
+
+inline Summary Writer::summarize(const uint8_t* data, size_t size) {
+    Summary result;
+    if (size >= ktx2::Descriptor::IDENTIFIER_LENGTH && 0 == memcmp(data, ktx2::Descriptor::IDENTIFIER().data(), ktx2::Descriptor::IDENTIFIER_LENGTH)) {
+        ktx2::Descriptor descriptor;
+        descriptor.parse(data, size);
+        const auto& header = descriptor.header;
+        result.container = Container::KTX2;
+        result.format = (uint32_t)header.format;
+        result.pixelWidth = header.pixelWidth;
+        result.pixelHeight = header.pixelHeight;
+        result.pixelDepth = header.pixelDepth;
+        result.layerCount = header.arrayElementCount;
+        result.faceCount = header.faceCount;
+        result.levelCount = header.levelCount;
+    } else {
+        ktx::Descriptor descriptor;
+        descriptor.parse(data, size);
+        const auto& header = descriptor.header;
+        result.container = Container::KTX;
+        result.format = (uint32_t)header.glInternalFormat;
+        result.pixelWidth = header.pixelWidth;
+        result.pixelHeight = header.pixelHeight;
+        result.pixelDepth = header.pixelDepth;
+        result.layerCount = header.numberOfArrayElements;
+        result.faceCount = header.numberOfFaces;
+        result.levelCount = header.numberOfMipmapLevels;
+    }
+    return result;
+}
+
+inline void Writer::add(const std::string& name, const utils::Storage::ConstPointer& storage) {
+    if (name.size() > UINT32_MAX) {
+        throw std::runtime_error("Pack entry name is too long");
+    }
+    for (const auto& entry : _entries) {
+        if (entry.name == name) {
+            throw std::runtime_error(FORMAT("Duplicate pack entry name {}", name));
+        }
+    }
+    _entries.push_back(PendingEntry{ name, hashName(name), summarize(storage->data(), storage->size()), storage });
+}
+
+inline void Writer::write(const std::string& filename) const {
+    std::vector<const PendingEntry*> sorted;
+    sorted.reserve(_entries.size());
+    for (const auto& entry : _entries) {
+        sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(), [](const PendingEntry* a, const PendingEntry* b) {
+        return a->nameHash != b->nameHash ? a->nameHash < b->nameHash : a->name < b->name;
+    });
+
+    Header header;
+    memcpy(header.identifier, IDENTIFIER().data(), IDENTIFIER_LENGTH);
+    header.entryCount = (uint32_t)sorted.size();
+    header.tocOffset = sizeof(Header);
+    header.namesOffset = header.tocOffset + sorted.size() * sizeof(Entry);
+
+    std::vector<Entry> entries(sorted.size());
+    std::string names;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        auto& entry = entries[i];
+        entry.nameHash = sorted[i]->nameHash;
+        entry.nameOffset = (uint32_t)names.size();
+        entry.nameLength = (uint32_t)sorted[i]->name.size();
+        entry.summary = sorted[i]->summary;
+        names += sorted[i]->name;
+        if (names.size() > UINT32_MAX) {
+            throw std::runtime_error("Pack name table is too large");
+        }
+    }
+    header.namesLength = names.size();
+
+    uint64_t offset = header.namesOffset + header.namesLength;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        offset = (offset + PAYLOAD_ALIGNMENT - 1) & ~(uint64_t)(PAYLOAD_ALIGNMENT - 1);
+        entries[i].byteOffset = offset;
+        entries[i].byteLength = sorted[i]->storage->size();
+        offset += entries[i].byteLength;
+    }
+
+    std::ofstream output(filename, std::ios::binary | std::ios::trunc);
+    if (!output) {
+        throw std::runtime_error(FORMAT("Unable to open {} for writing", filename));
+    }
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(Entry));
+    output.write(names.data(), names.size());
+    static const std::array<char, PAYLOAD_ALIGNMENT> PADDING{};
+    uint64_t written = header.namesOffset + header.namesLength;
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        output.write(PADDING.data(), entries[i].byteOffset - written);
+        const auto& storage = sorted[i]->storage;
+        output.write(reinterpret_cast<const char*>(storage->data()), storage->size());
+        written = entries[i].byteOffset + entries[i].byteLength;
+    }
+    if (!output) {
+        throw std::runtime_error(FORMAT("Unable to write {}", filename));
+    }
+}
+
+}}  // namespace khrpp::pack
+
+#endif
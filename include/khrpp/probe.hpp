@@ -0,0 +1,125 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_probe_hpp
+#define khrpp_probe_hpp
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+
+#include "storage.hpp"
+
+#if defined(_WIN32)
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace khrpp { namespace utils {
+
+// Measures the page faults and I/O incurred between its construction and a call to sample(), so a loader can tell
+// whether a slow texture was waiting on the disk or on the CPU.  Counters are per thread where the platform allows
+// it (Linux) and per process elsewhere, so probes are most meaningful around work done on the calling thread.
+//
+// If a storage range is given, the probe also reports how much of that range was paged in while it was running.
+class FaultProbe {
+public:
+    struct Result {
+        // Faults satisfied without any I/O, e.g. from the page cache
+        uint64_t minorFaults{ 0 };
+        // Faults that had to wait for I/O.  Always 0 on Windows, where all faults are reported as minor.
+        uint64_t majorFaults{ 0 };
+        // Bytes read from storage devices on behalf of the thread, including readahead.  Linux only.
+        uint64_t readBytes{ 0 };
+        // Bytes of the probed range that became resident, and how much of it was resident to begin with
+        size_t bytesPagedIn{ 0 };
+        size_t residentBefore{ 0 };
+        size_t rangeSize{ 0 };
+        std::chrono::nanoseconds elapsed{ 0 };
+
+        bool isIoBound() const { return majorFaults > 0 || readBytes > 0; }
+    };
+
+    FaultProbe() { restart(); }
+    explicit FaultProbe(const StorageSpan& range)
+        : _range{ range } {
+        restart();
+    }
+
+    void restart() {
+        _residentBefore = _range.residentBytes();
+        _start = Counters::read();
+        _startTime = std::chrono::steady_clock::now();
+    }
+
+    Result sample() const {
+        const auto elapsed = std::chrono::steady_clock::now() - _startTime;
+        const auto now = Counters::read();
+        Result result;
+        result.minorFaults = now.minorFaults - _start.minorFaults;
+        result.majorFaults = now.majorFaults - _start.majorFaults;
+        result.readBytes = now.readBytes - _start.readBytes;
+        result.residentBefore = _residentBefore;
+        result.rangeSize = _range.size();
+        const size_t residentAfter = _range.residentBytes();
+        result.bytesPagedIn = residentAfter > _residentBefore ? residentAfter - _residentBefore : 0;
+        result.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed);
+        return result;
+    }
+
+private:
+    struct Counters {
+        uint64_t minorFaults{ 0 };
+        uint64_t majorFaults{ 0 };
+        uint64_t readBytes{ 0 };
+
+        static Counters read() {
+            Counters result;
+#if defined(_WIN32)
+            PROCESS_MEMORY_COUNTERS counters;
+            if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+                result.minorFaults = counters.PageFaultCount;
+            }
+#else
+            struct rusage usage;
+#if defined(RUSAGE_THREAD)
+            const int who = RUSAGE_THREAD;
+#else
+            const int who = RUSAGE_SELF;
+#endif
+            if (0 == getrusage(who, &usage)) {
+                result.minorFaults = (uint64_t)usage.ru_minflt;
+                result.majorFaults = (uint64_t)usage.ru_majflt;
+            }
+#endif
+#if defined(__linux__)
+            // Requires task I/O accounting, which leaves the count at 0 if it's disabled
+            if (FILE* io = fopen("/proc/thread-self/io", "r")) {
+                char line[128];
+                unsigned long long value;
+                while (fgets(line, sizeof(line), io)) {
+                    if (1 == sscanf(line, "read_bytes: %llu", &value)) {
+                        result.readBytes = value;
+                        break;
+                    }
+                }
+                fclose(io);
+            }
+#endif
+            return result;
+        }
+    };
+
+    const StorageSpan _range;
+    size_t _residentBefore{ 0 };
+    Counters _start;
+    std::chrono::steady_clock::time_point _startTime;
+};
+
+}}  // namespace khrpp::utils
+
+#endif
@@ -0,0 +1,234 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_shared_hpp
+#define khrpp_shared_hpp
+
+#include "storage.hpp"
+
+// Storage that can be shared between processes on the same host.  Requires memfd_create and file sealing, so it's
+// only available on Linux.
+#if defined(__linux__) && !defined(__ANDROID__)
+#define KHRPP_HAVE_SHARED_MEMORY 1
+
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace khrpp { namespace utils {
+
+// Memory backed by an anonymous memfd, so that one process can decode a texture into it and any number of other
+// processes can map the same physical pages.
+//
+// A new storage is writable through mutableData() until publish() is called, which seals the memfd against any
+// further writes or resizing and remaps it read-only.  Only published storage can be sent to another process, and
+// receivers refuse any memfd that isn't sealed, so a mapping can never change underneath a reader.
+class SharedMemoryStorage : public Storage {
+public:
+    static constexpr int REQUIRED_SEALS{ F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE };
+
+    // Creates a new, unpublished storage, optionally populated with `data`
+    SharedMemoryStorage(size_t size, const uint8_t* data = nullptr, const char* name = "khrpp");
+    ~SharedMemoryStorage();
+
+    SharedMemoryStorage(const SharedMemoryStorage& other) = delete;
+    SharedMemoryStorage& operator=(const SharedMemoryStorage& other) = delete;
+
+    const uint8_t* data() const override { return _data; }
+    size_t size() const override { return _size; }
+    bool isFast() const override { return true; }
+
+    // Only valid until the storage is published
+    uint8_t* mutableData() {
+        if (_published) {
+            throw std::runtime_error("Shared memory storage has already been published");
+        }
+        return _data;
+    }
+
+    // Seals the contents and makes the mapping read-only.  Any pointers from mutableData() are invalidated.
+    void publish();
+    bool isPublished() const { return _published; }
+    int getFd() const { return _fd; }
+
+    // Adopts a published memfd, such as one received from another process.  Takes ownership of `fd`, and closes it if
+    // it can't be adopted.
+    static ConstPointer adopt(int fd);
+    // Passes a published storage to another process over a Unix domain socket
+    static void send(int socket, const SharedMemoryStorage& storage);
+    // Receives a storage sent with send(), blocking until one arrives
+    static ConstPointer receive(int socket);
+
+private:
+    struct AdoptTag {};
+    SharedMemoryStorage(int fd, AdoptTag);
+
+    void map(int protection);
+    void unmap();
+
+    int _fd{ -1 };
+    size_t _size{ 0 };
+    uint8_t* _data{ nullptr };
+    size_t _mappedSize{ 0 };
+    bool _published{ false };
+};
+
+inline SharedMemoryStorage::SharedMemoryStorage(size_t size, const uint8_t* data, const char* name)
+    : _size{ size } {
+    _fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (-1 == _fd) {
+        throw std::runtime_error("Unable to create memfd");
+    }
+    if (0 != ftruncate(_fd, (off_t)size)) {
+        close(_fd);
+        throw std::runtime_error("Unable to size memfd");
+    }
+    try {
+        map(PROT_READ | PROT_WRITE);
+    } catch (...) {
+        close(_fd);
+        throw;
+    }
+    if (data) {
+        memcpy(_data, data, size);
+    }
+}
+
+inline SharedMemoryStorage::SharedMemoryStorage(int fd, AdoptTag)
+    : _fd{ fd }
+    , _published{ true } {
+    try {
+        const int seals = fcntl(_fd, F_GET_SEALS);
+        if (-1 == seals || REQUIRED_SEALS != (seals & REQUIRED_SEALS)) {
+            throw std::runtime_error("Shared memory storage must be sealed before it can be mapped");
+        }
+        struct stat sb;
+        if (-1 == fstat(_fd, &sb)) {
+            throw std::runtime_error("Unable to stat memfd");
+        }
+        _size = (size_t)sb.st_size;
+        map(PROT_READ);
+    } catch (...) {
+        close(_fd);
+        throw;
+    }
+}
+
+inline Storage::ConstPointer SharedMemoryStorage::adopt(int fd) {
+    return ConstPointer{ new SharedMemoryStorage(fd, AdoptTag{}) };
+}
+
+inline SharedMemoryStorage::~SharedMemoryStorage() {
+    unmap();
+    close(_fd);
+}
+
+inline void SharedMemoryStorage::map(int protection) {
+    // Zero sized mappings aren't allowed, but an empty storage still needs a valid data pointer
+    _mappedSize = std::max<size_t>(_size, 1);
+    void* result = mmap(nullptr, _mappedSize, protection, _size ? MAP_SHARED : (MAP_PRIVATE | MAP_ANONYMOUS), _size ? _fd : -1, 0);
+    if (result == MAP_FAILED) {
+        _mappedSize = 0;
+        throw std::runtime_error("Unable to map memfd");
+    }
+    _data = static_cast<uint8_t*>(result);
+}
+
+inline void SharedMemoryStorage::unmap() {
+    if (_data) {
+        munmap(_data, _mappedSize);
+        _data = nullptr;
+        _mappedSize = 0;
+    }
+}
+
+inline void SharedMemoryStorage::publish() {
+    if (_published) {
+        return;
+    }
+    // F_SEAL_WRITE is refused while any writable shared mapping exists, so swap the mapping for a read-only one
+    unmap();
+    if (-1 == fcntl(_fd, F_ADD_SEALS, REQUIRED_SEALS | F_SEAL_SEAL)) {
+        map(PROT_READ | PROT_WRITE);
+        throw std::runtime_error("Unable to seal memfd");
+    }
+    map(PROT_READ);
+    _published = true;
+}
+
+inline void SharedMemoryStorage::send(int socket, const SharedMemoryStorage& storage) {
+    if (!storage.isPublished()) {
+        throw std::runtime_error("Shared memory storage must be published before it can be sent");
+    }
+    // At least one byte of real data has to accompany the descriptor
+    char payload = 0;
+    iovec io{ &payload, sizeof(payload) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &storage._fd, sizeof(int));
+
+    ssize_t result;
+    do {
+        result = sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (result < 0 && errno == EINTR);
+    if (result < 0) {
+        throw std::runtime_error("Unable to send shared memory storage");
+    }
+}
+
+inline Storage::ConstPointer SharedMemoryStorage::receive(int socket) {
+    char payload;
+    iovec io{ &payload, sizeof(payload) };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &io;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t result;
+    do {
+        result = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+    } while (result < 0 && errno == EINTR);
+    if (result <= 0) {
+        throw std::runtime_error("Unable to receive shared memory storage");
+    }
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    if (!header || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS || header->cmsg_len != CMSG_LEN(sizeof(int))) {
+        throw std::runtime_error("No shared memory storage in received message");
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    if (message.msg_flags & MSG_CTRUNC) {
+        close(fd);
+        throw std::runtime_error("Truncated shared memory storage message");
+    }
+    return adopt(fd);
+}
+
+}}  // namespace khrpp::utils
+
+#endif
+
+#endif
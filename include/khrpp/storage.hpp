@@ -8,10 +8,21 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstdint>
 #include <vector>
 #include <fstream>
+#include <cstring>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+#include "threads.hpp"
+#include "uring.hpp"
 
 #if defined(__ANDROID__)
 #include <android/asset_manager.h>
@@ -28,6 +39,82 @@
 
 namespace khrpp { namespace utils {
 
+// Hints describing how the contents of a storage are going to be accessed.  These are purely advisory, so storage that
+// is already in RAM is free to ignore them.
+enum class AccessHint
+{
+    NORMAL,
+    SEQUENTIAL,
+    RANDOM,
+    WILL_NEED,
+    DONT_NEED,
+};
+
+// How the buffer behind a memory backed storage is obtained
+enum class AllocationPolicy
+{
+    // Heap allocated, zero filled if no initial contents are provided
+    DEFAULT,
+    // Heap allocated, contents are undefined if no initial contents are provided
+    UNINITIALIZED,
+    // Backed by 2 MiB pages where the platform allows it, explicit huge pages first, then transparent huge pages.
+    // Sizes below a single huge page are treated as UNINITIALIZED.
+    HUGE_PAGES,
+    // Whole pages mapped directly from the OS, as required for the target of unbuffered (O_DIRECT) reads.  The
+    // contents are zero if no initial contents are provided.
+    PAGE_ALIGNED,
+};
+
+static const size_t HUGE_PAGE_SIZE{ 2 * 1024 * 1024 };
+
+inline size_t getPageSize() {
+#if defined(_WIN32)
+    static const size_t pageSize = [] {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (size_t)info.dwPageSize;
+    }();
+#else
+    static const size_t pageSize = (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    return pageSize;
+}
+
+namespace detail {
+
+// Counts the resident bytes of a range of the address space.  Returns false if residency can't be queried.
+inline bool queryResidentBytes(const uint8_t* address, size_t length, size_t& result) {
+    result = 0;
+#if defined(_WIN32) || defined(__ANDROID__)
+    return false;
+#else
+    static const size_t MAX_PAGES_PER_QUERY = 1024;
+    const size_t pageSize = getPageSize();
+    const uintptr_t start = reinterpret_cast<uintptr_t>(address);
+    const uintptr_t end = start + length;
+    uintptr_t page = start & ~(uintptr_t)(pageSize - 1);
+#if defined(__APPLE__)
+    char residency[MAX_PAGES_PER_QUERY];
+#else
+    unsigned char residency[MAX_PAGES_PER_QUERY];
+#endif
+    while (page < end) {
+        const size_t pageCount = std::min<size_t>(MAX_PAGES_PER_QUERY, (end - page + pageSize - 1) / pageSize);
+        if (0 != mincore(reinterpret_cast<void*>(page), pageCount * pageSize, residency)) {
+            return false;
+        }
+        for (size_t i = 0; i < pageCount; ++i, page += pageSize) {
+            if (residency[i] & 1) {
+                result += std::min<uintptr_t>(end, page + pageSize) - std::max<uintptr_t>(start, page);
+            }
+        }
+    }
+    return true;
+#endif
+}
+
+}  // namespace detail
+
 // Abstract class to represent memory that stored _somewhere_ (in system memory or in a file, for example)
 class Storage : public ::std::enable_shared_from_this<Storage> {
 public:
@@ -40,12 +127,40 @@ public:
 
     virtual const uint8_t* data() const = 0;
     virtual size_t size() const = 0;
+    // True if the data is already resident in RAM, so that reading it never has to wait on I/O
     virtual bool isFast() const = 0;
 
+    // Advise the storage how the given range will be accessed.  A length of 0 means "through the end of the storage"
+    virtual void advise(AccessHint hint, size_t offset = 0, size_t length = 0) const {}
+    // Ask for the given range to be paged in ahead of being read, so that the reads don't stall on page faults
+    inline void prefetch(size_t offset = 0, size_t length = 0) const { advise(AccessHint::WILL_NEED, offset, length); }
+    // The number of bytes of the given range that are currently resident in RAM, and so can be read without waiting on
+    // I/O.  A length of 0 means "through the end of the storage".  Where the platform can't report residency the whole
+    // range is assumed to be resident for fast storage and not resident otherwise.
+    size_t residentBytes(size_t offset = 0, size_t length = 0) const;
+
     static ConstPointer wrap(size_t size, uint8_t* data, bool fast = false);
-    static ConstPointer create(size_t size, uint8_t* data = nullptr);
-    static ConstPointer readFile(const std::string& filename);
-    inline ConstPointer createView(size_t size = 0, size_t offset = 0) const;
+    static ConstPointer create(size_t size, uint8_t* data = nullptr, AllocationPolicy policy = AllocationPolicy::DEFAULT);
+    static ConstPointer readFile(const std::string& filename, AccessHint hint = AccessHint::NORMAL);
+    // Reads a whole file into page aligned memory, bypassing the page cache where the platform and file system
+    // allow it, so that one-shot reads of large files don't evict everything else that's cached.
+    static ConstPointer readFileDirect(const std::string& filename);
+    // Reads a batch of files fully into memory, overlapping the I/O for all of them.  Uses io_uring where the kernel
+    // supports it and falls back to a pool of threads doing pread otherwise.  Failures are reported through the
+    // corresponding future.
+    static std::vector<std::future<ConstPointer>> readFiles(const std::vector<std::string>& filenames);
+    // A byte range of a file, and where in the target buffer it's read to
+    struct FileRange {
+        uint64_t offset{ 0 };
+        size_t size{ 0 };
+        size_t targetOffset{ 0 };
+    };
+    // Reads only the given ranges of a file into `target`, which must be large enough to hold all of them.  The reads
+    // are submitted together through io_uring where the kernel supports it, and issued with pread otherwise.  Throws
+    // if any of the ranges can't be read in full.
+    static void readFileRanges(const std::string& filename, const std::vector<FileRange>& ranges, uint8_t* target);
+    // Returns a view of part of this storage which keeps this storage alive.  A size of 0 means "through the end".
+    virtual ConstPointer createView(size_t size = 0, size_t offset = 0) const;
 
 #if defined(__ANDROID__)
 protected:
@@ -66,12 +181,21 @@ public:
         , _size{ size }
         , _offset{ offset } {
         if (offset + size > owner->size()) {
-            throw new std::runtime_error("Invalid view range");
+            throw std::runtime_error("Invalid view range");
         }
     }
     inline const uint8_t* data() const override { return _owner->data() + _offset; }
     inline size_t size() const override { return _size; }
     inline bool isFast() const override { return _owner->isFast(); }
+    inline void advise(AccessHint hint, size_t offset = 0, size_t length = 0) const override {
+        if (offset >= _size) {
+            return;
+        }
+        if (0 == length || length > _size - offset) {
+            length = _size - offset;
+        }
+        _owner->advise(hint, _offset + offset, length);
+    }
 
 private:
     const ConstPointer _owner;
@@ -79,7 +203,22 @@ private:
     const size_t _offset;
 };
 
-Storage::ConstPointer Storage::createView(size_t viewSize, size_t offset) const {
+inline size_t Storage::residentBytes(size_t offset, size_t length) const {
+    const size_t selfSize = size();
+    if (offset >= selfSize) {
+        return 0;
+    }
+    if (0 == length || length > selfSize - offset) {
+        length = selfSize - offset;
+    }
+    size_t result;
+    if (!detail::queryResidentBytes(data() + offset, length, result)) {
+        result = isFast() ? length : 0;
+    }
+    return result;
+}
+
+inline Storage::ConstPointer Storage::createView(size_t viewSize, size_t offset) const {
     auto selfSize = size();
     if (0 == viewSize) {
         viewSize = selfSize - offset;
@@ -87,6 +226,80 @@ Storage::ConstPointer Storage::createView(size_t viewSize, size_t offset) const
     return std::make_shared<ViewStorage>(shared_from_this(), viewSize, offset);
 }
 
+// A non-owning view of part of a storage, cheap enough to pass around by value and to slice without allocating.  The
+// storage it was taken from must outlive it, in the same way a std::string_view must not outlive its string.  Use
+// retain() to get a ConstPointer when the data needs to outlive the current scope.
+class StorageSpan {
+public:
+    static constexpr size_t REMAINDER{ ~(size_t)0 };
+
+    StorageSpan() = default;
+    StorageSpan(const Storage& storage)
+        : _storage{ &storage }
+        , _data{ storage.data() }
+        , _size{ storage.size() } {}
+    StorageSpan(const Storage::ConstPointer& storage)
+        : StorageSpan(*storage) {}
+
+    const uint8_t* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return 0 == _size; }
+    const uint8_t* begin() const { return _data; }
+    const uint8_t* end() const { return _data + _size; }
+    const uint8_t& operator[](size_t index) const { return _data[index]; }
+    const uint8_t& front() const { return _data[0]; }
+
+    // Offset of this span from the start of the storage it was taken from
+    size_t offset() const { return _storage ? (size_t)(_data - _storage->data()) : 0; }
+    const Storage* storage() const { return _storage; }
+
+    // Unlike createView a size of 0 is an empty span, leave the size off to get everything through the end
+    StorageSpan subspan(size_t offset, size_t size = REMAINDER) const {
+        if (offset > _size) {
+            throw std::runtime_error("Invalid span range");
+        }
+        if (REMAINDER == size) {
+            size = _size - offset;
+        } else if (size > _size - offset) {
+            throw std::runtime_error("Invalid span range");
+        }
+        return StorageSpan{ _storage, _data + offset, size };
+    }
+
+    void advise(AccessHint hint) const {
+        if (_storage && _size) {
+            _storage->advise(hint, offset(), _size);
+        }
+    }
+    void prefetch() const { advise(AccessHint::WILL_NEED); }
+    size_t residentBytes() const { return (_storage && _size) ? _storage->residentBytes(offset(), _size) : 0; }
+
+    // Returns a storage covering the same bytes that keeps the underlying storage alive.  This is the only point at
+    // which a span allocates or touches a reference count.  The underlying storage must be owned by a shared_ptr.
+    Storage::ConstPointer retain() const {
+        if (!_storage) {
+            return Storage::ConstPointer{};
+        }
+        if (_data == _storage->data() && _size == _storage->size()) {
+            return _storage->shared_from_this();
+        }
+        if (0 == _size) {
+            return std::make_shared<ViewStorage>(_storage->shared_from_this(), 0, offset());
+        }
+        return _storage->createView(_size, offset());
+    }
+
+private:
+    StorageSpan(const Storage* storage, const uint8_t* data, size_t size)
+        : _storage{ storage }
+        , _data{ data }
+        , _size{ size } {}
+
+    const Storage* _storage{ nullptr };
+    const uint8_t* _data{ nullptr };
+    size_t _size{ 0 };
+};
+
 class WrapperStorage : public Storage {
 public:
     WrapperStorage(size_t size, const uint8_t* data, bool fast = false)
@@ -99,7 +312,7 @@ public:
 
     const uint8_t* data() const override { return _data; }
     size_t size() const override { return _size; }
-    bool isFast() const override { return true; }
+    bool isFast() const override { return _fast; }
 };
 
 inline Storage::ConstPointer Storage::wrap(size_t size, uint8_t* data, bool fast) {
@@ -108,23 +321,265 @@ inline Storage::ConstPointer Storage::wrap(size_t size, uint8_t* data, bool fast
 
 class MemoryStorage : public Storage {
 public:
-    MemoryStorage(size_t size, const uint8_t* data = nullptr) {
-        _data.resize(size);
+    MemoryStorage(size_t size, const uint8_t* data = nullptr, AllocationPolicy policy = AllocationPolicy::DEFAULT)
+        : _size{ size } {
+        if (policy == AllocationPolicy::HUGE_PAGES && size >= HUGE_PAGE_SIZE) {
+            _data = allocateHugePages(size, _mappedSize);
+        } else if (policy == AllocationPolicy::PAGE_ALIGNED) {
+            _data = allocatePages(size, _mappedSize);
+        }
+        if (!_data) {
+            // Zero filling is wasted work if we're about to overwrite the contents anyway
+            const bool zeroFill = !data && (policy == AllocationPolicy::DEFAULT || policy == AllocationPolicy::PAGE_ALIGNED);
+            _data = zeroFill ? new uint8_t[size]() : new uint8_t[size];
+        }
         if (data) {
-            memcpy(_data.data(), data, size);
+            memcpy(_data, data, size);
+        }
+    }
+
+    ~MemoryStorage() {
+        if (_mappedSize) {
+#if defined(_WIN32)
+            VirtualFree(_data, 0, MEM_RELEASE);
+#else
+            munmap(_data, _mappedSize);
+#endif
+            return;
+        }
+        delete[] _data;
+    }
+
+    MemoryStorage(const MemoryStorage& other) = delete;
+    MemoryStorage& operator=(const MemoryStorage& other) = delete;
+
+    const uint8_t* data() const override { return _data; }
+    size_t size() const override { return _size; }
+    bool isFast() const override { return true; }
+    // For populating the storage before it's handed out as a ConstPointer
+    uint8_t* mutableData() { return _data; }
+    // The usable size of the buffer, which for page aligned storage extends to the end of the last page
+    size_t capacity() const { return _mappedSize ? _mappedSize : _size; }
+
+private:
+    // Returns nullptr if the pages can't be mapped, in which case the caller falls back to the heap
+    static uint8_t* allocatePages(size_t size, size_t& mappedSize) {
+        const size_t pageSize = getPageSize();
+        mappedSize = std::max<size_t>(pageSize, (size + pageSize - 1) & ~(pageSize - 1));
+#if defined(_WIN32)
+        void* result = VirtualAlloc(nullptr, mappedSize, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!result) {
+            mappedSize = 0;
+        }
+        return static_cast<uint8_t*>(result);
+#else
+        void* result = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (result == MAP_FAILED) {
+            mappedSize = 0;
+            return nullptr;
+        }
+        return static_cast<uint8_t*>(result);
+#endif
+    }
+
+    // Returns nullptr if huge pages can't be used, in which case the caller falls back to the heap
+    static uint8_t* allocateHugePages(size_t size, size_t& mappedSize) {
+#if defined(__linux__)
+        mappedSize = (size + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+#if defined(MAP_HUGETLB)
+        // Explicit huge pages only succeed if the administrator has reserved a pool of them
+        void* explicitPages = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (explicitPages != MAP_FAILED) {
+            return static_cast<uint8_t*>(explicitPages);
+        }
+#endif
+        // Transparent huge pages need a 2 MiB aligned range, so over-allocate and trim the ends
+        const size_t reservedSize = mappedSize + HUGE_PAGE_SIZE;
+        void* reserved = mmap(nullptr, reservedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (reserved == MAP_FAILED) {
+            mappedSize = 0;
+            return nullptr;
+        }
+        auto base = static_cast<uint8_t*>(reserved);
+        auto aligned = reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(base) + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+        if (aligned != base) {
+            munmap(base, aligned - base);
         }
+        const size_t tail = (base + reservedSize) - (aligned + mappedSize);
+        if (tail) {
+            munmap(aligned + mappedSize, tail);
+        }
+#if defined(MADV_HUGEPAGE)
+        madvise(aligned, mappedSize, MADV_HUGEPAGE);
+#endif
+        return aligned;
+#else
+        mappedSize = 0;
+        return nullptr;
+#endif
     }
-    const uint8_t* data() const override { return _data.data(); }
-    size_t size() const override { return _data.size(); }
+
+    uint8_t* _data{ nullptr };
+    const size_t _size;
+    // Non-zero if the buffer was mapped directly rather than coming from the heap
+    size_t _mappedSize{ 0 };
+};
+
+inline Storage::ConstPointer Storage::create(size_t size, uint8_t* data, AllocationPolicy policy) {
+    return std::make_shared<MemoryStorage>(size, data, policy);
+}
+
+class StorageArena;
+
+// A storage carved out of a StorageArena.  Keeps the whole arena alive.
+class ArenaStorage : public Storage {
+public:
+    ArenaStorage(const std::shared_ptr<const StorageArena>& arena, size_t size, const uint8_t* data)
+        : _arena{ arena }
+        , _size{ size }
+        , _data{ data } {}
+
+    const uint8_t* data() const override { return _data; }
+    size_t size() const override { return _size; }
     bool isFast() const override { return true; }
 
 private:
-    std::vector<uint8_t> _data;
+    const std::shared_ptr<const StorageArena> _arena;
+    const size_t _size;
+    const uint8_t* const _data;
 };
 
-inline Storage::ConstPointer Storage::create(size_t size, uint8_t* data) {
-    return std::make_shared<MemoryStorage>(size, data);
+// Bump allocator for many small, short lived storages.  Nothing is freed individually, all of the blocks are
+// released together once the arena and every storage allocated from it have gone out of scope.
+class StorageArena : public std::enable_shared_from_this<StorageArena> {
+public:
+    using Pointer = std::shared_ptr<StorageArena>;
+    static const size_t DEFAULT_BLOCK_SIZE{ 8 * HUGE_PAGE_SIZE };
+    static const size_t DEFAULT_ALIGNMENT{ 16 };
+
+    StorageArena(size_t blockSize = DEFAULT_BLOCK_SIZE, AllocationPolicy policy = AllocationPolicy::HUGE_PAGES)
+        : _blockSize{ blockSize }
+        , _policy{ policy } {}
+
+    static Pointer create(size_t blockSize = DEFAULT_BLOCK_SIZE, AllocationPolicy policy = AllocationPolicy::HUGE_PAGES) {
+        return std::make_shared<StorageArena>(blockSize, policy);
+    }
+
+    // Thread safe.  `alignment` must be a power of two.
+    Storage::ConstPointer allocate(size_t size, const uint8_t* data = nullptr, size_t alignment = DEFAULT_ALIGNMENT) {
+        uint8_t* result{ nullptr };
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            if (!_blocks.empty()) {
+                result = alignAddress(_blocks.back()->mutableData() + _offset, alignment);
+                if (result + size > _blocks.back()->mutableData() + _blocks.back()->size()) {
+                    result = nullptr;
+                }
+            }
+            if (!result) {
+                // Enough slack to align the start of the allocation, whatever alignment the block itself has
+                const size_t blockSize = size + alignment - 1;
+                // Oversized requests get a dedicated block, so they don't waste the remainder of the current one
+                if (size > _blockSize / 4 && !_blocks.empty()) {
+                    auto itr = _blocks.insert(_blocks.end() - 1, std::make_unique<MemoryStorage>(blockSize, nullptr, _policy));
+                    result = alignAddress((*itr)->mutableData(), alignment);
+                } else {
+                    _blocks.push_back(std::make_unique<MemoryStorage>(std::max(blockSize, _blockSize), nullptr, _policy));
+                    result = alignAddress(_blocks.back()->mutableData(), alignment);
+                    _offset = (result + size) - _blocks.back()->mutableData();
+                }
+            } else {
+                _offset = (result + size) - _blocks.back()->mutableData();
+            }
+            _allocatedBytes += size;
+        }
+        if (data) {
+            memcpy(result, data, size);
+        }
+        return std::make_shared<ArenaStorage>(shared_from_this(), size, result);
+    }
+
+    // Bytes handed out so far
+    size_t allocatedBytes() const {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _allocatedBytes;
+    }
+
+    // Bytes held by the arena's blocks
+    size_t capacity() const {
+        std::unique_lock<std::mutex> lock(_mutex);
+        size_t result = 0;
+        for (const auto& block : _blocks) {
+            result += block->size();
+        }
+        return result;
+    }
+
+private:
+    static uint8_t* alignAddress(uint8_t* address, size_t alignment) {
+        return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(address) + alignment - 1) & ~(uintptr_t)(alignment - 1));
+    }
+
+    const size_t _blockSize;
+    const AllocationPolicy _policy;
+    mutable std::mutex _mutex;
+    // The last block is the one currently being allocated from
+    std::vector<std::unique_ptr<MemoryStorage>> _blocks;
+    size_t _offset{ 0 };
+    size_t _allocatedBytes{ 0 };
+};
+
+namespace detail {
+
+#if !defined(__ANDROID__) && !defined(_WIN32)
+// Applies a hint to `length` bytes of a file mapping starting at `address`, which corresponds to `fileOffset` in `fd`
+inline void adviseMapping(AccessHint hint, const uint8_t* address, size_t length, int fd, size_t fileOffset) {
+    // madvise requires a page aligned start address
+    const auto pageAddress = reinterpret_cast<uintptr_t>(address) & ~(uintptr_t)(getPageSize() - 1);
+    const size_t pageLength = length + (reinterpret_cast<uintptr_t>(address) - pageAddress);
+    int advice = MADV_NORMAL;
+#if defined(__linux__)
+    int fileAdvice = POSIX_FADV_NORMAL;
+#endif
+    switch (hint) {
+        case AccessHint::NORMAL:
+            break;
+        case AccessHint::SEQUENTIAL:
+            advice = MADV_SEQUENTIAL;
+#if defined(__linux__)
+            fileAdvice = POSIX_FADV_SEQUENTIAL;
+#endif
+            break;
+        case AccessHint::RANDOM:
+            advice = MADV_RANDOM;
+#if defined(__linux__)
+            fileAdvice = POSIX_FADV_RANDOM;
+#endif
+            break;
+        case AccessHint::WILL_NEED:
+            advice = MADV_WILLNEED;
+#if defined(__linux__)
+            fileAdvice = POSIX_FADV_WILLNEED;
+#endif
+            break;
+        case AccessHint::DONT_NEED:
+            // File mappings are private and read-only, so discarding the pages is safe: they'll be re-read from the
+            // file if they're touched again
+            advice = MADV_DONTNEED;
+#if defined(__linux__)
+            fileAdvice = POSIX_FADV_DONTNEED;
+#endif
+            break;
+    }
+    // Failures are deliberately ignored, a hint that can't be applied isn't an error
+    madvise(reinterpret_cast<void*>(pageAddress), pageLength, advice);
+#if defined(__linux__)
+    posix_fadvise(fd, (off_t)fileOffset, (off_t)length, fileAdvice);
+#endif
 }
+#endif
+
+}  // namespace detail
 
 class FileStorage : public Storage {
 public:
@@ -139,7 +594,21 @@ public:
         withBinaryFileContents<T>(filename, [&](const char* filename, size_t size, const T* data) { handler(size, data); });
     }
 
-    FileStorage(const std::string& filename);
+    FileStorage(const std::string& filename, AccessHint hint = AccessHint::NORMAL);
+#if !defined(__ANDROID__)
+#if defined(_WIN32)
+    using Handle = HANDLE;
+#else
+    using Handle = int;
+#endif
+    static Handle invalidHandle();
+    // Opens a file for mapping, for callers that need to inspect it before deciding whether to map it.  Returns
+    // invalidHandle() on failure.
+    static Handle openHandle(const std::string& filename);
+    static void closeHandle(Handle handle);
+    // Maps a file opened with openHandle(), taking ownership of the handle even if mapping fails
+    explicit FileStorage(Handle handle, AccessHint hint = AccessHint::NORMAL);
+#endif
     ~FileStorage();
     // Prevent copying & assignment
     FileStorage(const FileStorage& other) = delete;
@@ -148,6 +617,7 @@ public:
     const uint8_t* data() const override { return _mapped; }
     size_t size() const override { return _size; }
     bool isFast() const override { return false; }
+    void advise(AccessHint hint, size_t offset = 0, size_t length = 0) const override;
 
 private:
     const size_t _size{ 0 };
@@ -163,19 +633,52 @@ private:
 };
 
 
-inline FileStorage::FileStorage(const std::string& filename) {
 #if defined(__ANDROID__)
+inline FileStorage::FileStorage(const std::string& filename, AccessHint hint) {
     // Load shader from compressed asset
     _asset = AAssetManager_open(getAssetManager(), filename.c_str(), AASSET_MODE_BUFFER);
     assert(_asset);
     const_cast<size_t&>(_size) = AAsset_getLength(_asset);
     assert(_size > 0);
     const_cast<const uint8_t*&>(_mapped) = (uint8_t*)(AAsset_getBuffer(_asset));
-#elif defined(_WIN32)
-    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
-    if (_file == INVALID_HANDLE_VALUE) {
+    if (hint != AccessHint::NORMAL) {
+        advise(hint);
+    }
+}
+#else
+inline FileStorage::FileStorage(const std::string& filename, AccessHint hint)
+    : FileStorage(openHandle(filename), hint) {}
+
+inline FileStorage::Handle FileStorage::invalidHandle() {
+#if defined(_WIN32)
+    return INVALID_HANDLE_VALUE;
+#else
+    return -1;
+#endif
+}
+
+inline FileStorage::Handle FileStorage::openHandle(const std::string& filename) {
+#if defined(_WIN32)
+    return CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+#else
+    return open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+#endif
+}
+
+inline void FileStorage::closeHandle(Handle handle) {
+#if defined(_WIN32)
+    CloseHandle(handle);
+#else
+    close(handle);
+#endif
+}
+
+inline FileStorage::FileStorage(Handle handle, AccessHint hint) {
+    if (handle == invalidHandle()) {
         throw std::runtime_error("Failed to open file");
     }
+#if defined(_WIN32)
+    _file = handle;
     {
         DWORD dwFileSizeHigh;
         const_cast<size_t&>(_size) = GetFileSize(_file, &dwFileSizeHigh);
@@ -183,26 +686,49 @@ inline FileStorage::FileStorage(const std::string& filename) {
     }
     _mapFile = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
     if (0 == _mapFile || _mapFile == INVALID_HANDLE_VALUE) {
+        CloseHandle(_file);
         throw std::runtime_error("Failed to create mapping");
     }
     const_cast<const uint8_t*&>(_mapped) = (uint8_t*)MapViewOfFile(_mapFile, FILE_MAP_READ, 0, 0, 0);
 #else
-    _fd = open(filename.c_str(), O_RDONLY);
-    if (-1 == _fd) {
-        throw std::runtime_error("Failed to open file");
-    }
-
+    _fd = handle;
     {
         struct stat sb;
         if (-1 == fstat(_fd, &sb)) {
+            close(_fd);
             throw std::runtime_error("Unable to stat file");
         }
         const_cast<size_t&>(_size) = sb.st_size;
     }
-    const_cast<const uint8_t*&>(_mapped) = static_cast<uint8_t*>(mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0));
+    int flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+    // If the caller knows they want the whole file, let the kernel read it in while building the mapping rather
+    // than taking a fault per page later
+    if (hint == AccessHint::WILL_NEED) {
+        flags |= MAP_POPULATE;
+    }
+#endif
+    const_cast<const uint8_t*&>(_mapped) = static_cast<uint8_t*>(mmap(nullptr, _size, PROT_READ, flags, _fd, 0));
     if (_mapped == MAP_FAILED) {
+        close(_fd);
         throw std::runtime_error("Unable to mmap file");
     }
+#endif
+    if (hint != AccessHint::NORMAL) {
+        advise(hint);
+    }
+}
+#endif
+
+inline void FileStorage::advise(AccessHint hint, size_t offset, size_t length) const {
+    if (offset >= _size) {
+        return;
+    }
+    if (0 == length || length > _size - offset) {
+        length = _size - offset;
+    }
+#if !defined(__ANDROID__) && !defined(_WIN32)
+    detail::adviseMapping(hint, _mapped + offset, length, _fd, offset);
 #endif
 }
 
@@ -219,8 +745,669 @@ inline FileStorage::~FileStorage() {
 #endif
 }
 
-inline Storage::ConstPointer Storage::readFile(const std::string& filename) {
-    return std::make_shared<const FileStorage>(filename);
+inline Storage::ConstPointer Storage::readFile(const std::string& filename, AccessHint hint) {
+    return std::make_shared<const FileStorage>(filename, hint);
+}
+
+#if !defined(__ANDROID__)
+// Maps only a leading window of a file up front (enough for the header and index of a KTX or KTX2 file), and maps
+// any other range on demand through createView.  Those mappings are released along with the returned views, so the
+// address space and resident memory used is proportional to what's actually being accessed rather than to the size
+// of the file.
+//
+// data() and size() cover just the leading window.  createView offsets are relative to the start of the file and
+// may extend to fileSize().
+class WindowedFileStorage : public Storage {
+public:
+    static constexpr size_t DEFAULT_WINDOW_SIZE{ 64 * 1024 };
+
+    WindowedFileStorage(const std::string& filename, size_t windowSize = DEFAULT_WINDOW_SIZE);
+    ~WindowedFileStorage();
+    WindowedFileStorage(const WindowedFileStorage& other) = delete;
+    WindowedFileStorage& operator=(const WindowedFileStorage& other) = delete;
+
+    const uint8_t* data() const override { return _window.data; }
+    size_t size() const override { return _window.size; }
+    bool isFast() const override { return false; }
+    void advise(AccessHint hint, size_t offset = 0, size_t length = 0) const override;
+    ConstPointer createView(size_t size = 0, size_t offset = 0) const override;
+
+    size_t fileSize() const { return _fileSize; }
+    // Bytes currently mapped, including the leading window
+    size_t mappedBytes() const { return _mappedBytes.load(); }
+
+private:
+    friend class MappedRangeStorage;
+
+    struct Mapping {
+        void* base{ nullptr };
+        size_t length{ 0 };
+        const uint8_t* data{ nullptr };
+        size_t size{ 0 };
+    };
+
+    // Maps a range of the file, expanded as needed to satisfy the platform's alignment requirements
+    Mapping map(size_t offset, size_t size) const;
+    void unmap(const Mapping& mapping) const;
+
+    size_t _fileSize{ 0 };
+    Mapping _window;
+    mutable std::atomic<size_t> _mappedBytes{ 0 };
+#if defined(_WIN32)
+    HANDLE _file{ INVALID_HANDLE_VALUE };
+    HANDLE _mapFile{ INVALID_HANDLE_VALUE };
+#else
+    int _fd{ -1 };
+#endif
+};
+
+// An on demand mapping of part of a WindowedFileStorage
+class MappedRangeStorage : public Storage {
+public:
+    MappedRangeStorage(const std::shared_ptr<const WindowedFileStorage>& owner, size_t offset, size_t size)
+        : _owner{ owner }
+        , _offset{ offset }
+        , _mapping{ owner->map(offset, size) } {}
+    ~MappedRangeStorage() { _owner->unmap(_mapping); }
+
+    const uint8_t* data() const override { return _mapping.data; }
+    size_t size() const override { return _mapping.size; }
+    bool isFast() const override { return false; }
+    void advise(AccessHint hint, size_t offset = 0, size_t length = 0) const override {
+        if (offset >= _mapping.size) {
+            return;
+        }
+        if (0 == length || length > _mapping.size - offset) {
+            length = _mapping.size - offset;
+        }
+#if !defined(_WIN32)
+        detail::adviseMapping(hint, _mapping.data + offset, length, _owner->_fd, _offset + offset);
+#endif
+    }
+
+private:
+    const std::shared_ptr<const WindowedFileStorage> _owner;
+    const size_t _offset;
+    const WindowedFileStorage::Mapping _mapping;
+};
+
+inline WindowedFileStorage::WindowedFileStorage(const std::string& filename, size_t windowSize) {
+#if defined(_WIN32)
+    _file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, NULL);
+    if (_file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open file");
+    }
+    {
+        DWORD dwFileSizeHigh;
+        _fileSize = GetFileSize(_file, &dwFileSizeHigh);
+        _fileSize += (((size_t)dwFileSizeHigh) << 32);
+    }
+    _mapFile = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (0 == _mapFile || _mapFile == INVALID_HANDLE_VALUE) {
+        CloseHandle(_file);
+        throw std::runtime_error("Failed to create mapping");
+    }
+#else
+    _fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == _fd) {
+        throw std::runtime_error("Failed to open file");
+    }
+    struct stat sb;
+    if (-1 == fstat(_fd, &sb)) {
+        close(_fd);
+        throw std::runtime_error("Unable to stat file");
+    }
+    _fileSize = sb.st_size;
+#endif
+    try {
+        _window = map(0, std::min(windowSize, _fileSize));
+    } catch (...) {
+#if defined(_WIN32)
+        CloseHandle(_mapFile);
+        CloseHandle(_file);
+#else
+        close(_fd);
+#endif
+        throw;
+    }
+}
+
+inline WindowedFileStorage::~WindowedFileStorage() {
+    unmap(_window);
+#if defined(_WIN32)
+    CloseHandle(_mapFile);
+    CloseHandle(_file);
+#else
+    close(_fd);
+#endif
+}
+
+inline WindowedFileStorage::Mapping WindowedFileStorage::map(size_t offset, size_t size) const {
+    if (offset > _fileSize || size > _fileSize - offset) {
+        throw std::runtime_error("Invalid view range");
+    }
+    Mapping result;
+    result.size = size;
+    if (0 == size) {
+        return result;
+    }
+#if defined(_WIN32)
+    static const size_t granularity = [] {
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return (size_t)info.dwAllocationGranularity;
+    }();
+#else
+    const size_t granularity = getPageSize();
+#endif
+    const size_t alignedOffset = offset & ~(granularity - 1);
+    result.length = size + (offset - alignedOffset);
+#if defined(_WIN32)
+    result.base = MapViewOfFile(_mapFile, FILE_MAP_READ, (DWORD)((uint64_t)alignedOffset >> 32), (DWORD)(alignedOffset & 0xFFFFFFFF), result.length);
+    if (!result.base) {
+        throw std::runtime_error("Unable to map file range");
+    }
+#else
+    result.base = mmap(nullptr, result.length, PROT_READ, MAP_PRIVATE, _fd, (off_t)alignedOffset);
+    if (result.base == MAP_FAILED) {
+        throw std::runtime_error("Unable to map file range");
+    }
+#endif
+    result.data = static_cast<const uint8_t*>(result.base) + (offset - alignedOffset);
+    _mappedBytes += result.length;
+    return result;
+}
+
+inline void WindowedFileStorage::unmap(const Mapping& mapping) const {
+    if (!mapping.base) {
+        return;
+    }
+#if defined(_WIN32)
+    UnmapViewOfFile(mapping.base);
+#else
+    munmap(mapping.base, mapping.length);
+#endif
+    _mappedBytes -= mapping.length;
+}
+
+inline void WindowedFileStorage::advise(AccessHint hint, size_t offset, size_t length) const {
+    if (offset >= _window.size) {
+        return;
+    }
+    if (0 == length || length > _window.size - offset) {
+        length = _window.size - offset;
+    }
+#if !defined(_WIN32)
+    detail::adviseMapping(hint, _window.data + offset, length, _fd, offset);
+#endif
+}
+
+inline Storage::ConstPointer WindowedFileStorage::createView(size_t viewSize, size_t offset) const {
+    if (offset > _fileSize) {
+        throw std::runtime_error("Invalid view range");
+    }
+    if (0 == viewSize) {
+        viewSize = _fileSize - offset;
+    }
+    auto self = std::static_pointer_cast<const WindowedFileStorage>(shared_from_this());
+    return std::make_shared<MappedRangeStorage>(self, offset, viewSize);
+}
+#endif
+
+namespace detail {
+
+#if defined(__ANDROID__) || defined(_WIN32)
+inline Storage::ConstPointer readFileContents(const std::string& filename) {
+    return Storage::readFile(filename);
+}
+#else
+// Synchronous open / fstat / pread of a whole file into memory
+inline Storage::ConstPointer readFileContents(const std::string& filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        throw std::runtime_error("Failed to open file");
+    }
+    std::shared_ptr<MemoryStorage> result;
+    try {
+        struct stat sb;
+        if (-1 == fstat(fd, &sb)) {
+            throw std::runtime_error("Unable to stat file");
+        }
+        result = std::make_shared<MemoryStorage>((size_t)sb.st_size);
+        size_t offset = 0;
+        while (offset < result->size()) {
+            auto bytesRead = pread(fd, result->mutableData() + offset, result->size() - offset, (off_t)offset);
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                throw std::runtime_error("Unable to read file");
+            }
+            offset += (size_t)bytesRead;
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return result;
+}
+#endif
+
+#if defined(__ANDROID__)
+inline Storage::ConstPointer readFileDirect(const std::string& filename) {
+    return Storage::readFile(filename);
+}
+#elif defined(_WIN32)
+inline Storage::ConstPointer readFileDirect(const std::string& filename) {
+    static const DWORD MAX_READ_SIZE = 1 << 30;
+    bool direct = true;
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                              FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        direct = false;
+        file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        throw std::runtime_error("Failed to open file");
+    }
+    std::shared_ptr<MemoryStorage> result;
+    try {
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file, &fileSize)) {
+            throw std::runtime_error("Unable to get file size");
+        }
+        result = std::make_shared<MemoryStorage>((size_t)fileSize.QuadPart, nullptr, AllocationPolicy::PAGE_ALIGNED);
+        const size_t pageSize = getPageSize();
+        if (direct && 0 != (reinterpret_cast<uintptr_t>(result->mutableData()) & (pageSize - 1))) {
+            throw std::runtime_error("Unable to allocate an aligned buffer for unbuffered reads");
+        }
+        size_t offset = 0;
+        while (offset < result->size()) {
+            size_t length = result->size() - offset;
+            if (direct) {
+                // Unbuffered reads have to cover whole sectors, which the page rounding of the buffer allows for
+                length = std::min<size_t>((length + pageSize - 1) & ~(pageSize - 1), result->capacity() - offset);
+            }
+            DWORD bytesRead = 0;
+            if (!ReadFile(file, result->mutableData() + offset, (DWORD)std::min<size_t>(length, MAX_READ_SIZE), &bytesRead, NULL) || 0 == bytesRead) {
+                throw std::runtime_error("Unable to read file");
+            }
+            offset += bytesRead;
+        }
+    } catch (...) {
+        CloseHandle(file);
+        throw;
+    }
+    CloseHandle(file);
+    return result;
+}
+#else
+// Reads a whole file with O_DIRECT (or F_NOCACHE on Apple platforms).  Falls back to ordinary reads on file systems
+// that reject unbuffered I/O, dropping whatever those reads pulled into the page cache afterwards.
+inline Storage::ConstPointer readFileDirect(const std::string& filename) {
+    static const size_t MAX_READ_SIZE = 1 << 30;
+    bool direct = false;
+    int fd = -1;
+#if defined(O_DIRECT)
+    fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    direct = -1 != fd;
+    if (!direct && errno == EINVAL)
+#endif
+    {
+        fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+#if defined(F_NOCACHE)
+        direct = -1 != fd && -1 != fcntl(fd, F_NOCACHE, 1);
+#endif
+    }
+    if (-1 == fd) {
+        throw std::runtime_error("Failed to open file");
+    }
+
+    const auto disableDirect = [&] {
+        direct = false;
+#if defined(O_DIRECT)
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+#endif
+    };
+
+    std::shared_ptr<MemoryStorage> result;
+    try {
+        struct stat sb;
+        if (-1 == fstat(fd, &sb)) {
+            throw std::runtime_error("Unable to stat file");
+        }
+        result = std::make_shared<MemoryStorage>((size_t)sb.st_size, nullptr, AllocationPolicy::PAGE_ALIGNED);
+        const size_t pageSize = getPageSize();
+        if (direct && 0 != (reinterpret_cast<uintptr_t>(result->mutableData()) & (pageSize - 1))) {
+            disableDirect();
+        }
+        size_t offset = 0;
+        while (offset < result->size()) {
+            size_t length = result->size() - offset;
+            if (direct) {
+                // Unbuffered reads have to cover whole blocks, which the page rounding of the buffer allows for
+                length = std::min((length + pageSize - 1) & ~(pageSize - 1), result->capacity() - offset);
+            }
+            auto bytesRead = pread(fd, result->mutableData() + offset, std::min(length, MAX_READ_SIZE), (off_t)offset);
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead < 0 && errno == EINVAL && direct) {
+                // Some file systems accept the flag on open, but not the I/O
+                disableDirect();
+                continue;
+            }
+            if (bytesRead <= 0) {
+                throw std::runtime_error("Unable to read file");
+            }
+            offset += (size_t)bytesRead;
+        }
+#if defined(POSIX_FADV_DONTNEED)
+        if (!direct) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        }
+#endif
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+    return result;
+}
+#endif
+
+#if defined(KHRPP_HAVE_IO_URING)
+static const uint32_t URING_MAX_IN_FLIGHT = 32;
+
+inline bool isUringFileReadSupported() {
+    static const bool SUPPORTED = IoUring::isSupported({ IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ });
+    return SUPPORTED;
+}
+
+// Drives a whole batch of file reads through a single ring.  Each file goes through an openat and a statx
+// (submitted together), then as many reads as it takes to fill a buffer of the reported size.
+inline void readFilesUring(IoUring& ring, const std::vector<std::string>& filenames, std::vector<std::promise<Storage::ConstPointer>>& promises) {
+    static const size_t MAX_READ_SIZE = 1 << 30;
+    enum Operation : uint64_t
+    {
+        OPEN = 0,
+        STAT = 1,
+        READ = 2,
+    };
+
+    struct Slot {
+        size_t file{ 0 };
+        int fd{ -1 };
+        int error{ 0 };
+        uint32_t pending{ 0 };
+        size_t offset{ 0 };
+        struct statx stat;
+        std::shared_ptr<MemoryStorage> storage;
+    };
+
+    std::vector<Slot> slots(URING_MAX_IN_FLIGHT);
+    std::vector<uint32_t> freeSlots;
+    for (uint32_t i = 0; i < URING_MAX_IN_FLIGHT; ++i) {
+        freeSlots.push_back(URING_MAX_IN_FLIGHT - 1 - i);
+    }
+
+    auto queueRead = [&](uint32_t slotIndex) {
+        auto& slot = slots[slotIndex];
+        auto sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = slot.fd;
+        sqe->addr = (uint64_t)(uintptr_t)(slot.storage->mutableData() + slot.offset);
+        sqe->len = (uint32_t)std::min(slot.storage->size() - slot.offset, MAX_READ_SIZE);
+        sqe->off = slot.offset;
+        sqe->user_data = ((uint64_t)slotIndex << 2) | READ;
+        ++slot.pending;
+    };
+
+    auto finish = [&](uint32_t slotIndex) {
+        auto& slot = slots[slotIndex];
+        if (slot.fd >= 0) {
+            close(slot.fd);
+        }
+        if (slot.error) {
+            promises[slot.file].set_exception(std::make_exception_ptr(std::runtime_error("Unable to read file")));
+        } else {
+            promises[slot.file].set_value(slot.storage);
+        }
+        slot = Slot{};
+        freeSlots.push_back(slotIndex);
+    };
+
+    size_t nextFile = 0;
+    // Files with requests queued or in flight
+    uint32_t activeFiles = 0;
+    while (nextFile < filenames.size() || activeFiles) {
+        while (nextFile < filenames.size() && !freeSlots.empty() && ring.space() >= 2) {
+            const uint32_t slotIndex = freeSlots.back();
+            freeSlots.pop_back();
+            auto& slot = slots[slotIndex];
+            slot.file = nextFile++;
+            const char* path = filenames[slot.file].c_str();
+
+            auto sqe = ring.getSqe();
+            sqe->opcode = IORING_OP_OPENAT;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            sqe->user_data = ((uint64_t)slotIndex << 2) | OPEN;
+
+            sqe = ring.getSqe();
+            sqe->opcode = IORING_OP_STATX;
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)path;
+            sqe->len = STATX_SIZE;
+            sqe->off = (uint64_t)(uintptr_t)&slot.stat;
+            sqe->user_data = ((uint64_t)slotIndex << 2) | STAT;
+
+            slot.pending = 2;
+            ++activeFiles;
+        }
+
+        // Anything the kernel doesn't take now stays queued for the next submit
+        if (ring.submit(1) < 0 && errno != EAGAIN && errno != EBUSY) {
+            throw std::runtime_error("Unable to submit io_uring requests");
+        }
+
+        ring.reap([&](const io_uring_cqe& cqe) {
+            const uint32_t slotIndex = (uint32_t)(cqe.user_data >> 2);
+            const auto operation = (Operation)(cqe.user_data & 3);
+            auto& slot = slots[slotIndex];
+            --slot.pending;
+            if (cqe.res < 0) {
+                slot.error = -cqe.res;
+            } else if (operation == OPEN) {
+                slot.fd = cqe.res;
+            } else if (operation == READ) {
+                if (0 == cqe.res) {
+                    // File shrank underneath us
+                    slot.error = EIO;
+                }
+                slot.offset += (size_t)cqe.res;
+            }
+
+            if (slot.pending) {
+                return;
+            }
+
+            if (!slot.error) {
+                if (operation != READ) {
+                    slot.storage = std::make_shared<MemoryStorage>((size_t)slot.stat.stx_size);
+                }
+                if (slot.offset < slot.storage->size()) {
+                    queueRead(slotIndex);
+                    return;
+                }
+            }
+            finish(slotIndex);
+            --activeFiles;
+        });
+    }
+}
+#endif
+
+#if !defined(__ANDROID__) && !defined(_WIN32)
+static const size_t MAX_RANGE_READ_SIZE = 1 << 30;
+
+inline void readFileRangesPread(int fd, const std::vector<Storage::FileRange>& ranges, uint8_t* target) {
+    for (const auto& range : ranges) {
+        size_t offset = 0;
+        while (offset < range.size) {
+            auto bytesRead = pread(fd, target + range.targetOffset + offset, std::min(range.size - offset, MAX_RANGE_READ_SIZE),
+                                   (off_t)(range.offset + offset));
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                throw std::runtime_error("Unable to read file range");
+            }
+            offset += (size_t)bytesRead;
+        }
+    }
+}
+#endif
+
+#if defined(KHRPP_HAVE_IO_URING)
+// Keeps up to a ring's worth of reads in flight, resubmitting the remainder of any short read.  Every read has
+// completed by the time this returns, even if one of them failed, so the target is never written to afterwards.
+inline void readFileRangesUring(IoUring& ring, int fd, const std::vector<Storage::FileRange>& ranges, uint8_t* target) {
+    struct Read {
+        uint64_t offset;
+        uint8_t* target;
+        size_t size;
+    };
+    std::vector<Read> reads;
+    reads.reserve(ranges.size());
+    for (const auto& range : ranges) {
+        if (range.size) {
+            reads.push_back(Read{ range.offset, target + range.targetOffset, range.size });
+        }
+    }
+
+    std::vector<uint32_t> retries;
+    size_t next = 0;
+    int error = 0;
+    const auto queueRead = [&](uint32_t index) {
+        const auto& read = reads[index];
+        auto sqe = ring.getSqe();
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)read.target;
+        sqe->len = (uint32_t)std::min(read.size, MAX_RANGE_READ_SIZE);
+        sqe->off = read.offset;
+        sqe->user_data = index;
+    };
+    // Reads are only in flight once the kernel has consumed them, and until then stay queued in the ring
+    while (ring.inFlight() || ring.queued() || (!error && (next < reads.size() || !retries.empty()))) {
+        while (!error && !retries.empty() && ring.space()) {
+            queueRead(retries.back());
+            retries.pop_back();
+        }
+        while (!error && next < reads.size() && ring.space()) {
+            queueRead((uint32_t)next++);
+        }
+        if (ring.submit(1) < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR) {
+            throw std::runtime_error("Unable to submit io_uring requests");
+        }
+        ring.reap([&](const io_uring_cqe& cqe) {
+            auto& read = reads[(size_t)cqe.user_data];
+            if (cqe.res < 0) {
+                error = -cqe.res;
+            } else if (0 == cqe.res) {
+                // The range is past the end of the file
+                error = EIO;
+            } else {
+                read.offset += (uint64_t)cqe.res;
+                read.target += cqe.res;
+                read.size -= (size_t)cqe.res;
+                if (read.size) {
+                    retries.push_back((uint32_t)cqe.user_data);
+                }
+            }
+        });
+    }
+    if (error) {
+        throw std::runtime_error("Unable to read file range");
+    }
+}
+#endif
+
+}  // namespace detail
+
+inline Storage::ConstPointer Storage::readFileDirect(const std::string& filename) {
+    return detail::readFileDirect(filename);
+}
+
+inline std::vector<std::future<Storage::ConstPointer>> Storage::readFiles(const std::vector<std::string>& filenames) {
+    std::vector<std::future<ConstPointer>> result;
+    result.reserve(filenames.size());
+#if defined(KHRPP_HAVE_IO_URING)
+    std::shared_ptr<IoUring> ring;
+    if (detail::isUringFileReadSupported()) {
+        try {
+            ring = std::make_shared<IoUring>(detail::URING_MAX_IN_FLIGHT * 2);
+        } catch (const std::runtime_error&) {
+            // Out of locked memory or similar, use the thread pool instead
+        }
+    }
+    if (ring) {
+        auto promises = std::make_shared<std::vector<std::promise<ConstPointer>>>(filenames.size());
+        for (auto& promise : *promises) {
+            result.push_back(promise.get_future());
+        }
+        // The ring is driven from a single pool thread, the parallelism comes from the kernel
+        ThreadPool::shared().submit([ring, filenames, promises] { detail::readFilesUring(*ring, filenames, *promises); });
+        return result;
+    }
+#endif
+    for (const auto& filename : filenames) {
+        result.push_back(ThreadPool::shared().submit([filename] { return detail::readFileContents(filename); }));
+    }
+    return result;
+}
+
+inline void Storage::readFileRanges(const std::string& filename, const std::vector<FileRange>& ranges, uint8_t* target) {
+#if defined(__ANDROID__) || defined(_WIN32)
+    auto file = readFile(filename);
+    for (const auto& range : ranges) {
+        if (range.offset > file->size() || range.size > file->size() - range.offset) {
+            throw std::runtime_error("Unable to read file range");
+        }
+        memcpy(target + range.targetOffset, file->data() + range.offset, range.size);
+    }
+#else
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (-1 == fd) {
+        throw std::runtime_error("Failed to open file");
+    }
+    try {
+#if defined(KHRPP_HAVE_IO_URING)
+        // A single range gains nothing from the ring
+        std::unique_ptr<IoUring> ring;
+        if (ranges.size() > 1 && detail::isUringFileReadSupported()) {
+            try {
+                ring.reset(new IoUring(detail::URING_MAX_IN_FLIGHT));
+            } catch (const std::runtime_error&) {
+                // Out of locked memory or similar, use pread instead
+            }
+        }
+        if (ring) {
+            detail::readFileRangesUring(*ring, fd, ranges, target);
+        } else
+#endif
+        {
+            detail::readFileRangesPread(fd, ranges, target);
+        }
+    } catch (...) {
+        close(fd);
+        throw;
+    }
+    close(fd);
+#endif
 }
 
 }}  // namespace khrpp::utils
@@ -0,0 +1,225 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_streaming_hpp
+#define khrpp_streaming_hpp
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+#include "storage.hpp"
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace khrpp { namespace utils {
+
+// Storage that grows as data arrives from a pipe, socket or decompressor.  The whole capacity is reserved as address
+// space up front and committed a chunk at a time as it's filled, so data() never moves and everything already
+// received stays valid and contiguous while more arrives.
+//
+// A single producer fills the storage with append() (or prepare() and commit()) and then calls finish() or fail().
+// Any number of consumers can wait for a given amount of data with waitFor().  size() is the number of bytes received
+// so far, so views created before the storage is complete only cover what had arrived at the time.
+class StreamingStorage : public Storage {
+public:
+    // Address space is cheap on 64 bit platforms, so by default leave plenty of room
+    static constexpr size_t DEFAULT_CAPACITY{ (size_t)1 << (sizeof(size_t) > 4 ? 36 : 28) };
+    static constexpr size_t COMMIT_CHUNK_SIZE{ 1024 * 1024 };
+
+    explicit StreamingStorage(size_t capacity = DEFAULT_CAPACITY);
+    ~StreamingStorage();
+
+    StreamingStorage(const StreamingStorage& other) = delete;
+    StreamingStorage& operator=(const StreamingStorage& other) = delete;
+
+    const uint8_t* data() const override { return _base; }
+    size_t size() const override { return _size.load(std::memory_order_acquire); }
+    bool isFast() const override { return true; }
+    size_t capacity() const { return _capacity; }
+
+    // Producer side
+
+    // Returns a pointer at which up to `size` more bytes can be written, which become visible on commit()
+    uint8_t* prepare(size_t size);
+    void commit(size_t size);
+    void append(const uint8_t* data, size_t size) {
+        memcpy(prepare(size), data, size);
+        commit(size);
+    }
+#if !defined(_WIN32)
+    // Appends everything that can be read from `fd` until end of file, and then finishes the storage.  Fails the
+    // storage and throws on a read error, or if there's more to read than fits in the capacity.
+    void appendFrom(int fd);
+#endif
+    // No more data will arrive
+    void finish() { close(false); }
+    // No more data will arrive because the producer failed.  Waiting consumers throw.
+    void fail() { close(true); }
+
+    // Consumer side
+
+    bool isComplete() const {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _complete;
+    }
+    // Blocks until at least `size` bytes are available or no more data will arrive, and returns the number of bytes
+    // available.  Throws if the producer failed.
+    size_t waitFor(size_t size) const;
+    // As above, but gives up after `timeout` and returns whatever is available
+    template <typename Rep, typename Period>
+    size_t waitFor(size_t size, const std::chrono::duration<Rep, Period>& timeout) const;
+
+private:
+    void close(bool failed);
+    // Must be called with the mutex held
+    size_t available() const {
+        if (_failed) {
+            throw std::runtime_error("Streaming storage producer failed");
+        }
+        return _size.load(std::memory_order_relaxed);
+    }
+
+    uint8_t* _base{ nullptr };
+    size_t _capacity{ 0 };
+    // Only touched by the producer
+    size_t _committed{ 0 };
+    size_t _prepared{ 0 };
+    std::atomic<size_t> _size{ 0 };
+    mutable std::mutex _mutex;
+    mutable std::condition_variable _condition;
+    bool _complete{ false };
+    bool _failed{ false };
+};
+
+inline StreamingStorage::StreamingStorage(size_t capacity) {
+    const size_t granularity = getPageSize();
+    _capacity = std::max(granularity, (capacity + granularity - 1) & ~(granularity - 1));
+#if defined(_WIN32)
+    _base = static_cast<uint8_t*>(VirtualAlloc(nullptr, _capacity, MEM_RESERVE, PAGE_NOACCESS));
+    if (!_base) {
+        throw std::runtime_error("Unable to reserve address space for streaming storage");
+    }
+#else
+    void* reserved = mmap(nullptr, _capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        throw std::runtime_error("Unable to reserve address space for streaming storage");
+    }
+    _base = static_cast<uint8_t*>(reserved);
+#endif
+}
+
+inline StreamingStorage::~StreamingStorage() {
+#if defined(_WIN32)
+    VirtualFree(_base, 0, MEM_RELEASE);
+#else
+    munmap(_base, _capacity);
+#endif
+}
+
+inline uint8_t* StreamingStorage::prepare(size_t size) {
+    const size_t current = _size.load(std::memory_order_relaxed);
+    if (size > _capacity - current) {
+        throw std::runtime_error("Streaming storage capacity exceeded");
+    }
+    const size_t required = current + size;
+    if (required > _committed) {
+        size_t commitEnd = std::min(_capacity, (required + COMMIT_CHUNK_SIZE - 1) / COMMIT_CHUNK_SIZE * COMMIT_CHUNK_SIZE);
+#if defined(_WIN32)
+        if (!VirtualAlloc(_base + _committed, commitEnd - _committed, MEM_COMMIT, PAGE_READWRITE)) {
+            throw std::runtime_error("Unable to commit streaming storage");
+        }
+#else
+        if (0 != mprotect(_base + _committed, commitEnd - _committed, PROT_READ | PROT_WRITE)) {
+            throw std::runtime_error("Unable to commit streaming storage");
+        }
+#endif
+        _committed = commitEnd;
+    }
+    _prepared = required;
+    return _base + current;
+}
+
+inline void StreamingStorage::commit(size_t size) {
+    const size_t current = _size.load(std::memory_order_relaxed);
+    if (size > _prepared - current) {
+        throw std::runtime_error("Committing more streaming storage than was prepared");
+    }
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _size.store(current + size, std::memory_order_release);
+    }
+    _condition.notify_all();
+}
+
+inline void StreamingStorage::close(bool failed) {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _complete = true;
+        _failed = failed;
+    }
+    _condition.notify_all();
+}
+
+inline size_t StreamingStorage::waitFor(size_t size) const {
+    if (_size.load(std::memory_order_acquire) >= size) {
+        return _size.load(std::memory_order_acquire);
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _condition.wait(lock, [&] { return _complete || _size.load(std::memory_order_relaxed) >= size; });
+    return available();
+}
+
+template <typename Rep, typename Period>
+inline size_t StreamingStorage::waitFor(size_t size, const std::chrono::duration<Rep, Period>& timeout) const {
+    if (_size.load(std::memory_order_acquire) >= size) {
+        return _size.load(std::memory_order_acquire);
+    }
+    std::unique_lock<std::mutex> lock(_mutex);
+    _condition.wait_for(lock, timeout, [&] { return _complete || _size.load(std::memory_order_relaxed) >= size; });
+    return available();
+}
+
+#if !defined(_WIN32)
+inline void StreamingStorage::appendFrom(int fd) {
+    static const size_t READ_SIZE = 64 * 1024;
+    while (true) {
+        const size_t readSize = std::min(READ_SIZE, _capacity - size());
+        // When full, a single byte is read to tell an input that exactly fits from one that doesn't
+        uint8_t probe;
+        uint8_t* target = readSize ? prepare(readSize) : &probe;
+        const ssize_t bytesRead = read(fd, target, readSize ? readSize : 1);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead < 0) {
+            fail();
+            throw std::runtime_error("Unable to read stream");
+        }
+        if (0 == bytesRead) {
+            finish();
+            return;
+        }
+        if (0 == readSize) {
+            fail();
+            throw std::runtime_error("Streaming storage capacity exceeded");
+        }
+        commit((size_t)bytesRead);
+    }
+}
+#endif
+
+}}  // namespace khrpp::utils
+
+#endif
@@ -0,0 +1,153 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_threads_hpp
+#define khrpp_threads_hpp
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace khrpp { namespace utils {
+
+// A minimal fixed size pool of worker threads consuming a FIFO task queue
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t threadCount = 0) {
+        if (0 == threadCount) {
+            threadCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+        }
+        _workers.reserve(threadCount);
+        for (size_t i = 0; i < threadCount; ++i) {
+            _workers.emplace_back([this] { run(); });
+        }
+    }
+
+    // Outstanding tasks are completed before the workers exit
+    ~ThreadPool() {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _condition.notify_all();
+        for (auto& worker : _workers) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const { return _workers.size(); }
+
+    template <typename F>
+    auto submit(F&& function) -> std::future<decltype(function())> {
+        using Result = decltype(function());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(function));
+        auto result = task->get_future();
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _tasks.emplace([task] { (*task)(); });
+        }
+        _condition.notify_one();
+        return result;
+    }
+
+    // Process wide pool, sized to the hardware concurrency
+    static ThreadPool& shared() {
+        static ThreadPool SHARED_POOL;
+        return SHARED_POOL;
+    }
+
+private:
+    void run() {
+        while (true) {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _condition.wait(lock, [this] { return _stopping || !_tasks.empty(); });
+                if (_tasks.empty()) {
+                    return;
+                }
+                task = std::move(_tasks.front());
+                _tasks.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _tasks;
+    std::mutex _mutex;
+    std::condition_variable _condition;
+    bool _stopping{ false };
+};
+
+// Calls function(index) for every index in [0, count) on `pool` and returns once they've all finished.  Indices are
+// claimed in order, so put the most expensive work first.  The calling thread takes part, so this is safe to call from
+// a task running on the same pool.  If any call throws, the first error by index is rethrown once every call has
+// finished.
+template <typename F>
+void parallelFor(ThreadPool& pool, size_t count, F&& function) {
+    if (0 == count) {
+        return;
+    }
+    struct State {
+        std::atomic<size_t> next{ 0 };
+        std::vector<std::exception_ptr> errors;
+        std::mutex mutex;
+        std::condition_variable condition;
+        size_t completed{ 0 };
+    };
+    auto state = std::make_shared<State>();
+    state->errors.resize(count);
+    auto* target = &function;
+    const auto work = [state, target, count] {
+        while (true) {
+            const size_t index = state->next++;
+            if (index >= count) {
+                return;
+            }
+            try {
+                (*target)(index);
+            } catch (...) {
+                state->errors[index] = std::current_exception();
+            }
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (++state->completed == count) {
+                state->condition.notify_all();
+            }
+        }
+    };
+    // Helpers that start after every index has been claimed return immediately without touching anything but the
+    // state they share ownership of
+    const size_t helperCount = std::min(pool.size(), count) - 1;
+    for (size_t i = 0; i < helperCount; ++i) {
+        pool.submit(work);
+    }
+    work();
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->condition.wait(lock, [&] { return state->completed == count; });
+    }
+    for (const auto& error : state->errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+}}  // namespace khrpp::utils
+
+#endif
@@ -0,0 +1,206 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#pragma once
+#ifndef khrpp_uring_hpp
+#define khrpp_uring_hpp
+
+// A thin wrapper around the raw io_uring syscalls, so that batched I/O doesn't require linking liburing.
+// Only available on Linux (Android's seccomp policy blocks io_uring for apps, so it's excluded).
+#if defined(__linux__) && !defined(__ANDROID__) && __has_include(<linux/io_uring.h>)
+#define KHRPP_HAVE_IO_URING 1
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <stdexcept>
+#include <vector>
+
+namespace khrpp { namespace utils {
+
+class IoUring {
+public:
+    explicit IoUring(uint32_t entries) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        _fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+        if (_fd < 0) {
+            throw std::runtime_error("Unable to create io_uring");
+        }
+
+        _sqRingSize = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+        _cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = 0 != (params.features & IORING_FEAT_SINGLE_MMAP);
+        if (singleMap) {
+            _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+        }
+
+        // The destructor doesn't run for a constructor that throws, so release whatever was acquired here
+        try {
+            _sqRing = mapRing(_sqRingSize, IORING_OFF_SQ_RING);
+            _cqRing = singleMap ? _sqRing : mapRing(_cqRingSize, IORING_OFF_CQ_RING);
+            _sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+            _sqes = static_cast<io_uring_sqe*>(mapRing(_sqesSize, IORING_OFF_SQES));
+        } catch (...) {
+            release();
+            throw;
+        }
+
+        auto sq = static_cast<uint8_t*>(_sqRing);
+        _sqHead = reinterpret_cast<uint32_t*>(sq + params.sq_off.head);
+        _sqTail = reinterpret_cast<uint32_t*>(sq + params.sq_off.tail);
+        _sqMask = *reinterpret_cast<uint32_t*>(sq + params.sq_off.ring_mask);
+        _sqEntries = params.sq_entries;
+        _sqArray = reinterpret_cast<uint32_t*>(sq + params.sq_off.array);
+
+        auto cq = static_cast<uint8_t*>(_cqRing);
+        _cqHead = reinterpret_cast<uint32_t*>(cq + params.cq_off.head);
+        _cqTail = reinterpret_cast<uint32_t*>(cq + params.cq_off.tail);
+        _cqMask = *reinterpret_cast<uint32_t*>(cq + params.cq_off.ring_mask);
+        _cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        _sqLocalTail = *_sqTail;
+    }
+
+    ~IoUring() { release(); }
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    // True if the running kernel allows io_uring and supports all of the requested opcodes
+    static bool isSupported(std::initializer_list<uint8_t> opcodes) {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        int fd = (int)syscall(__NR_io_uring_setup, 1, &params);
+        if (fd < 0) {
+            return false;
+        }
+        static const size_t MAX_OPS = 256;
+        std::vector<uint8_t> probeBuffer(sizeof(io_uring_probe) + MAX_OPS * sizeof(io_uring_probe_op), 0);
+        auto probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+        bool result = 0 <= syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, MAX_OPS);
+        for (auto opcode : opcodes) {
+            result = result && opcode <= probe->last_op && 0 != (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED);
+        }
+        close(fd);
+        return result;
+    }
+
+    // Number of submission queue slots that can currently be filled
+    uint32_t space() const { return _sqEntries - (_sqLocalTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE)); }
+
+    // Returns a zeroed submission entry, or nullptr if the submission queue is full
+    io_uring_sqe* getSqe() {
+        if (0 == space()) {
+            return nullptr;
+        }
+        const uint32_t index = _sqLocalTail & _sqMask;
+        io_uring_sqe* sqe = &_sqes[index];
+        memset(sqe, 0, sizeof(io_uring_sqe));
+        _sqArray[index] = index;
+        ++_sqLocalTail;
+        return sqe;
+    }
+
+    // Entries queued with getSqe() that the kernel hasn't consumed yet, including any a previous submit() left behind
+    uint32_t queued() const { return _sqLocalTail - __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE); }
+    // Entries the kernel has consumed whose completions haven't been reaped yet
+    uint32_t inFlight() const { return _inFlight; }
+
+    // Submits all queued entries, optionally waiting until at least `waitCount` completions are available.  Entries
+    // the kernel doesn't take (the call fails with EAGAIN or EBUSY, or submits only some of them) stay queued and are
+    // submitted by the next call.  Never waits when nothing has been submitted, as no completion could arrive.
+    int submit(uint32_t waitCount = 0) {
+        const uint32_t toSubmit = queued();
+        __atomic_store_n(_sqTail, _sqLocalTail, __ATOMIC_RELEASE);
+        if (0 == toSubmit && 0 == _inFlight) {
+            waitCount = 0;
+        }
+        if (0 == toSubmit && 0 == waitCount) {
+            return 0;
+        }
+        const unsigned flags = waitCount ? IORING_ENTER_GETEVENTS : 0;
+        int result;
+        do {
+            result = (int)syscall(__NR_io_uring_enter, _fd, toSubmit, waitCount, flags, nullptr, 0);
+        } while (result < 0 && errno == EINTR);
+        const int error = errno;
+        _inFlight += toSubmit - queued();
+        errno = error;
+        return result;
+    }
+
+    // Invokes `handler` for every available completion and returns how many were consumed
+    template <typename F>
+    uint32_t reap(F&& handler) {
+        uint32_t head = *_cqHead;
+        const uint32_t tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+        uint32_t count = 0;
+        for (; head != tail; ++head, ++count) {
+            handler(_cqes[head & _cqMask]);
+        }
+        __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+        _inFlight -= count;
+        return count;
+    }
+
+private:
+    void release() {
+        if (_sqes) {
+            munmap(_sqes, _sqesSize);
+        }
+        if (_cqRing && _cqRing != _sqRing) {
+            munmap(_cqRing, _cqRingSize);
+        }
+        if (_sqRing) {
+            munmap(_sqRing, _sqRingSize);
+        }
+        if (_fd >= 0) {
+            close(_fd);
+        }
+        _sqes = nullptr;
+        _cqRing = _sqRing = nullptr;
+        _fd = -1;
+    }
+
+    void* mapRing(size_t size, uint64_t offset) {
+        void* result = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, (off_t)offset);
+        if (result == MAP_FAILED) {
+            throw std::runtime_error("Unable to map io_uring");
+        }
+        return result;
+    }
+
+    int _fd{ -1 };
+    void* _sqRing{ nullptr };
+    void* _cqRing{ nullptr };
+    size_t _sqRingSize{ 0 };
+    size_t _cqRingSize{ 0 };
+    size_t _sqesSize{ 0 };
+    io_uring_sqe* _sqes{ nullptr };
+    uint32_t* _sqHead{ nullptr };
+    uint32_t* _sqTail{ nullptr };
+    uint32_t* _sqArray{ nullptr };
+    uint32_t _sqMask{ 0 };
+    uint32_t _sqEntries{ 0 };
+    uint32_t _sqLocalTail{ 0 };
+    uint32_t _inFlight{ 0 };
+    uint32_t* _cqHead{ nullptr };
+    uint32_t* _cqTail{ nullptr };
+    uint32_t _cqMask{ 0 };
+    io_uring_cqe* _cqes{ nullptr };
+};
+
+}}  // namespace khrpp::utils
+
+#endif
+
+#endif
@@ -0,0 +1,177 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/hash.hpp>
+#include <khrpp/ktx/ktx2.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class HashTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+static std::vector<uint8_t> randomBytes(size_t size, uint32_t seed) {
+    std::vector<uint8_t> result(size);
+    std::mt19937 generator{ seed };
+    for (auto& byte : result) {
+        byte = (uint8_t)generator();
+    }
+    return result;
+}
+
+TEST_F(HashTest, testCrc32c) {
+    // Known answers from RFC 3720
+    const std::string check{ "123456789" };
+    ASSERT_EQ(0xE3069283u, crc32c(reinterpret_cast<const uint8_t*>(check.data()), check.size()));
+    ASSERT_EQ(0xE3069283u, crc32cTables(reinterpret_cast<const uint8_t*>(check.data()), check.size()));
+    std::vector<uint8_t> zeros(32, 0), ones(32, 0xFF);
+    ASSERT_EQ(0x8A9136AAu, crc32c(zeros.data(), zeros.size()));
+    ASSERT_EQ(0x62A8AB43u, crc32c(ones.data(), ones.size()));
+    ASSERT_EQ(0u, crc32c(nullptr, 0));
+
+    // The hardware kernel (whatever the machine has), the tables, incremental updates, combination and the parallel
+    // version all have to agree, at every alignment and across the interleaving and chunking boundaries
+    const auto bytes = randomBytes(9 * 1024 * 1024 + 13, 1234);
+    for (size_t size : { (size_t)1, (size_t)7, (size_t)100, (size_t)24576, (size_t)24583, (size_t)100000, bytes.size() - 3 }) {
+        for (size_t offset : { (size_t)0, (size_t)1, (size_t)3 }) {
+            const uint8_t* data = bytes.data() + offset;
+            const uint32_t expected = crc32cTables(data, size);
+            ASSERT_EQ(expected, crc32c(data, size));
+            ASSERT_EQ(expected, crc32cParallel(data, size));
+            const size_t split = size / 3;
+            ASSERT_EQ(expected, crc32c(data + split, size - split, crc32c(data, split)));
+            ASSERT_EQ(expected, crc32cCombine(crc32c(data, split), crc32c(data + split, size - split), size - split));
+        }
+    }
+    ThreadPool pool{ 3 };
+    ASSERT_EQ(crc32cTables(bytes.data(), bytes.size()), crc32cParallel(bytes.data(), bytes.size(), pool));
+    // Parallel hashing from inside the pool it's using must not deadlock
+    auto nested = pool.submit([&] { return crc32cParallel(bytes.data(), bytes.size(), pool); });
+    ASSERT_EQ(crc32cTables(bytes.data(), bytes.size()), nested.get());
+
+}
+
+TEST_F(HashTest, testXxh3) {
+    // Known answers from the reference implementation, covering each of the input size classes
+    std::vector<uint8_t> bytes(100003);
+    for (size_t i = 0; i < bytes.size(); ++i) {
+        bytes[i] = (uint8_t)((i * 31 + 7) ^ (i >> 8));
+    }
+    static const std::vector<std::pair<size_t, uint64_t>> EXPECTED{
+        { 0, 0x2D06800538D394C2ULL },    { 1, 0x4C5CCA45D0F4811FULL },    { 3, 0x15F7093B173D005CULL },
+        { 4, 0xDCA012F95811B6B9ULL },    { 8, 0xDEC6A9A43575982EULL },    { 9, 0xCBE393399F17FFBDULL },
+        { 16, 0x7E484C18D74895D0ULL },   { 17, 0x208BDE5EE2BED407ULL },   { 128, 0xF92B70EAA21A6288ULL },
+        { 129, 0xF8F76713F2BB60FAULL },  { 240, 0xCCC7375172C41F03ULL },  { 241, 0x0B3B630948CE4A00ULL },
+        { 1024, 0xD218D699D62A6D8BULL }, { 1025, 0x38F5F1F86DDFA599ULL }, { 100003, 0x42282B032F56D111ULL },
+    };
+    for (const auto& expected : EXPECTED) {
+        ASSERT_EQ(expected.second, xxh3(bytes.data(), expected.first)) << expected.first;
+        ASSERT_EQ(expected.second, xxh3Scalar(bytes.data(), expected.first)) << expected.first;
+    }
+
+    // Each vectorized kernel the machine can run agrees with the scalar one at every alignment
+    const auto random = randomBytes(1024 * 1024 + 13, 1234);
+    for (size_t size : { (size_t)241, (size_t)1000, (size_t)1024, (size_t)4097, random.size() - 3 }) {
+        for (size_t offset : { (size_t)0, (size_t)1, (size_t)3 }) {
+            const uint8_t* data = random.data() + offset;
+            const uint64_t expected = xxh3Scalar(data, size);
+            ASSERT_EQ(expected, xxh3(data, size));
+#if defined(KHRPP_XXH3_SSE2)
+            ASSERT_EQ(expected, xxh3_detail::hashLong<xxh3_detail::Sse2Kernel>(data, size));
+#endif
+#if defined(KHRPP_XXH3_AVX2)
+            if (xxh3_detail::hasAvx2()) {
+                ASSERT_EQ(expected, xxh3_detail::hashLongAvx2(data, size));
+            }
+#endif
+        }
+    }
+
+    auto storage = Storage::create(random.size(), const_cast<uint8_t*>(random.data()));
+    ASSERT_EQ(xxh3(random.data(), random.size()), hash(*storage));
+    ASSERT_EQ(xxh3(random.data() + 10, 20), hash(StorageSpan{ storage }.subspan(10, 20)));
+}
+
+TEST_F(HashTest, testHashParallel) {
+    static const size_t CHUNK_SIZE = 4 * 1024 * 1024;
+    const auto bytes = randomBytes(2 * CHUNK_SIZE + 13, 1234);
+    auto storage = Storage::create(bytes.size(), const_cast<uint8_t*>(bytes.data()));
+    for (size_t size : { (size_t)0, (size_t)100, CHUNK_SIZE, bytes.size() }) {
+        // The XXH3 hash of the chunk hashes
+        std::vector<uint64_t> hashes;
+        for (size_t offset = 0; offset < size; offset += CHUNK_SIZE) {
+            hashes.push_back(xxh3Scalar(bytes.data() + offset, std::min(CHUNK_SIZE, size - offset)));
+        }
+        const uint64_t expected = xxh3Scalar(reinterpret_cast<const uint8_t*>(hashes.data()), hashes.size() * sizeof(uint64_t));
+        const auto span = StorageSpan{ storage }.subspan(0, size);
+        ThreadPool single{ 1 }, pool{ 3 };
+        ASSERT_EQ(expected, hashParallel(span, single));
+        ASSERT_EQ(expected, hashParallel(span, pool));
+        // Parallel hashing from inside the pool it's using must not deadlock
+        ASSERT_EQ(expected, pool.submit([&] { return hashParallel(span, pool); }).get());
+    }
+}
+
+TEST_F(HashTest, testLevelDigests) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        auto digests = descriptor.getLevelDigests(*storage);
+        ASSERT_EQ(descriptor.levels.size(), digests.size());
+        ThreadPool single{ 1 };
+        ASSERT_EQ(digests, descriptor.getLevelDigests(*storage, single));
+        for (size_t level = 0; level < digests.size(); ++level) {
+            const auto& levelDescriptor = descriptor.levels[level];
+            ASSERT_EQ(xxh3Scalar(storage->data() + levelDescriptor.byteOffset, levelDescriptor.byteLength), digests[level]);
+        }
+    }
+}
+
+TEST_F(HashTest, benchmarkHashing) {
+    static const size_t SIZE = 256 * 1024 * 1024;
+    const auto bytes = randomBytes(SIZE, 42);
+    const auto measure = [&](const std::function<uint64_t()>& hasher, uint64_t& result) {
+        auto start = std::chrono::high_resolution_clock::now();
+        result = hasher();
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        // Bytes per microsecond is MB/s
+        return (double)SIZE / std::max<int64_t>(1, elapsed);
+    };
+
+    uint64_t tablesResult, hardwareResult, parallelResult, xxh3ScalarResult, xxh3Result;
+    auto tables = measure([&] { return crc32cTables(bytes.data(), SIZE); }, tablesResult);
+    auto hardware = measure([&] { return crc32c(bytes.data(), SIZE); }, hardwareResult);
+    auto parallel = measure([&] { return crc32cParallel(bytes.data(), SIZE); }, parallelResult);
+    ASSERT_EQ(tablesResult, hardwareResult);
+    ASSERT_EQ(tablesResult, parallelResult);
+    auto xxh3ScalarRate = measure([&] { return xxh3Scalar(bytes.data(), SIZE); }, xxh3ScalarResult);
+    auto xxh3Rate = measure([&] { return xxh3(bytes.data(), SIZE); }, xxh3Result);
+    ASSERT_EQ(xxh3ScalarResult, xxh3Result);
+    uint64_t treeResult;
+    auto storage = Storage::create(SIZE, const_cast<uint8_t*>(bytes.data()));
+    auto treeRate = measure([&] { return hashParallel(*storage); }, treeResult);
+
+    std::cout << "CRC-32C of " << SIZE / (1024 * 1024) << " MB" << std::endl;
+    std::cout << "    tables          " << (uint64_t)tables << " MB/s" << std::endl;
+    std::cout << "    hardware        " << (uint64_t)hardware << " MB/s" << std::endl;
+    std::cout << "    parallel (" << ThreadPool::shared().size() << ")    " << (uint64_t)parallel << " MB/s" << std::endl;
+    std::cout << "XXH3 of " << SIZE / (1024 * 1024) << " MB" << std::endl;
+    std::cout << "    scalar          " << (uint64_t)xxh3ScalarRate << " MB/s" << std::endl;
+    std::cout << "    vectorized      " << (uint64_t)xxh3Rate << " MB/s" << std::endl;
+    std::cout << "    tree (" << ThreadPool::shared().size() << ")        " << (uint64_t)treeRate << " MB/s" << std::endl;
+}
@@ -5,13 +5,17 @@
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
 
-#include <khrpp/ktx2.hpp>
+#include <khrpp/ktx/ktx2.hpp>
 #include <khrpp/storage.hpp>
 
 #include "TestResources.h"
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <iostream>
+#include <thread>
+
 using namespace khrpp;
 
 class Ktx2Test : public ::testing::Test {
@@ -21,6 +25,37 @@ protected:
     void TearDown() override {}
 };
 
+// A 1x1 RGBA8 file with `entryCount` key/value pairs of `valueSize` bytes each
+static std::vector<uint8_t> makeKtx2WithKvd(size_t entryCount, size_t valueSize) {
+    std::vector<uint8_t> kvdBytes;
+    for (size_t i = 0; i < entryCount; ++i) {
+        const std::string key = "key" + std::to_string(i);
+        const uint32_t kvSize = (uint32_t)(key.size() + 1 + valueSize);
+        kvdBytes.insert(kvdBytes.end(), (const uint8_t*)&kvSize, (const uint8_t*)&kvSize + sizeof(kvSize));
+        kvdBytes.insert(kvdBytes.end(), key.begin(), key.end());
+        kvdBytes.push_back(0);
+        kvdBytes.insert(kvdBytes.end(), valueSize, (uint8_t)i);
+        kvdBytes.resize((kvdBytes.size() + 3) & ~(size_t)3, 0);
+    }
+
+    ktx2::Descriptor::Header header;
+    memcpy(header.identifier, ktx2::Descriptor::IDENTIFIER().data(), ktx2::Descriptor::IDENTIFIER_LENGTH);
+    header.format = vk::Format::R8G8B8A8_UNORM;
+    header.typeSize = 1;
+    header.kvdByteOffset = sizeof(header) + sizeof(ktx2::Descriptor::LevelDescriptor);
+    header.kvdByteLength = (uint32_t)kvdBytes.size();
+    ktx2::Descriptor::LevelDescriptor level;
+    level.byteOffset = (header.kvdByteOffset + header.kvdByteLength + 7) & ~(size_t)7;
+    level.byteLength = level.uncompressedByteLength = 4;
+
+    std::vector<uint8_t> result(level.byteOffset + level.byteLength, 0xFF);
+    memcpy(result.data(), &header, sizeof(header));
+    memcpy(result.data() + sizeof(header), &level, sizeof(level));
+    memcpy(result.data() + header.kvdByteOffset, kvdBytes.data(), kvdBytes.size());
+    std::fill(result.begin() + header.kvdByteOffset + header.kvdByteLength, result.begin() + level.byteOffset, 0);
+    return result;
+}
+
 TEST_F(Ktx2Test, testValidation) {
      for (const auto& file : getKtx2TestFiles()) {
          auto storage = khrpp::utils::Storage::readFile(file);
@@ -34,4 +69,420 @@ TEST_F(Ktx2Test, testKtxInalidation) {
         ASSERT_FALSE(ktx2::Descriptor::validate(storage->data(), storage->size()));
     }
  }
+
+TEST_F(Ktx2Test, testHugeLevelCount) {
+    // A bare header claiming 0xFFFFFFFF levels is rejected rather than reserving space for them
+    ktx2::Descriptor::Header header;
+    memcpy(header.identifier, ktx2::Descriptor::IDENTIFIER().data(), ktx2::Descriptor::IDENTIFIER_LENGTH);
+    header.format = vk::Format::R8G8B8A8_UNORM;
+    header.typeSize = 1;
+    header.levelCount = 0xFFFFFFFF;
+    std::vector<uint8_t> bytes(sizeof(header) + sizeof(ktx2::Descriptor::LevelDescriptor));
+    memcpy(bytes.data(), &header, sizeof(header));
+    ASSERT_FALSE(ktx2::Descriptor::validate(bytes.data(), bytes.size()));
+    ktx2::Descriptor descriptor;
+    ASSERT_THROW(descriptor.parse(bytes.data(), bytes.size()), std::runtime_error);
+}
 	
+
+TEST_F(Ktx2Test, testIncrementalParser) {
+    using Section = ktx2::Parser::Section;
+    const std::vector<size_t> chunkSizes{ 13, 4096, SIZE_MAX };
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = khrpp::utils::Storage::readFile(file);
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+        const uint32_t levelCount = (uint32_t)expected.levels.size();
+
+        for (const auto chunkSize : chunkSizes) {
+            std::vector<ktx2::Parser::Event> events;
+            ktx2::Parser parser{ [&](const ktx2::Parser::Event& event) { events.push_back(event); } };
+            ASSERT_EQ(0u, parser.need().offset);
+            ASSERT_EQ(sizeof(ktx2::Descriptor::Header), parser.need().size);
+            size_t offset = 0;
+            while (offset < storage->size()) {
+                const size_t size = std::min(chunkSize, storage->size() - offset);
+                parser.feed(storage->data() + offset, size);
+                offset += size;
+                // The parser only ever waits for data it hasn't been given yet
+                if (!parser.isComplete()) {
+                    ASSERT_EQ(offset, parser.need().offset);
+                    ASSERT_LT(0u, parser.need().size);
+                }
+            }
+            parser.finish();
+            ASSERT_TRUE(parser.isComplete());
+
+            // Sections in file order, then the levels smallest first
+            ASSERT_EQ(6u + levelCount, events.size());
+            const std::vector<Section> sections{ Section::HEADER, Section::LEVEL_INDEX, Section::DFD, Section::KVD, Section::SGD };
+            for (size_t i = 0; i < sections.size(); ++i) {
+                ASSERT_EQ(sections[i], events[i].section);
+            }
+            ASSERT_EQ(sizeof(ktx2::Descriptor::Header), events[0].data.size());
+            ASSERT_EQ(expected.header.dfdByteLength, events[2].data.size());
+            ASSERT_EQ(expected.header.kvdByteLength, events[3].data.size());
+            for (uint32_t i = 0; i < levelCount; ++i) {
+                const auto& event = events[sections.size() + i];
+                ASSERT_EQ(Section::LEVEL, event.section);
+                ASSERT_EQ(levelCount - 1 - i, event.level);
+                ASSERT_EQ(expected.levels[event.level].byteOffset, event.data.offset());
+                ASSERT_EQ(expected.levels[event.level].byteLength, event.data.size());
+                ASSERT_EQ(0, memcmp(storage->data() + event.data.offset(), event.data.data(), event.data.size()));
+            }
+            ASSERT_EQ(Section::COMPLETE, events.back().section);
+            ASSERT_EQ(storage->size(), events.back().data.size());
+
+            const auto& descriptor = parser.descriptor();
+            ASSERT_EQ(0, memcmp(&expected.header, &descriptor.header, sizeof(expected.header)));
+            ASSERT_EQ(levelCount, descriptor.levels.size());
+            ASSERT_EQ(expected.dfd, descriptor.dfd);
+            ASSERT_EQ(expected.kvd, descriptor.kvd);
+            ASSERT_EQ(0, memcmp(storage->data(), parser.storage()->data(), storage->size()));
+        }
+
+        // Truncated files are only an error once the input ends
+        {
+            ktx2::Parser parser{ nullptr };
+            parser.feed(storage->data(), storage->size() - 1);
+            ASSERT_FALSE(parser.isComplete());
+            ASSERT_EQ(storage->size() - 1, parser.need().offset);
+            ASSERT_EQ(1u, parser.need().size);
+            ASSERT_THROW(parser.finish(), std::runtime_error);
+        }
+
+        // Errors surface as soon as the offending section arrives, and the parser refuses any more data
+        {
+            std::vector<uint8_t> corrupt(storage->data(), storage->data() + storage->size());
+            corrupt.push_back(0);
+            ktx2::Parser parser{ nullptr };
+            parser.feed(corrupt.data(), expected.header.getIndexSize());
+            ASSERT_THROW(parser.feed(corrupt.data() + expected.header.getIndexSize(), corrupt.size() - expected.header.getIndexSize()),
+                         std::runtime_error);
+            ASSERT_THROW(parser.feed(corrupt.data(), 1), std::runtime_error);
+        }
+        {
+            std::vector<uint8_t> corrupt(storage->data(), storage->data() + storage->size());
+            corrupt[0] = 0;
+            ktx2::Parser parser{ nullptr };
+            ASSERT_THROW(parser.feed(corrupt.data(), sizeof(ktx2::Descriptor::Header)), std::runtime_error);
+        }
+    }
+
+    // A parser can follow storage filled by someone else
+    for (const auto& file : getKtxTestFiles()) {
+        auto storage = khrpp::utils::Storage::readFile(file);
+        auto stream = std::make_shared<khrpp::utils::StreamingStorage>(storage->size());
+        ktx2::Parser parser{ stream, nullptr };
+        ASSERT_THROW(parser.feed(storage->data(), storage->size()), std::runtime_error);
+        stream->append(storage->data(), storage->size());
+        stream->finish();
+        ASSERT_THROW(parser.update(), std::runtime_error);
+    }
+}
+
+TEST_F(Ktx2Test, testDescriptorView) {
+    std::vector<khrpp::utils::Storage::ConstPointer> storages;
+    for (const auto& file : getKtx2TestFiles()) {
+        storages.push_back(khrpp::utils::Storage::readFile(file));
+    }
+    auto synthetic = makeKtx2WithKvd(20, 33);
+    storages.push_back(khrpp::utils::Storage::create(synthetic.size(), synthetic.data()));
+
+    for (auto& storage : storages) {
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+        const khrpp::utils::StorageSpan file{ *storage };
+
+        ktx2::DescriptorView view;
+        view.parse(storage);
+        ASSERT_EQ(0, memcmp(&expected.header, &view.header, sizeof(expected.header)));
+        ASSERT_EQ(expected.levels.size(), view.levels.size());
+        ASSERT_EQ(expected.dfd, Bytes(view.dfd.begin(), view.dfd.end()));
+        ASSERT_EQ(expected.kvd.size(), view.kvd.size());
+        size_t entries = 0;
+        for (const auto& entry : view.kvd) {
+            auto itr = expected.kvd.find(std::string{ entry.key });
+            ASSERT_NE(expected.kvd.end(), itr);
+            ASSERT_EQ(itr->second, Bytes(entry.value.begin(), entry.value.end()));
+            auto found = view.kvd.find(entry.key);
+            ASSERT_TRUE(found.has_value());
+            ASSERT_EQ(entry.value.data(), found->data());
+            ++entries;
+        }
+        ASSERT_EQ(expected.kvd.size(), entries);
+        ASSERT_FALSE(view.kvd.find("not a key").has_value());
+        // Everything references the source rather than a copy
+        if (!view.dfd.empty()) {
+            ASSERT_EQ(storage.get(), view.dfd.storage());
+            ASSERT_EQ(storage->data() + expected.header.dfdByteOffset + sizeof(uint32_t), view.dfd.data());
+        }
+        for (uint32_t level = 0; level < view.levels.size(); ++level) {
+            ASSERT_EQ(expected.getLevel(file, level).data(), view.getLevel(level).data());
+            ASSERT_EQ(expected.getLevel(file, level).size(), view.getLevel(level).size());
+        }
+        if (expected.header.supercompressionScheme == ktx2::SupercompressionScheme::NONE) {
+            const uint32_t lastLayer = std::max<uint32_t>(1, expected.header.arrayElementCount) - 1;
+            ASSERT_EQ(expected.getImage(file, 0, lastLayer).data(), view.getImage(0, lastLayer).data());
+        }
+
+        // The view keeps its storage alive
+        const auto* levelData = view.getLevel(0).data();
+        storage.reset();
+        ASSERT_EQ(1, view.storage().use_count());
+        ASSERT_EQ(levelData, view.getLevel(0).data());
+
+        // And fails exactly where the descriptor does
+        std::vector<uint8_t> corrupt(view.storage()->data(), view.storage()->data() + view.storage()->size());
+        corrupt.back() ^= 1;
+        corrupt.push_back(1);
+        ASSERT_FALSE(ktx2::Descriptor::validate(corrupt.data(), corrupt.size()));
+        ASSERT_THROW(ktx2::DescriptorView{}.parse(khrpp::utils::Storage::create(corrupt.size(), corrupt.data())), std::runtime_error);
+    }
+
+    // Basis global data is referenced in place too
+    {
+        ktx2::Descriptor::Header header;
+        header.levelCount = 2;
+        ktx2::DescriptorView::BasisView::BasisHeader basisHeader;
+        basisHeader.endpointsByteLength = 12;
+        basisHeader.selectorsByteLength = 8;
+        basisHeader.tablesByteLength = 5;
+        basisHeader.extendedByteLength = 3;
+        std::vector<uint8_t> sgd(sizeof(basisHeader) + 2 * sizeof(ktx2::DescriptorView::BasisView::BasisImageDescriptor) + 12 + 8 + 5 + 3);
+        for (size_t i = 0; i < sgd.size(); ++i) {
+            sgd[i] = (uint8_t)i;
+        }
+        memcpy(sgd.data(), &basisHeader, sizeof(basisHeader));
+        auto sgdStorage = khrpp::utils::Storage::create(sgd.size(), sgd.data());
+
+        ktx2::Descriptor::BasisDescriptor expected;
+        expected.parse(header, sgd.data(), sgd.size());
+        ktx2::DescriptorView::BasisView basis;
+        basis.parse(header, *sgdStorage);
+        ASSERT_EQ(expected.images.size(), basis.getImageCount());
+        for (size_t i = 0; i < expected.images.size(); ++i) {
+            const auto image = basis.getImage(i);
+            ASSERT_EQ(0, memcmp(&expected.images[i], &image, sizeof(image)));
+        }
+        ASSERT_EQ(expected.endpointsData, Bytes(basis.endpointsData.begin(), basis.endpointsData.end()));
+        ASSERT_EQ(expected.selectorsData, Bytes(basis.selectorsData.begin(), basis.selectorsData.end()));
+        ASSERT_EQ(expected.tableData, Bytes(basis.tableData.begin(), basis.tableData.end()));
+        ASSERT_EQ(sgdStorage->data() + sgd.size() - 3 - 5, basis.tableData.data());
+        ASSERT_THROW(basis.getImage(2), std::runtime_error);
+        ASSERT_THROW(basis.parse(header, khrpp::utils::StorageSpan{ *sgdStorage }.subspan(0, sgd.size() - 1)), std::runtime_error);
+    }
+}
+
+TEST_F(Ktx2Test, benchmarkDescriptorView) {
+    static const size_t ITERATIONS = 20000;
+    auto bytes = makeKtx2WithKvd(32, 64);
+    auto storage = khrpp::utils::Storage::create(bytes.size(), bytes.data());
+
+    size_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        checksum += descriptor.kvd.size();
+    }
+    auto copyTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        ktx2::DescriptorView view;
+        view.parse(storage);
+        checksum += view.kvd.size();
+    }
+    auto viewTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(2 * ITERATIONS * 32, checksum);
+
+    std::cout << "Parse a KTX2 file with 32 key/value pairs " << ITERATIONS << " times" << std::endl;
+    std::cout << "    Descriptor     " << copyTime << " us" << std::endl;
+    std::cout << "    DescriptorView " << viewTime << " us" << std::endl;
+}
+
+TEST_F(Ktx2Test, testLazyDescriptor) {
+    std::vector<khrpp::utils::Storage::ConstPointer> storages;
+    for (const auto& file : getKtx2TestFiles()) {
+        storages.push_back(khrpp::utils::Storage::readFile(file));
+    }
+    auto synthetic = makeKtx2WithKvd(20, 33);
+    storages.push_back(khrpp::utils::Storage::create(synthetic.size(), synthetic.data()));
+
+    for (const auto& storage : storages) {
+        ktx2::DescriptorView expected;
+        expected.parse(storage);
+
+        ktx2::LazyDescriptor lazy{ storage };
+        ASSERT_EQ(0, memcmp(&expected.header, &lazy.header(), sizeof(expected.header)));
+        ASSERT_EQ(expected.levels.size(), lazy.levels().size());
+        for (uint32_t level = 0; level < lazy.levels().size(); ++level) {
+            ASSERT_EQ(expected.getLevel(level).data(), lazy.getLevel(level).data());
+            ASSERT_EQ(expected.getLevel(level).size(), lazy.getLevel(level).size());
+        }
+
+        // The sections are parsed once, whichever thread gets there first
+        std::vector<std::thread> threads;
+        std::vector<size_t> counts(4);
+        for (size_t i = 0; i < counts.size(); ++i) {
+            threads.emplace_back([&, i] { counts[i] = lazy.kvd().size(); });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (const auto count : counts) {
+            ASSERT_EQ(expected.kvd.size(), count);
+        }
+        ASSERT_EQ(expected.dfd.data(), lazy.dfd().data());
+        ASSERT_EQ(expected.dfd.size(), lazy.dfd().size());
+        ASSERT_EQ(expected.kvd.data().data(), lazy.kvd().data().data());
+        ASSERT_EQ(expected.basisData.has_value(), lazy.basisData().has_value());
+        ASSERT_NO_THROW(lazy.validateFully());
+    }
+
+    // Problems outside the header and level index only surface when the sections are used, or on validateFully
+    {
+        auto corrupt = synthetic;
+        ktx2::Descriptor::Header header;
+        memcpy(&header, corrupt.data(), sizeof(header));
+        const uint32_t hugeSize = 0xFFFFFF;
+        memcpy(corrupt.data() + header.kvdByteOffset, &hugeSize, sizeof(hugeSize));
+        ktx2::LazyDescriptor lazy{ khrpp::utils::Storage::create(corrupt.size(), corrupt.data()) };
+        ASSERT_EQ(vk::Format::R8G8B8A8_UNORM, lazy.header().format);
+        ASSERT_EQ(1u, lazy.levels().size());
+        ASSERT_THROW(lazy.kvd(), std::runtime_error);
+        ASSERT_THROW(lazy.dfd(), std::runtime_error);
+        ASSERT_THROW(lazy.validateFully(), std::runtime_error);
+    }
+    {
+        // An odd number of entries leaves padding between the key/value data and the level data
+        auto corrupt = makeKtx2WithKvd(21, 33);
+        ktx2::Descriptor::Header header;
+        memcpy(&header, corrupt.data(), sizeof(header));
+        ktx2::Descriptor::LevelDescriptor level;
+        memcpy(&level, corrupt.data() + sizeof(header), sizeof(level));
+        ASSERT_LT(header.getIndexSize(), level.byteOffset);
+        corrupt[level.byteOffset - 1] = 1;
+        ktx2::LazyDescriptor lazy{ khrpp::utils::Storage::create(corrupt.size(), corrupt.data()) };
+        ASSERT_EQ(21u, lazy.kvd().size());
+        ASSERT_THROW(lazy.validateFully(), std::runtime_error);
+    }
+    {
+        auto corrupt = synthetic;
+        corrupt.pop_back();
+        ASSERT_THROW(ktx2::LazyDescriptor{ khrpp::utils::Storage::create(corrupt.size(), corrupt.data()) }, std::runtime_error);
+        corrupt[0] = 0;
+        ASSERT_THROW(ktx2::LazyDescriptor{ khrpp::utils::Storage::create(corrupt.size(), corrupt.data()) }, std::runtime_error);
+    }
+    ASSERT_THROW(ktx2::LazyDescriptor{}.kvd(), std::runtime_error);
+}
+
+TEST_F(Ktx2Test, benchmarkMetadataScan) {
+    static const size_t FILE_COUNT = 20000;
+    auto bytes = makeKtx2WithKvd(32, 64);
+    auto storage = khrpp::utils::Storage::create(bytes.size(), bytes.data());
+
+    uint64_t checksum = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < FILE_COUNT; ++i) {
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        checksum += descriptor.header.pixelWidth + descriptor.levels[0].byteLength;
+    }
+    auto fullTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < FILE_COUNT; ++i) {
+        ktx2::DescriptorView view;
+        view.parse(storage);
+        checksum += view.header.pixelWidth + view.levels[0].byteLength;
+    }
+    auto viewTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < FILE_COUNT; ++i) {
+        ktx2::LazyDescriptor lazy{ storage };
+        checksum += lazy.header().pixelWidth + lazy.levels()[0].byteLength;
+    }
+    auto lazyTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(3 * FILE_COUNT * 5, checksum);
+
+    std::cout << "Read the dimensions and level sizes of " << FILE_COUNT << " textures" << std::endl;
+    std::cout << "    Descriptor     " << fullTime << " us" << std::endl;
+    std::cout << "    DescriptorView " << viewTime << " us" << std::endl;
+    std::cout << "    LazyDescriptor " << lazyTime << " us" << std::endl;
+}
+
+// A DFD with a vendor block ahead of the basic block of a BC7 sRGB format
+static std::vector<uint8_t> makeBc7Dfd() {
+    std::vector<uint8_t> result;
+    const auto appendWord = [&](uint32_t word) { result.insert(result.end(), (const uint8_t*)&word, (const uint8_t*)&word + sizeof(word)); };
+    appendWord(1);
+    appendWord(12u << 16);
+    appendWord(0xDEADBEEF);
+
+    appendWord(0);
+    appendWord((40u << 16) | 2);
+    result.insert(result.end(), { 134, 1, 2, 0 });
+    result.insert(result.end(), { 3, 3, 0, 0 });
+    result.insert(result.end(), { 16, 0, 0, 0, 0, 0, 0, 0 });
+    appendWord(127u << 16);
+    appendWord(0);
+    appendWord(0);
+    appendWord(UINT32_MAX);
+    return result;
+}
+
+TEST_F(Ktx2Test, testDataFormat) {
+    const auto dfd = makeBc7Dfd();
+    ktx2::DataFormat format;
+    ASSERT_TRUE(format.parse(dfd.data(), dfd.size()));
+    ASSERT_EQ(ktx2::DataFormat::ColorModel::BC7, format.colorModel);
+    ASSERT_TRUE(format.isSrgb());
+    ASSERT_EQ(2u, format.versionNumber);
+    ASSERT_EQ(4u, format.getBlockWidth());
+    ASSERT_EQ(4u, format.getBlockHeight());
+    ASSERT_EQ(1u, format.getBlockDepth());
+    ASSERT_EQ(16u, format.getBytesPerBlock());
+    ASSERT_EQ(1u, format.samples.size());
+    ASSERT_EQ(128u, format.samples[0].bitLength);
+    ASSERT_EQ(64u * 16, format.getImageSize(32, 32));
+    ASSERT_EQ(16u, format.getImageSize(1, 1));
+
+    // Sizes come from the DFD and the header, so even formats missing from the format tables can be addressed
+    ktx2::Descriptor::Header header;
+    header.pixelWidth = 13;
+    header.pixelHeight = 7;
+    header.pixelDepth = 3;
+    ASSERT_EQ(4u * 2 * 3 * 16, header.getImageSize(format, 0));
+    ASSERT_EQ(4u * 2 * 16, header.getSliceSize(format, 0));
+    ASSERT_EQ(2u * 1 * 1 * 16, header.getImageSize(format, 1));
+
+    // Truncated or malformed blocks are ignored
+    ASSERT_FALSE(format.parse(dfd.data(), dfd.size() - 1));
+    ASSERT_EQ(ktx2::DataFormat::ColorModel::UNSPECIFIED, format.colorModel);
+    ASSERT_EQ(0u, format.getBytesPerBlock());
+    ASSERT_FALSE(format.parse(dfd.data(), 12));
+    auto malformed = dfd;
+    malformed[12 + 6] = 41;
+    ASSERT_FALSE(format.parse(malformed.data(), malformed.size()));
+
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = khrpp::utils::Storage::readFile(file);
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        ktx2::DescriptorView view;
+        view.parse(storage);
+        ASSERT_EQ(descriptor.dataFormat.colorModel, view.getDataFormat().colorModel);
+        ASSERT_EQ(descriptor.dataFormat.samples.size(), ktx2::LazyDescriptor{ storage }.getDataFormat().samples.size());
+        if (descriptor.header.supercompressionScheme != ktx2::SupercompressionScheme::NONE) {
+            continue;
+        }
+        ASSERT_NE(0u, descriptor.dataFormat.getBytesPerBlock());
+        const size_t imageCount = (size_t)std::max<uint32_t>(1, descriptor.header.arrayElementCount) * std::max<uint32_t>(1, descriptor.header.faceCount);
+        for (uint32_t level = 0; level < descriptor.levels.size(); ++level) {
+            ASSERT_EQ(descriptor.levels[level].byteLength, descriptor.getImageSize(level) * imageCount) << file;
+        }
+    }
+}
@@ -4,13 +4,18 @@
 //  Distributed under the Apache License, Version 2.0.
 //  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
 //
-#include <khrpp/ktx.hpp>
+#include <khrpp/ktx/ktx.hpp>
+#include <khrpp/ktx/ktx2.hpp>
 #include <khrpp/storage.hpp>
 
 #include "TestResources.h"
 
 #include <gtest/gtest.h>
 
+#include <chrono>
+#include <iostream>
+#include <unordered_set>
+
 using namespace khrpp;
 
 class KtxTest : public ::testing::Test {
@@ -77,3 +82,179 @@ TEST_F(KtxTest, testKtx2Invalidation) {
         ASSERT_FALSE(ktx::Descriptor::validate(storage->data(), storage->size()));
     }
 }
+
+// An RGBA8 KTX with every face of every array element of every mip filled with its index in file order
+static std::vector<uint8_t> makeKtx(uint32_t size, uint32_t arrayElementCount, uint32_t faceCount, uint32_t mipCount) {
+    ktx::Descriptor::Header header;
+    memcpy(header.identifier, ktx::Descriptor::IDENTIFIER().data(), ktx::Descriptor::IDENTIFIER_LENGTH);
+    header.glTypeSize = 1;
+    header.pixelWidth = size;
+    header.pixelHeight = size;
+    header.numberOfArrayElements = arrayElementCount;
+    header.numberOfFaces = faceCount;
+    header.numberOfMipmapLevels = mipCount;
+
+    std::vector<uint8_t> result(sizeof(header));
+    memcpy(result.data(), &header, sizeof(header));
+    uint8_t index = 0;
+    for (uint32_t mip = 0; mip < mipCount; ++mip) {
+        const uint32_t mipSize = std::max<uint32_t>(1, size >> mip);
+        const uint32_t faceSize = mipSize * mipSize * 4;
+        const uint32_t imageCount = std::max<uint32_t>(1, arrayElementCount) * faceCount;
+        const uint32_t imageSize = header.hasFaceImageSize() ? faceSize : faceSize * imageCount;
+        const size_t start = result.size();
+        result.resize(start + sizeof(imageSize));
+        memcpy(result.data() + start, &imageSize, sizeof(imageSize));
+        for (uint32_t image = 0; image < imageCount; ++image) {
+            result.resize(result.size() + faceSize, index++);
+        }
+    }
+    return result;
+}
+
+TEST_F(KtxTest, testImageOffsets) {
+    struct Layout {
+        uint32_t size;
+        uint32_t arrayElementCount;
+        uint32_t faceCount;
+        uint32_t mipCount;
+    };
+    for (const auto& layout : std::vector<Layout>{ { 8, 0, 1, 4 }, { 8, 0, 6, 4 }, { 4, 5, 1, 3 }, { 4, 3, 6, 3 } }) {
+        const auto bytes = makeKtx(layout.size, layout.arrayElementCount, layout.faceCount, layout.mipCount);
+        auto storage = khrpp::utils::Storage::create(bytes.size(), const_cast<uint8_t*>(bytes.data()));
+        ktx::Descriptor descriptor;
+        descriptor.parse(bytes.data(), bytes.size());
+        const uint32_t arrayElementCount = std::max<uint32_t>(1, layout.arrayElementCount);
+        ASSERT_EQ((size_t)arrayElementCount * layout.faceCount * layout.mipCount, descriptor.imageOffsets->size());
+
+        uint8_t index = 0;
+        size_t expectedOffset = ktx::Descriptor::KTX_HEADER_SIZE;
+        for (uint32_t mip = 0; mip < layout.mipCount; ++mip) {
+            const auto& mipDescriptor = descriptor.mipDescriptors[mip];
+            const uint32_t mipSize = std::max<uint32_t>(1, layout.size >> mip);
+            ASSERT_EQ(mipSize * mipSize * 4u, mipDescriptor.faceSize);
+            ASSERT_EQ(arrayElementCount, mipDescriptor.arrayOffsets.size());
+            expectedOffset += sizeof(uint32_t);
+            for (uint32_t arrayElement = 0; arrayElement < arrayElementCount; ++arrayElement) {
+                ASSERT_EQ(layout.faceCount, mipDescriptor.arrayOffsets[arrayElement].size());
+                for (uint32_t face = 0; face < layout.faceCount; ++face) {
+                    ASSERT_EQ(expectedOffset, mipDescriptor.arrayOffsets[arrayElement][face]);
+                    ASSERT_EQ(expectedOffset, descriptor.getImageOffset(mip, arrayElement, face));
+                    auto image = descriptor.getImage(*storage, mip, arrayElement, face);
+                    ASSERT_EQ(mipDescriptor.faceSize, image.size());
+                    ASSERT_EQ(index, image.front());
+                    ASSERT_EQ(index, image[image.size() - 1]);
+                    ++index;
+                    expectedOffset += mipDescriptor.faceSize;
+                }
+            }
+        }
+        ASSERT_EQ(bytes.size(), expectedOffset);
+        ASSERT_THROW(descriptor.getImage(*storage, 0, arrayElementCount), std::runtime_error);
+        ASSERT_THROW(descriptor.getImage(*storage, 0, 0, layout.faceCount), std::runtime_error);
+
+        // Copies share the offset table
+        const ktx::Descriptor copy = descriptor;
+        ASSERT_EQ(descriptor.imageOffsets, copy.imageOffsets);
+        ASSERT_EQ(descriptor.mipDescriptors[0].arrayOffsets[0][0], copy.mipDescriptors[0].arrayOffsets[0][0]);
+    }
+}
+
+TEST_F(KtxTest, benchmarkArrayParse) {
+    static const uint32_t ARRAY_ELEMENT_COUNT = 512;
+    static const size_t ITERATIONS = 200;
+    const auto bytes = makeKtx(64, ARRAY_ELEMENT_COUNT, 1, 7);
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t total = 0;
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        ktx::Descriptor descriptor;
+        descriptor.parse(bytes.data(), bytes.size());
+        total += descriptor.getImageOffset(6, ARRAY_ELEMENT_COUNT - 1);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_LT(0u, total);
+    std::cout << "Parse a " << ARRAY_ELEMENT_COUNT << " element, 7 mip KTX array " << ITERATIONS << " times in " << elapsed << " us" << std::endl;
+}
+
+// The tables are usable at compile time
+static_assert(ktx::VALID_GL_TYPES().contains(gl::Type::UNSIGNED_BYTE), "");
+static_assert(!ktx::VALID_GL_TYPES().contains(gl::Type::COMPRESSED), "");
+static_assert(ktx::VALID_GL_INTERNAL_FORMATS().contains(gl::texture::InternalFormat::RGBA8), "");
+static_assert(ktx2::VALID_VK_FORMATS().contains(vk::Format::R8G8B8A8_UNORM), "");
+static_assert(ktx2::VALID_VK_FORMATS().contains(vk::Format::ASTC_12x12_SFLOAT_BLOCK_EXT), "");
+static_assert(!ktx2::VALID_VK_FORMATS().contains(static_cast<vk::Format>(0x7FFFFFFF)), "");
+
+// Every value within a few of a member of `table`, which takes in both members and non-members around the bitmap and
+// the sorted values
+template <typename T, typename Table>
+static std::vector<T> getProbeValues(const Table& table) {
+    std::vector<T> result;
+    for (size_t i = 0; i < table.size(); ++i) {
+        const auto value = static_cast<uint32_t>(table[i]);
+        for (uint32_t probe = value > 2 ? value - 2 : 0; probe <= value + 2; ++probe) {
+            result.push_back(static_cast<T>(probe));
+        }
+    }
+    return result;
+}
+
+template <typename T, typename Table>
+static void checkTable(const Table& table) {
+    std::unordered_set<T> expected;
+    for (size_t i = 0; i < table.size(); ++i) {
+        expected.insert(table[i]);
+        if (i) {
+            ASSERT_LT(static_cast<uint32_t>(table[i - 1]), static_cast<uint32_t>(table[i]));
+        }
+    }
+    ASSERT_EQ(expected.size(), table.size());
+    for (const auto value : getProbeValues<T>(table)) {
+        ASSERT_EQ(expected.count(value), table.count(value)) << static_cast<uint32_t>(value);
+    }
+}
+
+TEST_F(KtxTest, testValidationTables) {
+    checkTable<gl::Type>(ktx::VALID_GL_TYPES());
+    checkTable<gl::texture::Format>(ktx::VALID_GL_FORMATS());
+    checkTable<gl::texture::InternalFormat>(ktx::VALID_GL_INTERNAL_FORMATS());
+    checkTable<gl::texture::InternalFormat>(ktx::VALID_GL_INTERNAL_COMPRESSED_FORMATS());
+    checkTable<gl::texture::BaseInternalFormat>(ktx::VALID_GL_BASE_INTERNAL_FORMATS());
+    checkTable<vk::Format>(ktx2::VALID_VK_FORMATS());
+}
+
+TEST_F(KtxTest, benchmarkValidationTables) {
+    static const size_t ITERATIONS = 1000000;
+    const auto& table = ktx2::VALID_VK_FORMATS();
+    const auto probes = getProbeValues<vk::Format>(table);
+    std::unordered_set<vk::Format> hashed;
+    for (size_t i = 0; i < table.size(); ++i) {
+        hashed.insert(table[i]);
+    }
+
+    size_t found = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        found += hashed.count(probes[i % probes.size()]);
+    }
+    auto hashedElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        found -= table.count(probes[i % probes.size()]);
+    }
+    auto tableElapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(0u, found);
+    std::cout << "VkFormat validation: unordered_set " << (double)hashedElapsed / ITERATIONS << " ns, table " << (double)tableElapsed / ITERATIONS
+              << " ns" << std::endl;
+
+    // The complete enum validation of a KTX header, i.e. the cost per descriptor
+    ktx::Descriptor::Header header;
+    memcpy(header.identifier, ktx::Descriptor::IDENTIFIER().data(), ktx::Descriptor::IDENTIFIER_LENGTH);
+    header.glTypeSize = 1;
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        header.pixelWidth = 1 + (uint32_t)(i & 1);
+        header.validate();
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << "KTX header validation: " << (double)elapsed / ITERATIONS << " ns per descriptor" << std::endl;
+}
@@ -0,0 +1,165 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/pack.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class PackTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+TEST_F(PackTest, testPackRoundTrip) {
+    const std::string packFile = ::testing::TempDir() + "khrpp_pack_test.pack";
+    std::vector<std::string> files;
+    for (const auto& file : getKtx2TestFiles()) {
+        files.push_back(file);
+    }
+    for (const auto& file : getKtxTestFiles()) {
+        files.push_back(file);
+    }
+    if (files.empty()) {
+        return;
+    }
+
+    {
+        pack::Writer writer;
+        for (const auto& file : files) {
+            writer.addFile(file, file);
+        }
+        ASSERT_THROW(writer.addFile(files.front(), files.front()), std::runtime_error);
+        ASSERT_THROW(writer.add("garbage", Storage::create(128)), std::runtime_error);
+        ASSERT_EQ(files.size(), writer.size());
+        writer.write(packFile);
+    }
+
+    pack::Reader reader{ Storage::readFile(packFile) };
+    ASSERT_EQ(files.size(), reader.size());
+    for (const auto& file : files) {
+        auto entry = reader.find(file);
+        ASSERT_NE(nullptr, entry);
+        ASSERT_EQ(file, reader.getName(*entry));
+        ASSERT_EQ(0u, entry->byteOffset % pack::PAYLOAD_ALIGNMENT);
+
+        auto original = Storage::readFile(file);
+        auto view = reader.createView(*entry);
+        ASSERT_EQ(original->size(), view->size());
+        ASSERT_EQ(0, memcmp(original->data(), view->data(), view->size()));
+
+        // Views and spans of the payloads go straight into the descriptors
+        auto span = reader.getSpan(*entry);
+        ASSERT_EQ(view->data(), span.data());
+        if (entry->summary.container == pack::Container::KTX2) {
+            ktx2::Descriptor descriptor;
+            descriptor.parse(view->data(), view->size());
+            ASSERT_EQ((uint32_t)descriptor.header.format, entry->summary.format);
+            ASSERT_EQ(descriptor.header.pixelWidth, entry->summary.pixelWidth);
+            ASSERT_EQ(descriptor.header.levelCount, entry->summary.levelCount);
+            ASSERT_TRUE(ktx2::Descriptor::validate(span.data(), span.size()));
+        } else {
+            ktx::Descriptor descriptor;
+            descriptor.parse(view->data(), view->size());
+            ASSERT_EQ((uint32_t)descriptor.header.glInternalFormat, entry->summary.format);
+            ASSERT_EQ(descriptor.header.pixelWidth, entry->summary.pixelWidth);
+            ASSERT_TRUE(ktx::Descriptor::validate(span.data(), span.size()));
+        }
+    }
+    ASSERT_EQ(nullptr, reader.find("this/file/does/not.exist"));
+    ASSERT_EQ(nullptr, reader.find(""));
+
+    // Corruption is caught when the pack is opened rather than when an entry is used
+    auto bytes = Storage::readFile(packFile);
+    std::vector<uint8_t> corrupt(bytes->data(), bytes->data() + bytes->size());
+    pack::Header header;
+    memcpy(&header, corrupt.data(), sizeof(header));
+    ASSERT_NO_THROW(pack::Reader{ Storage::create(corrupt.size(), corrupt.data()) });
+    {
+        auto copy = corrupt;
+        copy[0] = 0;
+        ASSERT_THROW(pack::Reader{ Storage::create(copy.size(), copy.data()) }, std::runtime_error);
+    }
+    if (header.entryCount) {
+        auto copy = corrupt;
+        pack::Entry entry;
+        memcpy(&entry, copy.data() + header.tocOffset, sizeof(entry));
+        entry.byteLength = copy.size();
+        memcpy(copy.data() + header.tocOffset, &entry, sizeof(entry));
+        ASSERT_THROW(pack::Reader{ Storage::create(copy.size(), copy.data()) }, std::runtime_error);
+    }
+    if (header.namesLength) {
+        auto copy = corrupt;
+        copy[header.namesOffset] ^= 1;
+        ASSERT_THROW(pack::Reader{ Storage::create(copy.size(), copy.data()) }, std::runtime_error);
+    }
+    ASSERT_THROW(pack::Reader{ Storage::create(sizeof(header) - 1, corrupt.data()) }, std::runtime_error);
+    remove(packFile.c_str());
+}
+
+TEST_F(PackTest, benchmarkPackLookup) {
+    static const size_t ENTRY_COUNT = 2000;
+    // The smallest test file, so that the comparison is dominated by the cost of opening rather than parsing
+    Storage::ConstPointer source;
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        if (!source || storage->size() < source->size()) {
+            source = storage;
+        }
+    }
+    if (!source) {
+        return;
+    }
+    const std::string packFile = ::testing::TempDir() + "khrpp_pack_bench.pack";
+    std::vector<std::string> looseFiles;
+    {
+        pack::Writer writer;
+        for (size_t i = 0; i < ENTRY_COUNT; ++i) {
+            looseFiles.push_back(::testing::TempDir() + "khrpp_pack_bench_" + std::to_string(i) + ".ktx2");
+            std::ofstream(looseFiles.back(), std::ios::binary).write(reinterpret_cast<const char*>(source->data()), source->size());
+            writer.add(looseFiles.back(), source);
+        }
+        writer.write(packFile);
+    }
+
+    size_t valid = 0;
+    auto start = std::chrono::high_resolution_clock::now();
+    for (const auto& file : looseFiles) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor descriptor;
+        descriptor.parseIndex(storage->data(), storage->size(), storage->size());
+        valid += descriptor.levels.size() ? 1 : 0;
+    }
+    auto looseTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    pack::Reader reader{ Storage::readFile(packFile) };
+    for (const auto& file : looseFiles) {
+        auto span = reader.getSpan(*reader.find(file));
+        ktx2::Descriptor descriptor;
+        descriptor.parseIndex(span.data(), span.size(), span.size());
+        valid += descriptor.levels.size() ? 1 : 0;
+    }
+    auto packTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+    ASSERT_EQ(2 * ENTRY_COUNT, valid);
+
+    for (const auto& file : looseFiles) {
+        remove(file.c_str());
+    }
+    remove(packFile.c_str());
+
+    std::cout << "Open and parse the index of " << ENTRY_COUNT << " textures" << std::endl;
+    std::cout << "    loose files " << looseTime << " us" << std::endl;
+    std::cout << "    pack        " << packTime << " us" << std::endl;
+}
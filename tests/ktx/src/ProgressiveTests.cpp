@@ -0,0 +1,142 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/progressive.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <memory>
+#include <thread>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class ProgressiveTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+// What the listener saw of a level, and how much of the file the loader had been given or had parsed at the time.
+// Neither depends on how far ahead of the loader a producer thread has got.
+struct LoadedLevel {
+    ktx2::ProgressiveLoader::Level level;
+    size_t progress;
+};
+
+static void checkLevels(const ktx2::Descriptor& expected, const Storage& file, const std::vector<LoadedLevel>& loaded) {
+    const uint32_t levelCount = (uint32_t)expected.levels.size();
+    ASSERT_EQ(levelCount, loaded.size());
+    const StorageSpan expectedFile{ file };
+    for (uint32_t i = 0; i < levelCount; ++i) {
+        const auto& level = loaded[i].level;
+        // Smallest first, each one as soon as its bytes arrived rather than at the end of the file
+        ASSERT_EQ(levelCount - 1 - i, level.level);
+        ASSERT_EQ(std::max<uint32_t>(1, expected.header.pixelWidth >> level.level), level.width);
+        ASSERT_GE(loaded[i].progress, expected.levels[level.level].byteOffset + expected.levels[level.level].byteLength);
+        if (i + 1 < levelCount) {
+            ASSERT_LT(loaded[i].progress, file.size());
+        }
+        ASSERT_EQ(expected.levels[level.level].byteOffset, level.data.offset());
+        ASSERT_EQ(0, memcmp(file.data() + level.data.offset(), level.data.data(), level.data.size()));
+
+        if (expected.header.supercompressionScheme != ktx2::SupercompressionScheme::NONE) {
+            ASSERT_TRUE(level.images.empty());
+            continue;
+        }
+        // Every slice of every face of every layer, in file order, exactly covering the level
+        const uint32_t layerCount = std::max<uint32_t>(1, expected.header.arrayElementCount);
+        const uint32_t faceCount = std::max<uint32_t>(1, expected.header.faceCount);
+        ASSERT_EQ((size_t)layerCount * faceCount * level.depth, level.images.size());
+        size_t offset = level.data.offset();
+        for (const auto& image : level.images) {
+            ASSERT_EQ(offset, image.data.offset());
+            offset += image.data.size();
+            if (0 == image.slice) {
+                auto expectedImage = expected.getImage(expectedFile, level.level, image.layer, image.face);
+                ASSERT_EQ(expectedImage.offset(), image.data.offset());
+                ASSERT_EQ(expectedImage.size(), image.data.size() * level.depth);
+            }
+        }
+        ASSERT_EQ(level.data.offset() + level.data.size(), offset);
+    }
+}
+
+TEST_F(ProgressiveTest, testThrottledSource) {
+    static const size_t CHUNK_SIZE = 1024;
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+
+        // A producer trickling the file in small chunks, as a slow network would
+        auto source = std::make_shared<StreamingStorage>(storage->size());
+        std::thread producer{ [&] {
+            for (size_t offset = 0; offset < storage->size(); offset += CHUNK_SIZE) {
+                source->append(storage->data() + offset, std::min(CHUNK_SIZE, storage->size() - offset));
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+            source->finish();
+        } };
+
+        std::vector<LoadedLevel> loaded;
+        std::unique_ptr<ktx2::ProgressiveLoader> loader;
+        loader = std::make_unique<ktx2::ProgressiveLoader>(source, [&](const ktx2::ProgressiveLoader::Level& level) {
+            loaded.push_back({ level, loader->getParsedSize() });
+        });
+        loader->run();
+        producer.join();
+        ASSERT_TRUE(loader->isComplete());
+        ASSERT_EQ(expected.levels.size(), loader->getLoadedLevelCount());
+        checkLevels(expected, *storage, loaded);
+    }
+}
+
+TEST_F(ProgressiveTest, testFeed) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+
+        std::vector<LoadedLevel> loaded;
+        size_t fed = 0;
+        ktx2::ProgressiveLoader loader{ [&](const ktx2::ProgressiveLoader::Level& level) { loaded.push_back({ level, fed }); } };
+        while (fed < storage->size()) {
+            const size_t size = std::min<size_t>(333, storage->size() - fed);
+            fed += size;
+            loader.feed(storage->data() + fed - size, size);
+        }
+        loader.finish();
+        checkLevels(expected, *storage, loaded);
+    }
+}
+
+TEST_F(ProgressiveTest, testTruncatedSource) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+
+        // Everything but the largest level arrives, which is still enough to show the texture
+        const size_t truncated = expected.levels[0].byteOffset;
+        auto source = std::make_shared<StreamingStorage>(storage->size());
+        source->append(storage->data(), truncated);
+        source->finish();
+        ktx2::ProgressiveLoader loader{ source, nullptr };
+        ASSERT_THROW(loader.run(), std::runtime_error);
+        ASSERT_EQ(expected.levels.size() - 1, loader.getLoadedLevelCount());
+
+        // A failed producer surfaces as an error too
+        source = std::make_shared<StreamingStorage>(storage->size());
+        source->append(storage->data(), truncated);
+        source->fail();
+        ktx2::ProgressiveLoader failed{ source, nullptr };
+        ASSERT_THROW(failed.run(), std::runtime_error);
+    }
+}
@@ -0,0 +1,103 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/ranges.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <iostream>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class RangesTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+TEST_F(RangesTest, testKtx2) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto mapped = Storage::readFile(file);
+        const StorageSpan span{ mapped };
+        // Only the index is needed to plan the reads
+        ktx2::Descriptor::Header header;
+        memcpy(&header, mapped->data(), sizeof(header));
+        ktx2::Descriptor descriptor;
+        descriptor.parseIndex(mapped->data(), header.getIndexSize(), mapped->size());
+        const uint32_t levelCount = (uint32_t)descriptor.levels.size();
+
+        for (uint32_t baseLevel = 0; baseLevel < levelCount; ++baseLevel) {
+            const auto ranges = LevelRanges::create(descriptor, baseLevel);
+            ASSERT_EQ(baseLevel, ranges.getBaseLevel());
+            ASSERT_EQ(levelCount - baseLevel, ranges.getLevelCount());
+            // The smallest levels are stored together, so a single read covers them
+            ASSERT_EQ(1u, ranges.ranges().size());
+            ASSERT_EQ(descriptor.levels[baseLevel].byteOffset + descriptor.levels[baseLevel].byteLength,
+                      ranges.ranges()[0].offset + ranges.ranges()[0].size);
+            ASSERT_EQ(ranges.ranges()[0].size, ranges.size());
+
+            auto storage = ranges.read(file);
+            ASSERT_EQ(ranges.size(), storage->size());
+            for (uint32_t level = baseLevel; level < levelCount; ++level) {
+                auto actual = ranges.getLevel(StorageSpan{ storage }, level);
+                auto expected = descriptor.getLevel(span, level);
+                ASSERT_EQ(expected.size(), actual.size());
+                ASSERT_EQ(0, memcmp(expected.data(), actual.data(), actual.size()));
+            }
+            if (baseLevel) {
+                ASSERT_THROW(ranges.getLevel(StorageSpan{ storage }, baseLevel - 1), std::runtime_error);
+            }
+        }
+        ASSERT_THROW(LevelRanges::create(descriptor, levelCount), std::runtime_error);
+
+        // Only the base level
+        const auto single = LevelRanges::create(descriptor, 0, 1);
+        ASSERT_EQ(1u, single.getLevelCount());
+        ASSERT_EQ(descriptor.levels[0].byteLength, single.size());
+
+        // A budget of everything but the largest level skips just that
+        size_t budget = 0;
+        for (uint32_t level = 1; level < levelCount; ++level) {
+            budget += descriptor.levels[level].byteLength;
+        }
+        if (levelCount > 1) {
+            ASSERT_EQ(1u, LevelRanges::createForBudget(descriptor, budget).getBaseLevel());
+            ASSERT_EQ(1u, LevelRanges::createForBudget(descriptor, budget + descriptor.levels[0].byteLength - 1).getBaseLevel());
+            const auto reduced = LevelRanges::create(descriptor, 1);
+            std::cout << file << ": " << reduced.size() << " of " << mapped->size() << " bytes read without the base level" << std::endl;
+        }
+        ASSERT_EQ(0u, LevelRanges::createForBudget(descriptor, mapped->size()).getBaseLevel());
+        ASSERT_EQ(levelCount - 1, LevelRanges::createForBudget(descriptor, 0).getBaseLevel());
+    }
+}
+
+TEST_F(RangesTest, testKtx) {
+    for (const auto& file : getKtxTestFiles()) {
+        auto mapped = Storage::readFile(file);
+        const StorageSpan span{ mapped };
+        ktx::Descriptor descriptor;
+        descriptor.parse(mapped->data(), mapped->size());
+        const uint32_t mipCount = (uint32_t)descriptor.mipDescriptors.size();
+        for (uint32_t baseLevel = 0; baseLevel < mipCount; ++baseLevel) {
+            const auto ranges = LevelRanges::create(descriptor, baseLevel);
+            // The imageSize fields between the mips are close enough to read through
+            ASSERT_EQ(1u, ranges.ranges().size());
+            ASSERT_EQ(descriptor.getImageOffset(baseLevel), ranges.ranges()[0].offset);
+            auto storage = ranges.read(file);
+            for (uint32_t mip = baseLevel; mip < mipCount; ++mip) {
+                auto actual = ranges.getLevel(StorageSpan{ storage }, mip);
+                auto expected = descriptor.getImage(span, mip);
+                ASSERT_EQ(expected.size(), actual.size());
+                ASSERT_EQ(0, memcmp(expected.data(), actual.data(), actual.size()));
+                ASSERT_EQ(actual.offset(), ranges.getTargetOffset(descriptor.getImageOffset(mip)));
+            }
+        }
+        ASSERT_EQ(1u, LevelRanges::createForBudget(descriptor, descriptor.mipDescriptors[1].imageSize * 2).getBaseLevel());
+    }
+}
@@ -0,0 +1,980 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/ktx.hpp>
+#include <khrpp/ktx/ktx2.hpp>
+#include <khrpp/cache.hpp>
+#include <khrpp/probe.hpp>
+#include <khrpp/shared.hpp>
+#include <khrpp/storage.hpp>
+#include <khrpp/streaming.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <thread>
+
+#if defined(KHRPP_HAVE_SHARED_MEMORY)
+#include <sys/wait.h>
+#endif
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class StorageTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+// Reads every byte of the storage so that every page gets faulted in
+static uint64_t touchStorage(const Storage& storage) {
+    uint64_t sum = 0;
+    const auto data = storage.data();
+    for (size_t i = 0; i < storage.size(); ++i) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+// Best effort attempt to push a file out of the page cache, so the next read of it is a cold one
+static void evictFromPageCache(const std::string& filename) {
+#if defined(__linux__)
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd != -1) {
+        // Dirty pages can't be dropped, so make sure anything recently written has reached the disk first
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+#endif
+}
+
+// Builds an uncompressed RGBA8 KTX2 file in memory.  Every byte of an image holds the index of its layer and face.
+static std::vector<uint8_t> makeKtx2(uint32_t size, uint32_t layerCount, uint32_t faceCount, uint32_t levelCount) {
+    ktx2::Descriptor::Header header;
+    memcpy(header.identifier, ktx2::Descriptor::IDENTIFIER().data(), ktx2::Descriptor::IDENTIFIER_LENGTH);
+    header.format = vk::Format::R8G8B8A8_UNORM;
+    header.typeSize = 1;
+    header.pixelWidth = size;
+    header.pixelHeight = size;
+    header.arrayElementCount = layerCount;
+    header.faceCount = faceCount;
+    header.levelCount = levelCount;
+
+    std::vector<ktx2::Descriptor::LevelDescriptor> levels(levelCount);
+    size_t offset = sizeof(header) + levelCount * sizeof(ktx2::Descriptor::LevelDescriptor);
+    for (uint32_t level = levelCount; level-- > 0;) {
+        const size_t dimension = std::max<size_t>(1, size >> level);
+        offset = (offset + 7) & ~(size_t)7;
+        levels[level].byteOffset = offset;
+        levels[level].byteLength = levels[level].uncompressedByteLength = dimension * dimension * 4 * layerCount * faceCount;
+        offset += levels[level].byteLength;
+    }
+
+    std::vector<uint8_t> result(offset, 0);
+    memcpy(result.data(), &header, sizeof(header));
+    memcpy(result.data() + sizeof(header), levels.data(), levelCount * sizeof(ktx2::Descriptor::LevelDescriptor));
+    for (const auto& level : levels) {
+        const size_t imageSize = level.byteLength / (layerCount * faceCount);
+        for (uint32_t image = 0; image < layerCount * faceCount; ++image) {
+            memset(result.data() + level.byteOffset + image * imageSize, (uint8_t)image, imageSize);
+        }
+    }
+    return result;
+}
+
+TEST_F(StorageTest, testAccessHints) {
+    const std::vector<AccessHint> hints{ AccessHint::NORMAL, AccessHint::SEQUENTIAL, AccessHint::RANDOM, AccessHint::WILL_NEED,
+                                         AccessHint::DONT_NEED };
+    for (const auto& file : getKtx2TestFiles()) {
+        auto expected = touchStorage(*Storage::readFile(file));
+        for (const auto hint : hints) {
+            auto storage = Storage::readFile(file, hint);
+            // Hints must never change the contents
+            ASSERT_EQ(expected, touchStorage(*storage));
+            ASSERT_TRUE(ktx2::Descriptor::validate(storage->data(), storage->size()));
+
+            // Ranges past the end or unaligned must be tolerated
+            storage->advise(hint, 1, 3);
+            storage->advise(hint, storage->size() / 2);
+            storage->advise(hint, storage->size() + 1, 100);
+            storage->prefetch(storage->size() - 1, storage->size());
+
+            auto view = storage->createView(storage->size() / 2, storage->size() / 4);
+            view->advise(hint);
+            view->prefetch(1, view->size() * 2);
+            ASSERT_EQ(expected, touchStorage(*storage));
+        }
+    }
+
+    // Memory backed storage ignores the hints entirely
+    uint8_t bytes[16]{};
+    auto memory = Storage::create(sizeof(bytes), bytes);
+    memory->advise(AccessHint::DONT_NEED);
+    memory->prefetch();
+    ASSERT_EQ(0u, touchStorage(*memory));
+}
+
+TEST_F(StorageTest, benchmarkColdLoadHints) {
+    using Clock = std::chrono::steady_clock;
+    static const size_t ITERATIONS = 5;
+
+    std::list<std::string> files = getKtx2TestFiles();
+    for (const auto& file : getKtxTestFiles()) {
+        files.push_back(file);
+    }
+    if (files.empty()) {
+        return;
+    }
+
+    // Load each file from a (nominally) cold cache, parse it and read all the image data
+    auto load = [&](bool useHints) {
+        Clock::duration total{ 0 };
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+            for (const auto& file : files) {
+                evictFromPageCache(file);
+                auto start = Clock::now();
+                auto storage = useHints ? Storage::readFile(file, AccessHint::SEQUENTIAL) : Storage::readFile(file);
+                if (useHints) {
+                    storage->prefetch();
+                }
+                if (!ktx2::Descriptor::validate(storage->data(), storage->size())) {
+                    EXPECT_TRUE(ktx::Descriptor::validate(storage->data(), storage->size()));
+                }
+                touchStorage(*storage);
+                total += Clock::now() - start;
+            }
+        }
+        return std::chrono::duration_cast<std::chrono::microseconds>(total).count() / ITERATIONS;
+    };
+
+    auto withoutHints = load(false);
+    auto withHints = load(true);
+    std::cout << "Cold load of " << files.size() << " files without hints: " << withoutHints << " us" << std::endl;
+    std::cout << "Cold load of " << files.size() << " files with hints:    " << withHints << " us" << std::endl;
+}
+
+TEST_F(StorageTest, testReadFiles) {
+    std::vector<std::string> files;
+    for (const auto& file : getKtx2TestFiles()) {
+        files.push_back(file);
+    }
+    for (const auto& file : getKtxTestFiles()) {
+        files.push_back(file);
+    }
+    // Enough repeats to exceed the number of reads kept in flight at once
+    const size_t uniqueCount = files.size();
+    for (size_t i = 0; i < 100 && uniqueCount; ++i) {
+        files.push_back(files[i % uniqueCount]);
+    }
+    files.push_back("this/file/does/not.exist");
+
+    auto futures = Storage::readFiles(files);
+    ASSERT_EQ(files.size(), futures.size());
+    std::vector<size_t> sizes;
+    for (size_t i = 0; i < uniqueCount; ++i) {
+        auto storage = futures[i].get();
+        sizes.push_back(storage->size());
+        auto mapped = Storage::readFile(files[i]);
+        ASSERT_TRUE(storage->isFast());
+        ASSERT_EQ(mapped->size(), storage->size());
+        ASSERT_EQ(0, memcmp(mapped->data(), storage->data(), storage->size()));
+        if (!ktx2::Descriptor::validate(storage->data(), storage->size())) {
+            ASSERT_TRUE(ktx::Descriptor::validate(storage->data(), storage->size()));
+        }
+    }
+    for (size_t i = uniqueCount; i < files.size() - 1; ++i) {
+        ASSERT_EQ(sizes[i % uniqueCount], futures[i].get()->size());
+    }
+    ASSERT_THROW(futures.back().get(), std::runtime_error);
+
+    // The synchronous fallback must produce the same results
+    for (size_t i = 0; i < uniqueCount; ++i) {
+        auto storage = detail::readFileContents(files[i]);
+        auto mapped = Storage::readFile(files[i]);
+        ASSERT_EQ(mapped->size(), storage->size());
+        ASSERT_EQ(0, memcmp(mapped->data(), storage->data(), storage->size()));
+    }
+    ASSERT_THROW(detail::readFileContents(files.back()), std::runtime_error);
+}
+
+TEST_F(StorageTest, testAllocationPolicies) {
+    std::vector<uint8_t> source(3 * HUGE_PAGE_SIZE + 17);
+    for (size_t i = 0; i < source.size(); ++i) {
+        source[i] = (uint8_t)(i * 31);
+    }
+
+    const std::vector<AllocationPolicy> policies{ AllocationPolicy::DEFAULT, AllocationPolicy::UNINITIALIZED, AllocationPolicy::HUGE_PAGES,
+                                                  AllocationPolicy::PAGE_ALIGNED };
+    for (const auto policy : policies) {
+        for (size_t size : { (size_t)0, (size_t)1, (size_t)4096, source.size() }) {
+            auto storage = Storage::create(size, source.data(), policy);
+            ASSERT_EQ(size, storage->size());
+            ASSERT_TRUE(storage->isFast());
+            ASSERT_EQ(0, memcmp(source.data(), storage->data(), size));
+        }
+        // Buffers must be writable through the whole range
+        MemoryStorage writable{ source.size(), nullptr, policy };
+        memcpy(writable.mutableData(), source.data(), source.size());
+        ASSERT_EQ(0, memcmp(source.data(), writable.data(), source.size()));
+    }
+
+    // The default policy still zero fills when there's no initial data
+    auto zeroed = Storage::create(1024);
+    ASSERT_EQ(0u, touchStorage(*zeroed));
+
+    // Page aligned buffers are zero filled, and usable through the end of their last page
+    MemoryStorage aligned{ 100, nullptr, AllocationPolicy::PAGE_ALIGNED };
+    ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(aligned.data()) % getPageSize());
+    ASSERT_EQ(getPageSize(), aligned.capacity());
+    ASSERT_EQ(0u, touchStorage(aligned));
+
+    // Wrapped memory reports whatever the caller says about it
+    ASSERT_TRUE(Storage::wrap(source.size(), source.data(), true)->isFast());
+    ASSERT_FALSE(Storage::wrap(source.size(), source.data())->isFast());
+}
+
+TEST_F(StorageTest, testStorageArena) {
+    static const size_t ARENA_BLOCK_SIZE = 64 * 1024;
+    std::vector<Storage::ConstPointer> storages;
+    std::vector<uint8_t> source(ARENA_BLOCK_SIZE);
+    for (size_t i = 0; i < source.size(); ++i) {
+        source[i] = (uint8_t)(i * 7);
+    }
+    {
+        auto arena = StorageArena::create(ARENA_BLOCK_SIZE, AllocationPolicy::UNINITIALIZED);
+        size_t allocated = 0;
+        for (size_t i = 0; i < 1000; ++i) {
+            const size_t size = (i * 37) % 500 + 1;
+            storages.push_back(arena->allocate(size, source.data() + i));
+            allocated += size;
+            ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(storages.back()->data()) % StorageArena::DEFAULT_ALIGNMENT);
+        }
+        // An oversized allocation mustn't disturb the block being carved up
+        auto big = arena->allocate(ARENA_BLOCK_SIZE, source.data());
+        auto small = arena->allocate(8, source.data(), 256);
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(small->data()) % 256);
+        storages.push_back(big);
+        storages.push_back(small);
+        allocated += ARENA_BLOCK_SIZE + 8;
+        ASSERT_EQ(allocated, arena->allocatedBytes());
+        ASSERT_GE(arena->capacity(), allocated);
+    }
+
+    // The storages keep the arena alive after the last direct reference is gone
+    for (size_t i = 0; i < 1000; ++i) {
+        const size_t size = (i * 37) % 500 + 1;
+        ASSERT_EQ(size, storages[i]->size());
+        ASSERT_EQ(0, memcmp(storages[i]->data(), source.data() + i, size));
+    }
+    ASSERT_EQ(0, memcmp(storages[1000]->data(), source.data(), ARENA_BLOCK_SIZE));
+    ASSERT_EQ(0, memcmp(storages[1001]->data(), source.data(), 8));
+}
+
+TEST_F(StorageTest, testStorageCache) {
+    std::vector<std::string> files;
+    size_t totalSize = 0;
+    for (const auto& file : getKtx2TestFiles()) {
+        files.push_back(file);
+        totalSize += Storage::readFile(file)->size();
+    }
+    if (files.size() < 2) {
+        return;
+    }
+
+    {
+        StorageCache cache{ totalSize };
+        for (const auto& file : files) {
+            cache.readFile(file);
+        }
+        for (const auto& file : files) {
+            auto first = cache.readFile(file);
+            // Same identity, same mapping
+            ASSERT_EQ(first.get(), cache.readFile(file).get());
+            ASSERT_TRUE(ktx2::Descriptor::validate(first->data(), first->size()));
+        }
+        auto stats = cache.getStats();
+        ASSERT_EQ(files.size(), stats.misses);
+        ASSERT_EQ(files.size() * 2, stats.hits);
+        ASSERT_EQ(0u, stats.evictions);
+        ASSERT_EQ(totalSize, stats.mappedBytes);
+        ASSERT_EQ(files.size(), stats.entryCount);
+
+        cache.clear();
+        ASSERT_EQ(0u, cache.getStats().mappedBytes);
+        ASSERT_EQ(files.size(), cache.getStats().evictions);
+    }
+
+    {
+        // A budget of a single byte can only ever hold the most recent mapping
+        StorageCache cache{ 1 };
+        auto held = cache.readFile(files[0]);
+        for (const auto& file : files) {
+            cache.readFile(file);
+        }
+        auto stats = cache.getStats();
+        ASSERT_EQ(1u, stats.entryCount);
+        ASSERT_EQ(files.size() - 1, stats.evictions);
+        // Evicted mappings that are still referenced remain usable
+        ASSERT_TRUE(ktx2::Descriptor::validate(held->data(), held->size()));
+        ASSERT_NE(held.get(), cache.readFile(files[0]).get());
+
+        cache.setBudget(totalSize);
+        ASSERT_EQ(totalSize, cache.getBudget());
+    }
+
+    {
+        // Rewriting a file gives it a new identity, so the stale mapping isn't handed out
+        StorageCache cache{ 1 << 20 };
+        const std::string filename = ::testing::TempDir() + "khrpp_cache_test.bin";
+        std::ofstream(filename, std::ios::binary) << "first";
+        auto first = cache.readFile(filename);
+        std::ofstream(filename, std::ios::binary) << "second!";
+        auto second = cache.readFile(filename);
+        ASSERT_EQ(2u, cache.getStats().misses);
+        ASSERT_EQ(0, memcmp("second!", second->data(), second->size()));
+
+        // An open handle keeps the identity of the file it was opened on, even once another file replaces it
+        const auto handle = FileStorage::openHandle(filename);
+        FileIdentity before, after, replaced;
+        ASSERT_TRUE(FileIdentity::get(handle, before));
+        ASSERT_TRUE(FileIdentity::get(filename, after));
+        ASSERT_TRUE(before == after);
+        const std::string replacement = filename + ".new";
+        std::ofstream(replacement, std::ios::binary) << "third";
+        ASSERT_EQ(0, rename(replacement.c_str(), filename.c_str()));
+        ASSERT_TRUE(FileIdentity::get(handle, after));
+        ASSERT_TRUE(before == after);
+        ASSERT_TRUE(FileIdentity::get(filename, replaced));
+        ASSERT_FALSE(before == replaced);
+        FileStorage stale{ handle };
+        ASSERT_EQ(0, memcmp("second!", stale.data(), stale.size()));
+        auto third = cache.readFile(filename);
+        ASSERT_EQ(0, memcmp("third", third->data(), third->size()));
+        remove(filename.c_str());
+    }
+
+    ASSERT_THROW(StorageCache{ 1 }.readFile("this/file/does/not.exist"), std::runtime_error);
+}
+
+#if !defined(__ANDROID__) && !defined(_WIN32)
+TEST_F(StorageTest, testWindowedFileStorage) {
+    // A sparse 8 GB texture array, two mips of 512 2048x2048 RGBA8 layers
+    static const uint32_t LAYER_COUNT = 512;
+    static const size_t MAX_MAPPED_BYTES = 64 * 1024 * 1024;
+    const std::string filename = ::testing::TempDir() + "khrpp_windowed_test.ktx2";
+    {
+        ktx2::Descriptor::Header header;
+        memcpy(header.identifier, ktx2::Descriptor::IDENTIFIER().data(), ktx2::Descriptor::IDENTIFIER_LENGTH);
+        header.format = vk::Format::R8G8B8A8_UNORM;
+        header.typeSize = 1;
+        header.pixelWidth = 2048;
+        header.pixelHeight = 2048;
+        header.arrayElementCount = LAYER_COUNT;
+        header.levelCount = 2;
+
+        ktx2::Descriptor::LevelDescriptor levels[2];
+        levels[1].byteOffset = sizeof(header) + sizeof(levels);
+        levels[1].byteLength = levels[1].uncompressedByteLength = 1024ull * 1024 * 4 * LAYER_COUNT;
+        levels[0].byteOffset = levels[1].byteOffset + levels[1].byteLength;
+        levels[0].byteLength = levels[0].uncompressedByteLength = 2048ull * 2048 * 4 * LAYER_COUNT;
+
+        FILE* file = fopen(filename.c_str(), "wb");
+        ASSERT_NE(nullptr, file);
+        fwrite(&header, sizeof(header), 1, file);
+        fwrite(levels, sizeof(levels), 1, file);
+        fclose(file);
+        if (0 != truncate(filename.c_str(), (off_t)(levels[0].byteOffset + levels[0].byteLength))) {
+            remove(filename.c_str());
+            GTEST_SKIP() << "Unable to create a sparse file in " << ::testing::TempDir();
+        }
+    }
+
+    {
+        auto storage = std::make_shared<const WindowedFileStorage>(filename);
+        ASSERT_GT(storage->fileSize(), 8ull * 1024 * 1024 * 1024);
+        ASSERT_LE(storage->mappedBytes(), WindowedFileStorage::DEFAULT_WINDOW_SIZE);
+
+        ktx2::Descriptor descriptor;
+        descriptor.parseIndex(storage->data(), storage->size(), storage->fileSize());
+        ASSERT_LE(descriptor.header.getIndexSize(), storage->size());
+        ASSERT_EQ(2u, descriptor.levels.size());
+
+        // Map one layer of each mip at a time, walking the whole array
+        for (const auto& level : descriptor.levels) {
+            const size_t layerSize = level.byteLength / LAYER_COUNT;
+            for (uint32_t layer = 0; layer < LAYER_COUNT; layer += 31) {
+                auto view = storage->createView(layerSize, level.byteOffset + layer * layerSize);
+                ASSERT_EQ(layerSize, view->size());
+                ASSERT_EQ(0u, view->data()[0] + view->data()[layerSize - 1]);
+                ASSERT_LT(storage->mappedBytes(), MAX_MAPPED_BYTES);
+            }
+        }
+        // Views release their mappings as they go
+        ASSERT_LE(storage->mappedBytes(), WindowedFileStorage::DEFAULT_WINDOW_SIZE);
+
+        // A view of the whole file reserves address space, but only what's touched becomes resident
+        auto whole = storage->createView();
+        ASSERT_EQ(storage->fileSize(), whole->size());
+        ASSERT_EQ(0u, whole->data()[whole->size() - 1]);
+        whole.reset();
+
+        ASSERT_THROW(storage->createView(2, storage->fileSize() - 1), std::runtime_error);
+    }
+    remove(filename.c_str());
+
+    // The full parse still agrees with the windowed one on real files
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = std::make_shared<const WindowedFileStorage>(file);
+        ktx2::Descriptor windowed;
+        windowed.parseIndex(storage->data(), storage->size(), storage->fileSize());
+        auto full = Storage::readFile(file);
+        ktx2::Descriptor descriptor;
+        descriptor.parse(full->data(), full->size());
+        ASSERT_EQ(descriptor.levels.size(), windowed.levels.size());
+        for (size_t i = 0; i < descriptor.levels.size(); ++i) {
+            const auto& level = descriptor.levels[i];
+            auto view = storage->createView(level.byteLength, level.byteOffset);
+            ASSERT_EQ(0, memcmp(full->data() + level.byteOffset, view->data(), level.byteLength));
+        }
+    }
+}
+#endif
+
+TEST_F(StorageTest, testStorageSpan) {
+    static const uint32_t LAYER_COUNT = 5;
+    static const uint32_t FACE_COUNT = 6;
+    auto bytes = makeKtx2(16, LAYER_COUNT, FACE_COUNT, 5);
+    auto storage = Storage::create(bytes.size(), bytes.data());
+    ktx2::Descriptor descriptor;
+    descriptor.parse(storage->data(), storage->size());
+
+    StorageSpan file{ storage };
+    ASSERT_EQ(storage->data(), file.data());
+    ASSERT_EQ(storage->size(), file.size());
+    for (uint32_t level = 0; level < descriptor.levels.size(); ++level) {
+        auto levelSpan = descriptor.getLevel(file, level);
+        ASSERT_EQ(descriptor.levels[level].byteOffset, levelSpan.offset());
+        ASSERT_EQ(descriptor.levels[level].byteLength, levelSpan.size());
+        for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+            for (uint32_t face = 0; face < FACE_COUNT; ++face) {
+                auto image = descriptor.getImage(file, level, layer, face);
+                ASSERT_EQ(levelSpan.size() / (LAYER_COUNT * FACE_COUNT), image.size());
+                ASSERT_EQ(layer * FACE_COUNT + face, image.front());
+                ASSERT_EQ(layer * FACE_COUNT + face, image[image.size() - 1]);
+            }
+        }
+    }
+    ASSERT_THROW(descriptor.getLevel(file, 5), std::runtime_error);
+    ASSERT_THROW(descriptor.getImage(file, 0, LAYER_COUNT), std::runtime_error);
+    ASSERT_THROW(descriptor.getImage(file, 0, 0, FACE_COUNT), std::runtime_error);
+
+    // Slicing
+    ASSERT_EQ(file.size() - 10, file.subspan(10).size());
+    ASSERT_TRUE(file.subspan(10, 0).empty());
+    ASSERT_TRUE(file.subspan(file.size()).empty());
+    ASSERT_THROW(file.subspan(file.size() + 1), std::runtime_error);
+    ASSERT_THROW(file.subspan(10, file.size()), std::runtime_error);
+    ASSERT_FALSE(StorageSpan{}.retain());
+
+    // Retaining the whole storage hands back the storage itself, anything else is a view that keeps it alive
+    ASSERT_EQ(storage, file.retain());
+    auto image = descriptor.getImage(file, 0, LAYER_COUNT - 1, FACE_COUNT - 1);
+    auto retained = image.retain();
+    auto retainedEmpty = file.subspan(10, 0).retain();
+    storage.reset();
+    ASSERT_EQ(image.size(), retained->size());
+    ASSERT_EQ(0u, retainedEmpty->size());
+    ASSERT_EQ(LAYER_COUNT * FACE_COUNT - 1, retained->data()[retained->size() - 1]);
+
+    // KTX 1
+    for (const auto& file : getKtxTestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        for (uint32_t mip = 0; mip < descriptor.mipDescriptors.size(); ++mip) {
+            const auto& mipDescriptor = descriptor.mipDescriptors[mip];
+            auto image = descriptor.getImage(*storage, mip);
+            ASSERT_EQ(mipDescriptor.imageSize, image.size());
+            ASSERT_EQ(storage->data() + mipDescriptor.arrayOffsets[0][0], image.data());
+        }
+    }
+}
+
+TEST_F(StorageTest, benchmarkViewCreation) {
+    static const uint32_t LAYER_COUNT = 2048;
+    static const uint32_t LEVEL_COUNT = 6;
+    static const size_t ITERATIONS = 10;
+    auto bytes = makeKtx2(32, LAYER_COUNT, 1, LEVEL_COUNT);
+    auto storage = Storage::create(bytes.size(), bytes.data());
+    ktx2::Descriptor descriptor;
+    descriptor.parse(storage->data(), storage->size());
+
+    std::vector<Storage::ConstPointer> views;
+    views.reserve(LAYER_COUNT * LEVEL_COUNT);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        views.clear();
+        for (const auto& level : descriptor.levels) {
+            const size_t imageSize = level.byteLength / LAYER_COUNT;
+            for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+                views.push_back(storage->createView(imageSize, level.byteOffset + layer * imageSize));
+            }
+        }
+    }
+    auto viewTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
+    views.clear();
+
+    std::vector<StorageSpan> spans;
+    spans.reserve(LAYER_COUNT * LEVEL_COUNT);
+    const StorageSpan file{ storage };
+    start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 0; i < ITERATIONS; ++i) {
+        spans.clear();
+        for (uint32_t level = 0; level < LEVEL_COUNT; ++level) {
+            for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+                spans.push_back(descriptor.getImage(file, level, layer));
+            }
+        }
+    }
+    auto spanTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start);
+    ASSERT_EQ(LAYER_COUNT * LEVEL_COUNT, spans.size());
+    ASSERT_EQ((uint8_t)(LAYER_COUNT - 1), spans.back().front());
+    ASSERT_EQ(1, storage.use_count());
+
+    std::cout << LAYER_COUNT * LEVEL_COUNT << " subresources of a " << LAYER_COUNT << " layer array, averaged over " << ITERATIONS
+              << " passes" << std::endl;
+    std::cout << "    createView  " << viewTime.count() / ITERATIONS << " us" << std::endl;
+    std::cout << "    StorageSpan " << spanTime.count() / ITERATIONS << " us" << std::endl;
+}
+
+TEST_F(StorageTest, testReadFileDirect) {
+    std::vector<std::string> files;
+    for (const auto& file : getKtx2TestFiles()) {
+        files.push_back(file);
+    }
+    for (const auto& file : getKtxTestFiles()) {
+        files.push_back(file);
+    }
+    // A size that isn't a multiple of the block size, in a location that may not support O_DIRECT
+    const std::string oddFile = ::testing::TempDir() + "khrpp_direct_test.bin";
+    {
+        std::ofstream output(oddFile, std::ios::binary);
+        for (size_t i = 0; i < 3 * getPageSize() + 123; ++i) {
+            output.put((char)(i * 13));
+        }
+    }
+    files.push_back(oddFile);
+
+    for (const auto& file : files) {
+        auto storage = Storage::readFileDirect(file);
+        auto mapped = Storage::readFile(file);
+        ASSERT_TRUE(storage->isFast());
+        ASSERT_FALSE(mapped->isFast());
+        ASSERT_EQ(0u, reinterpret_cast<uintptr_t>(storage->data()) % getPageSize());
+        ASSERT_EQ(mapped->size(), storage->size());
+        ASSERT_EQ(0, memcmp(mapped->data(), storage->data(), storage->size()));
+    }
+    remove(oddFile.c_str());
+    ASSERT_THROW(Storage::readFileDirect("this/file/does/not.exist"), std::runtime_error);
+}
+
+TEST_F(StorageTest, testReadFileRanges) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto mapped = Storage::readFile(file);
+        // Every other 1000 bytes, in reverse, plus an empty range
+        std::vector<Storage::FileRange> ranges;
+        size_t targetSize = 0;
+        for (size_t offset = 0; offset < mapped->size(); offset += 2000) {
+            const size_t size = std::min<size_t>(1000, mapped->size() - offset);
+            ranges.insert(ranges.begin(), Storage::FileRange{ offset, size, targetSize });
+            targetSize += size;
+        }
+        ranges.push_back(Storage::FileRange{ 0, 0, 0 });
+        std::vector<uint8_t> target(targetSize);
+        Storage::readFileRanges(file, ranges, target.data());
+        for (const auto& range : ranges) {
+            ASSERT_EQ(0, memcmp(mapped->data() + range.offset, target.data() + range.targetOffset, range.size));
+        }
+        // A single range, which goes through pread
+        target.resize(mapped->size());
+        Storage::readFileRanges(file, { { 16, mapped->size() - 16, 0 } }, target.data());
+        ASSERT_EQ(0, memcmp(mapped->data() + 16, target.data(), mapped->size() - 16));
+
+        // Ranges past the end of the file can't be read in full
+        ASSERT_THROW(Storage::readFileRanges(file, { { 0, 8, 0 }, { mapped->size() - 4, 8, 8 } }, target.data()), std::runtime_error);
+        ASSERT_THROW(Storage::readFileRanges(file, { { mapped->size() - 4, 8, 0 } }, target.data()), std::runtime_error);
+    }
+    uint8_t target[4];
+    ASSERT_THROW(Storage::readFileRanges("this/file/does/not.exist", { { 0, 4, 0 } }, target), std::runtime_error);
+}
+
+#if defined(KHRPP_HAVE_IO_URING)
+TEST_F(StorageTest, testIoUring) {
+    if (!IoUring::isSupported({ IORING_OP_NOP })) {
+        return;
+    }
+    IoUring ring{ 4 };
+    // Waiting with nothing submitted returns rather than blocking on a completion that can never arrive
+    ASSERT_EQ(0, ring.submit(1));
+    for (uint32_t i = 0; i < 4; ++i) {
+        auto sqe = ring.getSqe();
+        ASSERT_NE(nullptr, sqe);
+        sqe->opcode = IORING_OP_NOP;
+        sqe->user_data = i;
+    }
+    ASSERT_EQ(nullptr, ring.getSqe());
+    ASSERT_EQ(4u, ring.queued());
+    ASSERT_EQ(0u, ring.inFlight());
+    // Entries only count as in flight once the kernel has taken them
+    ASSERT_EQ(4, ring.submit(4));
+    ASSERT_EQ(0u, ring.queued());
+    ASSERT_EQ(4u, ring.inFlight());
+    uint64_t seen = 0;
+    ASSERT_EQ(4u, ring.reap([&](const io_uring_cqe& cqe) { seen |= (uint64_t)1 << cqe.user_data; }));
+    ASSERT_EQ(0xFu, seen);
+    ASSERT_EQ(0u, ring.inFlight());
+    ASSERT_EQ(0, ring.submit(1));
+}
+#endif
+
+TEST_F(StorageTest, benchmarkDirectReads) {
+    static const size_t FILE_COUNT = 8;
+    static const size_t FILE_SIZE = 32 * 1024 * 1024;
+    std::vector<std::string> files;
+    {
+        std::vector<char> contents(FILE_SIZE);
+        for (size_t i = 0; i < contents.size(); ++i) {
+            contents[i] = (char)(i * 7);
+        }
+        for (size_t i = 0; i < FILE_COUNT; ++i) {
+            files.push_back(::testing::TempDir() + "khrpp_direct_bench_" + std::to_string(i) + ".bin");
+            std::ofstream(files.back(), std::ios::binary).write(contents.data(), contents.size());
+        }
+    }
+
+    const auto measure = [&](const std::function<Storage::ConstPointer(const std::string&)>& read) {
+        for (const auto& file : files) {
+            evictFromPageCache(file);
+        }
+        uint64_t sum = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (const auto& file : files) {
+            sum += touchStorage(*read(file));
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        EXPECT_NE(0u, sum);
+        // Bytes per microsecond is MB/s
+        return (double)(FILE_COUNT * FILE_SIZE) / std::max<int64_t>(1, elapsed);
+    };
+
+    auto mappedThroughput = measure([](const std::string& file) { return Storage::readFile(file); });
+    auto readThroughput = measure([](const std::string& file) { return detail::readFileContents(file); });
+    auto directThroughput = measure([](const std::string& file) { return Storage::readFileDirect(file); });
+    for (const auto& file : files) {
+        remove(file.c_str());
+    }
+
+    std::cout << "Cold read of " << FILE_COUNT << " x " << FILE_SIZE / (1024 * 1024) << " MB files" << std::endl;
+    std::cout << "    readFile       " << (uint64_t)mappedThroughput << " MB/s" << std::endl;
+    std::cout << "    pread          " << (uint64_t)readThroughput << " MB/s" << std::endl;
+    std::cout << "    readFileDirect " << (uint64_t)directThroughput << " MB/s" << std::endl;
+}
+
+TEST_F(StorageTest, testResidency) {
+    // Freshly mapped anonymous pages aren't resident until they're touched
+    const size_t size = 64 * getPageSize();
+    MemoryStorage memory{ size, nullptr, AllocationPolicy::PAGE_ALIGNED };
+    const size_t initial = memory.residentBytes();
+    ASSERT_LE(initial, size);
+    memset(memory.mutableData(), 1, size / 2);
+    ASSERT_GE(memory.residentBytes(), size / 2);
+    ASSERT_EQ(size / 2, memory.residentBytes(0, size / 2));
+    ASSERT_EQ(10u, memory.residentBytes(5, 10));
+    ASSERT_EQ(0u, memory.residentBytes(size));
+    ASSERT_EQ(0u, StorageSpan{}.residentBytes());
+
+    for (const auto& file : getKtx2TestFiles()) {
+        evictFromPageCache(file);
+        auto storage = Storage::readFile(file);
+        ASSERT_LE(storage->residentBytes(), storage->size());
+        touchStorage(*storage);
+        ASSERT_EQ(storage->size(), storage->residentBytes());
+        auto view = storage->createView(storage->size() / 2, storage->size() / 3);
+        ASSERT_EQ(view->size(), view->residentBytes());
+        ASSERT_EQ(view->size(), StorageSpan{ view }.residentBytes());
+    }
+}
+
+TEST_F(StorageTest, testFaultProbe) {
+    const size_t size = 256 * getPageSize();
+    MemoryStorage memory{ size, nullptr, AllocationPolicy::PAGE_ALIGNED };
+    FaultProbe probe{ memory };
+    memset(memory.mutableData(), 1, size);
+    auto result = probe.sample();
+#if defined(__linux__)
+    // Touching fresh anonymous pages has to fault them in, but never needs any I/O
+    ASSERT_GT(result.minorFaults, 0u);
+    ASSERT_EQ(size - result.residentBefore, result.bytesPagedIn);
+#endif
+    ASSERT_EQ(size, result.rangeSize);
+    ASSERT_GT(result.elapsed.count(), 0);
+
+    // Nothing happens between the restart and the sample
+    probe.restart();
+    result = probe.sample();
+    ASSERT_EQ(0u, result.bytesPagedIn);
+    ASSERT_EQ(size, result.residentBefore);
+}
+
+TEST_F(StorageTest, benchmarkCorpusFaults) {
+    std::vector<std::string> files;
+    for (const auto& file : getKtx2TestFiles()) {
+        files.push_back(file);
+    }
+    for (const auto& file : getKtxTestFiles()) {
+        files.push_back(file);
+    }
+
+    const auto load = [](const std::string& file) {
+        auto storage = Storage::readFile(file);
+        FaultProbe probe{ *storage };
+        bool valid = ktx2::Descriptor::validate(storage->data(), storage->size()) || ktx::Descriptor::validate(storage->data(), storage->size());
+        EXPECT_TRUE(valid);
+        return probe.sample();
+    };
+
+    for (const bool cold : { true, false }) {
+        std::cout << (cold ? "Cold" : "Warm") << " parse of the test corpus" << std::endl;
+        for (const auto& file : files) {
+            if (cold) {
+                evictFromPageCache(file);
+            }
+            auto result = load(file);
+            std::cout << "    " << file.substr(file.find_last_of("/\\") + 1) << ": " << result.elapsed.count() / 1000 << " us, "
+                      << result.minorFaults << " minor / " << result.majorFaults << " major faults, " << result.readBytes << " bytes read, "
+                      << result.bytesPagedIn << " of " << result.rangeSize << " bytes paged in" << (result.isIoBound() ? " (I/O bound)" : "")
+                      << std::endl;
+            if (!cold) {
+                EXPECT_EQ(0u, result.majorFaults);
+            }
+        }
+    }
+}
+
+#if defined(KHRPP_HAVE_SHARED_MEMORY)
+TEST_F(StorageTest, testSharedMemoryStorage) {
+    const auto files = getKtx2TestFiles();
+    if (files.empty()) {
+        return;
+    }
+    auto source = Storage::readFile(files.front());
+
+    auto shared = std::make_shared<SharedMemoryStorage>(source->size(), source->data());
+    ASSERT_FALSE(shared->isPublished());
+    ASSERT_TRUE(shared->isFast());
+    // Unpublished storage can't be sent
+    int sockets[2];
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+    ASSERT_THROW(SharedMemoryStorage::send(sockets[0], *shared), std::runtime_error);
+
+    shared->publish();
+    ASSERT_TRUE(shared->isPublished());
+    ASSERT_THROW(shared->mutableData(), std::runtime_error);
+    ASSERT_EQ(0, memcmp(source->data(), shared->data(), source->size()));
+    // The seals stop anyone holding the fd from changing the contents
+    ASSERT_NE(0, ftruncate(shared->getFd(), 0));
+    ASSERT_EQ(-1, pwrite(shared->getFd(), "x", 1, 0));
+    ASSERT_EQ(MAP_FAILED, mmap(nullptr, shared->size(), PROT_READ | PROT_WRITE, MAP_SHARED, shared->getFd(), 0));
+
+    SharedMemoryStorage::send(sockets[0], *shared);
+    auto received = SharedMemoryStorage::receive(sockets[1]);
+    ASSERT_NE(shared->data(), received->data());
+    ASSERT_EQ(shared->size(), received->size());
+    ASSERT_TRUE(ktx2::Descriptor::validate(received->data(), received->size()));
+
+    // A different process fills and publishes, this one maps the same pages
+    std::vector<uint8_t> expected(3 * getPageSize() + 5);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = (uint8_t)(i * 17);
+    }
+    pid_t child = fork();
+    ASSERT_NE(-1, child);
+    if (0 == child) {
+        int status = 0;
+        try {
+            SharedMemoryStorage decoded{ expected.size() };
+            memcpy(decoded.mutableData(), expected.data(), expected.size());
+            decoded.publish();
+            SharedMemoryStorage::send(sockets[0], decoded);
+        } catch (...) {
+            status = 1;
+        }
+        _exit(status);
+    }
+    auto fromChild = SharedMemoryStorage::receive(sockets[1]);
+    int status = -1;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+    ASSERT_EQ(expected.size(), fromChild->size());
+    ASSERT_EQ(0, memcmp(expected.data(), fromChild->data(), expected.size()));
+
+    // Unsealed memfds are refused
+    int unsealed = memfd_create("unsealed", MFD_CLOEXEC);
+    ASSERT_NE(-1, unsealed);
+    ASSERT_THROW(SharedMemoryStorage::adopt(unsealed), std::runtime_error);
+    ASSERT_EQ(-1, fcntl(unsealed, F_GETFD));
+
+    // Empty storage works too
+    SharedMemoryStorage empty{ (size_t)0 };
+    empty.publish();
+    ASSERT_EQ(0u, empty.size());
+    ASSERT_NE(nullptr, empty.data());
+
+    close(sockets[0]);
+    close(sockets[1]);
+    ASSERT_THROW(SharedMemoryStorage::receive(sockets[1]), std::runtime_error);
+}
+#endif
+
+TEST_F(StorageTest, testStreamingStorage) {
+    static const uint32_t LAYER_COUNT = 2;
+    static const uint32_t LEVEL_COUNT = 8;
+    static const size_t CHUNK_SIZE = 100;
+    auto bytes = makeKtx2(128, LAYER_COUNT, 1, LEVEL_COUNT);
+    auto stream = std::make_shared<StreamingStorage>(bytes.size());
+    const uint8_t* base = stream->data();
+    ASSERT_EQ(0u, stream->size());
+    ASSERT_FALSE(stream->isComplete());
+    ASSERT_EQ(0u, stream->waitFor(1, std::chrono::milliseconds(1)));
+
+    // Everything but the last byte arrives in small pieces, the rest only once the consumer has used the small levels
+    std::promise<void> release;
+    std::thread producer([&] {
+        size_t offset = 0;
+        while (offset < bytes.size() - 1) {
+            const size_t chunk = std::min(CHUNK_SIZE, bytes.size() - 1 - offset);
+            stream->append(bytes.data() + offset, chunk);
+            offset += chunk;
+        }
+        release.get_future().wait();
+        stream->append(bytes.data() + offset, bytes.size() - offset);
+        stream->finish();
+    });
+
+    // The level index says how big the file will be before the level data arrives
+    ASSERT_LE(sizeof(ktx2::Descriptor::Header), stream->waitFor(sizeof(ktx2::Descriptor::Header)));
+    ktx2::Descriptor::Header header;
+    memcpy(&header, stream->data(), sizeof(header));
+    const size_t available = stream->waitFor(header.getIndexSize());
+    const size_t fileSize = ktx2::Descriptor::getFileSize(stream->data(), available);
+    ASSERT_EQ(bytes.size(), fileSize);
+    ASSERT_EQ(0u, ktx2::Descriptor::getFileSize(stream->data(), sizeof(header) - 1));
+    ktx2::Descriptor descriptor;
+    descriptor.parseIndex(stream->data(), available, fileSize);
+    ASSERT_EQ(LEVEL_COUNT, descriptor.levels.size());
+
+    // Smallest levels first, while the largest is still outstanding
+    for (uint32_t level = LEVEL_COUNT; level-- > 1;) {
+        const auto& levelDescriptor = descriptor.levels[level];
+        ASSERT_LE(levelDescriptor.byteOffset + levelDescriptor.byteLength, stream->waitFor(levelDescriptor.byteOffset + levelDescriptor.byteLength));
+        StorageSpan file{ stream };
+        for (uint32_t layer = 0; layer < LAYER_COUNT; ++layer) {
+            auto image = descriptor.getImage(file, level, layer);
+            ASSERT_EQ((uint8_t)layer, image.front());
+            ASSERT_EQ((uint8_t)layer, image[image.size() - 1]);
+        }
+        ASSERT_FALSE(stream->isComplete());
+    }
+    // The producer may still be appending up to the last byte, but never past it until released
+    ASSERT_EQ(bytes.size() - 1, stream->waitFor(bytes.size() - 1));
+    release.set_value();
+    ASSERT_EQ(bytes.size(), stream->waitFor(fileSize));
+    producer.join();
+
+    // Addresses never move, and the completed storage is the whole file
+    ASSERT_TRUE(stream->isComplete());
+    ASSERT_EQ(base, stream->data());
+    ASSERT_EQ(bytes.size(), stream->waitFor(fileSize + 1));
+    ASSERT_EQ(0, memcmp(bytes.data(), stream->data(), bytes.size()));
+    ASSERT_TRUE(ktx2::Descriptor::validate(stream->data(), stream->size()));
+    ASSERT_EQ((uint8_t)1, descriptor.getImage(StorageSpan{ stream }, 0, 1).front());
+    ASSERT_THROW(stream->append(bytes.data(), stream->capacity() - stream->size() + 1), std::runtime_error);
+
+    // Waiters are woken, and throw, when the producer fails
+    auto failing = std::make_shared<StreamingStorage>();
+    std::thread failer([&] {
+        failing->append(bytes.data(), 10);
+        failing->fail();
+    });
+    ASSERT_THROW(failing->waitFor(bytes.size()), std::runtime_error);
+    failer.join();
+
+#if !defined(_WIN32)
+    // Reading from a pipe, which spans several commit chunks
+    std::vector<uint8_t> large(3 * StreamingStorage::COMMIT_CHUNK_SIZE + 13);
+    for (size_t i = 0; i < large.size(); ++i) {
+        large[i] = (uint8_t)(i * 31);
+    }
+    int fds[2];
+    ASSERT_EQ(0, pipe(fds));
+    auto piped = std::make_shared<StreamingStorage>();
+    std::thread writer([&] {
+        size_t offset = 0;
+        while (offset < large.size()) {
+            const ssize_t written = write(fds[1], large.data() + offset, std::min<size_t>(4096, large.size() - offset));
+            if (written <= 0) {
+                break;
+            }
+            offset += (size_t)written;
+        }
+        close(fds[1]);
+    });
+    std::thread reader([&] { piped->appendFrom(fds[0]); });
+    ASSERT_LE(large.size() / 2, piped->waitFor(large.size() / 2));
+    ASSERT_EQ(large[large.size() / 2 - 1], piped->data()[large.size() / 2 - 1]);
+    ASSERT_EQ(large.size(), piped->waitFor(large.size() + 1));
+    writer.join();
+    reader.join();
+    close(fds[0]);
+    ASSERT_TRUE(piped->isComplete());
+    ASSERT_EQ(0, memcmp(large.data(), piped->data(), large.size()));
+
+    // An input that exactly fills the capacity is complete, and one a byte longer fails
+    for (size_t extra : { (size_t)0, (size_t)1 }) {
+        auto bounded = std::make_shared<StreamingStorage>(1);
+        std::vector<uint8_t> input(bounded->capacity() + extra, 0x5A);
+        ASSERT_EQ(0, pipe(fds));
+        std::thread boundedWriter([&] {
+            size_t offset = 0;
+            while (offset < input.size()) {
+                const ssize_t written = write(fds[1], input.data() + offset, input.size() - offset);
+                if (written <= 0) {
+                    break;
+                }
+                offset += (size_t)written;
+            }
+            close(fds[1]);
+        });
+        if (extra) {
+            ASSERT_THROW(bounded->appendFrom(fds[0]), std::runtime_error);
+            ASSERT_THROW(bounded->waitFor(input.size()), std::runtime_error);
+        } else {
+            bounded->appendFrom(fds[0]);
+            ASSERT_TRUE(bounded->isComplete());
+            ASSERT_EQ(input.size(), bounded->waitFor(input.size() + 1));
+        }
+        boundedWriter.join();
+        close(fds[0]);
+    }
+#endif
+}
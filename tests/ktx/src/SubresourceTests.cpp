@@ -0,0 +1,136 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/subresource.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class SubresourceTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+TEST_F(SubresourceTest, testKtx2) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        const StorageSpan span{ storage };
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        if (descriptor.header.supercompressionScheme != ktx2::SupercompressionScheme::NONE) {
+            ASSERT_THROW(SubresourceIndex::create(descriptor), std::runtime_error);
+            continue;
+        }
+
+        const auto index = SubresourceIndex::create(descriptor);
+        ASSERT_EQ(descriptor.levels.size(), index.getLevelCount());
+        for (uint32_t level = 0; level < index.getLevelCount(); ++level) {
+            const uint32_t sliceCount = index.getSliceCount(level);
+            ASSERT_EQ(std::max<uint32_t>(1, descriptor.header.pixelDepth >> level), sliceCount);
+            // The slices of every image exactly cover the level, in order
+            size_t offset = descriptor.levels[level].byteOffset;
+            for (uint32_t layer = 0; layer < index.getLayerCount(); ++layer) {
+                for (uint32_t face = 0; face < index.getFaceCount(); ++face) {
+                    const auto image = index.getImage(span, level, layer, face);
+                    const auto expected = descriptor.getImage(span, level, layer, face);
+                    ASSERT_EQ(expected.offset(), image.offset());
+                    ASSERT_EQ(expected.size(), image.size());
+                    for (uint32_t slice = 0; slice < sliceCount; ++slice) {
+                        const auto range = index.getSlice(level, layer, face, slice);
+                        ASSERT_EQ(offset, range.offset);
+                        offset += range.size;
+                    }
+                    ASSERT_THROW(index.getSlice(level, layer, face, sliceCount), std::runtime_error);
+                }
+            }
+            ASSERT_EQ(descriptor.levels[level].byteOffset + descriptor.levels[level].byteLength, offset);
+            // The DFD agrees with the level index where it has a fixed block size
+            if (descriptor.getSliceSize(level)) {
+                ASSERT_EQ(descriptor.getSliceSize(level), index.getLevel(level).sliceSize);
+            }
+        }
+        ASSERT_THROW(index.getImage(index.getLevelCount()), std::runtime_error);
+        ASSERT_THROW(index.getImage(0, index.getLayerCount()), std::runtime_error);
+        ASSERT_THROW(index.getImage(0, 0, index.getFaceCount()), std::runtime_error);
+    }
+
+    ktx2::Descriptor supercompressed;
+    supercompressed.header.supercompressionScheme = ktx2::SupercompressionScheme::ZSTD;
+    ASSERT_THROW(SubresourceIndex::create(supercompressed), std::runtime_error);
+}
+
+TEST_F(SubresourceTest, testKtx) {
+    for (const auto& file : getKtxTestFiles()) {
+        auto storage = Storage::readFile(file);
+        const StorageSpan span{ storage };
+        ktx::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        const auto index = SubresourceIndex::create(descriptor);
+        ASSERT_EQ(descriptor.mipDescriptors.size(), index.getLevelCount());
+        for (uint32_t mip = 0; mip < index.getLevelCount(); ++mip) {
+            for (uint32_t layer = 0; layer < index.getLayerCount(); ++layer) {
+                for (uint32_t face = 0; face < index.getFaceCount(); ++face) {
+                    const auto image = index.getImage(span, mip, layer, face);
+                    const auto expected = descriptor.getImage(span, mip, layer, face);
+                    ASSERT_EQ(expected.offset(), image.offset());
+                    ASSERT_EQ(expected.size(), image.size());
+                }
+            }
+        }
+        // The last mip, with its padding, ends the file
+        const auto& last = index.getLevel(index.getLevelCount() - 1);
+        ASSERT_EQ(storage->size(), ktx::evalPaddedSize(last.offset + last.imageStride * index.getLayerCount() * index.getFaceCount()));
+    }
+}
+
+TEST_F(SubresourceTest, testKtxLayouts) {
+    // A non-array cube map gives the size of a single face, and each face is padded to 4 bytes
+    ktx::Descriptor cube;
+    cube.header.pixelWidth = 2;
+    cube.header.pixelHeight = 2;
+    cube.header.numberOfFaces = 6;
+    cube.header.numberOfMipmapLevels = 2;
+    cube.header.bytesOfKeyValueData = 16;
+    cube.mipDescriptors.resize(2);
+    // 2x2 and 1x1 RGB8 with 4 byte row alignment
+    cube.mipDescriptors[0].imageSize = 16;
+    cube.mipDescriptors[1].imageSize = 3;
+    auto index = SubresourceIndex::create(cube);
+    ASSERT_EQ(1u, index.getLayerCount());
+    ASSERT_EQ(6u, index.getFaceCount());
+    ASSERT_EQ(64u + 16 + 4, index.getSlice(0).offset);
+    ASSERT_EQ(64u + 16 + 4 + 16 * 5, index.getSlice(0, 0, 5).offset);
+    const size_t secondMip = 64 + 16 + 4 + 16 * 6 + 4;
+    ASSERT_EQ(secondMip, index.getSlice(1).offset);
+    ASSERT_EQ(secondMip + 4 * 3, index.getImage(1, 0, 3).offset);
+    ASSERT_EQ(3u, index.getImage(1, 0, 3).size);
+
+    // Everywhere else the size covers every layer, face and z slice of the mip
+    ktx::Descriptor volume;
+    volume.header.pixelWidth = 4;
+    volume.header.pixelHeight = 4;
+    volume.header.pixelDepth = 8;
+    volume.header.numberOfArrayElements = 3;
+    volume.header.numberOfMipmapLevels = 2;
+    volume.mipDescriptors.resize(2);
+    volume.mipDescriptors[0].imageSize = 4 * 4 * 8 * 4 * 3;
+    volume.mipDescriptors[1].imageSize = 2 * 2 * 4 * 4 * 3;
+    index = SubresourceIndex::create(volume);
+    ASSERT_EQ(3u, index.getLayerCount());
+    ASSERT_EQ(8u, index.getSliceCount(0));
+    ASSERT_EQ(4u, index.getSliceCount(1));
+    ASSERT_EQ(64u, index.getLevel(0).sliceSize);
+    ASSERT_EQ(68u + 2 * 512 + 5 * 64, index.getSlice(0, 2, 0, 5).offset);
+    ASSERT_EQ(68u + 3 * 512 + 4 + 16 * 4 + 3 * 16, index.getSlice(1, 1, 0, 3).offset);
+
+    volume.mipDescriptors[1].imageSize += 1;
+    ASSERT_THROW(SubresourceIndex::create(volume), std::runtime_error);
+}
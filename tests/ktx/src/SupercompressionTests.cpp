@@ -0,0 +1,239 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/supercompression.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <functional>
+#include <iostream>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class SupercompressionTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+using Compressor = std::function<Bytes(const StorageSpan&)>;
+
+// Rewrites an uncompressed KTX2 file with every level supercompressed by `compress`.  The header and level index are
+// the same size either way, so the DFD and KVD stay where they are, and the levels are packed without padding.
+static Bytes supercompress(const Storage& source, ktx2::SupercompressionScheme scheme, const Compressor& compress) {
+    ktx2::Descriptor descriptor;
+    descriptor.parse(source.data(), source.size());
+    const StorageSpan file{ source };
+    auto header = descriptor.header;
+    header.supercompressionScheme = scheme;
+    auto levels = descriptor.levels;
+
+    const size_t indexSize = header.getIndexSize();
+    Bytes result(source.data(), source.data() + indexSize);
+    for (uint32_t level = (uint32_t)levels.size(); level-- > 0;) {
+        const auto compressed = compress(descriptor.getLevel(file, level));
+        levels[level].byteOffset = result.size();
+        levels[level].byteLength = compressed.size();
+        levels[level].uncompressedByteLength = descriptor.levels[level].byteLength;
+        result.insert(result.end(), compressed.begin(), compressed.end());
+    }
+    memcpy(result.data(), &header, sizeof(header));
+    memcpy(result.data() + sizeof(header), levels.data(), levels.size() * sizeof(ktx2::Descriptor::LevelDescriptor));
+    return result;
+}
+
+// Checks that every level of `compressed` decompresses to the matching level of `original`
+static void testRoundTrip(const Storage::ConstPointer& original, const Storage::ConstPointer& compressed, ThreadPool& pool) {
+    ktx2::Descriptor expected;
+    expected.parse(original->data(), original->size());
+    ktx2::DescriptorView view;
+    view.parse(compressed);
+
+    size_t totalSize = 0;
+    for (const auto& level : view.levels) {
+        totalSize += level.uncompressedByteLength;
+    }
+    Bytes decompressed(totalSize);
+    std::vector<ktx2::LevelTarget> targets;
+    size_t offset = 0;
+    for (uint32_t level = 0; level < view.levels.size(); ++level) {
+        targets.push_back({ level, decompressed.data() + offset, view.levels[level].uncompressedByteLength });
+        offset += view.levels[level].uncompressedByteLength;
+    }
+    ktx2::decompressLevels(view, targets, pool);
+    for (const auto& target : targets) {
+        auto level = expected.getLevel(StorageSpan{ *original }, target.level);
+        ASSERT_EQ(level.size(), target.size);
+        ASSERT_EQ(0, memcmp(level.data(), target.data, target.size));
+    }
+}
+
+TEST_F(SupercompressionTest, testUncompressedLevels) {
+    ThreadPool pool{ 4 };
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        testRoundTrip(storage, storage, pool);
+    }
+    ASSERT_TRUE(ktx2::canDecompress(ktx2::SupercompressionScheme::NONE));
+    ASSERT_FALSE(ktx2::canDecompress(ktx2::SupercompressionScheme::LZMA));
+}
+
+// Round trips every test file through `scheme`, and checks that bad targets and corrupt data are caught
+static void testScheme(ktx2::SupercompressionScheme scheme, const Compressor& compress) {
+    ASSERT_TRUE(ktx2::canDecompress(scheme));
+    ThreadPool pool{ 4 };
+    for (const auto& file : getKtx2TestFiles()) {
+        auto original = Storage::readFile(file);
+        auto bytes = supercompress(*original, scheme, compress);
+        auto compressed = Storage::create(bytes.size(), bytes.data());
+        ASSERT_TRUE(ktx2::Descriptor::validate(compressed->data(), compressed->size()));
+        testRoundTrip(original, compressed, pool);
+
+        // Selected levels only, from inside a task on the same pool
+        ktx2::LazyDescriptor lazy{ compressed };
+        const uint32_t lastLevel = (uint32_t)lazy.levels().size() - 1;
+        Bytes smallest(lazy.levels()[lastLevel].uncompressedByteLength);
+        pool.submit([&] { ktx2::decompressLevels(lazy, { { lastLevel, smallest.data(), smallest.size() } }, pool); }).get();
+        ktx2::Descriptor expected;
+        expected.parse(original->data(), original->size());
+        ASSERT_EQ(0, memcmp(expected.getLevel(StorageSpan{ *original }, lastLevel).data(), smallest.data(), smallest.size()));
+
+        // Targets that are too small are refused before anything is written
+        Bytes target(lazy.levels()[0].uncompressedByteLength, 0xCD);
+        ASSERT_THROW(ktx2::decompressLevels(lazy, { { 0, target.data(), target.size() - 1 } }), std::runtime_error);
+        ASSERT_EQ(0xCD, target[0]);
+        ASSERT_THROW(ktx2::decompressLevels(lazy, { { lastLevel + 1, target.data(), target.size() } }), std::runtime_error);
+
+        // As are levels that don't decompress to their uncompressedByteLength
+        {
+            auto corrupt = bytes;
+            ktx2::Descriptor::LevelDescriptor level;
+            memcpy(&level, corrupt.data() + sizeof(ktx2::Descriptor::Header), sizeof(level));
+            level.uncompressedByteLength -= 1;
+            memcpy(corrupt.data() + sizeof(ktx2::Descriptor::Header), &level, sizeof(level));
+            ktx2::DescriptorView view;
+            view.parse(Storage::create(corrupt.size(), corrupt.data()));
+            ASSERT_THROW(ktx2::decompressLevels(view, { { 0, target.data(), target.size() } }, pool), std::runtime_error);
+        }
+        {
+            auto corrupt = bytes;
+            ktx2::Descriptor::LevelDescriptor level;
+            memcpy(&level, corrupt.data() + sizeof(ktx2::Descriptor::Header), sizeof(level));
+            corrupt[level.byteOffset + level.byteLength / 2] ^= 0xFF;
+            corrupt[level.byteOffset] ^= 0xFF;
+            ktx2::DescriptorView view;
+            view.parse(Storage::create(corrupt.size(), corrupt.data()));
+            ASSERT_THROW(ktx2::decompressLevels(view, { { 0, target.data(), target.size() } }, pool), std::runtime_error);
+        }
+    }
+}
+
+static void benchmarkScheme(ktx2::SupercompressionScheme scheme, const char* name, const Compressor& compress) {
+    static const size_t ITERATIONS = 5;
+    struct File {
+        ktx2::DescriptorView descriptor;
+        Bytes output;
+        std::vector<ktx2::LevelTarget> targets;
+    };
+    std::vector<File> files;
+    size_t totalSize = 0;
+    for (const auto& file : getKtx2TestFiles()) {
+        auto bytes = supercompress(*Storage::readFile(file), scheme, compress);
+        files.emplace_back();
+        auto& entry = files.back();
+        entry.descriptor.parse(Storage::create(bytes.size(), bytes.data()));
+        for (const auto& level : entry.descriptor.levels) {
+            entry.output.resize(entry.output.size() + level.uncompressedByteLength);
+        }
+        size_t offset = 0;
+        for (uint32_t level = 0; level < entry.descriptor.levels.size(); ++level) {
+            const size_t size = entry.descriptor.levels[level].uncompressedByteLength;
+            entry.targets.push_back({ level, entry.output.data() + offset, size });
+            offset += size;
+        }
+        totalSize += entry.output.size();
+    }
+
+    ThreadPool single{ 1 };
+    ThreadPool parallel{ std::max<size_t>(4, std::thread::hardware_concurrency()) };
+    std::cout << "Decode every level of " << files.size() << " " << name << " supercompressed files, " << totalSize << " bytes" << std::endl;
+    for (auto pool : { &single, &parallel }) {
+        auto start = std::chrono::high_resolution_clock::now();
+        for (size_t i = 0; i < ITERATIONS; ++i) {
+            for (const auto& file : files) {
+                ktx2::decompressLevels(file.descriptor, file.targets, *pool);
+            }
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "    " << pool->size() << " threads " << (totalSize * ITERATIONS) / std::max<int64_t>(1, elapsed) << " MB/s" << std::endl;
+    }
+}
+
+#if defined(KHRPP_HAVE_ZSTD)
+static Bytes compressZstd(const StorageSpan& data) {
+    Bytes result(ZSTD_compressBound(data.size()));
+    const size_t size = ZSTD_compress(result.data(), result.size(), data.data(), data.size(), 3);
+    if (ZSTD_isError(size)) {
+        throw std::runtime_error("Unable to compress");
+    }
+    result.resize(size);
+    return result;
+}
+
+TEST_F(SupercompressionTest, testZstd) {
+    testScheme(ktx2::SupercompressionScheme::ZSTD, compressZstd);
+}
+
+TEST_F(SupercompressionTest, benchmarkZstd) {
+    benchmarkScheme(ktx2::SupercompressionScheme::ZSTD, "ZSTD", compressZstd);
+}
+#else
+TEST_F(SupercompressionTest, testZstdUnavailable) {
+    ASSERT_FALSE(ktx2::canDecompress(ktx2::SupercompressionScheme::ZSTD));
+}
+#endif
+
+#if defined(KHRPP_HAVE_LIBDEFLATE)
+static Bytes compressZlib(const StorageSpan& data) {
+    auto compressor = libdeflate_alloc_compressor(6);
+    Bytes result(libdeflate_zlib_compress_bound(compressor, data.size()));
+    const size_t size = libdeflate_zlib_compress(compressor, data.data(), data.size(), result.data(), result.size());
+    libdeflate_free_compressor(compressor);
+    if (0 == size) {
+        throw std::runtime_error("Unable to compress");
+    }
+    result.resize(size);
+    return result;
+}
+#elif defined(KHRPP_HAVE_ZLIB)
+static Bytes compressZlib(const StorageSpan& data) {
+    uLongf size = compressBound((uLong)data.size());
+    Bytes result(size);
+    if (Z_OK != compress2(result.data(), &size, data.data(), (uLong)data.size(), 6)) {
+        throw std::runtime_error("Unable to compress");
+    }
+    result.resize(size);
+    return result;
+}
+#endif
+
+#if defined(KHRPP_HAVE_LIBDEFLATE) || defined(KHRPP_HAVE_ZLIB)
+TEST_F(SupercompressionTest, testZlib) {
+    testScheme(ktx2::SupercompressionScheme::ZLIB, compressZlib);
+}
+
+TEST_F(SupercompressionTest, benchmarkZlib) {
+    benchmarkScheme(ktx2::SupercompressionScheme::ZLIB, "ZLIB", compressZlib);
+}
+#else
+TEST_F(SupercompressionTest, testZlibUnavailable) {
+    ASSERT_FALSE(ktx2::canDecompress(ktx2::SupercompressionScheme::ZLIB));
+}
+#endif
@@ -0,0 +1,141 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/transcode.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class TranscodeTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+TEST_F(TranscodeTest, testTranscodeLayout) {
+    ktx2::Descriptor descriptor;
+    descriptor.header.pixelWidth = 13;
+    descriptor.header.pixelHeight = 7;
+    descriptor.header.levelCount = 4;
+    descriptor.header.arrayElementCount = 2;
+    descriptor.header.faceCount = 1;
+    descriptor.levels.resize(4);
+
+    auto layout = ktx2::TranscodeLayout::create(descriptor, ktx2::TranscodeFormat::BC1_RGB);
+    ASSERT_EQ(vk::Format::BC1_RGB_UNORM_BLOCK, layout.vkFormat);
+    ASSERT_EQ(2u, layout.getImageCount());
+    ASSERT_EQ(4u, layout.levels.size());
+    // 13x7 is 4x2 blocks, then 6x3 is 2x1, and 3x1 and 1x1 are a single block
+    ASSERT_EQ(64u, layout.levels[0].imageSize);
+    ASSERT_EQ(16u, layout.levels[1].imageSize);
+    ASSERT_EQ(8u, layout.levels[2].imageSize);
+    ASSERT_EQ(8u, layout.levels[3].imageSize);
+    ASSERT_EQ(1u, layout.levels[3].width);
+    ASSERT_EQ(1u, layout.levels[3].height);
+    size_t expectedOffset = 0;
+    for (const auto& level : layout.levels) {
+        ASSERT_EQ(expectedOffset, level.offset);
+        ASSERT_EQ(0u, level.offset % ktx2::TranscodeLayout::LEVEL_ALIGNMENT);
+        ASSERT_EQ(level.imageSize * 2, level.size);
+        expectedOffset = (level.offset + level.size + 15) & ~(size_t)15;
+    }
+    ASSERT_EQ(layout.levels.back().offset + layout.levels.back().size, layout.size);
+    ASSERT_EQ(layout.levels[1].offset + 16, layout.getImageOffset(1, 1));
+
+    layout = ktx2::TranscodeLayout::create(descriptor, ktx2::TranscodeFormat::RGBA32);
+    ASSERT_EQ(vk::Format::R8G8B8A8_UNORM, layout.vkFormat);
+    ASSERT_EQ(13u * 7 * 4, layout.levels[0].imageSize);
+    ASSERT_EQ(6u * 3 * 4, layout.levels[1].imageSize);
+
+    // The transfer function comes from the DFD
+    descriptor.dataFormat.transferFunction = ktx2::DataFormat::TransferFunction::SRGB;
+    ASSERT_EQ(vk::Format::BC7_SRGB_BLOCK, ktx2::TranscodeLayout::create(descriptor, ktx2::TranscodeFormat::BC7_RGBA).vkFormat);
+    ASSERT_EQ(ktx2::BasisCodec::NONE, ktx2::getBasisCodec(descriptor));
+    descriptor.dataFormat.colorModel = ktx2::DataFormat::ColorModel::UASTC;
+    ASSERT_EQ(ktx2::BasisCodec::UASTC, ktx2::getBasisCodec(descriptor));
+    descriptor.header.supercompressionScheme = ktx2::SupercompressionScheme::BASIS;
+    ASSERT_EQ(ktx2::BasisCodec::ETC1S, ktx2::getBasisCodec(descriptor));
+}
+
+#if defined(KHRPP_HAVE_BASISU)
+static const std::vector<ktx2::TranscodeFormat> TRANSCODE_FORMATS{
+    ktx2::TranscodeFormat::BC1_RGB,   ktx2::TranscodeFormat::BC3_RGBA,      ktx2::TranscodeFormat::BC7_RGBA,
+    ktx2::TranscodeFormat::ETC2_RGBA, ktx2::TranscodeFormat::ASTC_4x4_RGBA, ktx2::TranscodeFormat::RGBA32,
+};
+
+TEST_F(TranscodeTest, testTranscode) {
+    ThreadPool single{ 1 };
+    ThreadPool parallel{ 4 };
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        const StorageSpan span{ *storage };
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        if (ktx2::BasisCodec::NONE == ktx2::getBasisCodec(descriptor)) {
+            ASSERT_FALSE(ktx2::canTranscode(descriptor));
+            ASSERT_THROW(ktx2::transcode(descriptor, span, ktx2::TranscodeFormat::RGBA32), std::runtime_error);
+            continue;
+        }
+        if (!ktx2::canTranscode(descriptor)) {
+            continue;
+        }
+        for (const auto format : TRANSCODE_FORMATS) {
+            // Transcoding concurrently must give the same result as transcoding one image at a time
+            const auto expected = ktx2::transcode(descriptor, span, format, single);
+            const auto layout = ktx2::TranscodeLayout::create(descriptor, format);
+            ASSERT_EQ(layout.size, expected.size());
+            Bytes actual(layout.size);
+            ktx2::transcode(descriptor, span, layout, actual.data(), actual.size(), parallel);
+            ASSERT_EQ(expected, actual) << file;
+            ASSERT_THROW(ktx2::transcode(descriptor, span, layout, actual.data(), actual.size() - 1, parallel), std::runtime_error);
+        }
+    }
+}
+
+TEST_F(TranscodeTest, benchmarkTranscode) {
+    struct File {
+        ktx2::Descriptor descriptor;
+        Storage::ConstPointer storage;
+    };
+    std::vector<File> files;
+    for (const auto& file : getKtx2TestFiles()) {
+        File entry;
+        entry.storage = Storage::readFile(file);
+        entry.descriptor.parse(entry.storage->data(), entry.storage->size());
+        if (ktx2::canTranscode(entry.descriptor)) {
+            files.push_back(std::move(entry));
+        }
+    }
+    ThreadPool single{ 1 };
+    ThreadPool parallel{ std::max<size_t>(4, std::thread::hardware_concurrency()) };
+    std::cout << "Transcode every image of " << files.size() << " Basis Universal files to BC7" << std::endl;
+    for (auto pool : { &single, &parallel }) {
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t totalSize = 0;
+        for (const auto& file : files) {
+            totalSize += ktx2::transcode(file.descriptor, StorageSpan{ *file.storage }, ktx2::TranscodeFormat::BC7_RGBA, *pool).size();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        std::cout << "    " << pool->size() << " threads " << totalSize << " bytes in " << elapsed << " us" << std::endl;
+    }
+}
+#else
+TEST_F(TranscodeTest, testTranscodeUnavailable) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        ASSERT_FALSE(ktx2::canTranscode(descriptor));
+    }
+}
+#endif
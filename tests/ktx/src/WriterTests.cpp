@@ -0,0 +1,196 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/ktx/writer.hpp>
+
+#include "TestResources.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+
+using namespace khrpp;
+using namespace khrpp::utils;
+
+class WriterTest : public ::testing::Test {
+protected:
+    void SetUp() override {}
+
+    void TearDown() override {}
+};
+
+// Checks that `actual` describes the same texture as `expected`, with identical level data once decompressed
+static void compareDescriptors(const ktx2::Descriptor& expected, const StorageSpan& expectedFile, const ktx2::Descriptor& actual, const StorageSpan& actualFile) {
+    ASSERT_EQ(expected.header.format, actual.header.format);
+    ASSERT_EQ(expected.header.typeSize, actual.header.typeSize);
+    ASSERT_EQ(expected.header.pixelWidth, actual.header.pixelWidth);
+    ASSERT_EQ(expected.header.pixelHeight, actual.header.pixelHeight);
+    ASSERT_EQ(expected.header.pixelDepth, actual.header.pixelDepth);
+    ASSERT_EQ(expected.header.arrayElementCount, actual.header.arrayElementCount);
+    ASSERT_EQ(expected.header.faceCount, actual.header.faceCount);
+    ASSERT_EQ(expected.header.levelCount, actual.header.levelCount);
+    if (expected.header.supercompressionScheme == actual.header.supercompressionScheme) {
+        ASSERT_EQ(expected.dfd, actual.dfd);
+    } else {
+        // Supercompression clears the block size, and nothing else
+        ASSERT_EQ(expected.dfd.size(), actual.dfd.size());
+        ASSERT_EQ(0, memcmp(expected.dfd.data(), actual.dfd.data(), 16));
+        ASSERT_EQ(0, memcmp(expected.dfd.data() + 24, actual.dfd.data() + 24, expected.dfd.size() - 24));
+    }
+    ASSERT_EQ(expected.kvd, actual.kvd);
+    ASSERT_EQ(expected.basisData.has_value(), actual.basisData.has_value());
+    ASSERT_EQ(expected.levels.size(), actual.levels.size());
+    for (uint32_t level = 0; level < expected.levels.size(); ++level) {
+        ASSERT_EQ(expected.levels[level].uncompressedByteLength, actual.levels[level].uncompressedByteLength);
+        if (expected.header.supercompressionScheme == actual.header.supercompressionScheme) {
+            auto expectedLevel = expected.getLevel(expectedFile, level);
+            auto actualLevel = actual.getLevel(actualFile, level);
+            ASSERT_EQ(expectedLevel.size(), actualLevel.size());
+            ASSERT_EQ(0, memcmp(expectedLevel.data(), actualLevel.data(), actualLevel.size()));
+        } else {
+            Bytes decompressed(actual.levels[level].uncompressedByteLength);
+            ktx2::decompressLevels(actual, actualFile, { { level, decompressed.data(), decompressed.size() } });
+            auto expectedLevel = expected.getLevel(expectedFile, level);
+            ASSERT_EQ(expectedLevel.size(), decompressed.size());
+            ASSERT_EQ(0, memcmp(expectedLevel.data(), decompressed.data(), decompressed.size()));
+        }
+    }
+}
+
+TEST_F(WriterTest, testRoundTrip) {
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+
+        auto writer = ktx2::Writer::fromDescriptor(expected, StorageSpan{ storage });
+        const auto bytes = writer.write();
+        ASSERT_EQ(writer.prepare(), bytes.size());
+        ktx2::Descriptor actual;
+        actual.parse(bytes.data(), bytes.size());
+        auto written = Storage::create(bytes.size(), const_cast<uint8_t*>(bytes.data()));
+        compareDescriptors(expected, StorageSpan{ storage }, actual, StorageSpan{ written });
+
+        // Every output gets exactly the same bytes
+        std::ostringstream stream;
+        writer.write(stream);
+        ASSERT_EQ(std::string(bytes.begin(), bytes.end()), stream.str());
+
+        const std::string filename = ::testing::TempDir() + "khrpp_writer_test.ktx2";
+        writer.writeFile(filename);
+        auto mapped = Storage::readFile(filename);
+        ASSERT_EQ(bytes.size(), mapped->size());
+        ASSERT_EQ(0, memcmp(bytes.data(), mapped->data(), bytes.size()));
+        mapped.reset();
+        std::remove(filename.c_str());
+    }
+}
+
+TEST_F(WriterTest, testWriteLevels) {
+    ktx2::Descriptor::Header header;
+    header.format = vk::Format::R8G8B8A8_UNORM;
+    header.typeSize = 1;
+    header.pixelWidth = 5;
+    header.pixelHeight = 3;
+    header.levelCount = 3;
+
+    ktx2::Writer writer{ header };
+    // The DFD of a real file isn't needed to exercise the layout, only its size
+    writer.setDfd(Bytes(40, 1));
+    writer.setKeyValue("KTXwriter", Bytes{ 'k', 'h', 'r', 'p', 'p', 0 });
+    writer.setKeyValue("KTXorientation", Bytes{ 'r', 'd', 0 });
+    writer.setLevel(0, Bytes(5 * 3 * 4, 0x10));
+    writer.setLevel(1, Bytes(2 * 1 * 4, 0x20));
+    ASSERT_THROW(writer.write(), std::runtime_error);
+    writer.setLevel(2, Bytes(1 * 1 * 4, 0x30));
+    ASSERT_THROW(writer.setLevel(3, Bytes(4)), std::runtime_error);
+    ASSERT_THROW(writer.setKeyValue("", Bytes{}), std::runtime_error);
+
+    const auto bytes = writer.write();
+    ktx2::Descriptor descriptor;
+    descriptor.parse(bytes.data(), bytes.size());
+    ASSERT_EQ(Bytes(40, 1), descriptor.dfd);
+    ASSERT_EQ(2u, descriptor.kvd.size());
+    ASSERT_EQ((Bytes{ 'r', 'd', 0 }), descriptor.kvd["KTXorientation"]);
+    // Sorted by key
+    ASSERT_EQ(0, memcmp(bytes.data() + descriptor.header.kvdByteOffset + 4, "KTXorientation", 15));
+    // Smallest level first, every level 8 byte aligned
+    ASSERT_LT(descriptor.levels[2].byteOffset, descriptor.levels[1].byteOffset);
+    ASSERT_LT(descriptor.levels[1].byteOffset, descriptor.levels[0].byteOffset);
+    auto written = Storage::create(bytes.size(), const_cast<uint8_t*>(bytes.data()));
+    for (uint32_t level = 0; level < 3; ++level) {
+        ASSERT_EQ(0u, descriptor.levels[level].byteOffset % 8);
+        ASSERT_EQ(descriptor.levels[level].byteLength, descriptor.levels[level].uncompressedByteLength);
+        auto data = descriptor.getLevel(StorageSpan{ written }, level);
+        ASSERT_EQ(0x10 * (level + 1), data.data()[0]);
+    }
+
+    // A target that's too small is refused
+    Bytes target(bytes.size() - 1);
+    ASSERT_THROW(writer.write(target.data(), target.size()), std::runtime_error);
+}
+
+#if defined(KHRPP_HAVE_ZSTD)
+TEST_F(WriterTest, testZstd) {
+    ThreadPool pool{ 4 };
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor expected;
+        expected.parse(storage->data(), storage->size());
+        auto writer = ktx2::Writer::fromDescriptor(expected, StorageSpan{ storage });
+        if (expected.header.supercompressionScheme != ktx2::SupercompressionScheme::NONE) {
+            ASSERT_THROW(writer.setZstdCompression(), std::runtime_error);
+            continue;
+        }
+        writer.setZstdCompression(5);
+        const auto bytes = writer.write(pool);
+        ktx2::Descriptor actual;
+        actual.parse(bytes.data(), bytes.size());
+        ASSERT_EQ(ktx2::SupercompressionScheme::ZSTD, actual.header.supercompressionScheme);
+        ASSERT_EQ(0u, actual.dataFormat.getBytesPerBlock());
+        auto written = Storage::create(bytes.size(), const_cast<uint8_t*>(bytes.data()));
+        compareDescriptors(expected, StorageSpan{ storage }, actual, StorageSpan{ written });
+        // Compressing on a single thread gives the same file
+        ThreadPool single{ 1 };
+        writer.setZstdCompression(5);
+        ASSERT_EQ(bytes, writer.write(single));
+    }
+}
+
+TEST_F(WriterTest, benchmarkZstd) {
+    std::vector<ktx2::Writer> writers;
+    std::vector<Storage::ConstPointer> storages;
+    for (const auto& file : getKtx2TestFiles()) {
+        auto storage = Storage::readFile(file);
+        ktx2::Descriptor descriptor;
+        descriptor.parse(storage->data(), storage->size());
+        if (descriptor.header.supercompressionScheme == ktx2::SupercompressionScheme::NONE) {
+            writers.push_back(ktx2::Writer::fromDescriptor(descriptor, StorageSpan{ storage }));
+            storages.push_back(storage);
+        }
+    }
+    ThreadPool single{ 1 };
+    ThreadPool parallel{ std::max<size_t>(4, std::thread::hardware_concurrency()) };
+    std::cout << "ZSTD compress and write " << writers.size() << " files" << std::endl;
+    for (auto pool : { &single, &parallel }) {
+        size_t inputSize = 0;
+        size_t outputSize = 0;
+        auto start = std::chrono::high_resolution_clock::now();
+        for (auto& writer : writers) {
+            writer.setZstdCompression();
+            outputSize += writer.write(*pool).size();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - start).count();
+        for (const auto& storage : storages) {
+            inputSize += storage->size();
+        }
+        std::cout << "    " << pool->size() << " threads " << inputSize << " to " << outputSize << " bytes, " << inputSize / std::max<int64_t>(1, elapsed)
+                  << " MB/s" << std::endl;
+    }
+}
+#endif
@@ -0,0 +1,50 @@
+//
+//  Distributed under the Apache License, Version 2.0.
+//  See the accompanying file LICENSE or http://www.apache.org/licenses/LICENSE-2.0.html
+//
+
+#include <khrpp/pack.hpp>
+
+#include <iostream>
+
+using namespace khrpp;
+
+static int usage(const char* program) {
+    std::cerr << "Usage: " << program << " <output.pack> <input.ktx|input.ktx2>..." << std::endl;
+    std::cerr << "       " << program << " --list <input.pack>" << std::endl;
+    std::cerr << "Entries are named by their input path exactly as it's given on the command line." << std::endl;
+    return 1;
+}
+
+static int list(const std::string& filename) {
+    pack::Reader reader{ utils::Storage::readFile(filename) };
+    for (const auto& entry : reader) {
+        const auto& summary = entry.summary;
+        std::cout << reader.getName(entry) << ": " << (summary.container == pack::Container::KTX2 ? "KTX2" : "KTX") << " format "
+                  << summary.format << ", " << summary.pixelWidth << "x" << summary.pixelHeight << "x" << summary.pixelDepth << ", "
+                  << summary.layerCount << " layers, " << summary.faceCount << " faces, " << summary.levelCount << " levels, "
+                  << entry.byteLength << " bytes at " << entry.byteOffset << std::endl;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 3) {
+        return usage(argv[0]);
+    }
+    try {
+        if (std::string(argv[1]) == "--list") {
+            return list(argv[2]);
+        }
+        pack::Writer writer;
+        for (int i = 2; i < argc; ++i) {
+            writer.addFile(argv[i], argv[i]);
+        }
+        writer.write(argv[1]);
+        std::cout << "Packed " << writer.size() << " files into " << argv[1] << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}